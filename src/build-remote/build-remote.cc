@@ -41,6 +41,90 @@ static AutoCloseFD openSlotLock(const Machine & m, uint64_t slot)
     return openLockFile(fmt("%s/%s-%d", currentLoad, escapeUri(m.storeUri.render()), slot), true);
 }
 
+/**
+ * Whether `m` has a build slot that isn't in use right now.
+ */
+static bool hasFreeSlot(const Machine & m)
+{
+    for (uint64_t slot = 0; slot < m.maxJobs; ++slot)
+        if (lockFile(openSlotLock(m, slot).get(), ltWrite, false))
+            return true;
+    return false;
+}
+
+/**
+ * The file in which we record the paths known to be valid on the
+ * machine `storeUri`, along with the time at which they were found to
+ * be valid, so that the next invocations of the hook don't have to
+ * ask the machine about them again.
+ */
+static std::string knownValidFile(const std::string & storeUri)
+{
+    return fmt(
+        "%s/%s.known-valid", currentLoad, hashString(HashAlgorithm::MD5, storeUri).to_string(HashFormat::Base16, false));
+}
+
+typedef std::map<StorePath, time_t> KnownValid;
+
+static KnownValid readKnownValid(const std::string & storeUri)
+{
+    KnownValid res;
+    auto now = time(nullptr);
+    try {
+        for (auto & line : tokenizeString<Strings>(readFile(knownValidFile(storeUri)), "\n")) {
+            auto space = line.find(' ');
+            if (space == line.npos)
+                throw Error("line '%s' has no timestamp", line);
+            auto since = string2Int<time_t>(line.substr(0, space));
+            if (!since)
+                throw Error("line '%s' has an invalid timestamp", line);
+            /* Paths may be garbage-collected on the machine, so
+               forget about them after a while. */
+            if (*since + std::chrono::seconds(knownValidTTL).count() >= now)
+                res.insert_or_assign(StorePath(line.substr(space + 1)), *since);
+        }
+    } catch (Error & e) {
+        /* The file is only a cache, so if it's missing or corrupt,
+           we'll query the machine. */
+        debug("not using known valid paths of '%s': %s", storeUri, e.msg());
+        res.clear();
+    }
+    return res;
+}
+
+static void writeKnownValid(const std::string & storeUri, const KnownValid & knownValid)
+{
+    std::string contents;
+    for (auto & [path, since] : knownValid)
+        contents += fmt("%d %s\n", since, path.to_string());
+
+    auto fileName = knownValidFile(storeUri);
+    auto tmpFile = fmt("%s.tmp-%d", fileName, getpid());
+    try {
+        writeFile(tmpFile, contents);
+        std::filesystem::rename(tmpFile, fileName);
+    } catch (std::exception & e) {
+        debug("cannot write known valid paths of '%s': %s", storeUri, e.what());
+    }
+}
+
+/**
+ * Return the closure of the inputs of `drvPath`, i.e. the paths that
+ * will have to be copied to the remote machine.
+ */
+static StorePathSet getInputClosure(Store & store, const StorePath & drvPath)
+{
+    auto drv = store.readDerivation(drvPath);
+    StorePathSet inputs = drv.inputSrcs;
+    for (auto & [inputDrv, node] : drv.inputDrvs.map)
+        for (auto & [outputName, optPath] : store.queryPartialDerivationOutputMap(inputDrv))
+            if (optPath && node.value.count(outputName) && store.isValidPath(*optPath))
+                inputs.insert(*optPath);
+    StorePathSet closure;
+    store.computeFSClosure(inputs, closure);
+    return closure;
+}
+
 static bool allSupportedLocally(Store & store, const StringSet & requiredFeatures)
 {
     for (auto & feature : requiredFeatures)
@@ -104,6 +188,10 @@ static int main_build_remote(int argc, char ** argv)
         std::optional<StorePath> drvPath;
         std::string storeUri;
 
+        /* Connections to the machines that we asked for the paths
+           they have. */
+        std::map<std::string, ref<Store>> machineStores;
+
         while (true) {
 
             try {
@@ -131,7 +219,53 @@ static int main_build_remote(int argc, char ** argv)
             /* Error ignored here, will be caught later */
             mkdir(currentLoad.c_str(), 0777);
 
+            std::optional<StorePathSet> inputClosure;
+
             while (true) {
+                /* Determine how much of the input closure each
+                   suitable machine with a free slot is missing. We do
+                   this before acquiring the main lock since it may
+                   require connecting to the machines. The paths known
+                   to be valid on a machine are shared between hook
+                   invocations through a file, so usually we only have
+                   to ask about the paths built since then. */
+                std::map<std::string, uint64_t> missingSizes;
+                if (settings.buildersTransferCost) {
+                    if (!inputClosure)
+                        inputClosure = getInputClosure(*store, *drvPath);
+                    for (auto & m : machines) {
+                        if (!m.enabled || !m.systemSupported(neededSystem) || !m.allSupported(requiredFeatures)
+                            || !m.mandatoryMet(requiredFeatures) || !hasFreeSlot(m))
+                            continue;
+                        auto uri = m.storeUri.render();
+                        try {
+                            auto knownValid = readKnownValid(uri);
+                            StorePathSet unknown;
+                            for (auto & path : *inputClosure)
+                                if (!knownValid.count(path))
+                                    unknown.insert(path);
+                            if (!unknown.empty()) {
+                                auto i = machineStores.find(uri);
+                                if (i == machineStores.end())
+                                    i = machineStores.emplace(uri, m.openStore()).first;
+                                StorePathSet nowValid;
+                                missingSizes[uri] = getMissingSize(*store, *i->second, unknown, nowValid);
+                                if (!nowValid.empty()) {
+                                    auto now = time(nullptr);
+                                    for (auto & path : nowValid)
+                                        knownValid.insert_or_assign(path, now);
+                                    writeKnownValid(uri, knownValid);
+                                }
+                            }
+                            debug("machine '%s' is missing %d bytes of inputs", uri, missingSizes[uri]);
+                        } catch (std::exception & e) {
+                            auto msg = chomp(drainFD(5, false));
+                            printError("cannot build on '%s': %s%s", uri, e.what(), msg.empty() ? "" : ": " + msg);
+                            m.enabled = false;
+                        }
+                    }
+                }
+
                 bestSlotLock = -1;
                 AutoCloseFD lock = openLockFile(currentLoad + "/main-lock", true);
                 lockFile(lock.get(), ltWrite, true);
@@ -139,7 +273,7 @@ static int main_build_remote(int argc, char ** argv)
                 bool rightType = false;
 
                 Machine * bestMachine = nullptr;
-                uint64_t bestLoad = 0;
+                double bestLoad = 0;
                 for (auto & m : machines) {
                     debug("considering building on remote machine '%s'", m.storeUri.render());
 
@@ -147,7 +281,7 @@ static int main_build_remote(int argc, char ** argv)
                         && m.mandatoryMet(requiredFeatures)) {
                         rightType = true;
                         AutoCloseFD free;
-                        uint64_t load = 0;
+                        uint64_t slotsInUse = 0;
                         for (uint64_t slot = 0; slot < m.maxJobs; ++slot) {
                             auto slotLock = openSlotLock(m, slot);
                             if (lockFile(slotLock.get(), ltWrite, false)) {
@@ -155,12 +289,15 @@ static int main_build_remote(int argc, char ** argv)
                                     free = std::move(slotLock);
                                 }
                             } else {
-                                ++load;
+                                ++slotsInUse;
                             }
                         }
                         if (!free) {
                             continue;
                         }
+                        auto missingSize = missingSizes.find(m.storeUri.render());
+                        double load =
+                            getEffectiveLoad(slotsInUse, missingSize != missingSizes.end() ? missingSize->second : 0);
                         bool best = false;
                         if (!bestSlotLock) {
                             best = true;
@@ -233,7 +370,8 @@ static int main_build_remote(int argc, char ** argv)
 
                     Activity act(*logger, lvlTalkative, actUnknown, fmt("connecting to '%s'", storeUri));
 
-                    sshStore = bestMachine->openStore();
+                    auto i = machineStores.find(storeUri);
+                    sshStore = i != machineStores.end() ? i->second.get_ptr() : bestMachine->openStore().get_ptr();
                     sshStore->connect();
                 } catch (std::exception & e) {
                     auto msg = chomp(drainFD(5, false));
@@ -290,6 +428,14 @@ static int main_build_remote(int argc, char ** argv)
             copyPaths(*store, *sshStore, store->parseStorePathSet(inputs), NoRepair, NoCheckSigs, substitute);
         }
 
+        if (settings.buildersTransferCost) {
+            auto knownValid = readKnownValid(storeUri);
+            auto now = time(nullptr);
+            for (auto & input : inputs)
+                knownValid.insert_or_assign(store->parseStorePath(input), now);
+            writeKnownValid(storeUri, knownValid);
+        }
+
         uploadLock = -1;
 
         auto drv = store->readDerivation(*drvPath);
@@ -376,7 +522,7 @@ static int main_build_remote(int argc, char ** argv)
             Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
             if (auto localStore = store.dynamic_pointer_cast<LocalStore>())
                 for (auto & path : missingPaths)
-                    localStore->locksHeld.insert(store->printStorePath(path)); /* FIXME: ugly */
+                    localStore->locksHeld.lock()->insert(store->printStorePath(path)); /* FIXME: ugly */
             copyPaths(*sshStore, *store, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
         }
         // XXX: Should be done as part of `copyPaths`
@@ -88,6 +88,8 @@ DerivedPathsWithInfo InstallableAttrPath::toDerivedPaths()
             iter->second = iter->second.union_(newOutputs);
     }
 
+    state->flushDerivations();
+
     DerivedPathsWithInfo res;
     for (auto & [drvPath, outputs] : byDrvPath)
         res.push_back({
@@ -54,8 +54,12 @@ InstallableValue::trySinglePathToDerivedPaths(Value & v, const PosIdx pos, std::
     }
 
     else if (v.type() == nString) {
+        state->flushDerivations();
+        auto path = state->coerceToSingleDerivedPath(pos, v, errorCtx);
+        if (auto o = std::get_if<SingleDerivedPath::Opaque>(&path.raw()))
+            state->materializeStorePath(o->path);
         return {{
-            .path = DerivedPath::fromSingle(state->coerceToSingleDerivedPath(pos, v, errorCtx)),
+            .path = DerivedPath::fromSingle(std::move(path)),
             .info = make_ref<ExtraPathInfo>(),
         }};
     }
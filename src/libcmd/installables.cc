@@ -18,6 +18,7 @@
 #include "nix/main/shared.hh"
 #include "nix/flake/flake.hh"
 #include "nix/expr/eval-cache.hh"
+#include "nix/expr/dependency-tracker.hh"
 #include "nix/util/url.hh"
 #include "nix/fetchers/registry.hh"
 #include "nix/store/build-result.hh"
@@ -439,9 +440,22 @@ static StorePath getDeriver(ref<Store> store, const Installable & i, const Store
 
 ref<eval_cache::EvalCache> openEvalCache(EvalState & state, std::shared_ptr<flake::LockedFlake> lockedFlake)
 {
-    auto fingerprint = evalSettings.useEvalCache && evalSettings.pureEval
-                           ? lockedFlake->getFingerprint(state.store, state.fetchSettings)
-                           : std::nullopt;
+    std::optional<flake::Fingerprint> fingerprint;
+    std::optional<StorePath> trackedRoot;
+    std::string trackedRootRevision;
+
+    if (evalSettings.useEvalCache && evalSettings.pureEval) {
+        /* If we know which files the cached attributes depend on, we
+           can reuse the cache across changes to the flake. */
+        auto flakePath = lockedFlake->flake.path.path.abs();
+        if (state.dependencyTracker->isEnabled() && state.store->isInStore(flakePath)) {
+            fingerprint = lockedFlake->getStableFingerprint(state.fetchSettings);
+            trackedRoot = state.store->toStorePath(flakePath).first;
+            trackedRootRevision = fetchers::attrsToJSON(lockedFlake->getUnstableAttrs()).dump();
+        } else
+            fingerprint = lockedFlake->getFingerprint(state.store, state.fetchSettings);
+    }
+
     auto rootLoader = [&state, lockedFlake]() {
         /* For testing whether the evaluation cache is
            complete. */
@@ -462,10 +476,12 @@ ref<eval_cache::EvalCache> openEvalCache(EvalState & state, std::shared_ptr<flak
     if (fingerprint) {
         auto search = state.evalCaches.find(fingerprint.value());
         if (search == state.evalCaches.end()) {
-            search =
-                state.evalCaches
-                    .emplace(fingerprint.value(), make_ref<nix::eval_cache::EvalCache>(fingerprint, state, rootLoader))
-                    .first;
+            search = state.evalCaches
+                         .emplace(
+                             fingerprint.value(),
+                             make_ref<nix::eval_cache::EvalCache>(
+                                 fingerprint, state, rootLoader, trackedRoot, trackedRootRevision))
+                         .first;
         }
         return search->second;
     } else {
@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval-gc.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/environment-variables.hh"
+#include "nix/util/file-system.hh"
+
+using namespace nix;
+
+// Custom main to initialize Nix before running benchmarks
+int main(int argc, char ** argv)
+{
+    initLibStore(false);
+    initGC();
+
+    // Don't touch the user's evaluation cache
+    auto cacheDir = createTempDir();
+    setEnv("XDG_CACHE_HOME", cacheDir.c_str());
+
+    ::benchmark::Initialize(&argc, argv);
+    ::benchmark::RunSpecifiedBenchmarks();
+
+    deletePath(cacheDir);
+    return 0;
+}
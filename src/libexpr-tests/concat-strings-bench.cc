@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+// Evaluate `expr` applied to the benchmark argument
+static void runConcatBenchmark(benchmark::State & bench, std::string_view expr)
+{
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings;
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, store, fetchSettings, evalSettings, nullptr);
+
+    auto f = state.allocValue();
+    state.eval(state.parseExprFromString(std::string(expr), state.rootPath(CanonPath::root)), *f);
+
+    Value n;
+    n.mkInt(bench.range(0));
+
+    for (auto _ : bench) {
+        Value res;
+        state.callFunction(*f, n, res, noPos);
+        state.forceValue(res, noPos);
+        benchmark::DoNotOptimize(res);
+    }
+
+    bench.SetItemsProcessed(bench.iterations() * bench.range(0));
+}
+
+// Interpolate a string into itself and into `optionalString false`
+// patterns; these share the fragment rather than copying it
+static void BM_ConcatStringsSingleFragment(benchmark::State & bench)
+{
+    runConcatBenchmark(bench, R"(
+      n:
+      let s = builtins.concatStrings (builtins.genList (i: "x") 100000);
+      in builtins.foldl' (acc: i: builtins.seq acc ("" + "${s}")) "" (builtins.genList (i: i) n)
+    )");
+}
+
+BENCHMARK(BM_ConcatStringsSingleFragment)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+// Build a string by appending to it repeatedly, which copies the
+// accumulated string every time
+static void BM_ConcatStringsRepeatedAppend(benchmark::State & bench)
+{
+    runConcatBenchmark(bench, R"(
+      n: builtins.foldl' (acc: i: acc + "line ${toString i}\n") "" (builtins.genList (i: i) n)
+    )");
+}
+
+BENCHMARK(BM_ConcatStringsRepeatedAppend)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// Build the same string with `concatStrings`, which copies each
+// fragment once
+static void BM_ConcatStringsList(benchmark::State & bench)
+{
+    runConcatBenchmark(bench, R"(
+      n: builtins.concatStrings (builtins.genList (i: "line ${toString i}\n") n)
+    )");
+}
+
+BENCHMARK(BM_ConcatStringsList)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,71 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval-cache.hh"
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+// Walk an attribute set of packages the way `nix search` does, with a
+// warm evaluation cache
+static void BM_EvalCacheSearchWarm(benchmark::State & bench)
+{
+    auto numPackages = bench.range(0);
+
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings;
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    evalSettings.nixPath = {};
+    EvalState state({}, store, fetchSettings, evalSettings, nullptr);
+
+    auto expr = state.parseExprFromString(
+        fmt(R"(
+          builtins.listToAttrs (builtins.genList (i: {
+            name = "pkg${toString i}";
+            value = {
+              type = "derivation";
+              name = "pkg-${toString i}";
+              meta.description = "Package number ${toString i}";
+            };
+          }) %d)
+        )",
+            numPackages),
+        state.rootPath(CanonPath::root));
+
+    auto fingerprint = hashString(HashAlgorithm::SHA256, fmt("eval-cache-bench-%d", numPackages));
+
+    auto walk = [&]() {
+        auto cache = make_ref<eval_cache::EvalCache>(std::cref(fingerprint), state, [&]() {
+            auto v = state.allocValue();
+            state.eval(expr, *v);
+            return v;
+        });
+
+        size_t found = 0;
+        auto root = cache->getRoot();
+        for (auto & attr : root->getAttrs()) {
+            auto cursor = root->getAttr(attr);
+            if (!cursor->isDerivation())
+                continue;
+            cursor->getAttr("name")->getString();
+            if (auto meta = cursor->maybeGetAttr("meta"))
+                if (auto description = meta->maybeGetAttr("description"))
+                    description->getString();
+            found++;
+        }
+        return found;
+    };
+
+    // Populate the cache
+    walk();
+
+    for (auto _ : bench)
+        benchmark::DoNotOptimize(walk());
+
+    bench.SetItemsProcessed(bench.iterations() * numPackages);
+}
+
+BENCHMARK(BM_EvalCacheSearchWarm)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
@@ -174,4 +174,55 @@ TEST_F(EvalStateTest, getBuiltin_fail)
     ASSERT_THROW(state.getBuiltin("nonexistent"), EvalError);
 }
 
+TEST_F(EvalStateTest, mkString_sharesEqualContexts)
+{
+    NixStringContext context{
+        NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo")},
+        NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-bar")},
+    };
+
+    Value v1, v2;
+    v1.mkString("a", context, state);
+    v2.mkString("b", context, state);
+    ASSERT_NE(v1.context(), nullptr);
+    ASSERT_EQ(v1.context(), v2.context());
+
+    NixStringContext decoded;
+    copyContext(v1, decoded);
+    ASSERT_EQ(decoded, context);
+}
+
+TEST_F(EvalStateTest, mkString_contextsArePerEvalState)
+{
+    NixStringContext context{
+        NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo")},
+    };
+
+    EvalState state2({}, store, fetchSettings, evalSettings, nullptr);
+
+    Value v1, v2;
+    v1.mkString("a", context, state);
+    v2.mkString("a", context, state2);
+    ASSERT_NE(v1.context(), v2.context());
+    ASSERT_STREQ(v1.context()[0], v2.context()[0]);
+}
+
+TEST_F(EvalStateTest, concatStrings_reusesSharedContext)
+{
+    NixStringContext context{
+        NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-foo")},
+    };
+
+    Value s;
+    s.mkString("x", context, state);
+
+    auto f = eval(R"(s: s + "y" + s)");
+    Value concatenated;
+    state.callFunction(f, s, concatenated, noPos);
+    state.forceValue(concatenated, noPos);
+
+    ASSERT_EQ(concatenated.string_view(), "xyx");
+    ASSERT_EQ(concatenated.context(), s.context());
+}
+
 } // namespace nix
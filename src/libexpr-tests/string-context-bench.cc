@@ -0,0 +1,73 @@
+#include <benchmark/benchmark.h>
+#include "nix/expr/eval.hh"
+#include "nix/expr/eval-settings.hh"
+#include "nix/fetchers/fetch-settings.hh"
+#include "nix/store/store-open.hh"
+
+using namespace nix;
+
+// Create strings that refer to a few store paths, the way a package set
+// does when it interpolates the same dependencies into many strings
+static void BM_MkStringWithContext(benchmark::State & bench)
+{
+    auto numContexts = bench.range(0);
+
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings;
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, store, fetchSettings, evalSettings, nullptr);
+
+    std::vector<NixStringContext> contexts;
+    for (int64_t i = 0; i < numContexts; ++i)
+        contexts.push_back({
+            NixStringContextElem::Opaque{.path = StorePath(fmt("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-dep-%d", i))},
+            NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-stdenv")},
+        });
+
+    size_t i = 0;
+    for (auto _ : bench) {
+        Value v;
+        v.mkString(
+            "--with-dep=/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-dep", contexts[i++ % contexts.size()], state);
+        benchmark::DoNotOptimize(v.context());
+    }
+}
+
+BENCHMARK(BM_MkStringWithContext)->Arg(10)->Arg(1000);
+
+// Concatenate strings that all carry the same context
+static void BM_ConcatStringsSharedContext(benchmark::State & bench)
+{
+    auto store = openStore("dummy://");
+    fetchers::Settings fetchSettings;
+    bool readOnlyMode = true;
+    EvalSettings evalSettings{readOnlyMode};
+    EvalState state({}, store, fetchSettings, evalSettings, nullptr);
+
+    Value dep;
+    dep.mkString(
+        "/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-dep",
+        {NixStringContextElem::Opaque{.path = StorePath("g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-dep")}},
+        state);
+
+    auto f = state.allocValue();
+    state.eval(
+        state.parseExprFromString(
+            R"(dep: builtins.genList (i: "${dep}/bin:${dep}/lib:${toString i}") 1000)",
+            state.rootPath(CanonPath::root)),
+        *f);
+
+    for (auto _ : bench) {
+        Value res;
+        state.callFunction(*f, dep, res, noPos);
+        state.forceValue(res, noPos);
+        for (auto elem : res.listView())
+            state.forceValue(*elem, noPos);
+        benchmark::DoNotOptimize(res);
+    }
+
+    bench.SetItemsProcessed(bench.iterations() * 1000);
+}
+
+BENCHMARK(BM_ConcatStringsSharedContext)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,154 @@
+#include "nix/expr/dependency-tracker.hh"
+
+namespace nix {
+
+/**
+ * A `SourceAccessor` that records every access in a
+ * `DependencyTracker` before forwarding it to the underlying
+ * accessor.
+ */
+struct TrackingSourceAccessor : SourceAccessor
+{
+    ref<SourceAccessor> next;
+    DependencyTracker & tracker;
+
+    using Kind = DependencyTracker::Kind;
+
+    TrackingSourceAccessor(ref<SourceAccessor> next, DependencyTracker & tracker)
+        : next(next)
+        , tracker(tracker)
+    {
+        displayPrefix.clear();
+    }
+
+    std::string readFile(const CanonPath & path) override
+    {
+        tracker.record(Kind::File, path);
+        return next->readFile(path);
+    }
+
+    bool pathExists(const CanonPath & path) override
+    {
+        tracker.record(Kind::Stat, path);
+        return next->pathExists(path);
+    }
+
+    std::optional<Stat> maybeLstat(const CanonPath & path) override
+    {
+        tracker.record(Kind::Stat, path);
+        return next->maybeLstat(path);
+    }
+
+    DirEntries readDirectory(const CanonPath & path) override
+    {
+        tracker.record(Kind::Directory, path);
+        return next->readDirectory(path);
+    }
+
+    std::string readLink(const CanonPath & path) override
+    {
+        tracker.record(Kind::Symlink, path);
+        return next->readLink(path);
+    }
+
+    void dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter) override
+    {
+        tracker.record(Kind::Tree, path);
+        next->dumpPath(path, sink, filter);
+    }
+
+    std::optional<std::filesystem::path> getPhysicalPath(const CanonPath & path) override
+    {
+        tracker.record(Kind::Tree, path);
+        return next->getPhysicalPath(path);
+    }
+
+    std::optional<std::string> getContentFingerprint(const CanonPath & path) override
+    {
+        tracker.record(Kind::Tree, path);
+        return next->getContentFingerprint(path);
+    }
+
+    std::string showPath(const CanonPath & path) override
+    {
+        return next->showPath(path);
+    }
+};
+
+DependencyTracker::DependencyTracker(ref<SourceAccessor> next, bool enabled)
+    : next(next)
+    , accessor(enabled ? ref<SourceAccessor>(make_ref<TrackingSourceAccessor>(next, *this)) : next)
+    , enabled(enabled)
+{
+}
+
+void DependencyTracker::record(Kind kind, const CanonPath & path)
+{
+    if (!enabled)
+        return;
+
+    auto state(state_.lock());
+    Dependency dep{kind, path};
+    if (state->seen.insert(dep).second)
+        state->log.push_back(std::move(dep));
+}
+
+size_t DependencyTracker::size()
+{
+    return state_.lock()->log.size();
+}
+
+std::vector<DependencyTracker::Dependency> DependencyTracker::getLog(size_t from, size_t to)
+{
+    auto state(state_.lock());
+    assert(from <= to && to <= state->log.size());
+    return {state->log.begin() + from, state->log.begin() + to};
+}
+
+std::string DependencyTracker::getHash(Kind kind, const CanonPath & path)
+{
+    /* Use a value that can't be a valid hash, file type or symlink
+       target for missing or inaccessible objects. */
+    static const std::string missing = "-";
+
+    /* Note: we use `next` rather than `accessor` here so that
+       checking a dependency doesn't record it. */
+    try {
+        switch (kind) {
+
+        case Kind::File:
+            return hashString(HashAlgorithm::SHA256, next->readFile(path)).to_string(HashFormat::Base16, false);
+
+        case Kind::Directory: {
+            std::string s;
+            for (auto & [name, type] : next->readDirectory(path)) {
+                s += name;
+                s.push_back(0);
+                s += type ? std::to_string((int) *type) : "?";
+                s.push_back(0);
+            }
+            return hashString(HashAlgorithm::SHA256, s).to_string(HashFormat::Base16, false);
+        }
+
+        case Kind::Stat: {
+            auto st = next->maybeLstat(path);
+            if (!st)
+                return missing;
+            return st->typeString() + (st->isExecutable ? ",executable" : "");
+        }
+
+        case Kind::Symlink:
+            return "link:" + next->readLink(path);
+
+        case Kind::Tree:
+            if (auto fingerprint = next->getContentFingerprint(path))
+                return *fingerprint;
+            return next->hashPath(path).to_string(HashFormat::SRI, true);
+        }
+    } catch (Error &) {
+    }
+
+    return missing;
+}
+
+} // namespace nix
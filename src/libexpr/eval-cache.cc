@@ -1,5 +1,6 @@
 #include "nix/util/users.hh"
 #include "nix/expr/eval-cache.hh"
+#include "nix/expr/dependency-tracker.hh"
 #include "nix/store/sqlite.hh"
 #include "nix/expr/eval.hh"
 #include "nix/expr/eval-inline.hh"
@@ -38,38 +39,194 @@ create table if not exists Attributes (
     type        integer not null,
     value       text,
     context     text,
+    session     integer not null,
+    seq         integer not null,
     primary key (parent, name)
 );
+
+create index if not exists IndexAttributesSession on Attributes(session);
+
+create table if not exists Sessions (
+    id          integer primary key autoincrement not null,
+    timestamp   integer not null
+);
+
+create table if not exists Dependencies (
+    session     integer not null,
+    seq         integer not null,
+    kind        integer not null,
+    path        text not null,
+    hash        text not null,
+    primary key (session, seq)
+);
+
+create table if not exists SearchIndexes (
+    root        integer not null,
+    session     integer not null,
+    seq         integer not null,
+    primary key (root, session)
+);
+
+create table if not exists SearchEntries (
+    root        integer not null,
+    idx         integer not null,
+    attrPath    text not null,
+    pname       text not null,
+    version     text not null,
+    description text not null,
+    primary key (root, idx)
+);
 )sql";
 
+/* Attributes are cached together with the position `seq` in the
+   dependency log of the process (`session`) that computed them. An
+   attribute is valid if all dependencies in that log before `seq`
+   are unchanged. Attributes with session 0 don't have recorded
+   dependencies (the cache is keyed on the contents of the flake
+   instead).
+
+   The search index of an attribute (the row `root`) lists the
+   derivations underneath it. Since it is computed from many cached
+   attributes, it records in `SearchIndexes` the latest position in
+   the dependency log of every session whose attributes it was
+   computed from. */
+
 struct AttrDb
 {
     std::atomic_bool failed{false};
 
     const StoreDirConfig & cfg;
 
+    /**
+     * A row of the `Attributes` table.
+     */
+    struct Row
+    {
+        AttrId rowId;
+        AttrType type;
+        std::variant<std::monostate, int64_t, std::string> value;
+        std::optional<std::string> context;
+        int64_t session;
+        uint64_t seq;
+    };
+
+    /**
+     * The children of an attribute, indexed by name.
+     */
+    typedef std::map<std::string, Row, std::less<>> Children;
+
+    /**
+     * The number of rows written by a single insert statement.
+     */
+    static constexpr size_t insertBatchSize = 64;
+
+    /**
+     * The maximum number of rows to keep in memory before writing
+     * them to the database.
+     */
+    static constexpr size_t maxPending = 4096;
+
     struct State
     {
         SQLite db;
         SQLiteStmt insertAttribute;
-        SQLiteStmt insertAttributeWithContext;
-        SQLiteStmt queryAttribute;
-        SQLiteStmt queryAttributes;
+        SQLiteStmt insertAttributes;
+        SQLiteStmt queryChildren;
+        SQLiteStmt insertSession;
+        SQLiteStmt insertDependency;
+        SQLiteStmt queryDependencies;
+        SQLiteStmt insertSearchIndex;
+        SQLiteStmt insertSearchEntry;
+        SQLiteStmt querySearchIndex;
+        SQLiteStmt querySearchEntries;
+        SQLiteStmt deleteSearchIndex;
+        SQLiteStmt deleteSearchEntries;
         std::unique_ptr<SQLiteTxn> txn;
+
+        /**
+         * The rowid of the next inserted attribute. We assign rowids
+         * ourselves so that inserts can be batched.
+         */
+        AttrId nextRowId = 1;
+
+        /**
+         * Rows that haven't been written to the database yet,
+         * together with their parent and name.
+         */
+        std::vector<std::tuple<AttrId, std::string, Row>> pending;
+
+        /**
+         * The children of every attribute that has been looked up.
+         * These are read from the database in a single query, so
+         * that walking the attribute tree (e.g. in `nix search`)
+         * doesn't need a query for every attribute.
+         */
+        std::unordered_map<AttrId, Children> children;
+
+        /**
+         * The ID of this process's session, or 0 if we haven't
+         * written anything yet.
+         */
+        int64_t session = 0;
+
+        /**
+         * The number of entries of the dependency log that have been
+         * written to the database.
+         */
+        size_t depsFlushed = 0;
+
+        /**
+         * For each session, the position of the first dependency that
+         * has changed since that session.
+         */
+        std::map<int64_t, uint64_t> validDeps;
+
+        /**
+         * Memoised results of `getCurrentHash()`.
+         */
+        std::map<DependencyTracker::Dependency, std::string> currentHashes;
+
+        /**
+         * For each session whose attributes we have read, the
+         * highest position of those attributes.
+         */
+        std::map<int64_t, uint64_t> usedSessions;
     };
 
     std::unique_ptr<Sync<State>> _state;
 
     SymbolTable & symbols;
 
-    AttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
+    DependencyTracker & tracker;
+
+    /**
+     * The store path of the source tree whose accesses are recorded
+     * as dependencies of the cached attributes, if any.
+     */
+    std::optional<CanonPath> trackedRoot;
+
+    /**
+     * Metadata of `trackedRoot` that isn't implied by its contents.
+     */
+    std::string trackedRootRevision;
+
+    AttrDb(
+        const StoreDirConfig & cfg,
+        const Hash & fingerprint,
+        SymbolTable & symbols,
+        DependencyTracker & tracker,
+        std::optional<CanonPath> trackedRoot,
+        std::string trackedRootRevision)
         : cfg(cfg)
         , _state(std::make_unique<Sync<State>>())
         , symbols(symbols)
+        , tracker(tracker)
+        , trackedRoot(std::move(trackedRoot))
+        , trackedRootRevision(std::move(trackedRootRevision))
     {
         auto state(_state->lock());
 
-        Path cacheDir = getCacheDir() + "/eval-cache-v5";
+        Path cacheDir = getCacheDir() + "/eval-cache-v7";
         createDirs(cacheDir);
 
         Path dbPath = cacheDir + "/" + fingerprint.to_string(HashFormat::Base16, false) + ".sqlite";
@@ -78,26 +235,65 @@ struct AttrDb
         state->db.isCache();
         state->db.exec(schema);
 
-        state->insertAttribute.create(
-            state->db, "insert or replace into Attributes(parent, name, type, value) values (?, ?, ?, ?)");
+        static const std::string insertAttributesQuery =
+            "insert or replace into Attributes(rowid, parent, name, type, value, context, session, seq) values ";
+        static const std::string row = "(?, ?, ?, ?, ?, ?, ?, ?)";
+
+        state->insertAttribute.create(state->db, insertAttributesQuery + row);
 
-        state->insertAttributeWithContext.create(
-            state->db, "insert or replace into Attributes(parent, name, type, value, context) values (?, ?, ?, ?, ?)");
+        std::vector<std::string> rows(insertBatchSize, row);
+        state->insertAttributes.create(state->db, insertAttributesQuery + concatStringsSep(", ", rows));
 
-        state->queryAttribute.create(
-            state->db, "select rowid, type, value, context from Attributes where parent = ? and name = ?");
+        state->queryChildren.create(
+            state->db, "select rowid, name, type, value, context, session, seq from Attributes where parent = ?");
 
-        state->queryAttributes.create(state->db, "select name from Attributes where parent = ?");
+        state->insertSession.create(state->db, "insert into Sessions(timestamp) values (?)");
+
+        state->insertDependency.create(
+            state->db, "insert into Dependencies(session, seq, kind, path, hash) values (?, ?, ?, ?, ?)");
+
+        state->queryDependencies.create(
+            state->db, "select seq, kind, path, hash from Dependencies where session = ? order by seq");
+
+        state->insertSearchIndex.create(state->db, "insert into SearchIndexes(root, session, seq) values (?, ?, ?)");
+
+        state->insertSearchEntry.create(
+            state->db,
+            "insert into SearchEntries(root, idx, attrPath, pname, version, description) values (?, ?, ?, ?, ?, ?)");
+
+        state->querySearchIndex.create(state->db, "select session, seq from SearchIndexes where root = ?");
+
+        state->querySearchEntries.create(
+            state->db, "select attrPath, pname, version, description from SearchEntries where root = ? order by idx");
+
+        state->deleteSearchIndex.create(state->db, "delete from SearchIndexes where root = ?");
+
+        state->deleteSearchEntries.create(state->db, "delete from SearchEntries where root = ?");
 
         state->txn = std::make_unique<SQLiteTxn>(state->db);
+
+        /* Remove the search indexes of replaced attributes, so that
+           they don't get attached to a new attribute that reuses the
+           rowid. */
+        state->db.exec("delete from SearchIndexes where root not in (select rowid from Attributes)");
+        state->db.exec("delete from SearchEntries where root not in (select rowid from Attributes)");
+
+        SQLiteStmt queryMaxRowId;
+        queryMaxRowId.create(state->db, "select max(rowid) from Attributes");
+        auto query(queryMaxRowId.use());
+        if (query.next() && !query.isNull(0))
+            state->nextRowId = query.getInt(0) + 1;
     }
 
     ~AttrDb()
     {
         try {
             auto state(_state->lock());
-            if (!failed && state->txn->active)
-                state->txn->commit();
+            if (!failed) {
+                flushPending(*state);
+                if (state->txn->active)
+                    state->txn->commit();
+            }
             state->txn.reset();
         } catch (...) {
             ignoreExceptionInDestructor();
@@ -118,18 +314,230 @@ struct AttrDb
         }
     }
 
+    /**
+     * Return a hash of the current state of a dependency relative to
+     * `trackedRoot`.
+     */
+    std::string getCurrentHash(State & state, const DependencyTracker::Dependency & dep)
+    {
+        auto i = state.currentHashes.find(dep);
+        if (i != state.currentHashes.end())
+            return i->second;
+
+        auto & [kind, path] = dep;
+
+        /* The store path of the root changes whenever anything in the
+           tree changes, so we don't need to hash the tree. However,
+           dependencies on the entire tree include its revision
+           (e.g. `self.rev`), which can change without the contents
+           changing. */
+        auto hash = kind == DependencyTracker::Kind::Tree && path.isRoot()
+                        ? std::string(*trackedRoot->baseName()) + ";" + trackedRootRevision
+                        : tracker.getHash(kind, *trackedRoot / path);
+
+        state.currentHashes.emplace(dep, hash);
+        return hash;
+    }
+
+    /**
+     * Write the entries of the dependency log that are in
+     * `trackedRoot` to the database, and return the position of the
+     * attributes computed at this point.
+     */
+    uint64_t flushDependencies(State & state)
+    {
+        if (!trackedRoot)
+            return 0;
+
+        if (!state.session) {
+            /* Garbage-collect the dependencies of sessions whose
+               attributes have all been replaced. */
+            state.db.exec(
+                "delete from Dependencies where session not in "
+                "(select session from Attributes union select session from SearchIndexes)");
+            state.db.exec(
+                "delete from Sessions where id not in "
+                "(select session from Attributes union select session from SearchIndexes)");
+            state.insertSession.use()((int64_t) time(nullptr)).exec();
+            state.session = state.db.getLastInsertedRowId();
+        }
+
+        auto seq = tracker.size();
+
+        for (auto & [kind, path] : tracker.getLog(state.depsFlushed, seq)) {
+            if (path.isWithin(*trackedRoot)) {
+                DependencyTracker::Dependency dep{kind, path.removePrefix(*trackedRoot)};
+                state.insertDependency
+                    .use()(state.session)((int64_t) state.depsFlushed)((int64_t) kind)(dep.second.abs())(
+                        getCurrentHash(state, dep))
+                    .exec();
+            }
+            state.depsFlushed++;
+        }
+
+        return seq;
+    }
+
+    /**
+     * Return whether the dependencies of an attribute computed at
+     * position `seq` of the dependency log of `session` are
+     * unchanged.
+     */
+    bool isValid(State & state, int64_t session, uint64_t seq)
+    {
+        if (!trackedRoot || !session || session == state.session)
+            return true;
+
+        auto i = state.validDeps.find(session);
+
+        if (i == state.validDeps.end()) {
+            uint64_t firstChanged = std::numeric_limits<uint64_t>::max();
+
+            auto queryDependencies(state.queryDependencies.use()(session));
+            while (queryDependencies.next()) {
+                DependencyTracker::Dependency dep{
+                    (DependencyTracker::Kind) queryDependencies.getInt(1), CanonPath(queryDependencies.getStr(2))};
+                if (getCurrentHash(state, dep) != queryDependencies.getStr(3)) {
+                    debug("evaluation cache dependency '%s' has changed", dep.second);
+                    firstChanged = queryDependencies.getInt(0);
+                    break;
+                }
+            }
+
+            i = state.validDeps.emplace(session, firstChanged).first;
+        }
+
+        return seq <= i->second;
+    }
+
+    /**
+     * Write the pending rows to the database.
+     */
+    void flushPending(State & state)
+    {
+        auto bindRow = [&](SQLiteStmt::Use & query, const std::tuple<AttrId, std::string, Row> & entry) {
+            auto & [parent, name, row] = entry;
+            query((int64_t) row.rowId)((int64_t) parent)(name)((int64_t) row.type);
+            std::visit(
+                overloaded{
+                    [&](std::monostate) { query(0, false); },
+                    [&](int64_t n) { query(n); },
+                    [&](const std::string & s) { query(s); },
+                },
+                row.value);
+            query(row.context ? *row.context : "", row.context.has_value())(row.session)((int64_t) row.seq);
+        };
+
+        size_t i = 0;
+
+        for (; i + insertBatchSize <= state.pending.size(); i += insertBatchSize) {
+            auto query(state.insertAttributes.use());
+            for (size_t j = i; j < i + insertBatchSize; ++j)
+                bindRow(query, state.pending[j]);
+            query.exec();
+        }
+
+        for (; i < state.pending.size(); ++i) {
+            auto query(state.insertAttribute.use());
+            bindRow(query, state.pending[i]);
+            query.exec();
+        }
+
+        state.pending.clear();
+    }
+
+    /**
+     * Return the children of `parent`, reading them from the
+     * database if necessary.
+     */
+    Children & getChildren(State & state, AttrId parent)
+    {
+        auto i = state.children.find(parent);
+        if (i != state.children.end())
+            return i->second;
+
+        /* Make sure the query sees the rows we haven't written yet. */
+        doSQLite([&]() {
+            flushPending(state);
+            return 0;
+        });
+
+        Children children;
+
+        auto query(state.queryChildren.use()((int64_t) parent));
+        while (query.next()) {
+            Row row{
+                .rowId = (AttrId) query.getInt(0),
+                .type = (AttrType) query.getInt(2),
+                .session = query.getInt(5),
+                .seq = (uint64_t) query.getInt(6),
+            };
+            if (!query.isNull(3)) {
+                if (row.type == AttrType::Bool || row.type == AttrType::Int)
+                    row.value = query.getInt(3);
+                else
+                    row.value = query.getStr(3);
+            }
+            if (!query.isNull(4))
+                row.context = query.getStr(4);
+            children.emplace(query.getStr(1), std::move(row));
+        }
+
+        return state.children.emplace(parent, std::move(children)).first->second;
+    }
+
+    /**
+     * Insert or replace the attribute `key`. The row is written to
+     * the database in a batch later on.
+     */
+    AttrId insertAttribute(
+        State & state,
+        AttrKey key,
+        AttrType type,
+        std::variant<std::monostate, int64_t, std::string> value = {},
+        std::optional<std::string> context = {})
+    {
+        auto seq = flushDependencies(state);
+
+        Row row{
+            .rowId = state.nextRowId++,
+            .type = type,
+            .value = std::move(value),
+            .context = std::move(context),
+            .session = state.session,
+            .seq = seq,
+        };
+
+        std::string name(symbols[key.second]);
+
+        /* If we've read the siblings of this attribute, keep them up
+           to date. */
+        auto i = state.children.find(key.first);
+        if (i != state.children.end())
+            i->second.insert_or_assign(name, row);
+
+        auto rowId = row.rowId;
+
+        state.pending.emplace_back(key.first, std::move(name), std::move(row));
+
+        if (state.pending.size() >= maxPending)
+            flushPending(state);
+
+        return rowId;
+    }
+
     AttrId setAttrs(AttrKey key, const std::vector<Symbol> & attrs)
     {
         return doSQLite([&]() {
             auto state(_state->lock());
 
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::FullAttrs) (0, false).exec();
+            AttrId rowId = insertAttribute(*state, key, AttrType::FullAttrs);
 
-            AttrId rowId = state->db.getLastInsertedRowId();
-            assert(rowId);
+            /* This is a new attribute, so we know all its children. */
+            state->children.emplace(rowId, Children());
 
             for (auto & attr : attrs)
-                state->insertAttribute.use()(rowId)(symbols[attr])(AttrType::Placeholder) (0, false).exec();
+                insertAttribute(*state, {rowId, attr}, AttrType::Placeholder);
 
             return rowId;
         });
@@ -140,20 +548,17 @@ struct AttrDb
         return doSQLite([&]() {
             auto state(_state->lock());
 
+            std::optional<std::string> ctx;
             if (context) {
-                std::string ctx;
+                ctx.emplace();
                 for (const char ** p = context; *p; ++p) {
                     if (p != context)
-                        ctx.push_back(' ');
-                    ctx.append(*p);
+                        ctx->push_back(' ');
+                    ctx->append(*p);
                 }
-                state->insertAttributeWithContext.use()(key.first)(symbols[key.second])(AttrType::String) (s) (ctx)
-                    .exec();
-            } else {
-                state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::String) (s).exec();
             }
 
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::String, std::string(s), std::move(ctx));
         });
     }
 
@@ -161,10 +566,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Bool) (b ? 1 : 0).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Bool, (int64_t) (b ? 1 : 0));
         });
     }
 
@@ -172,10 +574,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Int) (n).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Int, (int64_t) n);
         });
     }
 
@@ -183,13 +582,8 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute
-                .use()(key.first)(symbols[key.second])(
-                    AttrType::ListOfStrings) (dropEmptyInitThenConcatStringsSep("\t", l))
-                .exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(
+                *state, key, AttrType::ListOfStrings, dropEmptyInitThenConcatStringsSep("\t", l));
         });
     }
 
@@ -197,10 +591,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Placeholder) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Placeholder);
         });
     }
 
@@ -208,10 +599,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Missing) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Missing);
         });
     }
 
@@ -219,10 +607,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Misc) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Misc);
         });
     }
 
@@ -230,10 +615,7 @@ struct AttrDb
     {
         return doSQLite([&]() {
             auto state(_state->lock());
-
-            state->insertAttribute.use()(key.first)(symbols[key.second])(AttrType::Failed) (0, false).exec();
-
-            return state->db.getLastInsertedRowId();
+            return insertAttribute(*state, key, AttrType::Failed);
         });
     }
 
@@ -241,37 +623,62 @@ struct AttrDb
     {
         auto state(_state->lock());
 
-        auto queryAttribute(state->queryAttribute.use()(key.first)(symbols[key.second]));
-        if (!queryAttribute.next())
+        auto & siblings = getChildren(*state, key.first);
+
+        auto i = siblings.find(std::string_view(symbols[key.second]));
+        if (i == siblings.end())
             return {};
 
-        auto rowId = (AttrId) queryAttribute.getInt(0);
-        auto type = (AttrType) queryAttribute.getInt(1);
+        auto & row = i->second;
+
+        if (!isValid(*state, row.session, row.seq)) {
+            debug("ignoring outdated cached attribute '%s'", symbols[key.second]);
+            return {};
+        }
+
+        if (trackedRoot) {
+            auto & seq = state->usedSessions[row.session];
+            seq = std::max(seq, row.seq);
+        }
+
+        auto rowId = row.rowId;
 
-        switch (type) {
+        auto getStr = [&]() -> const std::string & {
+            auto s = std::get_if<std::string>(&row.value);
+            if (!s)
+                throw Error("unexpected value in evaluation cache");
+            return *s;
+        };
+
+        auto getInt = [&]() {
+            auto n = std::get_if<int64_t>(&row.value);
+            if (!n)
+                throw Error("unexpected value in evaluation cache");
+            return *n;
+        };
+
+        switch (row.type) {
         case AttrType::Placeholder:
             return {{rowId, placeholder_t()}};
         case AttrType::FullAttrs: {
-            // FIXME: expensive, should separate this out.
             std::vector<Symbol> attrs;
-            auto queryAttributes(state->queryAttributes.use()(rowId));
-            while (queryAttributes.next())
-                attrs.emplace_back(symbols.create(queryAttributes.getStr(0)));
+            for (auto & [name, child] : getChildren(*state, rowId))
+                attrs.emplace_back(symbols.create(name));
             return {{rowId, attrs}};
         }
         case AttrType::String: {
             NixStringContext context;
-            if (!queryAttribute.isNull(3))
-                for (auto & s : tokenizeString<std::vector<std::string>>(queryAttribute.getStr(3), ";"))
+            if (row.context)
+                for (auto & s : tokenizeString<std::vector<std::string>>(*row.context, ";"))
                     context.insert(NixStringContextElem::parse(s));
-            return {{rowId, string_t{queryAttribute.getStr(2), context}}};
+            return {{rowId, string_t{getStr(), context}}};
         }
         case AttrType::Bool:
-            return {{rowId, queryAttribute.getInt(2) != 0}};
+            return {{rowId, getInt() != 0}};
         case AttrType::Int:
-            return {{rowId, int_t{NixInt{queryAttribute.getInt(2)}}}};
+            return {{rowId, int_t{NixInt{getInt()}}}};
         case AttrType::ListOfStrings:
-            return {{rowId, tokenizeString<std::vector<std::string>>(queryAttribute.getStr(2), "\t")}};
+            return {{rowId, tokenizeString<std::vector<std::string>>(getStr(), "\t")}};
         case AttrType::Missing:
             return {{rowId, missing_t()}};
         case AttrType::Misc:
@@ -282,12 +689,76 @@ struct AttrDb
             throw Error("unexpected type in evaluation cache");
         }
     }
+
+    void setSearchIndex(AttrId root, const std::vector<SearchEntry> & entries)
+    {
+        doSQLite([&]() {
+            auto state(_state->lock());
+
+            auto sessions = state->usedSessions;
+            auto seq = flushDependencies(*state);
+            sessions[state->session] = seq;
+
+            state->deleteSearchIndex.use()((int64_t) root).exec();
+            state->deleteSearchEntries.use()((int64_t) root).exec();
+
+            for (auto & [session, sessionSeq] : sessions)
+                state->insertSearchIndex.use()((int64_t) root)(session)((int64_t) sessionSeq).exec();
+
+            int64_t idx = 0;
+            for (auto & entry : entries)
+                state->insertSearchEntry.use()((int64_t) root)(idx++)(entry.attrPath)(entry.pname)(entry.version)(
+                        entry.description)
+                    .exec();
+
+            return 0;
+        });
+    }
+
+    std::optional<std::vector<SearchEntry>> getSearchIndex(AttrId root)
+    {
+        auto state(_state->lock());
+
+        bool found = false;
+
+        auto querySearchIndex(state->querySearchIndex.use()((int64_t) root));
+        while (querySearchIndex.next()) {
+            found = true;
+            if (!isValid(*state, querySearchIndex.getInt(0), querySearchIndex.getInt(1))) {
+                debug("ignoring outdated search index");
+                return {};
+            }
+        }
+
+        if (!found)
+            return {};
+
+        std::vector<SearchEntry> entries;
+
+        auto querySearchEntries(state->querySearchEntries.use()((int64_t) root));
+        while (querySearchEntries.next())
+            entries.push_back({
+                .attrPath = querySearchEntries.getStr(0),
+                .pname = querySearchEntries.getStr(1),
+                .version = querySearchEntries.getStr(2),
+                .description = querySearchEntries.getStr(3),
+            });
+
+        return entries;
+    }
 };
 
-static std::shared_ptr<AttrDb> makeAttrDb(const StoreDirConfig & cfg, const Hash & fingerprint, SymbolTable & symbols)
+static std::shared_ptr<AttrDb> makeAttrDb(
+    const StoreDirConfig & cfg,
+    const Hash & fingerprint,
+    SymbolTable & symbols,
+    DependencyTracker & tracker,
+    std::optional<CanonPath> trackedRoot,
+    std::string trackedRootRevision)
 {
     try {
-        return std::make_shared<AttrDb>(cfg, fingerprint, symbols);
+        return std::make_shared<AttrDb>(
+            cfg, fingerprint, symbols, tracker, std::move(trackedRoot), std::move(trackedRootRevision));
     } catch (SQLiteError &) {
         ignoreExceptionExceptInterrupt();
         return nullptr;
@@ -295,8 +766,21 @@ static std::shared_ptr<AttrDb> makeAttrDb(const StoreDirConfig & cfg, const Hash
 }
 
 EvalCache::EvalCache(
-    std::optional<std::reference_wrapper<const Hash>> useCache, EvalState & state, RootLoader rootLoader)
-    : db(useCache ? makeAttrDb(*state.store, *useCache, state.symbols) : nullptr)
+    std::optional<std::reference_wrapper<const Hash>> useCache,
+    EvalState & state,
+    RootLoader rootLoader,
+    std::optional<StorePath> trackedRoot,
+    std::string trackedRootRevision)
+    : db(
+          useCache ? makeAttrDb(
+                         *state.store,
+                         *useCache,
+                         state.symbols,
+                         *state.dependencyTracker,
+                         trackedRoot ? std::optional(CanonPath(state.store->printStorePath(*trackedRoot)))
+                                     : std::nullopt,
+                         std::move(trackedRootRevision))
+                   : nullptr)
     , state(state)
     , rootLoader(rootLoader)
 {
@@ -332,7 +816,10 @@ AttrKey AttrCursor::getKey()
         return {0, root->state.sEpsilon};
     if (!parent->first->cachedValue) {
         parent->first->cachedValue = root->db->getAttr(parent->first->getKey());
-        assert(parent->first->cachedValue);
+        /* The cached parent may have been invalidated by a change to
+           one of its dependencies. */
+        if (!parent->first->cachedValue)
+            parent->first->cachedValue = {root->db->setPlaceholder(parent->first->getKey()), placeholder_t()};
     }
     return {parent->first->cachedValue->first, parent->second};
 }
@@ -388,6 +875,23 @@ std::string AttrCursor::getAttrPathStr(Symbol name) const
     return dropEmptyInitThenConcatStringsSep(".", root->state.symbols.resolve(getAttrPath(name)));
 }
 
+/**
+ * Record a dependency on the entire tree of every store path that
+ * occurs in `s`. Strings can refer to a store path without having it
+ * in their context, e.g. the result of `toString ./foo` in a flake.
+ */
+static void recordStorePaths(EvalState & state, std::string_view s)
+{
+    auto prefix = state.store->storeDir + "/";
+    for (auto pos = s.find(prefix); pos != s.npos; pos = s.find(prefix, pos)) {
+        pos += prefix.size();
+        auto end = s.find_first_not_of("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ+-._?=", pos);
+        if (auto path = state.store->maybeParseStorePath(prefix + std::string(s.substr(pos, end - pos))))
+            state.dependencyTracker->record(
+                DependencyTracker::Kind::Tree, CanonPath(state.store->printStorePath(*path)));
+    }
+}
+
 Value & AttrCursor::forceValue()
 {
     debug("evaluating uncached attribute '%s'", getAttrPathStr());
@@ -404,10 +908,22 @@ Value & AttrCursor::forceValue()
     }
 
     if (root->db && (!cachedValue || std::get_if<placeholder_t>(&cachedValue->second))) {
-        if (v.type() == nString)
+        if (v.type() == nString) {
+            /* The string contains the store paths in its context, so
+               it depends on their entire contents. */
+            NixStringContext context;
+            copyContext(v, context);
+            for (auto & c : context)
+                if (auto o = std::get_if<NixStringContextElem::Opaque>(&c.raw))
+                    root->state.dependencyTracker->record(
+                        DependencyTracker::Kind::Tree, CanonPath(root->state.store->printStorePath(o->path)));
+            recordStorePaths(root->state, v.string_view());
             cachedValue = {root->db->setString(getKey(), v.c_str(), v.context()), string_t{v.c_str(), {}}};
-        else if (v.type() == nPath) {
+        } else if (v.type() == nPath) {
+            /* The cached path includes the store path of its source
+               tree, which changes whenever the tree changes. */
             auto path = v.path().path;
+            recordStorePaths(root->state, path.abs());
             cachedValue = {root->db->setString(getKey(), path.abs()), string_t{path.abs(), {}}};
         } else if (v.type() == nBool)
             cachedValue = {root->db->setBool(getKey(), v.boolean()), v.boolean()};
@@ -704,10 +1220,12 @@ StorePath AttrCursor::forceDerivation()
     auto aDrvPath = getAttr(root->state.sDrvPath);
     auto drvPath = root->state.store->parseStorePath(aDrvPath->getString());
     drvPath.requireDerivation();
+    root->state.flushDerivations();
     if (!root->state.store->isValidPath(drvPath) && !settings.readOnlyMode) {
         /* The eval cache contains 'drvPath', but the actual path has
            been garbage-collected. So force it to be regenerated. */
         aDrvPath->forceValue();
+        root->state.flushDerivations();
         if (!root->state.store->isValidPath(drvPath))
             throw Error(
                 "don't know how to recreate store derivation '%s'!", root->state.store->printStorePath(drvPath));
@@ -715,4 +1233,30 @@ StorePath AttrCursor::forceDerivation()
     return drvPath;
 }
 
+std::optional<std::vector<SearchEntry>> AttrCursor::getSearchIndex()
+{
+    if (!root->db)
+        return std::nullopt;
+
+    if (!cachedValue)
+        cachedValue = root->db->getAttr(getKey());
+    if (!cachedValue || !cachedValue->first || std::get_if<failed_t>(&cachedValue->second))
+        return std::nullopt;
+
+    return root->db->getSearchIndex(cachedValue->first);
+}
+
+void AttrCursor::setSearchIndex(const std::vector<SearchEntry> & entries)
+{
+    if (!root->db)
+        return;
+
+    if (!cachedValue)
+        cachedValue = {root->db->setPlaceholder(getKey()), placeholder_t()};
+    if (!cachedValue->first)
+        return;
+
+    root->db->setSearchIndex(cachedValue->first, entries);
+}
+
 } // namespace nix::eval_cache
@@ -15,6 +15,8 @@ EvalProfilerMode BaseSetting<EvalProfilerMode>::parse(const std::string & str) c
         return EvalProfilerMode::disabled;
     else if (str == "flamegraph")
         return EvalProfilerMode::flamegraph;
+    else if (str == "pprof")
+        return EvalProfilerMode::pprof;
     else
         throw UsageError("option '%s' has invalid value '%s'", name, str);
 }
@@ -32,6 +34,8 @@ std::string BaseSetting<EvalProfilerMode>::to_string() const
         return "disabled";
     else if (value == EvalProfilerMode::flamegraph)
         return "flamegraph";
+    else if (value == EvalProfilerMode::pprof)
+        return "pprof";
     else
         unreachable();
 }
@@ -41,6 +45,7 @@ NLOHMANN_JSON_SERIALIZE_ENUM(
     {
         {EvalProfilerMode::disabled, "disabled"},
         {EvalProfilerMode::flamegraph, "flamegraph"},
+        {EvalProfilerMode::pprof, "pprof"},
     });
 
 /* Explicit instantiation of templates */
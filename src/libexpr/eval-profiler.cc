@@ -2,6 +2,7 @@
 #include "nix/expr/nixexpr.hh"
 #include "nix/expr/eval.hh"
 #include "nix/util/lru-cache.hh"
+#include "nix/util/compression.hh"
 
 namespace nix {
 
@@ -130,8 +131,6 @@ class SampleStack : public EvalProfiler
         return Hooks().set(preFunctionCall).set(postFunctionCall);
     }
 
-    FrameInfo getPrimOpFrameInfo(const PrimOp & primOp, std::span<Value *> args, PosIdx pos);
-
 public:
     SampleStack(EvalState & state, std::filesystem::path profileFile, std::chrono::nanoseconds period)
         : state(state)
@@ -153,7 +152,6 @@ public:
 
     void maybeSaveProfile(std::chrono::time_point<std::chrono::high_resolution_clock> now);
     void saveProfile();
-    FrameInfo getFrameInfoFromValueAndPos(const Value & v, std::span<Value *> args, PosIdx pos);
 
     SampleStack(SampleStack &&) = default;
     SampleStack & operator=(SampleStack &&) = delete;
@@ -173,7 +171,7 @@ private:
     PosCache posCache;
 };
 
-FrameInfo SampleStack::getPrimOpFrameInfo(const PrimOp & primOp, std::span<Value *> args, PosIdx pos)
+static FrameInfo getPrimOpFrameInfo(EvalState & state, const PrimOp & primOp, std::span<Value *> args, PosIdx pos)
 {
     auto derivationInfo = [&]() -> std::optional<FrameInfo> {
         /* Here we rely a bit on the implementation details of libexpr/primops/derivation.nix
@@ -199,14 +197,15 @@ FrameInfo SampleStack::getPrimOpFrameInfo(const PrimOp & primOp, std::span<Value
     return derivationInfo.value_or(PrimOpFrameInfo{.expr = &primOp, .callPos = pos});
 }
 
-FrameInfo SampleStack::getFrameInfoFromValueAndPos(const Value & v, std::span<Value *> args, PosIdx pos)
+static FrameInfo getFrameInfoFromValueAndPos(
+    EvalState & state, PosCache & posCache, const Value & v, std::span<Value *> args, PosIdx pos)
 {
     /* NOTE: No actual references to garbage collected values are not held in
        the profiler. */
     if (v.isLambda())
         return LambdaFrameInfo{.expr = v.lambda().fun, .callPos = pos};
     else if (v.isPrimOp()) {
-        return getPrimOpFrameInfo(*v.primOp(), args, pos);
+        return getPrimOpFrameInfo(state, *v.primOp(), args, pos);
     } else if (v.isPrimOpApp())
         /* Resolve primOp eagerly. Must not hold on to a reference to a Value. */
         return PrimOpFrameInfo{.expr = v.primOpAppPrimOp(), .callPos = pos};
@@ -225,7 +224,7 @@ FrameInfo SampleStack::getFrameInfoFromValueAndPos(const Value & v, std::span<Va
 [[gnu::noinline]] void
 SampleStack::preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos)
 {
-    stack.push_back(getFrameInfoFromValueAndPos(v, args, pos));
+    stack.push_back(getFrameInfoFromValueAndPos(state, posCache, v, args, pos));
 
     auto now = std::chrono::high_resolution_clock::now();
 
@@ -341,6 +340,240 @@ SampleStack::~SampleStack()
     }
 }
 
+/**
+ * Minimal protobuf encoder, sufficient for writing pprof profiles.
+ */
+class ProtoWriter
+{
+    std::string buf;
+
+    void varint(uint64_t n)
+    {
+        while (n >= 0x80) {
+            buf.push_back(char(n | 0x80));
+            n >>= 7;
+        }
+        buf.push_back(char(n));
+    }
+
+    void tag(uint32_t field, uint8_t wireType)
+    {
+        varint((uint64_t(field) << 3) | wireType);
+    }
+
+public:
+    void integer(uint32_t field, uint64_t n)
+    {
+        tag(field, 0);
+        varint(n);
+    }
+
+    void bytes(uint32_t field, std::string_view s)
+    {
+        tag(field, 2);
+        varint(s.size());
+        buf.append(s);
+    }
+
+    void message(uint32_t field, const ProtoWriter & msg)
+    {
+        bytes(field, msg.buf);
+    }
+
+    void packed(uint32_t field, std::span<const uint64_t> ns)
+    {
+        ProtoWriter p;
+        for (auto n : ns)
+            p.varint(n);
+        bytes(field, p.buf);
+    }
+
+    std::string_view str() const
+    {
+        return buf;
+    }
+};
+
+/**
+ * Deterministic profiler that records every call instead of sampling.
+ * Each distinct call stack is a node of a call tree that accumulates
+ * exact call counts, self time and bytes allocated by the evaluator.
+ * Inclusive figures are the sums over subtrees. The tree is saved in
+ * the pprof [1] format when the profiler is destroyed.
+ *
+ * [1]: https://github.com/google/pprof/blob/main/proto/profile.proto
+ */
+class CallTreeProfiler : public EvalProfiler
+{
+    Hooks getNeededHooksImpl() const override
+    {
+        return Hooks().set(preFunctionCall).set(postFunctionCall);
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Node
+    {
+        FrameInfo frame;
+        uint32_t parent;
+        uint64_t calls = 0;
+        std::chrono::nanoseconds selfTime{0};
+        uint64_t selfBytes = 0;
+    };
+
+    struct ActiveCall
+    {
+        uint32_t node;
+        Clock::time_point start;
+        uint64_t startBytes;
+        std::chrono::nanoseconds childTime{0};
+        uint64_t childBytes = 0;
+    };
+
+public:
+    CallTreeProfiler(EvalState & state, std::filesystem::path profileFile)
+        : state(state)
+        , profileFile(std::move(profileFile))
+        , posCache(state)
+    {
+        /* The root of the call tree, which isn't itself a call. */
+        nodes.push_back({.frame = GenericFrameInfo{.pos = noPos}, .parent = 0});
+    }
+
+    [[gnu::noinline]] void
+    preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override;
+    [[gnu::noinline]] void
+    postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos) override;
+
+    void saveProfile();
+
+    ~CallTreeProfiler();
+
+private:
+    EvalState & state;
+    std::filesystem::path profileFile;
+    std::vector<Node> nodes;
+    std::map<std::pair<uint32_t, FrameInfo>, uint32_t> children;
+    std::vector<ActiveCall> stack;
+    Clock::time_point startTime = Clock::now();
+    PosCache posCache;
+};
+
+[[gnu::noinline]] void
+CallTreeProfiler::preFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos)
+{
+    uint32_t parent = stack.empty() ? 0 : stack.back().node;
+    auto frame = getFrameInfoFromValueAndPos(state, posCache, v, args, pos);
+    auto [i, inserted] = children.try_emplace({parent, frame}, nodes.size());
+    if (inserted)
+        nodes.push_back({.frame = std::move(frame), .parent = parent});
+
+    nodes[i->second].calls++;
+
+    stack.push_back({.node = i->second, .start = Clock::now(), .startBytes = state.allocatedBytes()});
+}
+
+[[gnu::noinline]] void
+CallTreeProfiler::postFunctionCallHook(EvalState & state, const Value & v, std::span<Value *> args, const PosIdx pos)
+{
+    if (stack.empty())
+        return;
+
+    auto call = stack.back();
+    stack.pop_back();
+
+    auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - call.start);
+    auto bytes = state.allocatedBytes() - call.startBytes;
+
+    auto & node = nodes[call.node];
+    node.selfTime += time - call.childTime;
+    node.selfBytes += bytes - call.childBytes;
+
+    if (!stack.empty()) {
+        stack.back().childTime += time;
+        stack.back().childBytes += bytes;
+    }
+}
+
+void CallTreeProfiler::saveProfile()
+{
+    std::vector<std::string> strings{""};
+    std::unordered_map<std::string, uint64_t> stringIds{{"", 0}};
+    auto intern = [&](std::string s) -> uint64_t {
+        auto [i, inserted] = stringIds.try_emplace(s, strings.size());
+        if (inserted)
+            strings.push_back(std::move(s));
+        return i->second;
+    };
+
+    ProtoWriter profile;
+
+    for (auto [type, unit] : {
+             std::pair{"calls", "count"},
+             std::pair{"time", "nanoseconds"},
+             std::pair{"alloc_space", "bytes"},
+         }) {
+        ProtoWriter valueType;
+        valueType.integer(1, intern(type));
+        valueType.integer(2, intern(unit));
+        profile.message(1, valueType);
+    }
+
+    /* Every node has a location (whose ID is its index) and a function
+       (shared between nodes with the same symbolized frame). */
+    std::unordered_map<std::string, uint64_t> functionIds;
+    std::vector<uint64_t> locationIds;
+
+    for (uint32_t n = 1; n < nodes.size(); ++n) {
+        auto & node = nodes[n];
+
+        locationIds.clear();
+        for (auto i = n; i != 0; i = nodes[i].parent)
+            locationIds.push_back(i);
+
+        ProtoWriter sample;
+        sample.packed(1, locationIds);
+        uint64_t values[] = {node.calls, uint64_t(node.selfTime.count()), node.selfBytes};
+        sample.packed(2, values);
+        profile.message(2, sample);
+
+        std::ostringstream os;
+        std::visit([&](auto && info) { info.symbolize(state, os, posCache); }, node.frame);
+        auto name = std::move(os).str();
+
+        auto [f, inserted] = functionIds.try_emplace(name, functionIds.size() + 1);
+        if (inserted) {
+            ProtoWriter function;
+            function.integer(1, f->second);
+            function.integer(2, intern(name));
+            profile.message(5, function);
+        }
+
+        ProtoWriter line;
+        line.integer(1, f->second);
+        ProtoWriter location;
+        location.integer(1, n);
+        location.message(4, line);
+        profile.message(4, location);
+    }
+
+    for (auto & s : strings)
+        profile.bytes(6, s);
+
+    profile.integer(10, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - startTime).count());
+
+    writeFile(profileFile, compress("gzip", profile.str()));
+}
+
+CallTreeProfiler::~CallTreeProfiler()
+{
+    try {
+        saveProfile();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
 } // namespace
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency)
@@ -352,4 +585,9 @@ ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::pa
     return make_ref<SampleStack>(state, profileFile, period);
 }
 
+ref<EvalProfiler> makeCallTreeProfiler(EvalState & state, std::filesystem::path profileFile)
+{
+    return make_ref<CallTreeProfiler>(state, profileFile);
+}
+
 } // namespace nix
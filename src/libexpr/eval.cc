@@ -8,6 +8,7 @@
 #include "nix/util/util.hh"
 #include "nix/store/store-api.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/archive.hh"
 #include "nix/store/downstream-placeholder.hh"
 #include "nix/expr/eval-inline.hh"
 #include "nix/store/filetransfer.hh"
@@ -16,6 +17,8 @@
 #include "nix/expr/print.hh"
 #include "nix/fetchers/filtering-source-accessor.hh"
 #include "nix/util/memory-source-accessor.hh"
+#include "nix/util/mounted-source-accessor.hh"
+#include "nix/expr/dependency-tracker.hh"
 #include "nix/expr/gc-small-vector.hh"
 #include "nix/util/url.hh"
 #include "nix/fetchers/fetch-to-store.hh"
@@ -36,6 +39,7 @@
 
 #include <nlohmann/json.hpp>
 #include <boost/container/small_vector.hpp>
+#include <boost/unordered/concurrent_flat_map.hpp>
 
 #ifndef _WIN32 // TODO use portable implementation
 #  include <sys/resource.h>
@@ -281,8 +285,9 @@ EvalState::EvalState(
                    catch it, so we don't need to do this hack.
                  */
                 {CanonPath(store->storeDir), store->getFSAccessor(settings.pureEval)},
-            }))
-    , rootFS(
+            })
+            .cast<MountedSourceAccessor>())
+    , dependencyTracker(
         ({
             /* In pure eval mode, we provide a filesystem that only
                contains the Nix store.
@@ -296,12 +301,20 @@ EvalState::EvalState(
             auto accessor = getFSSourceAccessor();
 
             auto realStoreDir = dirOf(store->toRealPath(StorePath::dummy));
-            if (settings.pureEval || store->storeDir != realStoreDir) {
+            if (settings.pureEval || store->storeDir != realStoreDir || settings.lazyTrees) {
                 accessor = settings.pureEval
                     ? storeFS
                     : makeUnionSourceAccessor({accessor, storeFS});
             }
 
+            /* Only the evaluation cache needs to know what files
+               were accessed, and it's only used in pure mode. */
+            make_ref<DependencyTracker>(accessor, settings.pureEval && settings.useEvalCache);
+        }))
+    , rootFS(
+        ({
+            auto accessor = dependencyTracker->getAccessor();
+
             /* Apply access control if needed. */
             if (settings.restrictEval || settings.pureEval)
                 accessor = AllowListSourceAccessor::create(accessor, {}, {},
@@ -323,6 +336,7 @@ EvalState::EvalState(
     , store(store)
     , buildStore(buildStore ? buildStore : store)
     , inputCache(fetchers::InputCache::create())
+    , contextTable(make_ref<ContextTable>())
     , debugRepl(nullptr)
     , debugStop(false)
     , trylevel(0)
@@ -393,12 +407,99 @@ EvalState::EvalState(
         profiler.addProfiler(
             makeSampleStackProfiler(*this, settings.evalProfileFile.get(), settings.evalProfilerFrequency));
         break;
+    case EvalProfilerMode::pprof:
+        profiler.addProfiler(makeCallTreeProfiler(*this, settings.evalProfileFile.get()));
+        break;
     case EvalProfilerMode::disabled:
         break;
     }
 }
 
-EvalState::~EvalState() {}
+struct EvalState::PendingDerivation
+{
+    StorePath path;
+    std::string name;
+    std::string contents;
+    StorePathSet references;
+};
+
+EvalState::~EvalState()
+{
+    try {
+        flushDerivations();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+StorePath EvalState::writeDerivation(const Derivation & drv)
+{
+    if (!settings.derivationBatchSize || nix::settings.readOnlyMode)
+        return nix::writeDerivation(*store, drv, repair);
+
+    auto references = drv.inputSrcs;
+    for (auto & i : drv.inputDrvs.map)
+        references.insert(i.first);
+
+    auto name = std::string(drv.name) + drvExtension;
+    auto contents = drv.unparse(*store, false);
+    auto path = store->makeFixedOutputPathFromCA(
+        name,
+        TextInfo{
+            .hash = hashString(HashAlgorithm::SHA256, contents),
+            .references = references,
+        });
+
+    pendingDerivations.push_back({
+        .path = path,
+        .name = std::move(name),
+        .contents = std::move(contents),
+        .references = std::move(references),
+    });
+
+    if (pendingDerivations.size() >= settings.derivationBatchSize)
+        flushDerivations();
+
+    return path;
+}
+
+void EvalState::flushDerivations()
+{
+    if (pendingDerivations.empty())
+        return;
+
+    Activity act(*logger, lvlChatty, actUnknown, fmt("writing %d derivations", pendingDerivations.size()));
+
+    /* The sources below are views into these NARs, so they must not
+       be reallocated. */
+    std::vector<std::string> nars;
+    nars.reserve(pendingDerivations.size());
+
+    Store::PathsSource pathsToAdd;
+    for (auto & drv : pendingDerivations) {
+        StringSink nar;
+        dumpString(drv.contents, nar);
+        ValidPathInfo info{
+            *store,
+            drv.name,
+            TextInfo{
+                .hash = hashString(HashAlgorithm::SHA256, drv.contents),
+                .references = drv.references,
+            },
+            hashString(HashAlgorithm::SHA256, nar.s),
+        };
+        assert(info.path == drv.path);
+        info.narSize = nar.s.size();
+        nars.push_back(std::move(nar.s));
+        pathsToAdd.emplace_back(std::move(info), std::make_unique<StringSource>(nars.back()));
+    }
+
+    store->addMultipleToStore(std::move(pathsToAdd), act, repair);
+
+    /* Only forget the derivations once they've been written, so that
+       a failed write can be retried by a later flush. */
+    pendingDerivations.clear();
+}
 
 void EvalState::allowPath(const Path & path)
 {
@@ -430,6 +531,52 @@ void EvalState::allowAndSetStorePathString(const StorePath & storePath, Value &
     mkStorePathString(storePath, v);
 }
 
+StorePath
+EvalState::mountInput(fetchers::Input & input, const fetchers::Input & originalInput, ref<SourceAccessor> accessor)
+{
+    auto [storePath, narHash] = fetchToStore2(
+        fetchSettings, *store, accessor, settings.lazyTrees ? FetchMode::DryRun : FetchMode::Copy, input.getName());
+
+    allowPath(storePath);
+
+    if (settings.lazyTrees)
+        storeFS->mount(CanonPath(store->printStorePath(storePath)), accessor);
+
+    input.attrs.insert_or_assign("narHash", narHash.to_string(HashFormat::SRI, true));
+
+    assert(!originalInput.getNarHash() || storePath == originalInput.computeStorePath(*store));
+
+    return storePath;
+}
+
+void EvalState::materializeStorePath(const StorePath & path)
+{
+    /* The caller needs the entire store path, so the result of the
+       evaluation depends on all of it. */
+    dependencyTracker->record(DependencyTracker::Kind::Tree, CanonPath(store->printStorePath(path)));
+
+    auto accessor = storeFS->getMount(CanonPath(store->printStorePath(path)));
+    if (!accessor || settings.readOnlyMode || store->isValidPath(path))
+        return;
+
+    auto [storePath, narHash] = fetchToStore2(
+        fetchSettings, *store, SourcePath(ref<SourceAccessor>(accessor)), FetchMode::Copy, path.name());
+
+    if (storePath != path)
+        error<EvalError>(
+            "lazily fetched source tree '%s' was copied to unexpected store path '%s'",
+            store->printStorePath(path),
+            store->printStorePath(storePath))
+            .debugThrow();
+}
+
+void EvalState::materializeContext(const NixStringContext & context)
+{
+    for (auto & c : context)
+        if (auto o = std::get_if<NixStringContextElem::Opaque>(&c.raw))
+            materializeStorePath(o->path);
+}
+
 inline static bool isJustSchemePrefix(std::string_view prefix)
 {
     return !prefix.empty() && prefix[prefix.size() - 1] == ':'
@@ -885,28 +1032,84 @@ void Value::mkString(std::string_view s)
     mkString(makeImmutableString(s));
 }
 
-static const char ** encodeContext(const NixStringContext & context)
+/**
+ * Hash-consed string contexts. Large evaluations create millions of
+ * strings that refer to the same few hundred store paths, so encoded
+ * contexts and their elements are shared by pointer instead of being
+ * copied for every string. Interned contexts are immutable. The table
+ * belongs to an `EvalState` (so it's freed with it) and is safe to use
+ * from several threads.
+ */
+struct ContextTable
+{
+    template<typename V>
+    using Map = boost::concurrent_flat_map<
+        std::string,
+        V,
+        StringViewHash,
+        std::equal_to<>,
+        traceable_allocator<std::pair<const std::string, V>>>;
+
+    /**
+     * Element strings, keyed by their encoding.
+     */
+    Map<const char *> elems;
+
+    /**
+     * Null-terminated context arrays, keyed by the NUL-separated
+     * encodings of their (sorted) elements.
+     */
+    Map<const char **> contexts;
+};
+
+static const char ** encodeContext(ContextTable & table, const NixStringContext & context)
 {
-    if (!context.empty()) {
-        size_t n = 0;
-        auto ctx = (const char **) allocBytes((context.size() + 1) * sizeof(char *));
-        for (auto & i : context) {
-            ctx[n++] = makeImmutableString({i.to_string()});
-        }
-        ctx[n] = nullptr;
-        return ctx;
-    } else
+    if (context.empty())
         return nullptr;
+
+    std::vector<std::string> elems;
+    elems.reserve(context.size());
+    std::string key;
+    for (auto & i : context) {
+        elems.push_back(i.to_string());
+        key += elems.back();
+        key.push_back('\0');
+    }
+
+    const char ** res = nullptr;
+    table.contexts.cvisit(key, [&](auto & i) { res = i.second; });
+    if (res)
+        return res;
+
+    /* If another thread interns the same element or context
+       concurrently, we use its copy and let ours be garbage
+       collected. */
+    size_t n = 0;
+    auto ctx = (const char **) allocBytes((elems.size() + 1) * sizeof(char *));
+    for (auto & e : elems) {
+        const char * elem = nullptr;
+        table.elems.cvisit(e, [&](auto & i) { elem = i.second; });
+        if (!elem) {
+            elem = makeImmutableString(e);
+            table.elems.try_emplace_or_cvisit(e, elem, [&](auto & i) { elem = i.second; });
+        }
+        ctx[n++] = elem;
+    }
+    ctx[n] = nullptr;
+
+    res = ctx;
+    table.contexts.try_emplace_or_cvisit(std::move(key), ctx, [&](auto & i) { res = i.second; });
+    return res;
 }
 
-void Value::mkString(std::string_view s, const NixStringContext & context)
+void Value::mkString(std::string_view s, const NixStringContext & context, EvalState & state)
 {
-    mkString(makeImmutableString(s), encodeContext(context));
+    mkString(makeImmutableString(s), encodeContext(*state.contextTable, context));
 }
 
-void Value::mkStringMove(const char * s, const NixStringContext & context)
+void Value::mkStringMove(const char * s, const NixStringContext & context, EvalState & state)
 {
-    mkString(s, encodeContext(context));
+    mkString(s, encodeContext(*state.contextTable, context));
 }
 
 void Value::mkPath(const SourcePath & path)
@@ -1012,7 +1215,7 @@ void EvalState::mkOutputString(
     std::optional<StorePath> optStaticOutputPath,
     const ExperimentalFeatureSettings & xpSettings)
 {
-    value.mkString(mkOutputStringRaw(b, optStaticOutputPath, xpSettings), NixStringContext{b});
+    value.mkString(mkOutputStringRaw(b, optStaticOutputPath, xpSettings), NixStringContext{b}, *this);
 }
 
 std::string EvalState::mkSingleDerivedPathStringRaw(const SingleDerivedPath & p)
@@ -2003,6 +2206,23 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
     NixInt n{0};
     NixFloat nf = 0;
 
+    /* Number of string fragments that are not empty, context-free
+       strings, and the last such fragment if it was a string. If
+       there is only one, the result shares it. Otherwise, the
+       fragments are copied into a new string, so building a string by
+       repeatedly appending to it (e.g. `foldl' (s: x: s + x)`) is
+       still quadratic. Strings are contiguous, NUL-terminated arrays
+       that are accessed without evaluation, so they can't be ropes;
+       `builtins.concatStrings` and `concatStringsSep` copy each
+       fragment once. */
+    size_t opaqueParts = 0;
+    Value * sharedPart = nullptr;
+
+    /* The context shared by all fragments that have one, if they are
+       all strings with the same (interned) context. */
+    const char ** sharedContext = nullptr;
+    bool mixedContexts = false;
+
     bool first = !forceString;
     ValueType firstType = nString;
 
@@ -2081,6 +2301,17 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             path */
             auto part = state.coerceToString(
                 i_pos, vTmp, context, "while evaluating a path segment", false, firstType == nString, !first);
+            if (vTmp.type() != nString || !part->empty() || vTmp.context()) {
+                opaqueParts++;
+                sharedPart = vTmp.type() == nString ? &vTmp : nullptr;
+            }
+            if (vTmp.type() != nString)
+                mixedContexts = true;
+            else if (auto partContext = vTmp.context()) {
+                if (sharedContext && sharedContext != partContext)
+                    mixedContexts = true;
+                sharedContext = partContext;
+            }
             sSize += part->size();
             s.emplace_back(std::move(part));
         }
@@ -2099,8 +2330,18 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
                 .withFrame(env, *this)
                 .debugThrow();
         v.mkPath(state.rootPath(CanonPath(str())));
-    } else
-        v.mkStringMove(c_str(), context);
+    } else if (opaqueParts == 1 && sharedPart)
+        /* All other fragments are empty strings without context, so
+           the result is exactly this fragment. Strings are immutable,
+           so share its characters and context rather than copying
+           them. This keeps patterns like `optionalString false "..." +
+           s` and `"${s}"` from allocating. */
+        v.mkString(sharedPart->c_str(), sharedPart->context());
+    else if (!mixedContexts)
+        /* The union of the fragments' contexts is one of them. */
+        v.mkString(c_str(), sharedContext);
+    else
+        v.mkStringMove(c_str(), context, state);
 }
 
 void ExprPos::eval(EvalState & state, Env & env, Value & v)
@@ -2886,6 +3127,12 @@ void EvalState::maybePrintStats()
     }
 }
 
+uint64_t EvalState::allocatedBytes() const
+{
+    return nrEnvs * sizeof(Env) + nrValuesInEnvs * sizeof(Value *) + nrListElems * sizeof(Value *)
+           + nrValues * sizeof(Value) + nrAttrsets * sizeof(Bindings) + nrAttrsInAttrsets * sizeof(Attr);
+}
+
 void EvalState::printStatistics()
 {
 #ifndef _WIN32 // TODO use portable implementation
@@ -0,0 +1,107 @@
+#pragma once
+///@file
+
+#include "nix/util/source-accessor.hh"
+#include "nix/util/sync.hh"
+
+#include <set>
+
+namespace nix {
+
+/**
+ * Records which file system objects were accessed by the evaluator,
+ * so that the evaluation cache can reuse results that don't depend
+ * on anything that has changed since they were computed.
+ *
+ * Accesses are appended to a single log. Since the evaluator
+ * memoises the results of evaluation (e.g. thunks and parsed
+ * files), a value computed when the log had length `n` may depend
+ * on any of the first `n` entries of the log, not just on the
+ * accesses performed while computing it.
+ */
+struct DependencyTracker
+{
+    enum struct Kind : int {
+        /**
+         * The contents of a regular file.
+         */
+        File = 0,
+
+        /**
+         * The names and types of the entries of a directory.
+         */
+        Directory = 1,
+
+        /**
+         * The type (or absence) of a file system object.
+         */
+        Stat = 2,
+
+        /**
+         * The target of a symlink.
+         */
+        Symlink = 3,
+
+        /**
+         * The entire tree underneath a path, e.g. because it was
+         * copied to the store or used as a derivation input.
+         */
+        Tree = 4,
+    };
+
+    typedef std::pair<Kind, CanonPath> Dependency;
+
+    /**
+     * Wrap `next` in an accessor that records all accesses in this
+     * tracker (if enabled).
+     */
+    DependencyTracker(ref<SourceAccessor> next, bool enabled);
+
+    /**
+     * The accessor that records accesses.
+     */
+    ref<SourceAccessor> getAccessor()
+    {
+        return accessor;
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    void record(Kind kind, const CanonPath & path);
+
+    /**
+     * Return the current length of the log.
+     */
+    size_t size();
+
+    /**
+     * Return the log entries in the range `[from, to)`.
+     */
+    std::vector<Dependency> getLog(size_t from, size_t to);
+
+    /**
+     * Return a hash of the current state of the dependency `path`
+     * of type `kind`, without recording the access. Missing objects
+     * have a hash that differs from that of any existing object.
+     */
+    std::string getHash(Kind kind, const CanonPath & path);
+
+private:
+
+    ref<SourceAccessor> next;
+    ref<SourceAccessor> accessor;
+    const bool enabled;
+
+    struct State
+    {
+        std::vector<Dependency> log;
+        std::set<Dependency> seen;
+    };
+
+    Sync<State> state_;
+};
+
+} // namespace nix
@@ -4,6 +4,7 @@
 #include "nix/util/sync.hh"
 #include "nix/util/hash.hh"
 #include "nix/expr/eval.hh"
+#include "nix/store/path.hh"
 
 #include <functional>
 #include <variant>
@@ -43,7 +44,25 @@ class EvalCache : public std::enable_shared_from_this<EvalCache>
 
 public:
 
-    EvalCache(std::optional<std::reference_wrapper<const Hash>> useCache, EvalState & state, RootLoader rootLoader);
+    /**
+     * @param useCache The key of the on-disk cache to use, if any.
+     *
+     * @param trackedRoot If set, cached attributes record which files
+     * in this source tree they depend on (see `DependencyTracker`),
+     * and are only reused if those files are unchanged. `useCache`
+     * can then stay the same when the tree changes.
+     *
+     * @param trackedRootRevision Metadata of `trackedRoot` that isn't
+     * implied by its contents, such as its Git revision. Attributes
+     * that depend on the entire tree are only reused if this is
+     * unchanged.
+     */
+    EvalCache(
+        std::optional<std::reference_wrapper<const Hash>> useCache,
+        EvalState & state,
+        RootLoader rootLoader,
+        std::optional<StorePath> trackedRoot = std::nullopt,
+        std::string trackedRootRevision = "");
 
     ref<AttrCursor> getRoot();
 };
@@ -93,6 +112,18 @@ typedef std::variant<
     std::vector<std::string>>
     AttrValue;
 
+/**
+ * A derivation found while walking a package set (e.g. by `nix
+ * search`), as stored in the search index of the evaluation cache.
+ */
+struct SearchEntry
+{
+    std::string attrPath;
+    std::string pname;
+    std::string version;
+    std::string description;
+};
+
 class AttrCursor : public std::enable_shared_from_this<AttrCursor>
 {
     friend class EvalCache;
@@ -168,6 +199,20 @@ public:
      * Force creation of the .drv file in the Nix store.
      */
     StorePath forceDerivation();
+
+    /**
+     * Return the derivations underneath this attribute, as previously
+     * stored by `setSearchIndex()`, if the attributes they were
+     * computed from are still valid.
+     */
+    std::optional<std::vector<SearchEntry>> getSearchIndex();
+
+    /**
+     * Store the complete list of derivations underneath this
+     * attribute, so that later searches don't have to walk the
+     * attribute tree.
+     */
+    void setSearchIndex(const std::vector<SearchEntry> & entries);
 };
 
 } // namespace nix::eval_cache
@@ -111,4 +111,10 @@ public:
 
 ref<EvalProfiler> makeSampleStackProfiler(EvalState & state, std::filesystem::path profileFile, uint64_t frequency);
 
+/**
+ * Create a profiler that counts every call and saves a gzipped pprof
+ * profile to `profileFile`.
+ */
+ref<EvalProfiler> makeCallTreeProfiler(EvalState & state, std::filesystem::path profileFile);
+
 } // namespace nix
@@ -231,6 +231,7 @@ struct EvalSettings : Config
           Enables evaluation profiling. The following modes are supported:
 
           * `flamegraph` stack sampling profiler. Outputs folded format, one line per stack (suitable for `flamegraph.pl` and compatible tools).
+          * `pprof` deterministic profiler that records every function call. Outputs a gzipped [pprof](https://github.com/google/pprof) profile with exact call counts, time and bytes allocated per call stack.
 
           Use [`eval-profile-file`](#conf-eval-profile-file) to specify where the profile is saved.
 
@@ -265,6 +266,35 @@ struct EvalSettings : Config
             Intermediate results are not cached.
         )"};
 
+    Setting<unsigned int> derivationBatchSize{
+        this,
+        0,
+        "derivation-batch-size",
+        R"(
+          If set to a non-zero value, derivations instantiated during evaluation are
+          not written to the store one at a time. Instead they are queued in memory and
+          written in batches of up to this many derivations, in a single
+          request when the store is accessed through the Nix daemon.
+
+          Queued derivations are written early whenever evaluation needs them to be in the
+          store, e.g. for [import from derivation](@docroot@/language/import-from-derivation.md)
+          or `builtins.readFile`.
+        )"};
+
+    Setting<bool> lazyTrees{
+        this,
+        false,
+        "lazy-trees",
+        R"(
+          If set to true, flake inputs are not copied to the Nix store before they are
+          evaluated. Instead, evaluation reads files directly from the fetched source tree
+          (e.g. the Git repository or the tarball cache), and a source tree is only copied
+          to the store when its store path is actually needed, for instance because it is
+          used as an input of a derivation.
+
+          The store paths of flake inputs are the same as when this setting is disabled.
+        )"};
+
     Setting<bool> ignoreExceptionsDuringTry{
         this,
         false,
@@ -38,13 +38,18 @@ class Store;
 namespace fetchers {
 struct Settings;
 struct InputCache;
+struct Input;
 } // namespace fetchers
 struct EvalSettings;
 class EvalState;
 class StorePath;
+struct Derivation;
 struct SingleDerivedPath;
 enum RepairFlag : bool;
 struct MemorySourceAccessor;
+struct MountedSourceAccessor;
+struct ContextTable;
+struct DependencyTracker;
 
 namespace eval_cache {
 class EvalCache;
@@ -274,9 +279,16 @@ public:
     Value vStringUnknown;
 
     /**
-     * The accessor corresponding to `store`.
+     * The accessor corresponding to `store`. Lazily fetched source
+     * trees are mounted on top of it (see `mountInput()`).
      */
-    const ref<SourceAccessor> storeFS;
+    const ref<MountedSourceAccessor> storeFS;
+
+    /**
+     * Records the accesses to the root filesystem, for use by the
+     * evaluation cache.
+     */
+    const ref<DependencyTracker> dependencyTracker;
 
     /**
      * The accessor for the root filesystem.
@@ -310,6 +322,12 @@ public:
 
     ref<fetchers::InputCache> inputCache;
 
+    /**
+     * Interned string contexts of this evaluation, see
+     * `Value::mkString()`.
+     */
+    const ref<ContextTable> contextTable;
+
     /**
      * Debugger
      */
@@ -357,8 +375,31 @@ public:
      */
     std::map<const Hash, ref<eval_cache::EvalCache>> evalCaches;
 
+    /**
+     * Write a derivation to the store, or, if
+     * `derivation-batch-size` is set, queue it to be written together
+     * with others by `flushDerivations()`.
+     *
+     * @return The store path of the derivation.
+     */
+    StorePath writeDerivation(const Derivation & drv);
+
+    /**
+     * Write all queued derivations to the store. This must be called
+     * before anything outside the evaluator may observe them.
+     */
+    void flushDerivations();
+
 private:
 
+    struct PendingDerivation;
+
+    /**
+     * Derivations instantiated but not yet written to the store, in
+     * instantiation order (and hence in topological order).
+     */
+    std::vector<PendingDerivation> pendingDerivations;
+
     /* Cache for calls to addToStore(); maps source paths to the store
        paths. */
     Sync<std::unordered_map<SourcePath, StorePath>> srcToStore;
@@ -470,6 +511,26 @@ public:
      */
     void allowAndSetStorePathString(const StorePath & storePath, Value & v);
 
+    /**
+     * Make the source tree `accessor` of `input` available under its
+     * store path, and set the `narHash` attribute of `input`. If
+     * `lazy-trees` is enabled, the tree is mounted in `storeFS`
+     * rather than copied to the store; it's copied later by
+     * `materializeStorePath()` if necessary.
+     */
+    StorePath mountInput(fetchers::Input & input, const fetchers::Input & originalInput, ref<SourceAccessor> accessor);
+
+    /**
+     * If `path` is a lazily mounted source tree that is not valid in
+     * the store yet, copy it to the store.
+     */
+    void materializeStorePath(const StorePath & path);
+
+    /**
+     * Call `materializeStorePath()` on the store paths in `context`.
+     */
+    void materializeContext(const NixStringContext & context);
+
     void checkURI(const std::string & uri);
 
     /**
@@ -874,6 +935,12 @@ public:
      */
     void printStatistics();
 
+    /**
+     * Bytes allocated so far for environments, values, lists and
+     * attribute sets (but not strings).
+     */
+    uint64_t allocatedBytes() const;
+
     /**
      * Perform a full memory garbage collection - not incremental.
      *
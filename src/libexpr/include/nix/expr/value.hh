@@ -967,9 +967,13 @@ public:
 
     void mkString(std::string_view s);
 
-    void mkString(std::string_view s, const NixStringContext & context);
+    /**
+     * Create a string with context. The encoded context is interned
+     * in `state`, so strings with equal contexts share it.
+     */
+    void mkString(std::string_view s, const NixStringContext & context, EvalState & state);
 
-    void mkStringMove(const char * s, const NixStringContext & context);
+    void mkStringMove(const char * s, const NixStringContext & context, EvalState & state);
 
     void mkPath(const SourcePath & path);
     void mkPath(std::string_view path);
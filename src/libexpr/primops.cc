@@ -15,6 +15,7 @@
 #include "nix/expr/primops.hh"
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/util/sort.hh"
+#include "nix/util/mounted-source-accessor.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <nlohmann/json.hpp>
@@ -61,6 +62,9 @@ StringMap EvalState::realiseContext(const NixStringContext & context, StorePathS
     std::vector<DerivedPath::Built> drvs;
     StringMap res;
 
+    if (!context.empty())
+        flushDerivations();
+
     for (auto & c : context) {
         auto ensureValid = [&](const StorePath & p) {
             if (!store->isValidPath(p))
@@ -77,6 +81,13 @@ StringMap EvalState::realiseContext(const NixStringContext & context, StorePathS
                     ensureValid(b.drvPath->getBaseStorePath());
                 },
                 [&](const NixStringContextElem::Opaque & o) {
+                    /* Lazily mounted source trees can be read through
+                       `storeFS`, so they only need to be copied to the
+                       store if the caller wants the actual paths. */
+                    if (maybePathsOut)
+                        materializeStorePath(o.path);
+                    else if (storeFS->getMount(CanonPath(store->printStorePath(o.path))))
+                        return;
                     ensureValid(o.path);
                     if (maybePathsOut)
                         maybePathsOut->emplace(o.path);
@@ -453,6 +464,7 @@ void prim_exec(EvalState & state, const PosIdx pos, Value ** args, Value & v)
                                   .toOwned());
     }
     try {
+        state.materializeContext(context);
         auto _ = state.realiseContext(context); // FIXME: Handle CA derivations
     } catch (InvalidPathError & e) {
         state.error<EvalError>("cannot execute '%1%', since path '%2%' is not valid", program, e.path)
@@ -1577,6 +1589,7 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
                    available when the builder runs. */
                 [&](const NixStringContextElem::DrvDeep & d) {
                     /* !!! This doesn't work if readOnlyMode is set. */
+                    state.flushDerivations();
                     StorePathSet refs;
                     state.store->computeFSClosure(d.drvPath, refs);
                     for (auto & j : refs) {
@@ -1589,7 +1602,10 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
                 [&](const NixStringContextElem::Built & b) {
                     drv.inputDrvs.ensureSlot(*b.drvPath).value.insert(b.output);
                 },
-                [&](const NixStringContextElem::Opaque & o) { drv.inputSrcs.insert(o.path); },
+                [&](const NixStringContextElem::Opaque & o) {
+                    state.materializeStorePath(o.path);
+                    drv.inputSrcs.insert(o.path);
+                },
             },
             c.raw);
     }
@@ -1702,7 +1718,7 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
     }
 
     /* Write the resulting term into the Nix store directory. */
-    auto drvPath = writeDerivation(*state.store, drv, state.repair);
+    auto drvPath = state.writeDerivation(drv);
     auto drvPathS = state.store->printStorePath(drvPath);
 
     printMsg(lvlChatty, "instantiated '%1%' -> '%2%'", drvName, drvPathS);
@@ -1712,7 +1728,7 @@ static void derivationStrictInternal(EvalState & state, std::string_view drvName
        read them later. */
     {
         auto h = hashDerivationModulo(*state.store, drv, false);
-        drvHashes.lock()->insert_or_assign(drvPath, h);
+        drvHashes.insert_or_assign(drvPath, h);
     }
 
     auto result = state.buildBindings(1 + drv.outputs.size());
@@ -1774,7 +1790,7 @@ static void prim_toPath(EvalState & state, const PosIdx pos, Value ** args, Valu
     NixStringContext context;
     auto path =
         state.coerceToPath(pos, *args[0], context, "while evaluating the first argument passed to builtins.toPath");
-    v.mkString(path.path.abs(), context);
+    v.mkString(path.path.abs(), context, state);
 }
 
 static RegisterPrimOp primop_toPath({
@@ -1814,10 +1830,12 @@ static void prim_storePath(EvalState & state, const PosIdx pos, Value ** args, V
     if (!state.store->isInStore(path.abs()))
         state.error<EvalError>("path '%1%' is not in the Nix store", path).atPos(pos).debugThrow();
     auto path2 = state.store->toStorePath(path.abs()).first;
-    if (!settings.readOnlyMode)
+    if (!settings.readOnlyMode) {
+        state.materializeStorePath(path2);
         state.store->ensurePath(path2);
+    }
     context.insert(NixStringContextElem::Opaque{.path = path2});
-    v.mkString(path.abs(), context);
+    v.mkString(path.abs(), context, state);
 }
 
 static RegisterPrimOp primop_storePath({
@@ -1934,7 +1952,7 @@ static void prim_dirOf(EvalState & state, const PosIdx pos, Value ** args, Value
         auto path = state.coerceToString(
             pos, *args[0], context, "while evaluating the first argument passed to 'builtins.dirOf'", false, false);
         auto dir = dirOf(*path);
-        v.mkString(dir, context);
+        v.mkString(dir, context, state);
     }
 }
 
@@ -1976,7 +1994,7 @@ static void prim_readFile(EvalState & state, const PosIdx pos, Value ** args, Va
                 .path = std::move((StorePath &&) p),
             });
     }
-    v.mkString(s, context);
+    v.mkString(s, context, state);
 }
 
 static RegisterPrimOp primop_readFile({
@@ -2344,7 +2362,7 @@ static void prim_toXML(EvalState & state, const PosIdx pos, Value ** args, Value
     std::ostringstream out;
     NixStringContext context;
     printValueAsXML(state, true, false, *args[0], out, context, pos);
-    v.mkString(toView(out), context);
+    v.mkString(toView(out), context, state);
 }
 
 static RegisterPrimOp primop_toXML({
@@ -2452,7 +2470,7 @@ static void prim_toJSON(EvalState & state, const PosIdx pos, Value ** args, Valu
     std::ostringstream out;
     NixStringContext context;
     printValueAsJSON(state, true, *args[0], pos, out, context);
-    v.mkString(toView(out), context);
+    v.mkString(toView(out), context, state);
 }
 
 static RegisterPrimOp primop_toJSON({
@@ -2521,6 +2539,10 @@ static void prim_toFile(EvalState & state, const PosIdx pos, Value ** args, Valu
                 .debugThrow();
     }
 
+    /* The references must be valid, so copy any lazily fetched trees
+       to the store. */
+    state.materializeContext(context);
+
     auto storePath = settings.readOnlyMode ? state.store->makeFixedOutputPathFromCA(
                                                  name,
                                                  TextInfo{
@@ -4282,7 +4304,7 @@ static void prim_toString(EvalState & state, const PosIdx pos, Value ** args, Va
     NixStringContext context;
     auto s = state.coerceToString(
         pos, *args[0], context, "while evaluating the first argument passed to builtins.toString", true, false);
-    v.mkString(*s, context);
+    v.mkString(*s, context, state);
 }
 
 static RegisterPrimOp primop_toString({
@@ -4355,7 +4377,7 @@ static void prim_substring(EvalState & state, const PosIdx pos, Value ** args, V
     auto s = state.coerceToString(
         pos, *args[2], context, "while evaluating the third argument (the string) passed to builtins.substring");
 
-    v.mkString(NixUInt(start) >= s->size() ? "" : s->substr(start, _len), context);
+    v.mkString(NixUInt(start) >= s->size() ? "" : s->substr(start, _len), context, state);
 }
 
 static RegisterPrimOp primop_substring({
@@ -4743,6 +4765,17 @@ static void prim_concatStringsSep(EvalState & state, const PosIdx pos, Value **
         pos,
         "while evaluating the second argument (the list of strings to concat) passed to builtins.concatStringsSep");
 
+    /* A single-element list with a context-free separator yields the
+       element itself, so share it instead of copying. */
+    if (args[1]->listSize() == 1 && context.empty()) {
+        auto elem = args[1]->listView()[0];
+        state.forceValue(*elem, pos);
+        if (elem->type() == nString) {
+            v.mkString(elem->c_str(), elem->context());
+            return;
+        }
+    }
+
     std::string res;
     res.reserve((args[1]->listSize() + 32) * sep.size());
     bool first = true;
@@ -4759,7 +4792,7 @@ static void prim_concatStringsSep(EvalState & state, const PosIdx pos, Value **
             "while evaluating one element of the list of strings to concat passed to builtins.concatStringsSep");
     }
 
-    v.mkString(res, context);
+    v.mkString(res, context, state);
 }
 
 static RegisterPrimOp primop_concatStringsSep({
@@ -4834,7 +4867,7 @@ static void prim_replaceStrings(EvalState & state, const PosIdx pos, Value ** ar
         }
     }
 
-    v.mkString(res, context);
+    v.mkString(res, context, state);
 }
 
 static RegisterPrimOp primop_replaceStrings({
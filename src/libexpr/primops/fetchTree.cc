@@ -10,6 +10,7 @@
 #include "nix/util/url.hh"
 #include "nix/expr/value-to-json.hh"
 #include "nix/fetchers/fetch-to-store.hh"
+#include "nix/expr/dependency-tracker.hh"
 
 #include <nlohmann/json.hpp>
 
@@ -375,6 +376,13 @@ static RegisterPrimOp primop_fetchTree({
 
           Default: `true`
 
+        - `blobless` (Bool, optional)
+
+          Make a partial clone without file contents when fetching the Git tree.
+          Files are fetched from the remote in batches, one directory at a time, when they're first read.
+
+          Default: `false`
+
         - `submodules` (Bool, optional)
 
           Also fetch submodules if available.
@@ -472,6 +480,28 @@ static RegisterPrimOp primop_fetchFinalTree({
     .internal = true,
 });
 
+/**
+ * Return the second argument, after recording that the evaluation
+ * depends on the entire source tree denoted by the first argument.
+ * This is used for attributes like `narHash` that change whenever
+ * anything in the tree changes.
+ */
+static void prim_trackSourceTree(EvalState & state, const PosIdx pos, Value ** args, Value & v)
+{
+    auto path = state.forceStringNoCtx(
+        *args[0], pos, "while evaluating the first argument passed to builtins.trackSourceTree");
+    state.dependencyTracker->record(DependencyTracker::Kind::Tree, CanonPath(path));
+    state.forceValue(*args[1], pos);
+    v = *args[1];
+}
+
+static RegisterPrimOp primop_trackSourceTree({
+    .name = "trackSourceTree",
+    .args = {"path", "value"},
+    .fun = prim_trackSourceTree,
+    .internal = true,
+});
+
 static void fetch(
     EvalState & state,
     const PosIdx pos,
@@ -728,6 +758,11 @@ static RegisterPrimOp primop_fetchGit({
         Make a shallow clone when fetching the Git tree.
         When this is enabled, the options `ref` and `allRefs` have no effect anymore.
 
+      - `blobless` (default: `false`)
+
+        Make a partial clone without file contents when fetching the Git tree.
+        Files are fetched from the remote in batches, one directory at a time, when they're first read.
+
       - `lfs` (default: `false`)
 
         A boolean that when `true` specifies that [Git LFS] files should be fetched.
@@ -10,8 +10,10 @@
 #include <gtest/gtest.h>
 #include "nix/util/fs-sink.hh"
 #include "nix/util/serialise.hh"
+#include "nix/util/tarfile.hh"
 #include "nix/fetchers/git-lfs-fetch.hh"
 
+#include <archive_entry.h>
 #include <git2/blob.h>
 #include <git2/tree.h>
 
@@ -123,6 +125,93 @@ TEST_F(GitUtilsTest, sink_hardlink)
     }
 };
 
+/**
+ * Return a tarball with a top-level directory `foo-1.1` containing
+ * the regular files in `files`.
+ */
+static std::string makeTarball(const std::map<std::string, std::string> & files)
+{
+    size_t size = 1024 * 1024;
+    for (auto & [_, contents] : files)
+        size += contents.size() + 1024;
+    std::string buf(size, 0);
+    size_t used = 0;
+
+    auto a = archive_write_new();
+    archive_write_set_format_ustar(a);
+    archive_write_open_memory(a, buf.data(), buf.size(), &used);
+
+    auto entry = archive_entry_new();
+    archive_entry_set_pathname(entry, "foo-1.1");
+    archive_entry_set_filetype(entry, AE_IFDIR);
+    archive_entry_set_perm(entry, 0755);
+    EXPECT_EQ(archive_write_header(a, entry), ARCHIVE_OK);
+
+    for (auto & [name, contents] : files) {
+        archive_entry_clear(entry);
+        archive_entry_set_pathname(entry, ("foo-1.1/" + name).c_str());
+        archive_entry_set_filetype(entry, AE_IFREG);
+        archive_entry_set_perm(entry, 0644);
+        archive_entry_set_size(entry, contents.size());
+        EXPECT_EQ(archive_write_header(a, entry), ARCHIVE_OK);
+        EXPECT_EQ(archive_write_data(a, contents.data(), contents.size()), (la_ssize_t) contents.size());
+    }
+
+    archive_entry_free(entry);
+    archive_write_close(a);
+    archive_write_free(a);
+
+    buf.resize(used);
+    return buf;
+}
+
+static size_t countPackfiles(const std::filesystem::path & repoDir)
+{
+    size_t n = 0;
+    for (auto & entry : std::filesystem::directory_iterator(repoDir / ".git" / "objects" / "pack"))
+        if (entry.path().extension() == ".pack")
+            n++;
+    return n;
+}
+
+TEST_F(GitUtilsTest, sink_flushes_pending_blobs)
+{
+    std::map<std::string, std::string> files;
+    for (int i = 0; i < 8; i++) {
+        std::string contents;
+        for (int j = 0; contents.size() < 64 * 1024; j++)
+            contents += fmt("file %d, line %d\n", i, j);
+        files.emplace(fmt("file-%d", i), contents);
+    }
+    auto tarball = makeTarball(files);
+
+    auto import = [&](GitRepo & repo, uint64_t maxPendingBytes) {
+        StringSource source(tarball);
+        TarArchive archive(source);
+        auto sink = repo.getFileSystemObjectSink(maxPendingBytes);
+        unpackTarfileToSink(archive, *sink);
+        return repo.dereferenceSingletonDirectory(sink->flush());
+    };
+
+    /* Import the tarball with a threshold that is crossed several
+       times, so that the blobs end up in multiple packfiles. */
+    auto repo = openRepo();
+    auto tree = import(*repo, 100 * 1024);
+    ASSERT_GT(countPackfiles(tmpDir), 1u);
+
+    /* Importing it in one go must produce the same tree. */
+    auto otherDir = createTempDir();
+    AutoDelete delOtherDir(otherDir, true);
+    auto otherRepo = GitRepo::openRepo(otherDir, true, false);
+    ASSERT_EQ(import(*otherRepo, 128 * 1024 * 1024), tree);
+    ASSERT_EQ(countPackfiles(otherDir), 1u);
+
+    auto accessor = repo->getAccessor(tree, false, getRepoName());
+    ASSERT_EQ(accessor->readDirectory(CanonPath::root).size(), files.size());
+    for (auto & [name, contents] : files)
+        ASSERT_EQ(accessor->readFile(CanonPath(name)), contents);
+}
+
 TEST_F(GitUtilsTest, peel_reference)
 {
     // Create a commit in the repo
@@ -12,6 +12,22 @@ fetchers::Cache::Key makeFetchToStoreCacheKey(
         {{"name", name}, {"fingerprint", fingerprint}, {"method", std::string{method.render()}}, {"path", path}}};
 }
 
+/**
+ * Return the key under which the result of copying `path` is cached.
+ * This prefers the fingerprint of the contents of `path` (which is
+ * shared between e.g. Git revisions in which the subtree at `path`
+ * is unchanged) over the fingerprint of the accessor.
+ */
+static std::optional<fetchers::Cache::Key>
+getCacheKey(const SourcePath & path, std::string_view name, ContentAddressMethod method)
+{
+    if (auto fingerprint = path.accessor->getContentFingerprint(path.path))
+        return makeFetchToStoreCacheKey(std::string{name}, *fingerprint, method, "/");
+    if (path.accessor->fingerprint)
+        return makeFetchToStoreCacheKey(std::string{name}, *path.accessor->fingerprint, method, path.path.abs());
+    return std::nullopt;
+}
+
 StorePath fetchToStore(
     const fetchers::Settings & settings,
     Store & store,
@@ -27,8 +43,7 @@ StorePath fetchToStore(
 
     std::optional<fetchers::Cache::Key> cacheKey;
 
-    if (!filter && path.accessor->fingerprint) {
-        cacheKey = makeFetchToStoreCacheKey(std::string{name}, *path.accessor->fingerprint, method, path.path.abs());
+    if (!filter && (cacheKey = getCacheKey(path, name, method))) {
         if (auto res = settings.getCache()->lookupStorePath(*cacheKey, store)) {
             debug("store path cache hit for '%s'", path);
             return res->storePath;
@@ -56,4 +71,49 @@ StorePath fetchToStore(
     return storePath;
 }
 
+std::pair<StorePath, Hash> fetchToStore2(
+    const fetchers::Settings & settings, Store & store, const SourcePath & path, FetchMode mode, std::string_view name)
+{
+    std::optional<fetchers::Cache::Key> cacheKey;
+
+    if ((cacheKey = getCacheKey(path, name, ContentAddressMethod::Raw::NixArchive))) {
+        cacheKey->second.insert_or_assign("store", store.storeDir);
+
+        /* In dry-run mode, the store path doesn't need to be valid,
+           so we can use any cache entry that records the NAR hash. */
+        if (auto res = settings.getCache()->lookup(*cacheKey); res && res->contains("narHash")) {
+            StorePath storePath(fetchers::getStrAttr(*res, "storePath"));
+            if (mode == FetchMode::DryRun || store.isValidPath(storePath)) {
+                debug("store path cache hit for '%s'", path);
+                return {storePath, Hash::parseSRI(fetchers::getStrAttr(*res, "narHash"))};
+            }
+        }
+    } else
+        debug("source path '%s' is uncacheable", path);
+
+    Activity act(
+        *logger,
+        lvlChatty,
+        actUnknown,
+        fmt(mode == FetchMode::DryRun ? "hashing '%s'" : "copying '%s' to the store", path));
+
+    auto [storePath, narHash] = [&]() -> std::pair<StorePath, Hash> {
+        if (mode == FetchMode::DryRun)
+            return store.computeStorePath(
+                name, path, ContentAddressMethod::Raw::NixArchive, HashAlgorithm::SHA256, {}, defaultPathFilter);
+        auto storePath = store.addToStore(
+            name, path, ContentAddressMethod::Raw::NixArchive, HashAlgorithm::SHA256, {}, defaultPathFilter);
+        return {storePath, store.queryPathInfo(storePath)->narHash};
+    }();
+
+    debug(mode == FetchMode::DryRun ? "hashed '%s'" : "copied '%s' to '%s'", path, store.printStorePath(storePath));
+
+    if (cacheKey)
+        settings.getCache()->upsert(
+            *cacheKey,
+            {{"storePath", std::string(storePath.to_string())}, {"narHash", narHash.to_string(HashFormat::SRI, true)}});
+
+    return {storePath, narHash};
+}
+
 } // namespace nix
@@ -79,6 +79,15 @@ struct AllowListSourceAccessorImpl : AllowListSourceAccessor
     {
         allowedPrefixes.insert(std::move(prefix));
     }
+
+    std::optional<std::string> getContentFingerprint(const CanonPath & path) override
+    {
+        /* Only forward if everything underneath `path` is allowed. */
+        for (auto & allowedPrefix : allowedPrefixes)
+            if (path.isWithin(allowedPrefix))
+                return next->getContentFingerprint(prefix / path);
+        return std::nullopt;
+    }
 };
 
 ref<AllowListSourceAccessor> AllowListSourceAccessor::create(
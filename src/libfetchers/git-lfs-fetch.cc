@@ -5,41 +5,29 @@
 #include "nix/util/url.hh"
 #include "nix/util/users.hh"
 #include "nix/util/hash.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/file-system.hh"
 
 #include <git2/attr.h>
+#include <git2/blob.h>
 #include <git2/config.h>
 #include <git2/errors.h>
+#include <git2/object.h>
 #include <git2/remote.h>
+#include <git2/tree.h>
 
 #include <nlohmann/json.hpp>
 
 namespace nix::lfs {
 
-// if authHeader is "", downloadToSink assumes no auth is expected
-static void downloadToSink(
-    const std::string & url,
-    const std::string & authHeader,
-    // FIXME: passing a StringSink is superfluous, we may as well
-    // return a string. Or use an abstract Sink for streaming.
-    StringSink & sink,
-    std::string sha256Expected,
-    size_t sizeExpected)
+/**
+ * Return the location of an LFS object in the local object cache. Since
+ * objects are addressed by their SHA-256 hash, the cache is shared by
+ * all repositories and revisions.
+ */
+static Path getCachePath(const Pointer & pointer)
 {
-    FileTransferRequest request(url);
-    Headers headers;
-    if (!authHeader.empty())
-        headers.push_back({"Authorization", authHeader});
-    request.headers = headers;
-    getFileTransfer()->download(std::move(request), sink);
-
-    auto sizeActual = sink.s.length();
-    if (sizeExpected != sizeActual)
-        throw Error("size mismatch while fetching %s: expected %d but got %d", url, sizeExpected, sizeActual);
-
-    auto sha256Actual = hashString(HashAlgorithm::SHA256, sink.s).to_string(HashFormat::Base16, false);
-    if (sha256Actual != sha256Expected)
-        throw Error(
-            "hash mismatch while fetching %s: expected sha256:%s but got sha256:%s", url, sha256Expected, sha256Actual);
+    return getCacheDir() + "/git-lfs/objects/" + pointer.oid.substr(0, 2) + "/" + pointer.oid;
 }
 
 static std::string getLfsApiToken(const ParsedURL & url)
@@ -215,6 +203,168 @@ std::vector<nlohmann::json> Fetch::fetchUrls(const std::vector<Pointer> & pointe
     }
 }
 
+std::vector<Pointer> Fetch::getPointers() const
+{
+    auto repo = (git_repository *) this->repo;
+
+    git_object * object = nullptr;
+    if (git_object_lookup(&object, repo, &rev, GIT_OBJECT_ANY))
+        throw Error("looking up revision for git-lfs: %s", git_error_last()->message);
+    Finally freeObject([&]() { git_object_free(object); });
+
+    git_tree * tree = nullptr;
+    if (git_object_peel((git_object **) &tree, object, GIT_OBJECT_TREE))
+        throw Error("looking up tree for git-lfs: %s", git_error_last()->message);
+    Finally freeTree([&]() { git_tree_free(tree); });
+
+    struct WalkState
+    {
+        const Fetch & fetch;
+        git_repository * repo;
+        std::map<std::string, Pointer> pointers;
+        std::exception_ptr exception;
+    } state{*this, repo};
+
+    auto callback = [](const char * root, const git_tree_entry * entry, void * payload) -> int {
+        auto & state = *(WalkState *) payload;
+        try {
+            if (git_tree_entry_type(entry) != GIT_OBJECT_BLOB)
+                return 0;
+
+            CanonPath path(std::string(root) + git_tree_entry_name(entry));
+            if (!state.fetch.shouldFetch(path))
+                return 0;
+
+            /* The blob may be missing in a partial clone, in which
+               case it's handled when it's read. */
+            git_blob * blob = nullptr;
+            if (git_blob_lookup(&blob, state.repo, git_tree_entry_id(entry)))
+                return 0;
+            Finally freeBlob([&]() { git_blob_free(blob); });
+
+            if (git_blob_rawsize(blob) >= 1024)
+                return 0;
+
+            std::string_view content((const char *) git_blob_rawcontent(blob), git_blob_rawsize(blob));
+            if (auto pointer = parseLfsPointer(content, path.rel()))
+                state.pointers.insert_or_assign(pointer->oid, *pointer);
+
+            return 0;
+        } catch (...) {
+            state.exception = std::current_exception();
+            return -1;
+        }
+    };
+
+    if (git_tree_walk(tree, GIT_TREEWALK_PRE, callback, &state)) {
+        if (state.exception)
+            std::rethrow_exception(state.exception);
+        throw Error("walking tree for git-lfs: %s", git_error_last()->message);
+    }
+
+    std::vector<Pointer> res;
+    for (auto & [_, pointer] : state.pointers)
+        res.push_back(pointer);
+    return res;
+}
+
+void Fetch::download(const std::vector<Pointer> & pointers, bool prefetch) const
+{
+    std::vector<Pointer> missing;
+    for (auto & pointer : pointers)
+        if (!pathExists(getCachePath(pointer)))
+            missing.push_back(pointer);
+
+    /* Request the download URLs of up to 100 objects at a time (the
+       batch size recommended by the git-lfs API), and download the
+       objects of each batch concurrently. Also limit the total size
+       of a batch, since the objects are held in memory. */
+    constexpr size_t maxBatchObjects = 100;
+    constexpr uint64_t maxBatchBytes = 256 * 1024 * 1024;
+
+    /* When prefetching, a failure to get one object shouldn't stop us
+       from getting the others. The failing object is downloaded again
+       on its own if it's actually read, which reports the error. */
+    auto skip = [&](const Pointer & pointer, const Error & e) {
+        debug("not prefetching git-lfs object %s: %s", pointer.oid, e.msg());
+    };
+
+    auto i = missing.begin();
+    while (i != missing.end()) {
+        std::vector<Pointer> batch;
+        uint64_t batchBytes = 0;
+        do {
+            batchBytes += i->size;
+            batch.push_back(*i++);
+        } while (i != missing.end() && batch.size() < maxBatchObjects && batchBytes + i->size <= maxBatchBytes);
+
+        std::vector<std::pair<Pointer, std::future<FileTransferResult>>> downloads;
+
+        for (auto & obj : fetchUrls(batch)) {
+            try {
+                Pointer pointer{obj.at("oid").get<std::string>(), obj.at("size").get<size_t>()};
+                /* The server reports objects it can't provide (e.g.
+                   because they don't exist) per object. */
+                if (obj.contains("error")) {
+                    auto & error = obj.at("error");
+                    Error e(
+                        "git-lfs server cannot provide object %s: %s (code %d)",
+                        pointer.oid,
+                        error.value("message", ""),
+                        error.value("code", 0));
+                    if (!prefetch)
+                        throw e;
+                    skip(pointer, e);
+                    continue;
+                }
+                auto & action = obj.at("actions").at("download");
+                FileTransferRequest request(action.at("href").get<std::string>());
+                if (action.contains("header") && action.at("header").contains("Authorization"))
+                    request.headers.push_back(
+                        {"Authorization", action.at("header").at("Authorization").get<std::string>()});
+                downloads.emplace_back(pointer, getFileTransfer()->enqueueFileTransfer(request));
+            } catch (const nlohmann::json::exception & e) {
+                throw Error("bad json from /info/lfs/objects/batch: %s %s", obj, e.what());
+            }
+        }
+
+        for (auto & [pointer, future] : downloads) {
+            try {
+                auto data = future.get().data;
+
+                if (data.size() != pointer.size)
+                    throw Error(
+                        "size mismatch while fetching git-lfs object %s: expected %d but got %d",
+                        pointer.oid,
+                        pointer.size,
+                        data.size());
+
+                auto sha256Actual = hashString(HashAlgorithm::SHA256, data).to_string(HashFormat::Base16, false);
+                if (sha256Actual != pointer.oid)
+                    throw Error(
+                        "hash mismatch while fetching git-lfs object: expected sha256:%s but got sha256:%s",
+                        pointer.oid,
+                        sha256Actual);
+
+                auto cachePath = getCachePath(pointer);
+                debug("creating cache entry %s", cachePath);
+                createDirs(dirOf(cachePath));
+                /* Use a unique temporary file, since other processes
+                   may be downloading the same object. */
+                auto tmpPath = makeTempPath(dirOf(cachePath), pointer.oid + ".tmp");
+                AutoDelete autoDelTmp(tmpPath, false);
+                writeFile(tmpPath, data);
+                std::filesystem::rename(tmpPath, cachePath);
+                autoDelTmp.cancel();
+            } catch (Error & e) {
+                if (!prefetch)
+                    throw;
+                skip(pointer, e);
+            }
+        }
+    }
+}
+
 void Fetch::fetch(
     const std::string & content,
     const CanonPath & pointerFilePath,
@@ -238,43 +388,49 @@ void Fetch::fetch(
         return;
     }
 
-    Path cacheDir = getCacheDir() + "/git-lfs";
-    std::string key = hashString(HashAlgorithm::SHA256, pointerFilePath.rel()).to_string(HashFormat::Base16, false)
-                      + "/" + pointer->oid;
-    Path cachePath = cacheDir + "/" + key;
-    if (pathExists(cachePath)) {
-        debug("using cache entry %s -> %s", key, cachePath);
-        sink(readFile(cachePath));
-        return;
-    }
-    debug("did not find cache entry for %s", key);
+    auto cachePath = getCachePath(*pointer);
 
-    std::vector<Pointer> pointers;
-    pointers.push_back(pointer.value());
-    const auto objUrls = fetchUrls(pointers);
+    if (!pathExists(cachePath)) {
+        debug("did not find cache entry for %s", pointer->oid);
 
-    const auto obj = objUrls[0];
-    try {
-        std::string sha256 = obj.at("oid"); // oid is also the sha256
-        std::string ourl = obj.at("actions").at("download").at("href");
-        std::string authHeader = "";
-        if (obj.at("actions").at("download").contains("header")
-            && obj.at("actions").at("download").at("header").contains("Authorization")) {
-            authHeader = obj["actions"]["download"]["header"]["Authorization"];
+        /* Download all the LFS objects in this revision at once,
+           since they're likely to be needed as well. */
+        if (!prefetched) {
+            prefetched = true;
+            download(getPointers(), true);
         }
-        const uint64_t size = obj.at("size");
-        sizeCallback(size);
-        downloadToSink(ourl, authHeader, sink, sha256, size);
-
-        debug("creating cache entry %s -> %s", key, cachePath);
-        if (!pathExists(dirOf(cachePath)))
-            createDirs(dirOf(cachePath));
-        writeFile(cachePath, sink.s);
-
-        debug("%s fetched with git-lfs", pointerFilePath);
-    } catch (const nlohmann::json::out_of_range & e) {
-        throw Error("bad json from /info/lfs/objects/batch: %s %s", obj, e.what());
+
+        if (!pathExists(cachePath)) {
+            try {
+                download({*pointer});
+            } catch (Error & e) {
+                e.addTrace({}, "while fetching git-lfs file '%s'", pointerFilePath);
+                throw;
+            }
+        }
+    }
+
+    debug("using cache entry %s", cachePath);
+    auto data = readFile(cachePath);
+
+    /* The cache is outside of the Nix store, so it may have been
+       modified or truncated. */
+    if (hashString(HashAlgorithm::SHA256, data).to_string(HashFormat::Base16, false) != pointer->oid) {
+        warn("git-lfs cache entry '%s' is corrupt; fetching it again", cachePath);
+        deletePath(cachePath);
+        try {
+            download({*pointer});
+        } catch (Error & e) {
+            e.addTrace({}, "while fetching git-lfs file '%s'", pointerFilePath);
+            throw;
+        }
+        data = readFile(cachePath);
     }
+
+    sizeCallback(data.size());
+    sink(data);
+
+    debug("%s fetched with git-lfs", pointerFilePath);
 }
 
 } // namespace nix::lfs
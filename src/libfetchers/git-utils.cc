@@ -94,6 +94,13 @@ static void initLibGit2()
 {
     if (git_libgit2_init() < 0)
         throw Error("initialising libgit2: %s", git_error_last()->message);
+
+    /* Allow opening partial clones (see `GitRepo::fetch()`). libgit2
+       can't fetch missing objects itself, so we do that in
+       `GitSourceAccessor`. */
+    static const char * extensions[] = {"partialclone"};
+    if (git_libgit2_opts(GIT_OPT_SET_EXTENSIONS, extensions, 1))
+        throw Error("enabling Git repository extensions: %s", git_error_last()->message);
 }
 
 git_oid hashToOID(const Hash & hash)
@@ -187,6 +194,30 @@ static int packBuilderProgressCheckInterrupt(int stage, uint32_t current, uint32
 
 static git_packbuilder_progress PACKBUILDER_PROGRESS_CHECK_INTERRUPT = &packBuilderProgressCheckInterrupt;
 
+struct PackBuilderIndexerContext : PackBuilderContext
+{
+    git_indexer * indexer = nullptr;
+    git_indexer_progress stats{};
+};
+
+/**
+ * A `git_packbuilder_foreach_cb` implementation that feeds the packfile
+ * to an indexer, which writes it to disk.
+ */
+static int packBuilderAppendToIndexer(void * buf, size_t size, void * payload)
+{
+    PackBuilderIndexerContext & args = *(PackBuilderIndexerContext *) payload;
+    try {
+        checkInterrupt();
+        if (git_indexer_append(args.indexer, buf, size, &args.stats))
+            throw Error("appending to git packfile index: %s", git_error_last()->message);
+        return GIT_OK;
+    } catch (const std::exception & e) {
+        args.exception = std::current_exception();
+        return GIT_EUSER;
+    }
+}
+
 } // extern "C"
 
 static void initRepoAtomically(std::filesystem::path & path, bool bare)
@@ -261,46 +292,37 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
     {
         checkInterrupt();
 
-        git_buf buf = GIT_BUF_INIT;
-        Finally _disposeBuf{[&] { git_buf_dispose(&buf); }};
-        PackBuilder packBuilder;
-        PackBuilderContext packBuilderContext;
-        git_packbuilder_new(Setter(packBuilder), *this);
-        git_packbuilder_set_callbacks(packBuilder.get(), PACKBUILDER_PROGRESS_CHECK_INTERRUPT, &packBuilderContext);
-        git_packbuilder_set_threads(packBuilder.get(), 0 /* autodetect */);
-
-        packBuilderContext.handleException(
-            "preparing packfile", git_mempack_write_thin_pack(mempack_backend, packBuilder.get()));
-        checkInterrupt();
-        packBuilderContext.handleException("writing packfile", git_packbuilder_write_buf(&buf, packBuilder.get()));
-        checkInterrupt();
-
         std::string repo_path = std::string(git_repository_path(repo.get()));
         while (!repo_path.empty() && repo_path.back() == '/')
             repo_path.pop_back();
         std::string pack_dir_path = repo_path + "/objects/pack";
 
-        // TODO (performance): could the indexing be done in a separate thread?
-        //                     we'd need a more streaming variation of
-        //                     git_packbuilder_write_buf, or incur the cost of
-        //                     copying parts of the buffer to a separate thread.
-        //                     (synchronously on the git_packbuilder_write_buf thread)
         Indexer indexer;
-        git_indexer_progress stats;
         if (git_indexer_new(Setter(indexer), pack_dir_path.c_str(), 0, nullptr, nullptr))
             throw Error("creating git packfile indexer: %s", git_error_last()->message);
 
-        // TODO: provide index callback for checkInterrupt() termination
-        //       though this is about an order of magnitude faster than the packbuilder
-        //       expect up to 1 sec latency due to uninterruptible git_indexer_append.
-        constexpr size_t chunkSize = 128 * 1024;
-        for (size_t offset = 0; offset < buf.size; offset += chunkSize) {
-            if (git_indexer_append(indexer.get(), buf.ptr + offset, std::min(chunkSize, buf.size - offset), &stats))
-                throw Error("appending to git packfile index: %s", git_error_last()->message);
-            checkInterrupt();
-        }
+        PackBuilder packBuilder;
+        PackBuilderIndexerContext packBuilderContext;
+        packBuilderContext.indexer = indexer.get();
+        git_packbuilder_new(Setter(packBuilder), *this);
+        git_packbuilder_set_callbacks(
+            packBuilder.get(),
+            PACKBUILDER_PROGRESS_CHECK_INTERRUPT,
+            static_cast<PackBuilderContext *>(&packBuilderContext));
+        git_packbuilder_set_threads(packBuilder.get(), 0 /* autodetect */);
 
-        if (git_indexer_commit(indexer.get(), &stats))
+        packBuilderContext.handleException(
+            "preparing packfile", git_mempack_write_thin_pack(mempack_backend, packBuilder.get()));
+        checkInterrupt();
+
+        /* Stream the packfile into the indexer as it's being generated,
+           rather than building the entire packfile in memory first. */
+        packBuilderContext.handleException(
+            "writing packfile",
+            git_packbuilder_foreach(packBuilder.get(), packBuilderAppendToIndexer, &packBuilderContext));
+        checkInterrupt();
+
+        if (git_indexer_commit(indexer.get(), &packBuilderContext.stats))
             throw Error("committing git packfile index: %s", git_error_last()->message);
 
         if (git_mempack_reset(mempack_backend))
@@ -456,9 +478,38 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         if (pathExists(modulesFile.string()))
             info.submodules = parseSubmodules(modulesFile);
 
+        info.fileConfig = getFileConfig();
+
         return info;
     }
 
+    std::string getFileConfig()
+    {
+        GitConfig config;
+        if (git_repository_config_snapshot(Setter(config), repo.get()))
+            throw Error("getting config of Git repository %s: %s", path, git_error_last()->message);
+
+        /* Variable names are normalised to lower case. */
+        ConfigIterator it;
+        if (git_config_iterator_glob_new(
+                Setter(it), config.get(), "^(core\\.filemode|filter\\..*\\.(clean|smudge|process|required))$"))
+            throw Error("iterating over config of Git repository %s: %s", path, git_error_last()->message);
+
+        std::string res;
+
+        while (true) {
+            git_config_entry * entry = nullptr;
+            if (auto err = git_config_next(&entry, it.get())) {
+                if (err == GIT_ITEROVER)
+                    break;
+                throw Error("iterating over config of Git repository %s: %s", path, git_error_last()->message);
+            }
+            res += fmt("%s=%s\n", entry->name, entry->value);
+        }
+
+        return res;
+    }
+
     std::optional<std::string> getWorkdirRef() override
     {
         Reference ref;
@@ -509,7 +560,7 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
 
     ref<SourceAccessor> getAccessor(const WorkdirInfo & wd, bool exportIgnore, MakeNotAllowedError e) override;
 
-    ref<GitFileSystemObjectSink> getFileSystemObjectSink() override;
+    ref<GitFileSystemObjectSink> getFileSystemObjectSink(uint64_t maxPendingBytes) override;
 
     static int sidebandProgressCallback(const char * str, int len, void * payload)
     {
@@ -532,7 +583,7 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         return getInterrupted() ? -1 : 0;
     }
 
-    void fetch(const std::string & url, const std::string & refspec, bool shallow) override
+    void fetch(const std::string & url, const std::string & refspec, bool shallow, bool blobless) override
     {
         Activity act(*logger, lvlTalkative, actFetchTree, fmt("fetching Git repository '%s'", url));
 
@@ -544,7 +595,14 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         Strings gitArgs{"-C", dir.string(), "--git-dir", ".", "fetch", "--quiet", "--force"};
         if (shallow)
             append(gitArgs, {"--depth", "1"});
-        append(gitArgs, {std::string("--"), url, refspec});
+        if (blobless) {
+            /* Git only allows object filters when fetching from the
+               promisor remote of a partial clone. */
+            setRemote("origin", url);
+            enablePartialClone("origin");
+            append(gitArgs, {"--filter=blob:none", "--", "origin", refspec});
+        } else
+            append(gitArgs, {std::string("--"), url, refspec});
 
         auto [status, output] = runProgram(
             RunOptions{
@@ -562,6 +620,78 @@ struct GitRepoImpl : GitRepo, std::enable_shared_from_this<GitRepoImpl>
         }
     }
 
+    /**
+     * Turn this repository into a partial clone that lazily fetches
+     * blobs from `remote`.
+     */
+    void enablePartialClone(const std::string & remote)
+    {
+        GitConfig config;
+        if (git_repository_config(Setter(config), repo.get()))
+            throw Error("getting config of Git repository %s: %s", path, git_error_last()->message);
+
+        if (git_config_set_int32(config.get(), "core.repositoryformatversion", 1)
+            || git_config_set_string(config.get(), "extensions.partialclone", remote.c_str())
+            || git_config_set_bool(config.get(), fmt("remote.%s.promisor", remote).c_str(), 1)
+            || git_config_set_string(config.get(), fmt("remote.%s.partialclonefilter", remote).c_str(), "blob:none"))
+            throw Error("configuring Git repository %s as a partial clone: %s", path, git_error_last()->message);
+    }
+
+    bool isPartialClone()
+    {
+        GitConfig config;
+        if (git_repository_config(Setter(config), repo.get()))
+            throw Error("getting config of Git repository %s: %s", path, git_error_last()->message);
+
+        git_buf buf = GIT_BUF_INIT;
+        Finally _disposeBuf{[&] { git_buf_dispose(&buf); }};
+        return git_config_get_string_buf(&buf, config.get(), "extensions.partialclone") == 0;
+    }
+
+    /**
+     * Fetch missing objects of a partial clone from its promisor
+     * remote, in a single request.
+     */
+    void fetchMissingObjects(const std::vector<git_oid> & oids)
+    {
+        Activity act(
+            *logger, lvlTalkative, actUnknown, fmt("fetching %d missing objects into Git repository %s", oids.size(), path));
+
+        Strings gitArgs{
+            "-C",
+            path.string(),
+            "--git-dir",
+            ".",
+            "-c",
+            "fetch.negotiationAlgorithm=noop",
+            "fetch",
+            "--quiet",
+            "--no-tags",
+            "--no-write-fetch-head",
+            "--recurse-submodules=no",
+            "--filter=blob:none",
+            "origin"};
+        for (auto & oid : oids)
+            gitArgs.push_back(toHash(oid).gitRev());
+
+        auto [status, output] = runProgram(
+            RunOptions{
+                .program = "git",
+                .lookupPath = true,
+                .args = gitArgs,
+                .input = {},
+                .mergeStderrToStdout = true,
+                .isInteractive = true});
+
+        if (status > 0)
+            throw Error("Failed to fetch missing objects into Git repository %s: %s", path, output);
+
+        /* Make libgit2 pick up the new packfile. */
+        ObjectDb odb;
+        if (git_repository_odb(Setter(odb), repo.get()) || git_odb_refresh(odb.get()))
+            throw Error("refreshing Git object database: %s", git_error_last()->message);
+    }
+
     void verifyCommit(const Hash & rev, const std::vector<fetchers::PublicKey> & publicKeys) override
     {
         // Create ad-hoc allowedSignersFile and populate it with publicKeys
@@ -785,6 +915,22 @@ struct GitSourceAccessor : SourceAccessor
         return readBlob(path, true);
     }
 
+    std::optional<std::string> getContentFingerprint(const CanonPath & path) override
+    {
+        auto state(state_.lock());
+
+        /* Smudging depends on the attributes of the entire revision,
+           not just on the tree at `path`. */
+        if (state->lfsFetch)
+            return std::nullopt;
+
+        auto tree = lookupTree(*state, path);
+        if (!tree)
+            return std::nullopt;
+
+        return "git-tree:" + toHash(*git_tree_id(tree->get())).gitRev();
+    }
+
     /**
      * If `path` exists and is a submodule, return its
      * revision. Otherwise return nothing.
@@ -901,6 +1047,81 @@ struct GitSourceAccessor : SourceAccessor
         return tree;
     }
 
+    /**
+     * Append the IDs of the blobs under `dir` that are missing from
+     * `odb` and that pass `filter` to `missing`. If `recursive` is
+     * false, only the blobs directly in `dir` are considered.
+     */
+    void findMissingBlobs(
+        State & state,
+        git_odb * odb,
+        const CanonPath & dir,
+        git_tree * tree,
+        bool recursive,
+        PathFilter & filter,
+        std::vector<git_oid> & missing)
+    {
+        auto count = git_tree_entrycount(tree);
+        for (size_t n = 0; n < count; ++n) {
+            auto entry = git_tree_entry_byindex(tree, n);
+            auto path = dir / git_tree_entry_name(entry);
+            if (!filter(path.abs()))
+                continue;
+            auto type = git_tree_entry_type(entry);
+            if (type == GIT_OBJECT_BLOB) {
+                if (!git_odb_exists(odb, git_tree_entry_id(entry)))
+                    missing.push_back(*git_tree_entry_id(entry));
+            } else if (type == GIT_OBJECT_TREE && recursive) {
+                Tree subtree;
+                if (git_tree_entry_to_object((git_object **) (git_tree **) Setter(subtree), *state.repo, entry))
+                    throw Error("looking up directory '%s': %s", showPath(path), git_error_last()->message);
+                findMissingBlobs(state, odb, path, subtree.get(), recursive, filter, missing);
+            }
+        }
+    }
+
+    /**
+     * In a partial clone, fetch all missing blobs under `dir` that
+     * pass `filter` at once. Reading a single file fetches the rest of
+     * its directory (non-recursively), since those files are likely
+     * to be read as well; `dumpPath()` fetches the entire subtree
+     * before walking it.
+     */
+    void fetchMissingBlobs(
+        State & state, const CanonPath & dir, bool recursive, PathFilter & filter = defaultPathFilter)
+    {
+        auto tree = lookupTree(state, dir);
+        if (!tree)
+            return;
+
+        ObjectDb odb;
+        if (git_repository_odb(Setter(odb), *state.repo))
+            throw Error("getting Git object database: %s", git_error_last()->message);
+
+        std::vector<git_oid> missing;
+        findMissingBlobs(state, odb.get(), dir, tree->get(), recursive, filter, missing);
+
+        if (!missing.empty())
+            state.repo->fetchMissingObjects(missing);
+    }
+
+    /**
+     * In a partial clone, fetch the missing blobs under `path` that
+     * pass `filter` in a single request.
+     */
+    void prefetchMissingBlobs(const CanonPath & path, PathFilter & filter)
+    {
+        auto state(state_.lock());
+        if (state->repo->isPartialClone())
+            fetchMissingBlobs(*state, path, true, filter);
+    }
+
+    void dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter) override
+    {
+        prefetchMissingBlobs(path, filter);
+        SourceAccessor::dumpPath(path, sink, filter);
+    }
+
     Blob getBlob(State & state, const CanonPath & path, bool expectSymlink)
     {
         if (!expectSymlink && git_object_type(state.root.get()) == GIT_OBJECT_BLOB)
@@ -928,8 +1149,15 @@ struct GitSourceAccessor : SourceAccessor
         }
 
         Blob blob;
-        if (git_tree_entry_to_object((git_object **) (git_blob **) Setter(blob), *state.repo, entry))
-            throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
+        if (auto err = git_tree_entry_to_object((git_object **) (git_blob **) Setter(blob), *state.repo, entry)) {
+            if (err != GIT_ENOTFOUND || !state.repo->isPartialClone())
+                throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
+
+            fetchMissingBlobs(state, *path.parent(), false);
+
+            if (git_tree_entry_to_object((git_object **) (git_blob **) Setter(blob), *state.repo, entry))
+                throw Error("looking up file '%s': %s", showPath(path), git_error_last()->message);
+        }
 
         return blob;
     }
@@ -993,12 +1221,39 @@ struct GitExportIgnoreSourceAccessor : CachingFilteringSourceAccessor
     {
         return !isExportIgnored(path);
     }
+
+    void dumpPath(const CanonPath & path, Sink & sink, PathFilter & filter) override
+    {
+        if (auto gitAccessor = next.dynamic_pointer_cast<GitSourceAccessor>()) {
+            PathFilter filter2 = [&](const Path & p) { return isAllowed(CanonPath(p)) && filter(p); };
+            gitAccessor->prefetchMissingBlobs(prefix / path, filter2);
+        }
+        SourceAccessor::dumpPath(path, sink, filter);
+    }
 };
 
 struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
 {
     ref<GitRepoImpl> repo;
 
+    /**
+     * Once this many bytes of blobs have accumulated in the mempack
+     * backend, they're written to a packfile, so that importing a large
+     * tarball doesn't hold all of its contents in memory.
+     */
+    const uint64_t maxPendingBytes;
+
+    uint64_t pendingBytes = 0;
+
+    void addPendingBytes(uint64_t n)
+    {
+        pendingBytes += n;
+        if (pendingBytes >= maxPendingBytes) {
+            repo->flush();
+            pendingBytes = 0;
+        }
+    }
+
     struct PendingDir
     {
         std::string name;
@@ -1029,8 +1284,9 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
         pendingDirs.push_back({.name = std::move(name), .builder = TreeBuilder(b)});
     };
 
-    GitFileSystemObjectSinkImpl(ref<GitRepoImpl> repo)
+    GitFileSystemObjectSinkImpl(ref<GitRepoImpl> repo, uint64_t maxPendingBytes)
         : repo(repo)
+        , maxPendingBytes(maxPendingBytes)
     {
         pushBuilder("");
     }
@@ -1098,6 +1354,7 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
             GitFileSystemObjectSinkImpl & back;
             git_writestream * stream;
             bool executable = false;
+            uint64_t size = 0;
 
             CRF(const CanonPath & path, GitFileSystemObjectSinkImpl & back, git_writestream * stream)
                 : path(path)
@@ -1110,6 +1367,7 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
             {
                 if (stream->write(stream, data.data(), data.size()))
                     throw Error("writing a blob for tarball member '%s': %s", path, git_error_last()->message);
+                size += data.size();
             }
 
             void isExecutable() override
@@ -1125,6 +1383,8 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
             throw Error("creating a blob object for tarball member '%s': %s", path, git_error_last()->message);
 
         addToTree(*pathComponents.rbegin(), oid, crf.executable ? GIT_FILEMODE_BLOB_EXECUTABLE : GIT_FILEMODE_BLOB);
+
+        addPendingBytes(crf.size);
     }
 
     void createDirectory(const CanonPath & path) override
@@ -1207,6 +1467,7 @@ struct GitFileSystemObjectSinkImpl : GitFileSystemObjectSink
         auto [oid, _name] = popBuilder();
 
         repo->flush();
+        pendingBytes = 0;
 
         return toHash(oid);
     }
@@ -1230,6 +1491,53 @@ GitRepoImpl::getAccessor(const Hash & rev, bool exportIgnore, std::string displa
         return rawGitAccessor;
 }
 
+/**
+ * A wrapper around the accessor for a (possibly dirty) workdir that
+ * gives a content fingerprint to every directory that doesn't contain
+ * modified, added or deleted files. Such a directory has the same
+ * contents as the corresponding tree in `HEAD`, so `fetchToStore()`
+ * can reuse its previous copy even if other parts of the workdir
+ * changed.
+ */
+struct GitWorkdirSourceAccessor : FilteringSourceAccessor
+{
+    ref<GitSourceAccessor> headAccessor;
+    std::set<CanonPath> changedFiles;
+
+    GitWorkdirSourceAccessor(
+        ref<SourceAccessor> next, ref<GitSourceAccessor> headAccessor, const GitRepo::WorkdirInfo & wd)
+        : FilteringSourceAccessor(SourcePath(next), {})
+        , headAccessor(headAccessor)
+    {
+        changedFiles.insert(wd.dirtyFiles.begin(), wd.dirtyFiles.end());
+        changedFiles.insert(wd.deletedFiles.begin(), wd.deletedFiles.end());
+    }
+
+    bool isAllowed(const CanonPath & path) override
+    {
+        /* Access control is done by `next`. */
+        return true;
+    }
+
+    std::optional<std::string> getContentFingerprint(const CanonPath & path) override
+    {
+        /* Children sort directly after their parent, so this finds
+           any changed file underneath `path`. */
+        if (auto i = changedFiles.lower_bound(path); i != changedFiles.end() && i->isWithin(path))
+            return std::nullopt;
+
+        /* Use a different prefix than `GitSourceAccessor`, because
+           the checked out files may differ from the blobs in the
+           repo (e.g. due to smudge filters). */
+        if (auto fingerprint = headAccessor->getContentFingerprint(path)) {
+            assert(hasPrefix(*fingerprint, "git-tree:"));
+            return "git-workdir-tree:" + fingerprint->substr(9);
+        }
+
+        return std::nullopt;
+    }
+};
+
 ref<SourceAccessor>
 GitRepoImpl::getAccessor(const WorkdirInfo & wd, bool exportIgnore, MakeNotAllowedError makeNotAllowedError)
 {
@@ -1241,15 +1549,17 @@ GitRepoImpl::getAccessor(const WorkdirInfo & wd, bool exportIgnore, MakeNotAllow
                                            std::unordered_set<CanonPath>{CanonPath::root},
                                            std::move(makeNotAllowedError))
                                            .cast<SourceAccessor>();
+    if (wd.headRev)
+        fileAccessor = make_ref<GitWorkdirSourceAccessor>(fileAccessor, getRawAccessor(*wd.headRev), wd);
     if (exportIgnore)
         return make_ref<GitExportIgnoreSourceAccessor>(self, fileAccessor, std::nullopt);
     else
         return fileAccessor;
 }
 
-ref<GitFileSystemObjectSink> GitRepoImpl::getFileSystemObjectSink()
+ref<GitFileSystemObjectSink> GitRepoImpl::getFileSystemObjectSink(uint64_t maxPendingBytes)
 {
-    return make_ref<GitFileSystemObjectSinkImpl>(ref<GitRepoImpl>(shared_from_this()));
+    return make_ref<GitFileSystemObjectSinkImpl>(ref<GitRepoImpl>(shared_from_this()), maxPendingBytes);
 }
 
 std::vector<std::tuple<GitRepoImpl::Submodule, Hash>> GitRepoImpl::getSubmodules(const Hash & rev, bool exportIgnore)
@@ -41,10 +41,10 @@ bool isCacheFileWithinTtl(time_t now, const struct stat & st)
     return st.st_mtime + static_cast<time_t>(settings.tarballTtl) > now;
 }
 
-Path getCachePath(std::string_view key, bool shallow)
+Path getCachePath(std::string_view key, bool shallow, bool blobless = false)
 {
     return getCacheDir() + "/gitv3/" + hashString(HashAlgorithm::SHA256, key).to_string(HashFormat::Nix32, false)
-           + (shallow ? "-shallow" : "");
+           + (shallow ? "-shallow" : "") + (blobless ? "-blobless" : "");
 }
 
 // Returns the name of the HEAD branch.
@@ -83,9 +83,9 @@ std::optional<std::string> readHead(const Path & path)
 }
 
 // Persist the HEAD ref from the remote repo in the local cached repo.
-bool storeCachedHead(const std::string & actualUrl, bool shallow, const std::string & headRef)
+bool storeCachedHead(const std::string & actualUrl, bool shallow, bool blobless, const std::string & headRef)
 {
-    Path cacheDir = getCachePath(actualUrl, shallow);
+    Path cacheDir = getCachePath(actualUrl, shallow, blobless);
     try {
         runProgram("git", true, {"-C", cacheDir, "--git-dir", ".", "symbolic-ref", "--", "HEAD", headRef});
     } catch (ExecError & e) {
@@ -104,11 +104,11 @@ bool storeCachedHead(const std::string & actualUrl, bool shallow, const std::str
     return true;
 }
 
-std::optional<std::string> readHeadCached(const std::string & actualUrl, bool shallow)
+std::optional<std::string> readHeadCached(const std::string & actualUrl, bool shallow, bool blobless)
 {
     // Create a cache path to store the branch of the HEAD ref. Append something
     // in front of the URL to prevent collision with the repository itself.
-    Path cacheDir = getCachePath(actualUrl, shallow);
+    Path cacheDir = getCachePath(actualUrl, shallow, blobless);
     Path headRefFile = cacheDir + "/HEAD";
 
     time_t now = time(0);
@@ -179,8 +179,8 @@ struct GitInputScheme : InputScheme
             if (name == "rev" || name == "ref" || name == "keytype" || name == "publicKey" || name == "publicKeys")
                 attrs.emplace(name, value);
             else if (
-                name == "shallow" || name == "submodules" || name == "lfs" || name == "exportIgnore"
-                || name == "allRefs" || name == "verifyCommit")
+                name == "shallow" || name == "blobless" || name == "submodules" || name == "lfs"
+                || name == "exportIgnore" || name == "allRefs" || name == "verifyCommit")
                 attrs.emplace(name, Explicit<bool>{value == "1"});
             else
                 url2.query.emplace(name, value);
@@ -203,6 +203,7 @@ struct GitInputScheme : InputScheme
             "ref",
             "rev",
             "shallow",
+            "blobless",
             "submodules",
             "lfs",
             "exportIgnore",
@@ -239,6 +240,7 @@ struct GitInputScheme : InputScheme
         parseURL(url);
         input.attrs["url"] = url;
         getShallowAttr(input);
+        getBloblessAttr(input);
         getSubmodulesAttr(input);
         getAllRefsAttr(input);
         return input;
@@ -255,6 +257,8 @@ struct GitInputScheme : InputScheme
             url.query.insert_or_assign("ref", *ref);
         if (getShallowAttr(input))
             url.query.insert_or_assign("shallow", "1");
+        if (getBloblessAttr(input))
+            url.query.insert_or_assign("blobless", "1");
         if (getLfsAttr(input))
             url.query.insert_or_assign("lfs", "1");
         if (getSubmodulesAttr(input))
@@ -423,6 +427,11 @@ struct GitInputScheme : InputScheme
         return maybeGetBoolAttr(input.attrs, "shallow").value_or(false);
     }
 
+    bool getBloblessAttr(const Input & input) const
+    {
+        return maybeGetBoolAttr(input.attrs, "blobless").value_or(false);
+    }
+
     bool getSubmodulesAttr(const Input & input) const
     {
         return maybeGetBoolAttr(input.attrs, "submodules").value_or(false);
@@ -508,6 +517,45 @@ struct GitInputScheme : InputScheme
         return repoInfo;
     }
 
+    /**
+     * Return the hash of the NAR serialisation of a file in a dirty
+     * workdir. This is memoised on-disk by the file's inode, size and
+     * timestamps, and by the repository's `fileConfig` (see
+     * `GitRepo::WorkdirInfo`), so that fingerprinting a dirty workdir
+     * only needs to read the files that changed since the last time.
+     */
+    Hash getDirtyFileHash(
+        const Settings & settings, const std::filesystem::path & path, const std::string & fileConfig) const
+    {
+        auto st = lstat(path.string());
+
+        Cache::Key key{
+            "gitDirtyFile",
+            {{"path", path.string()},
+             {"ino", (uint64_t) st.st_ino},
+             {"size", (uint64_t) st.st_size},
+             {"mtime", (uint64_t) st.st_mtime},
+             {"ctime", (uint64_t) st.st_ctime},
+             {"config", fileConfig}}};
+
+        auto cache = settings.getCache();
+
+        if (auto res = cache->lookup(key))
+            return Hash::parseAny(getStrAttr(*res, "hash"), HashAlgorithm::SHA256);
+
+        HashSink hashSink{HashAlgorithm::SHA256};
+        dumpPath(path.string(), hashSink);
+        auto hash = hashSink.finish().first;
+
+        /* Like Git, don't trust the timestamps of files that were
+           modified so recently that a later modification could go
+           unnoticed. */
+        if (std::max(st.st_mtime, st.st_ctime) < time(nullptr) - 1)
+            cache->upsert(key, {{"hash", hash.to_string(HashFormat::SRI, true)}});
+
+        return hash;
+    }
+
     uint64_t getLastModified(
         const Settings & settings,
         const RepoInfo & repoInfo,
@@ -551,12 +599,12 @@ struct GitInputScheme : InputScheme
         return revCount;
     }
 
-    std::string getDefaultRef(const RepoInfo & repoInfo, bool shallow) const
+    std::string getDefaultRef(const RepoInfo & repoInfo, bool shallow, bool blobless) const
     {
         auto head = std::visit(
             overloaded{
                 [&](const std::filesystem::path & path) { return GitRepo::openRepo(path)->getWorkdirRef(); },
-                [&](const ParsedURL & url) { return readHeadCached(url.to_string(), shallow); }},
+                [&](const ParsedURL & url) { return readHeadCached(url.to_string(), shallow, blobless); }},
             repoInfo.location);
         if (!head) {
             warn("could not read HEAD ref from repo at '%s', using 'master'", repoInfo.locationToArg());
@@ -605,7 +653,8 @@ struct GitInputScheme : InputScheme
 
         auto originalRef = input.getRef();
         bool shallow = getShallowAttr(input);
-        auto ref = originalRef ? *originalRef : getDefaultRef(repoInfo, shallow);
+        bool blobless = getBloblessAttr(input);
+        auto ref = originalRef ? *originalRef : getDefaultRef(repoInfo, shallow, blobless);
         input.attrs.insert_or_assign("ref", ref);
 
         std::filesystem::path repoDir;
@@ -616,7 +665,7 @@ struct GitInputScheme : InputScheme
                 input.attrs.insert_or_assign("rev", GitRepo::openRepo(repoDir)->resolveRef(ref).gitRev());
         } else {
             auto repoUrl = std::get<ParsedURL>(repoInfo.location);
-            std::filesystem::path cacheDir = getCachePath(repoUrl.to_string(), shallow);
+            std::filesystem::path cacheDir = getCachePath(repoUrl.to_string(), shallow, blobless);
             repoDir = cacheDir;
             repoInfo.gitDir = ".";
 
@@ -657,7 +706,7 @@ struct GitInputScheme : InputScheme
                                     : ref == "HEAD"                   ? ref
                                                                       : fmt("%1%:%1%", "refs/heads/" + ref);
 
-                    repo->fetch(repoUrl.to_string(), fetchRef, shallow);
+                    repo->fetch(repoUrl.to_string(), fetchRef, shallow, blobless);
                 } catch (Error & e) {
                     if (!std::filesystem::exists(localRefFile))
                         throw;
@@ -673,7 +722,7 @@ struct GitInputScheme : InputScheme
                 } catch (Error & e) {
                     warn("could not update mtime for file %s: %s", localRefFile, e.info().msg);
                 }
-                if (!originalRef && !storeCachedHead(repoUrl.to_string(), shallow, ref))
+                if (!originalRef && !storeCachedHead(repoUrl.to_string(), shallow, blobless, ref))
                     warn("could not update cached head '%s' for '%s'", ref, repoInfo.locationToArg());
             }
 
@@ -747,6 +796,7 @@ struct GitInputScheme : InputScheme
                 attrs.insert_or_assign("exportIgnore", Explicit<bool>{exportIgnore});
                 attrs.insert_or_assign("submodules", Explicit<bool>{true});
                 attrs.insert_or_assign("lfs", Explicit<bool>{smudgeLfs});
+                attrs.insert_or_assign("blobless", Explicit<bool>{getBloblessAttr(input)});
                 attrs.insert_or_assign("allRefs", Explicit<bool>{true});
                 auto submoduleInput = fetchers::Input::fromAttrs(*input.settings, std::move(attrs));
                 auto [submoduleAccessor, submoduleInput2] = submoduleInput.getAccessor(store);
@@ -889,12 +939,19 @@ struct GitInputScheme : InputScheme
             if (auto repoPath = repoInfo.getPath();
                 repoPath && repoInfo.workdirInfo.headRev && repoInfo.workdirInfo.submodules.empty()) {
                 /* Calculate a fingerprint that takes into account the
-                   deleted and modified/added files. */
+                   deleted and modified/added files, and the settings
+                   that determine which files Git considers modified. */
                 HashSink hashSink{HashAlgorithm::SHA512};
+                auto & fileConfig = repoInfo.workdirInfo.fileConfig;
+                writeString("config:", hashSink);
+                writeString(fileConfig, hashSink);
                 for (auto & file : repoInfo.workdirInfo.dirtyFiles) {
                     writeString("modified:", hashSink);
                     writeString(file.abs(), hashSink);
-                    dumpPath((*repoPath / file.rel()).string(), hashSink);
+                    writeString(
+                        getDirtyFileHash(*input.settings, *repoPath / file.rel(), fileConfig)
+                            .to_string(HashFormat::Base16, false),
+                        hashSink);
                 }
                 for (auto & file : repoInfo.workdirInfo.deletedFiles) {
                     writeString("deleted:", hashSink);
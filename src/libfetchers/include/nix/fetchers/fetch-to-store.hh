@@ -24,6 +24,18 @@ StorePath fetchToStore(
     PathFilter * filter = nullptr,
     RepairFlag repair = NoRepair);
 
+/**
+ * Like `fetchToStore()`, but always uses NAR serialisation and also
+ * returns the NAR hash of the path. In `FetchMode::DryRun` mode the
+ * result is cached even though the path is not added to the store.
+ */
+std::pair<StorePath, Hash> fetchToStore2(
+    const fetchers::Settings & settings,
+    Store & store,
+    const SourcePath & path,
+    FetchMode mode,
+    std::string_view name = "source");
+
 fetchers::Cache::Key makeFetchToStoreCacheKey(
     const std::string & name, const std::string & fingerprint, ContentAddressMethod method, const std::string & path);
 
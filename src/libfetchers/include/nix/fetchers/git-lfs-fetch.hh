@@ -33,6 +33,9 @@ struct Fetch
     // derived from git remote url
     nix::ParsedURL url;
 
+    // whether all objects in `rev` have been downloaded
+    mutable bool prefetched = false;
+
     Fetch(git_repository * repo, git_oid rev);
     bool shouldFetch(const CanonPath & path) const;
     void fetch(
@@ -41,6 +44,20 @@ struct Fetch
         StringSink & sink,
         std::function<void(uint64_t)> sizeCallback) const;
     std::vector<nlohmann::json> fetchUrls(const std::vector<Pointer> & pointers) const;
+
+    /**
+     * Return the git-lfs pointers of all files in `rev`.
+     */
+    std::vector<Pointer> getPointers() const;
+
+    /**
+     * Download the specified objects that are not in the local object
+     * cache yet, using batch requests and concurrent transfers.
+     *
+     * @param prefetch If true, objects that cannot be downloaded are
+     * skipped rather than causing an error.
+     */
+    void download(const std::vector<Pointer> & pointers, bool prefetch = false) const;
 };
 
 } // namespace nix::lfs
@@ -69,6 +69,11 @@ struct GitRepo
 
         /* The submodules listed in .gitmodules of this workdir. */
         std::vector<Submodule> submodules;
+
+        /* The settings that affect how the files in the working
+           directory map to blobs, i.e. `core.fileMode` and the
+           clean/smudge filters, as `name=value` lines. */
+        std::string fileConfig;
     };
 
     virtual WorkdirInfo getWorkdirInfo() = 0;
@@ -94,11 +99,23 @@ struct GitRepo
     virtual ref<SourceAccessor>
     getAccessor(const WorkdirInfo & wd, bool exportIgnore, MakeNotAllowedError makeNotAllowedError) = 0;
 
-    virtual ref<GitFileSystemObjectSink> getFileSystemObjectSink() = 0;
+    /**
+     * Return a sink that imports a file system object into this
+     * repository. Once `maxPendingBytes` bytes of blobs have
+     * accumulated in memory, they're written to a packfile, so that
+     * importing a large tarball doesn't hold all of its contents in
+     * memory.
+     */
+    virtual ref<GitFileSystemObjectSink> getFileSystemObjectSink(uint64_t maxPendingBytes = 128 * 1024 * 1024) = 0;
 
     virtual void flush() = 0;
 
-    virtual void fetch(const std::string & url, const std::string & refspec, bool shallow) = 0;
+    /**
+     * Fetch `refspec` from `url`. If `blobless` is set, the repository
+     * is turned into a partial clone and blobs are not fetched until
+     * they're accessed.
+     */
+    virtual void fetch(const std::string & url, const std::string & refspec, bool shallow, bool blobless) = 0;
 
     /**
      * Verify that commit `rev` is signed by one of the keys in
@@ -15,6 +15,8 @@
 #include "nix/fetchers/fetch-to-store.hh"
 #include "nix/util/memory-source-accessor.hh"
 #include "nix/fetchers/input-cache.hh"
+#include "nix/util/thread-pool.hh"
+#include "nix/expr/dependency-tracker.hh"
 
 #include <nlohmann/json.hpp>
 
@@ -24,21 +26,6 @@ using namespace flake;
 
 namespace flake {
 
-static StorePath copyInputToStore(
-    EvalState & state, fetchers::Input & input, const fetchers::Input & originalInput, ref<SourceAccessor> accessor)
-{
-    auto storePath = fetchToStore(*input.settings, *state.store, accessor, FetchMode::Copy, input.getName());
-
-    state.allowPath(storePath);
-
-    auto narHash = state.store->queryPathInfo(storePath)->narHash;
-    input.attrs.insert_or_assign("narHash", narHash.to_string(HashFormat::SRI, true));
-
-    assert(!originalInput.getNarHash() || storePath == originalInput.computeStorePath(*state.store));
-
-    return storePath;
-}
-
 static void forceTrivialValue(EvalState & state, Value & value, const PosIdx pos)
 {
     if (value.isThunk() && value.isTrivial())
@@ -358,8 +345,8 @@ static Flake getFlake(
         lockedRef = FlakeRef(std::move(cachedInput2.lockedInput), newLockedRef.subdir);
     }
 
-    // Copy the tree to the store.
-    auto storePath = copyInputToStore(state, lockedRef.input, originalRef.input, cachedInput.accessor);
+    // Copy the tree to the store, or mount it lazily.
+    auto storePath = state.mountInput(lockedRef.input, originalRef.input, cachedInput.accessor);
 
     // Re-parse flake.nix from the store.
     return readFlake(state, originalRef, resolvedRef, lockedRef, state.storePath(storePath), lockRootAttrPath);
@@ -434,6 +421,62 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
 
         std::vector<FlakeRef> parents;
 
+        /* Fetch the inputs of a node that are likely to need fetching
+           concurrently, to populate the input cache before
+           computeLocks() visits them one at a time. This only warms
+           caches, so the resulting lock file is the same as without
+           it. Fetch errors are ignored here and reported by
+           computeLocks() instead. */
+        auto prefetchInputs = [&](const FlakeInputs & flakeInputs,
+                                  const InputAttrPath & inputAttrPathPrefix,
+                                  std::shared_ptr<const Node> oldNode) {
+            std::vector<std::pair<fetchers::Input, fetchers::UseRegistries>> toFetch;
+
+            for (auto & [id, input2] : flakeInputs) {
+                auto inputAttrPath(inputAttrPathPrefix);
+                inputAttrPath.push_back(id);
+
+                auto i = overrides.find(inputAttrPath);
+                auto & input = i != overrides.end() ? i->second.input : input2;
+
+                /* Only direct, non-relative inputs can be fetched
+                   without resolving them against a registry or a
+                   parent flake. */
+                if (input.follows || !input.ref || !input.ref->input.isDirect() || input.ref->input.isRelative())
+                    continue;
+
+                if (oldNode && !lockFlags.inputUpdates.count(inputAttrPath))
+                    if (auto oldLock = get(oldNode->inputs, id))
+                        if (auto oldLock2 = std::get_if<0>(&*oldLock))
+                            if ((*oldLock2)->originalRef.canonicalize() == input.ref->canonicalize())
+                                continue;
+
+                if (state.inputCache->lookup(input.ref->input))
+                    continue;
+
+                toFetch.emplace_back(
+                    input.ref->input,
+                    explicitCliOverrides.contains(inputAttrPath) ? fetchers::UseRegistries::All
+                                                                 : useRegistriesInputs);
+            }
+
+            if (toFetch.size() < 2 || settings.inputFetchJobs <= 1)
+                return;
+
+            ThreadPool pool{std::min<size_t>(toFetch.size(), settings.inputFetchJobs)};
+
+            for (auto & [input, useRegistries] : toFetch)
+                pool.enqueue([&]() {
+                    try {
+                        state.inputCache->getAccessor(state.store, input, useRegistries);
+                    } catch (Error & e) {
+                        debug("prefetching input '%s' failed: %s", input.to_string(), e.what());
+                    }
+                });
+
+            pool.process();
+        };
+
         std::function<void(
             const FlakeInputs & flakeInputs,
             ref<Node> node,
@@ -502,6 +545,8 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
                         follow);
             }
 
+            prefetchInputs(flakeInputs, inputAttrPathPrefix, oldNode);
+
             /* Go over the flake inputs, resolve/fetch them if
                necessary (i.e. if they're new or the flakeref changed
                from what's in the lock file). */
@@ -719,9 +764,8 @@ lockFlake(const Settings & settings, EvalState & state, const FlakeRef & topRef,
 
                                     auto lockedRef = FlakeRef(std::move(cachedInput.lockedInput), input.ref->subdir);
 
-                                    // FIXME: allow input to be lazy.
-                                    auto storePath = copyInputToStore(
-                                        state, lockedRef.input, input.ref->input, cachedInput.accessor);
+                                    auto storePath =
+                                        state.mountInput(lockedRef.input, input.ref->input, cachedInput.accessor);
 
                                     return {state.storePath(storePath), lockedRef};
                                 }
@@ -888,6 +932,37 @@ static Value * requireInternalFile(EvalState & state, CanonPath path)
     return v;
 }
 
+/**
+ * Make the attributes of `vSourceInfo` that change whenever anything
+ * in the source tree changes record a dependency on the entire tree
+ * when they're forced. This allows the evaluation cache to reuse
+ * attributes that don't depend on them.
+ */
+static void trackSourceInfo(EvalState & state, const StorePath & storePath, Value & vSourceInfo)
+{
+    auto vTrackSourceTree = get(state.internalPrimOps, "trackSourceTree");
+    assert(vTrackSourceTree);
+
+    auto vPath = state.allocValue();
+    vPath->mkString(state.store->printStorePath(storePath));
+
+    auto vTrack = state.allocValue();
+    vTrack->mkApp(*vTrackSourceTree, vPath);
+
+    auto attrs = state.buildBindings(vSourceInfo.attrs()->size());
+    for (auto & attr : *vSourceInfo.attrs()) {
+        auto name = state.symbols[attr.name];
+        if (name == "narHash" || name == "lastModified" || name == "lastModifiedDate" || name == "rev"
+            || name == "shortRev" || name == "revCount" || name == "dirtyRev" || name == "dirtyShortRev") {
+            auto v = state.allocValue();
+            v->mkApp(vTrack, attr.value);
+            attrs.insert(attr.name, v, attr.pos);
+        } else
+            attrs.insert(attr);
+    }
+    vSourceInfo.mkAttrs(attrs);
+}
+
 void callFlake(EvalState & state, const LockedFlake & lockedFlake, Value & vRes)
 {
     experimentalFeatureSettings.require(Xp::Flakes);
@@ -913,6 +988,9 @@ void callFlake(EvalState & state, const LockedFlake & lockedFlake, Value & vRes)
             false,
             !lockedNode && lockedFlake.flake.forceDirty);
 
+        if (!lockedNode && state.dependencyTracker->isEnabled())
+            trackSourceInfo(state, storePath, vSourceInfo);
+
         auto key = keyMap.find(node);
         assert(key != keyMap.end());
 
@@ -962,6 +1040,35 @@ std::optional<Fingerprint> LockedFlake::getFingerprint(ref<Store> store, const f
     return hashString(HashAlgorithm::SHA256, *fingerprint);
 }
 
+std::optional<Fingerprint>
+LockedFlake::getStableFingerprint(const fetchers::Settings & fetchSettings) const
+{
+    if (lockFile.isUnlocked(fetchSettings))
+        return std::nullopt;
+
+    /* Leave out the attributes that change whenever the contents
+       of the flake change. The evaluation cache instead records
+       the parts of the source tree that each attribute depends on,
+       and `callFlake()` makes the corresponding `sourceInfo`
+       attributes record a dependency on the entire tree. */
+    auto attrs = flake.lockedRef.input.attrs;
+    for (auto & [name, _] : getUnstableAttrs())
+        attrs.erase(name);
+
+    return hashString(
+        HashAlgorithm::SHA256,
+        fmt("%s;%s;%s", fetchers::attrsToJSON(attrs).dump(), flake.lockedRef.subdir, lockFile));
+}
+
+fetchers::Attrs LockedFlake::getUnstableAttrs() const
+{
+    fetchers::Attrs res;
+    for (auto & name : {"narHash", "lastModified", "ref", "rev", "revCount", "dirtyRev", "dirtyShortRev"})
+        if (auto i = flake.lockedRef.input.attrs.find(name); i != flake.lockedRef.input.attrs.end())
+            res.insert(*i);
+    return res;
+}
+
 Flake::~Flake() {}
 
 } // namespace nix
@@ -135,6 +135,20 @@ struct LockedFlake
     std::map<ref<Node>, SourcePath> nodePaths;
 
     std::optional<Fingerprint> getFingerprint(ref<Store> store, const fetchers::Settings & fetchSettings) const;
+
+    /**
+     * Like `getFingerprint()`, but doesn't change when the contents
+     * of the top-level flake change. This is used as the key of an
+     * evaluation cache that records which files each cached
+     * attribute depends on.
+     */
+    std::optional<Fingerprint> getStableFingerprint(const fetchers::Settings & fetchSettings) const;
+
+    /**
+     * The attributes of the top-level flake's input that
+     * `getStableFingerprint()` leaves out, such as its revision.
+     */
+    fetchers::Attrs getUnstableAttrs() const;
 };
 
 struct LockFlags
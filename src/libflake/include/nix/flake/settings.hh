@@ -48,6 +48,19 @@ struct Settings : public Config
         {"commit-lockfile-summary"},
         true,
         Xp::Flakes};
+
+    Setting<unsigned int> inputFetchJobs{
+        this,
+        8,
+        "flake-input-fetch-jobs",
+        R"(
+          The maximum number of flake inputs that are fetched concurrently while
+          computing a lock file. Concurrent fetching does not affect the resulting
+          lock file. Set to `1` to fetch inputs one at a time.
+        )",
+        {},
+        true,
+        Xp::Flakes};
 };
 
 } // namespace nix::flake
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/drv-hash-disk-cache.hh"
+#include "nix/store/tests/libstore.hh"
+
+namespace nix {
+
+class DrvHashDiskCacheTest : public LibStoreTest
+{};
+
+TEST_F(DrvHashDiskCacheTest, create_and_read)
+{
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto cache = getTestDrvHashDiskCache(tmpDir + "/test-drv-hashes.sqlite");
+
+    auto dep = store->parseStorePath("/nix/store/c015dhfh5l0lp6wxyvdn7bmwhbbr6hr9-dep.drv");
+    DrvHash depHash{
+        .hashes = {{"out", hashString(HashAlgorithm::SHA256, "dep")}},
+        .kind = DrvHash::Kind::Deferred,
+    };
+
+    ASSERT_TRUE(cache->lookup(*store, {dep}).empty());
+
+    cache->upsert(*store, dep, depHash);
+
+    auto found = cache->lookup(*store, {dep});
+    ASSERT_EQ(found.size(), 1);
+    ASSERT_EQ(found.at(dep).hashes, depHash.hashes);
+    ASSERT_EQ(found.at(dep).kind, depHash.kind);
+
+    // A fresh connection to the same database sees the entry.
+    ASSERT_EQ(
+        getTestDrvHashDiskCache(tmpDir + "/test-drv-hashes.sqlite")->lookup(*store, {dep}).at(dep).hashes,
+        depHash.hashes);
+}
+
+TEST_F(DrvHashDiskCacheTest, hashDerivationModulo)
+{
+    Path tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir);
+    auto cache = getTestDrvHashDiskCache(tmpDir + "/test-drv-hashes.sqlite");
+
+    auto dep = store->parseStorePath("/nix/store/c015dhfh5l0lp6wxyvdn7bmwhbbr6hr9-dep.drv");
+    cache->upsert(
+        *store,
+        dep,
+        DrvHash{
+            .hashes = {{"out", hashString(HashAlgorithm::SHA256, "dep")}},
+            .kind = DrvHash::Kind::Regular,
+        });
+
+    Derivation drv;
+    drv.name = "drv-hash-disk-cache";
+    drv.inputDrvs = {.map = {{dep, {.value = {"out"}}}}};
+    drv.outputs = {{"out", DerivationOutput{DerivationOutput::Deferred{}}}};
+    drv.platform = "wasm-sel4";
+    drv.builder = "foo";
+
+    drvHashes.erase(dep);
+
+    // The dummy store can't provide the input derivation, so hashing
+    // only succeeds if its hash comes from the cache.
+    ASSERT_THROW(hashDerivationModulo(*store, drv, true), Error);
+
+    loadDrvHashes(*cache, *store, {dep});
+    auto h = hashDerivationModulo(*store, drv, true);
+    ASSERT_EQ(hashDerivationModulo(*store, drv, true).hashes, h.hashes);
+
+    // Changing the input derivation changes its path, which misses.
+    auto dep2 = store->parseStorePath("/nix/store/g1w7hy3qg1w7hy3qg1w7hy3qg1w7hy3q-dep.drv");
+    drv.inputDrvs = {.map = {{dep2, {.value = {"out"}}}}};
+
+    loadDrvHashes(*cache, *store, {dep2});
+    ASSERT_FALSE(drvHashes.contains(dep2));
+    ASSERT_THROW(hashDerivationModulo(*store, drv, true), Error);
+
+    drvHashes.erase(dep);
+}
+
+} // namespace nix
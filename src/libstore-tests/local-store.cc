@@ -1,18 +1,22 @@
+#include <gtest/gtest.h>
+
+#include "nix/store/local-store.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/file-system.hh"
+
 // FIXME: Odd failures for templates that are causing the PR to break
 // for now with discussion with @Ericson2314 to comment out.
 #if 0
-#  include <gtest/gtest.h>
-
-#  include "nix/store/local-store.hh"
-
 // Needed for template specialisations. This is not good! When we
 // overhaul how store configs work, this should be fixed.
 #  include "nix/util/args.hh"
 #  include "nix/util/config-impl.hh"
 #  include "nix/util/abstract-setting-to-json.hh"
+#endif
 
 namespace nix {
 
+#if 0
 TEST(LocalStore, constructConfig_rootQueryParam)
 {
     LocalStoreConfig config{
@@ -35,6 +39,39 @@ TEST(LocalStore, constructConfig_rootPath)
 
     EXPECT_EQ(config.rootDir.get(), std::optional{"/foo/bar"});
 }
+#endif
 
-} // namespace nix
+#ifndef _WIN32
+TEST(LocalStore, queryBuildStatsByName)
+{
+    auto tmpDir = createTempDir();
+    AutoDelete delTmpDir(tmpDir, true);
+
+    auto store = openStore(fmt("local?root=%s", tmpDir)).dynamic_pointer_cast<LocalStore>();
+    ASSERT_TRUE(store);
+
+    auto addBuildStats = [&](std::string_view name, uint64_t memoryPeak) {
+        BuildStats stats;
+        stats.memoryPeak = memoryPeak;
+        store->addBuildStats(StorePath::random(name), stats);
+    };
+
+    addBuildStats("hello-2.12.drv", 1);
+    addBuildStats("hello-2.13.drv", 2);
+    addBuildStats("hello-world-1.0.drv", 3);
+
+    auto memoryPeaks = [&](std::string_view name) {
+        std::vector<uint64_t> res;
+        for (auto & stats : store->queryBuildStatsByName(name))
+            res.push_back(stats.memoryPeak.value_or(0));
+        return res;
+    };
+
+    /* Other packages with a common prefix don't match. */
+    EXPECT_EQ(memoryPeaks("hello"), (std::vector<uint64_t>{2, 1}));
+    EXPECT_EQ(memoryPeaks("hello-world"), (std::vector<uint64_t>{3}));
+    EXPECT_EQ(memoryPeaks("hell"), (std::vector<uint64_t>{}));
+}
 #endif
+
+} // namespace nix
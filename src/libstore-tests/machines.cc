@@ -1,8 +1,12 @@
 #include "nix/store/machines.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/store-open.hh"
 #include "nix/util/file-system.hh"
+#include "nix/util/finally.hh"
 #include "nix/util/util.hh"
 
 #include "nix/util/tests/characterization.hh"
+#include "nix/store/tests/libstore.hh"
 
 #include <gtest/gtest.h>
 #include <gmock/gmock-matchers.h>
@@ -203,3 +207,62 @@ TEST(machines, getMachinesWithCorrectFileReferenceToIncorrectFile)
             {}, "@" + std::filesystem::weakly_canonical(getUnitTestData() / "machines" / "bad_format").string()),
         FormatError);
 }
+
+class MissingSizeTest : public LibStoreTest
+{
+protected:
+    std::filesystem::path tmpDir = createTempDir();
+    AutoDelete delTmpDir{tmpDir, true};
+
+    ref<Store> openCache(std::string_view name)
+    {
+        return openStore(fmt("file://%s/%s", tmpDir.string(), name));
+    }
+
+    static StorePath addText(Store & store, std::string_view name, std::string_view text)
+    {
+        StringSource source(text);
+        return store.addToStoreFromDump(
+            source, name, FileSerialisationMethod::Flat, ContentAddressMethod::Raw::Text, HashAlgorithm::SHA256);
+    }
+};
+
+TEST_F(MissingSizeTest, countsOnlyMissingPaths)
+{
+    auto src = openCache("src");
+    auto dst = openCache("dst");
+
+    auto a = addText(*src, "a", "aaaa");
+    auto b = addText(*src, "b", std::string(1000, 'b'));
+    ASSERT_EQ(addText(*dst, "a", "aaaa"), a);
+
+    StorePathSet knownValid;
+    EXPECT_EQ(getMissingSize(*src, *dst, {a, b}, knownValid), src->queryPathInfo(b)->narSize);
+    EXPECT_EQ(knownValid, StorePathSet{a});
+}
+
+TEST_F(MissingSizeTest, doesNotQueryKnownValidPaths)
+{
+    auto src = openCache("src");
+    auto dst = openCache("dst");
+
+    auto a = addText(*src, "a", "aaaa");
+
+    /* `a` isn't actually valid in `dst`, but we claim it is. */
+    StorePathSet knownValid{a};
+    EXPECT_EQ(getMissingSize(*src, *dst, {a}, knownValid), 0);
+}
+
+TEST(machines, getEffectiveLoad)
+{
+    auto oldCost = settings.buildersTransferCost.get();
+    Finally restoreCost([&]() { settings.buildersTransferCost = oldCost; });
+
+    settings.buildersTransferCost = 0;
+    EXPECT_EQ(getEffectiveLoad(3, 1 << 30), 3);
+
+    settings.buildersTransferCost = 1 << 20;
+    EXPECT_EQ(getEffectiveLoad(3, 0), 3);
+    EXPECT_EQ(getEffectiveLoad(3, 2 << 20), 5);
+    EXPECT_EQ(getEffectiveLoad(0, 1 << 19), 0.5);
+}
@@ -5,4 +5,21 @@ namespace nix {
 bool BuildResult::operator==(const BuildResult &) const noexcept = default;
 std::strong_ordering BuildResult::operator<=>(const BuildResult &) const noexcept = default;
 
+BuildStats BuildStats::fromBuildResult(const BuildResult & res)
+{
+    return {
+        .status = res.status,
+        .startTime = res.startTime,
+        .stopTime = res.stopTime,
+        .cpuUser = res.cpuUser,
+        .cpuSystem = res.cpuSystem,
+        .memoryPeak = res.memoryPeak,
+        .ioRead = res.ioRead,
+        .ioWrite = res.ioWrite,
+    };
+}
+
+bool BuildStats::operator==(const BuildStats &) const noexcept = default;
+std::strong_ordering BuildStats::operator<=>(const BuildStats &) const noexcept = default;
+
 } // namespace nix
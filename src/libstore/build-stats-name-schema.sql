@@ -0,0 +1,7 @@
+-- The package name of the derivation (as determined by `DrvName`), so
+-- that the history of other versions of a derivation can be looked up
+-- through an index. Rows recorded before this migration have no name.
+
+alter table BuildStats add column drvName text;
+
+create index if not exists IndexBuildStatsName on BuildStats(drvName, id);
@@ -0,0 +1,18 @@
+-- Resource usage of local builds, recorded after each build so that
+-- the scheduler and `nix derivation stats` can look at the history
+-- of a derivation.
+
+create table if not exists BuildStats (
+    id integer primary key autoincrement not null,
+    drvPath text not null,
+    status integer not null,
+    startTime integer not null,
+    stopTime integer not null,
+    cpuUser integer, -- microseconds
+    cpuSystem integer, -- microseconds
+    memoryPeak integer, -- bytes
+    ioRead integer, -- bytes
+    ioWrite integer -- bytes
+);
+
+create index if not exists IndexBuildStats on BuildStats(drvPath, id);
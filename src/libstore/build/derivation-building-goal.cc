@@ -2,6 +2,7 @@
 #include "nix/store/build/derivation-trampoline-goal.hh"
 #ifndef _WIN32 // TODO enable build hook on Windows
 #  include "nix/store/build/hook-instance.hh"
+#  include "nix/store/build/remote-dispatcher.hh"
 #  include "nix/store/build/derivation-builder.hh"
 #endif
 #include "nix/util/processes.hh"
@@ -9,6 +10,7 @@
 #include "nix/store/build/worker.hh"
 #include "nix/util/util.hh"
 #include "nix/util/compression.hh"
+#include "nix/store/indexed-log.hh"
 #include "nix/store/common-protocol.hh"
 #include "nix/store/common-protocol-impl.hh"
 #include "nix/store/local-store.hh" // TODO remove, along with remaining downcasts
@@ -94,6 +96,10 @@ void DerivationBuildingGoal::killChild()
 {
 #ifndef _WIN32 // TODO enable build hook on Windows
     hook.reset();
+    /* This doesn't wait for the remote build; the thread carries on
+       in the background (until the worker is destroyed) but won't
+       copy back any outputs. */
+    remoteBuild.reset();
 #endif
 #ifndef _WIN32 // TODO enable `DerivationBuilder` on Windows
     if (builder && builder->pid != -1) {
@@ -444,7 +450,7 @@ void DerivationBuildingGoal::started()
             worker.store.printStorePath(drvPath));
     fmt("building '%s'", worker.store.printStorePath(drvPath));
 #ifndef _WIN32 // TODO enable build hook on Windows
-    if (hook)
+    if (hook || remoteBuild)
         msg += fmt(" on '%s'", machineName);
 #endif
     act = std::make_unique<Activity>(
@@ -455,7 +461,7 @@ void DerivationBuildingGoal::started()
         Logger::Fields{
             worker.store.printStorePath(drvPath),
 #ifndef _WIN32 // TODO enable build hook on Windows
-            hook ? machineName :
+            hook || remoteBuild ? machineName :
 #endif
                  "",
             1,
@@ -586,8 +592,7 @@ Goal::Co DerivationBuildingGoal::tryToBuild()
 
         assert(!hook);
 
-        unsigned int curBuilds = worker.getNrLocalBuilds();
-        if (curBuilds >= settings.maxBuildJobs) {
+        if (!worker.canStartLocalBuild(drvPath)) {
             outputLocks.unlock();
             co_await waitForBuildSlot();
             co_return tryToBuild();
@@ -808,7 +813,7 @@ void DerivationBuildingGoal::appendLogTailErrorMsg(std::string & msg)
 Goal::Co DerivationBuildingGoal::hookDone()
 {
 #ifndef _WIN32
-    assert(hook);
+    assert(hook || remoteBuild);
 #endif
 
     trace("hook build done");
@@ -819,11 +824,23 @@ Goal::Co DerivationBuildingGoal::hookDone()
        kill it. */
     int status =
 #ifndef _WIN32 // TODO enable build hook on Windows
-        hook->pid.kill();
+        hook ? hook->pid.kill() : 0;
 #else
         0;
 #endif
 
+    std::optional<std::string> remoteError;
+#ifndef _WIN32 // TODO enable build hook on Windows
+    if (remoteBuild) {
+        try {
+            remoteBuild->wait();
+        } catch (Error & e) {
+            remoteError = e.msg();
+        }
+        remoteBuild.reset();
+    }
+#endif
+
     debug("build hook for '%s' finished", worker.store.printStorePath(drvPath));
 
     buildResult.timesBuilt++;
@@ -834,20 +851,22 @@ Goal::Co DerivationBuildingGoal::hookDone()
 
     /* Close the read side of the logger pipe. */
 #ifndef _WIN32 // TODO enable build hook on Windows
-    hook->builderOut.readSide.close();
-    hook->fromHook.readSide.close();
+    if (hook) {
+        hook->builderOut.readSide.close();
+        hook->fromHook.readSide.close();
+    }
 #endif
 
     /* Close the log file. */
     closeLogFile();
 
     /* Check the exit status. */
-    if (!statusOk(status)) {
+    if (!statusOk(status) || remoteError) {
         auto msg =
             fmt("Cannot build '%s'.\n"
-                "Reason: " ANSI_RED "builder %s" ANSI_NORMAL ".",
+                "Reason: " ANSI_RED "%s" ANSI_NORMAL ".",
                 Magenta(worker.store.printStorePath(drvPath)),
-                statusToString(status));
+                remoteError ? *remoteError : "builder " + statusToString(status));
 
         msg += showKnownOutputs(worker.store, *drv);
 
@@ -892,6 +911,9 @@ HookReply DerivationBuildingGoal::tryBuildHook()
 #ifdef _WIN32 // TODO enable build hook on Windows
     return rpDecline;
 #else
+    if (settings.buildersInProcess)
+        return tryRemoteDispatcher();
+
     /* This should use `worker.evalStore`, but per #13179 the build hook
        doesn't work with eval store anyways. */
     if (settings.buildHook.get().empty() || !worker.tryBuildHook || !worker.store.isValidPath(drvPath))
@@ -995,6 +1017,60 @@ HookReply DerivationBuildingGoal::tryBuildHook()
 #endif
 }
 
+HookReply DerivationBuildingGoal::tryRemoteDispatcher()
+{
+#ifdef _WIN32 // TODO enable build hook on Windows
+    return rpDecline;
+#else
+    if (!worker.tryBuildHook || !worker.store.isValidPath(drvPath))
+        return rpDecline;
+
+    auto & dispatcher = RemoteDispatcher::get();
+
+    if (!worker.remoteThreads)
+        worker.remoteThreads = std::make_unique<RemoteThreads>();
+
+    auto [reply, slot] = dispatcher.reserve(
+        *worker.remoteThreads,
+        worker.store,
+        drvPath,
+        drv->platform,
+        drvOptions->getRequiredSystemFeatures(*drv),
+        inputPaths,
+        worker.getNrLocalBuilds() < settings.maxBuildJobs);
+
+    switch (reply) {
+    case RemoteDispatcher::Reply::DeclinePermanently:
+        worker.tryBuildHook = false;
+        return rpDecline;
+    case RemoteDispatcher::Reply::Decline:
+        return rpDecline;
+    case RemoteDispatcher::Reply::Postpone:
+        return rpPostpone;
+    case RemoteDispatcher::Reply::Accept:
+        break;
+    }
+
+    machineName = slot->getMachineName();
+
+    StringSet missingOutputs;
+    for (auto & [outputName, status] : initialOutputs) {
+        if (buildMode != bmCheck && status.known && status.known->isValid())
+            continue;
+        missingOutputs.insert(outputName);
+    }
+
+    remoteBuild =
+        dispatcher.build(*worker.remoteThreads, std::move(slot), worker.store, drvPath, inputPaths, missingOutputs);
+
+    /* We don't get any log output through this pipe; we only use it
+       to find out when the build has finished. */
+    worker.childStarted(shared_from_this(), {remoteBuild->done.readSide.get()}, false, false);
+
+    return rpAccept;
+#endif
+}
+
 Path DerivationBuildingGoal::openLogFile()
 {
     logSize = 0;
@@ -1013,6 +1089,12 @@ Path DerivationBuildingGoal::openLogFile()
     Path dir = fmt("%s/%s/%s/", logDir, LocalFSStore::drvsLogDir, baseName.substr(0, 2));
     createDirs(dir);
 
+    if (settings.indexedLog) {
+        Path logFileName = fmt("%s/%s.zst", dir, baseName.substr(2));
+        logSink = std::make_shared<IndexedLogSink>(logFileName);
+        return logFileName;
+    }
+
     Path logFileName = fmt("%s/%s%s", dir, baseName.substr(2), settings.compressLog ? ".bz2" : "");
 
     fdLogFile = toDescriptor(open(
@@ -1038,12 +1120,13 @@ Path DerivationBuildingGoal::openLogFile()
 
 void DerivationBuildingGoal::closeLogFile()
 {
-    auto logSink2 = std::dynamic_pointer_cast<CompressionSink>(logSink);
+    auto logSink2 = std::dynamic_pointer_cast<FinishSink>(logSink);
     if (logSink2)
         logSink2->finish();
     if (logFileSink)
         logFileSink->flush();
-    logSink = logFileSink = 0;
+    logSink = 0;
+    logFileSink = 0;
     fdLogFile.close();
 }
 
@@ -1056,6 +1139,19 @@ bool DerivationBuildingGoal::isReadDesc(Descriptor fd)
 #endif
 }
 
+std::optional<std::chrono::steady_clock::time_point> DerivationBuildingGoal::logFlushDeadline()
+{
+    if (auto indexedLogSink = std::dynamic_pointer_cast<IndexedLogSink>(logSink))
+        return indexedLogSink->flushDeadline();
+    return std::nullopt;
+}
+
+void DerivationBuildingGoal::flushLog()
+{
+    if (auto indexedLogSink = std::dynamic_pointer_cast<IndexedLogSink>(logSink))
+        indexedLogSink->flushPending();
+}
+
 void DerivationBuildingGoal::handleChildOutput(Descriptor fd, std::string_view data)
 {
     // local & `ssh://`-builds are dealt with here.
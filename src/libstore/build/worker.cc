@@ -1,5 +1,7 @@
 #include "nix/store/local-store.hh"
 #include "nix/store/machines.hh"
+#include "nix/store/build-result.hh"
+#include "nix/store/names.hh"
 #include "nix/store/build/worker.hh"
 #include "nix/store/build/substitution-goal.hh"
 #include "nix/store/build/drv-output-substitution-goal.hh"
@@ -8,6 +10,7 @@
 #include "nix/store/build/derivation-trampoline-goal.hh"
 #ifndef _WIN32 // TODO Enable building on Windows
 #  include "nix/store/build/hook-instance.hh"
+#  include "nix/store/build/remote-dispatcher.hh"
 #endif
 #include "nix/util/signals.hh"
 
@@ -210,7 +213,6 @@ void Worker::childStarted(
     child.timeStarted = child.lastOutput = steady_time_point::clock::now();
     child.inBuildSlot = inBuildSlot;
     child.respectTimeouts = respectTimeouts;
-    children.emplace_back(child);
     if (inBuildSlot) {
         switch (goal->jobCategory()) {
         case JobCategory::Substitution:
@@ -218,6 +220,9 @@ void Worker::childStarted(
             break;
         case JobCategory::Build:
             nrLocalBuilds++;
+            if (auto buildingGoal = dynamic_cast<DerivationBuildingGoal *>(goal.get()))
+                child.memoryReserved = predictMemoryUsage(buildingGoal->drvPath);
+            memoryReserved += child.memoryReserved;
             break;
         case JobCategory::Administration:
             /* Intentionally not limited, see docs */
@@ -226,6 +231,7 @@ void Worker::childStarted(
             unreachable();
         }
     }
+    children.emplace_back(child);
 }
 
 void Worker::childTerminated(Goal * goal, bool wakeSleepers)
@@ -243,6 +249,8 @@ void Worker::childTerminated(Goal * goal, bool wakeSleepers)
         case JobCategory::Build:
             assert(nrLocalBuilds > 0);
             nrLocalBuilds--;
+            assert(memoryReserved >= i->memoryReserved);
+            memoryReserved -= i->memoryReserved;
             break;
         case JobCategory::Administration:
             /* Intentionally not limited, see docs */
@@ -267,11 +275,107 @@ void Worker::childTerminated(Goal * goal, bool wakeSleepers)
     }
 }
 
+#ifdef __linux__
+/**
+ * Return the percentage of time in which some tasks were stalled on
+ * memory over the last 10 seconds, if the kernel supports pressure
+ * stall information.
+ */
+static std::optional<double> getMemoryPressure()
+{
+    try {
+        /* The first line looks like `some avg10=1.23 avg60=0.50 avg300=0.10 total=12345`. */
+        auto lines = tokenizeString<std::vector<std::string>>(readFile("/proc/pressure/memory"), "\n");
+        if (lines.empty())
+            return std::nullopt;
+        std::string_view prefix = "avg10=";
+        for (auto & field : tokenizeString<std::vector<std::string>>(lines[0], " "))
+            if (hasPrefix(field, prefix))
+                return string2Float<double>(std::string_view(field).substr(prefix.size()));
+    } catch (SysError &) {
+    }
+    return std::nullopt;
+}
+#endif
+
+uint64_t Worker::predictMemoryUsage(const StorePath & drvPath)
+{
+    if (!settings.buildMemoryBudget)
+        return 0;
+
+    auto i = memoryPredictions.find(drvPath);
+    if (i != memoryPredictions.end())
+        return i->second;
+
+    uint64_t res = 0;
+
+    if (auto localStore = dynamic_cast<LocalStore *>(&store)) {
+        try {
+            auto stats = localStore->queryBuildStats(drvPath);
+
+            /* Fall back to the history of other versions of this
+               package, since changing any input yields a new
+               derivation. */
+            if (stats.empty()) {
+                DrvName drvName(drvPath.name().substr(0, drvPath.name().size() - drvExtension.size()));
+                if (!drvName.version.empty())
+                    stats = localStore->queryBuildStatsByName(drvName.name);
+            }
+
+            for (auto & s : stats)
+                if (s.memoryPeak)
+                    res = std::max(res, *s.memoryPeak);
+        } catch (Error & e) {
+            debug("cannot query build statistics of '%s': %s", store.printStorePath(drvPath), e.msg());
+        }
+    }
+
+    memoryPredictions.insert_or_assign(drvPath, res);
+    return res;
+}
+
+bool Worker::canStartLocalBuild(const StorePath & drvPath)
+{
+    if (getNrLocalBuilds() >= settings.maxBuildJobs)
+        return false;
+
+    /* Always allow one build, otherwise a build that exceeds the
+       budget by itself would never start. */
+    if (getNrLocalBuilds() == 0)
+        return true;
+
+    if (settings.buildMemoryBudget) {
+        auto predicted = predictMemoryUsage(drvPath);
+        if (memoryReserved + predicted > settings.buildMemoryBudget) {
+            debug(
+                "delaying build of '%s': it is predicted to use %s, and running builds %s",
+                store.printStorePath(drvPath),
+                showBytes(predicted),
+                showBytes(memoryReserved));
+            return false;
+        }
+    }
+
+#ifdef __linux__
+    if (settings.maxMemoryPressure) {
+        auto pressure = getMemoryPressure();
+        if (pressure && *pressure >= settings.maxMemoryPressure) {
+            debug("delaying build of '%s': memory pressure is %.2f%%", store.printStorePath(drvPath), *pressure);
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
 void Worker::waitForBuildSlot(GoalPtr goal)
 {
     goal->trace("wait for build slot");
     bool isSubstitutionGoal = goal->jobCategory() == JobCategory::Substitution;
-    if ((!isSubstitutionGoal && getNrLocalBuilds() < settings.maxBuildJobs)
+    auto buildingGoal = dynamic_cast<DerivationBuildingGoal *>(goal.get());
+    if ((!isSubstitutionGoal
+         && (buildingGoal ? canStartLocalBuild(buildingGoal->drvPath) : getNrLocalBuilds() < settings.maxBuildJobs))
         || (isSubstitutionGoal && getNrSubstitutions() < settings.maxSubstitutionJobs))
         wakeUp(goal); /* we can do it right away */
     else
@@ -389,6 +493,12 @@ void Worker::waitForInput()
         // Periodicallty wake up to see if we need to run the garbage collector.
         nearest = before + std::chrono::seconds(10);
     for (auto & i : children) {
+        /* Wake up when a goal's buffered log output is due to be
+           written, so that the log can be followed while the build
+           is silent. */
+        if (auto goal = i.goal.lock())
+            if (auto deadline = goal->logFlushDeadline())
+                nearest = std::min(nearest, *deadline);
         if (!i.respectTimeouts)
             continue;
         if (0 != settings.maxSilentTime)
@@ -404,14 +514,16 @@ void Worker::waitForInput()
     /* If we are polling goals that are waiting for a lock, then wake
        up after a few seconds at most. */
     if (!waitingForAWhile.empty()) {
-        useTimeout = true;
         if (lastWokenUp == steady_time_point::min() || lastWokenUp > before)
             lastWokenUp = before;
-        timeout = std::max(
+        auto pollTimeout = std::max(
             1L,
             (long) std::chrono::duration_cast<std::chrono::seconds>(
                 lastWokenUp + std::chrono::seconds(settings.pollInterval) - before)
                 .count());
+        /* Don't miss an earlier deadline of a child. */
+        timeout = useTimeout ? std::min(timeout, pollTimeout) : pollTimeout;
+        useTimeout = true;
     } else
         lastWokenUp = steady_time_point::min();
 
@@ -463,6 +575,8 @@ void Worker::waitForInput()
                 goal->handleEOF(k);
             });
 
+        goal->flushLog();
+
         if (goal->exitCode == Goal::ecBusy && 0 != settings.maxSilentTime && j->respectTimeouts
             && after - j->lastOutput >= std::chrono::seconds(settings.maxSilentTime)) {
             goal->timedOut(
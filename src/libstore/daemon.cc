@@ -9,6 +9,7 @@
 #include "nix/store/gc-store.hh"
 #include "nix/store/log-store.hh"
 #include "nix/store/indirect-root-store.hh"
+#include "nix/store/local-store.hh"
 #include "nix/store/path-with-outputs.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/archive.hh"
@@ -16,12 +17,16 @@
 #include "nix/util/args.hh"
 #include "nix/util/git.hh"
 #include "nix/util/logging.hh"
+#include "nix/util/unix-domain-socket.hh"
 
 #ifndef _WIN32 // TODO need graceful async exit support on Windows?
 #  include "nix/util/monitor-fd.hh"
 #endif
 
+#include <condition_variable>
+#include <queue>
 #include <sstream>
+#include <thread>
 
 namespace nix::daemon {
 
@@ -57,6 +62,12 @@ struct TunnelLogger : public Logger
 
     WorkerProto::Version clientVersion;
 
+    /**
+     * In a daemon that serves connections in threads, the verbosity
+     * requested by the client, which may be lower than the daemon's.
+     */
+    Verbosity clientVerbosity = lvlVomit;
+
     TunnelLogger(FdSink & to, WorkerProto::Version clientVersion)
         : to(to)
         , clientVersion(clientVersion)
@@ -84,7 +95,7 @@ struct TunnelLogger : public Logger
 
     void log(Verbosity lvl, std::string_view s) override
     {
-        if (lvl > verbosity)
+        if (lvl > verbosity || lvl > clientVerbosity)
             return;
 
         StringSink buf;
@@ -94,7 +105,7 @@ struct TunnelLogger : public Logger
 
     void logEI(const ErrorInfo & ei) override
     {
-        if (ei.level > verbosity)
+        if (ei.level > verbosity || ei.level > clientVerbosity)
             return;
 
         std::ostringstream oss;
@@ -177,6 +188,102 @@ struct TunnelLogger : public Logger
     }
 };
 
+/**
+ * The daemon's own logger, if it serves connections in threads.
+ */
+static Logger * daemonLogger = nullptr;
+
+/**
+ * The logger of the connection served by the current thread, if any.
+ */
+static thread_local Logger * connectionLogger = nullptr;
+
+/**
+ * A logger that forwards messages to the logger of the connection
+ * served by the current thread, or to the daemon's own logger in
+ * other threads.
+ */
+struct ConnectionThreadsLogger : Logger
+{
+    std::unique_ptr<Logger> daemonLogger;
+
+    ConnectionThreadsLogger(std::unique_ptr<Logger> daemonLogger)
+        : daemonLogger(std::move(daemonLogger))
+    {
+    }
+
+    Logger & current()
+    {
+        return connectionLogger ? *connectionLogger : *daemonLogger;
+    }
+
+    void stop() override
+    {
+        daemonLogger->stop();
+    }
+
+    void pause() override
+    {
+        daemonLogger->pause();
+    }
+
+    void resume() override
+    {
+        daemonLogger->resume();
+    }
+
+    bool isVerbose() override
+    {
+        return current().isVerbose();
+    }
+
+    void log(Verbosity lvl, std::string_view s) override
+    {
+        current().log(lvl, s);
+    }
+
+    void logEI(const ErrorInfo & ei) override
+    {
+        current().logEI(ei);
+    }
+
+    void warn(const std::string & msg) override
+    {
+        current().warn(msg);
+    }
+
+    void startActivity(
+        ActivityId act,
+        Verbosity lvl,
+        ActivityType type,
+        const std::string & s,
+        const Fields & fields,
+        ActivityId parent) override
+    {
+        current().startActivity(act, lvl, type, s, fields, parent);
+    }
+
+    void stopActivity(ActivityId act) override
+    {
+        current().stopActivity(act);
+    }
+
+    void result(ActivityId act, ResultType type, const Fields & fields) override
+    {
+        current().result(act, type, fields);
+    }
+
+    void writeToStdout(std::string_view s) override
+    {
+        daemonLogger->writeToStdout(s);
+    }
+
+    void setPrintBuildLogs(bool printBuildLogs) override
+    {
+        daemonLogger->setPrintBuildLogs(printBuildLogs);
+    }
+};
+
 struct TunnelSink : Sink
 {
     Sink & to;
@@ -245,24 +352,9 @@ struct ClientSettings
             auto & value(i.second);
 
             auto setSubstituters = [&](Setting<Strings> & res) {
-                if (name != res.name && res.aliases.count(name) == 0)
+                if (!isSetting(res, name))
                     return false;
-                StringSet trusted = settings.trustedSubstituters;
-                for (auto & s : settings.substituters.get())
-                    trusted.insert(s);
-                Strings subs;
-                auto ss = tokenizeString<Strings>(value);
-                for (auto & s : ss)
-                    if (trusted.count(s))
-                        subs.push_back(s);
-                    else if (!hasSuffix(s, "/") && trusted.count(s + "/"))
-                        subs.push_back(s + "/");
-                    else
-                        warn(
-                            "ignoring untrusted substituter '%s', you are not a trusted user.\n"
-                            "Run `man nix.conf` for more information on the `substituters` configuration option.",
-                            s);
-                res = subs;
+                res = filterSubstituters(value, true);
                 return true;
             };
 
@@ -279,10 +371,7 @@ struct ClientSettings
                     warn(
                         "Ignoring the client-specified plugin-files.\n"
                         "The client specifying plugins to the daemon never made sense, and was removed in Nix >=2.14.");
-                } else if (
-                    trusted || name == settings.buildTimeout.name || name == settings.maxSilentTime.name
-                    || name == settings.pollInterval.name || name == "connect-timeout"
-                    || (name == "builders" && value == ""))
+                } else if (trusted || untrustedMaySet(name, value))
                     settings.set(name, value);
                 else if (setSubstituters(settings.substituters))
                     ;
@@ -295,6 +384,421 @@ struct ClientSettings
             }
         }
     }
+
+    static bool isSetting(const AbstractSetting & setting, const std::string & name)
+    {
+        return name == setting.name || setting.aliases.count(name);
+    }
+
+    /**
+     * Whether an untrusted client may set `name` to `value`. The
+     * substituters are handled by `filterSubstituters()`.
+     */
+    static bool untrustedMaySet(const std::string & name, const std::string & value)
+    {
+        return name == settings.buildTimeout.name || name == settings.maxSilentTime.name
+               || name == settings.pollInterval.name || name == "connect-timeout"
+               || (name == "builders" && value == "");
+    }
+
+    /**
+     * The substituters in `value` that an untrusted client may use,
+     * i.e. those in `substituters` or `trusted-substituters`.
+     */
+    static Strings filterSubstituters(const std::string & value, bool warnUntrusted)
+    {
+        StringSet trusted = settings.trustedSubstituters;
+        for (auto & s : settings.substituters.get())
+            trusted.insert(s);
+        Strings subs;
+        auto ss = tokenizeString<Strings>(value);
+        for (auto & s : ss)
+            if (trusted.count(s))
+                subs.push_back(s);
+            else if (!hasSuffix(s, "/") && trusted.count(s + "/"))
+                subs.push_back(s + "/");
+            else if (warnUntrusted)
+                warn(
+                    "ignoring untrusted substituter '%s', you are not a trusted user.\n"
+                    "Run `man nix.conf` for more information on the `substituters` configuration option.",
+                    s);
+        return subs;
+    }
+
+    /**
+     * Whether `apply(trusted)` could change any of the daemon's
+     * settings. Overrides that it ignores don't count.
+     */
+    bool differs(TrustedFlag trusted) const
+    {
+        if (keepFailed != settings.keepFailed || keepGoing != settings.keepGoing || tryFallback != settings.tryFallback
+            || verbosity > nix::verbosity || maxBuildJobs != settings.maxBuildJobs
+            || maxSilentTime != settings.maxSilentTime || verboseBuild != settings.verboseBuild
+            || buildCores != settings.buildCores || useSubstitutes != settings.useSubstitutes)
+            return true;
+
+        std::map<std::string, Config::SettingInfo> current;
+        settings.getSettings(current);
+
+        for (auto & [name, value] : overrides) {
+            if (name == "ssh-auth-sock" || name == experimentalFeatureSettings.experimentalFeatures.name
+                || name == "plugin-files")
+                continue;
+            if (!trusted && !untrustedMaySet(name, value)) {
+                if (isSetting(settings.substituters, name)
+                    && filterSubstituters(value, false) != settings.substituters.get())
+                    return true;
+                continue;
+            }
+            auto i = current.find(name);
+            if (i != current.end() && i->second.value != value)
+                return true;
+        }
+
+        return false;
+    }
+};
+
+static ClientSettings readClientSettings(Source & from, WorkerProto::Version protoVersion)
+{
+    ClientSettings clientSettings;
+
+    clientSettings.keepFailed = readInt(from);
+    clientSettings.keepGoing = readInt(from);
+    clientSettings.tryFallback = readInt(from);
+    clientSettings.verbosity = (Verbosity) readInt(from);
+    clientSettings.maxBuildJobs = readInt(from);
+    clientSettings.maxSilentTime = readInt(from);
+    readInt(from); // obsolete useBuildHook
+    clientSettings.verboseBuild = lvlError == (Verbosity) readInt(from);
+    readInt(from); // obsolete logType
+    readInt(from); // obsolete printBuildTrace
+    clientSettings.buildCores = readInt(from);
+    clientSettings.useSubstitutes = readInt(from);
+
+    if (GET_PROTOCOL_MINOR(protoVersion) >= 12) {
+        unsigned int n = readInt(from);
+        for (unsigned int i = 0; i < n; i++) {
+            auto name = readString(from);
+            auto value = readString(from);
+            clientSettings.overrides.emplace(name, value);
+        }
+    }
+
+    return clientSettings;
+}
+
+/**
+ * The state of a connection served by `processConnectionInThread()`.
+ */
+struct ConnectionThread
+{
+    std::function<void(SuspendedConnection &&)> handOver;
+
+    /**
+     * The arguments of the last `SetOptions` operation.
+     */
+    std::optional<std::string> clientSettings;
+
+    bool handedOver = false;
+
+    /**
+     * Hand the connection over to a process of its own, which will
+     * perform `op`. `args` are the arguments of `op` that have
+     * already been read.
+     */
+    void suspend(
+        WorkerProto::BasicServerConnection & conn, TrustedFlag trusted, WorkerProto::Op op, std::string args = "")
+    {
+        handOver(
+            SuspendedConnection{
+                .protoVersion = conn.protoVersion,
+                .features = conn.features,
+                .trusted = trusted,
+                .clientSettings = clientSettings,
+                .op = op,
+                .buffered = args + conn.from.takeBuffer(),
+            });
+        handedOver = true;
+    }
+};
+
+/**
+ * Whether `op` may build or substitute paths, and thus depends on
+ * the client's settings.
+ */
+static bool needsProcess(WorkerProto::Op op)
+{
+    switch (op) {
+    case WorkerProto::Op::BuildPaths:
+    case WorkerProto::Op::BuildPathsWithResults:
+    case WorkerProto::Op::BuildDerivation:
+    case WorkerProto::Op::EnsurePath:
+    case WorkerProto::Op::VerifyStore:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * Serves a connection in multiplexed mode (see
+ * `WorkerProto::Op::Multiplex`). The requests are read by the thread
+ * serving the connection and performed by a number of worker threads.
+ */
+struct Multiplexer
+{
+    ref<Store> store;
+
+    WorkerProto::BasicServerConnection & conn;
+
+    Verbosity clientVerbosity;
+
+    struct Request
+    {
+        uint64_t id;
+        WorkerProto::Op op;
+        std::string args;
+    };
+
+    struct State
+    {
+        std::queue<Request> pending;
+        bool done = false;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    /**
+     * Serialises writing reply frames to the client.
+     */
+    std::mutex sendLock;
+
+    /**
+     * Forwards log messages to the client, tagged with the ID of the
+     * request that produced them.
+     */
+    struct RequestLogger : Logger
+    {
+        Multiplexer & mux;
+        uint64_t id;
+
+        RequestLogger(Multiplexer & mux, uint64_t id)
+            : mux(mux)
+            , id(id)
+        {
+        }
+
+        bool enabled(Verbosity lvl)
+        {
+            return lvl <= verbosity && lvl <= mux.clientVerbosity;
+        }
+
+        void log(Verbosity lvl, std::string_view s) override
+        {
+            if (!enabled(lvl))
+                return;
+            StringSink buf;
+            buf << STDERR_NEXT << (s + "\n");
+            mux.send(id, buf.s);
+        }
+
+        void logEI(const ErrorInfo & ei) override
+        {
+            if (!enabled(ei.level))
+                return;
+            std::ostringstream oss;
+            showErrorInfo(oss, ei, false);
+            StringSink buf;
+            buf << STDERR_NEXT << toView(oss);
+            mux.send(id, buf.s);
+        }
+
+        void startActivity(
+            ActivityId act,
+            Verbosity lvl,
+            ActivityType type,
+            const std::string & s,
+            const Fields & fields,
+            ActivityId parent) override
+        {
+            StringSink buf;
+            buf << STDERR_START_ACTIVITY << act << lvl << type << s << fields << parent;
+            mux.send(id, buf.s);
+        }
+
+        void stopActivity(ActivityId act) override
+        {
+            StringSink buf;
+            buf << STDERR_STOP_ACTIVITY << act;
+            mux.send(id, buf.s);
+        }
+
+        void result(ActivityId act, ResultType type, const Fields & fields) override
+        {
+            StringSink buf;
+            buf << STDERR_RESULT << act << type << fields;
+            mux.send(id, buf.s);
+        }
+    };
+
+    Multiplexer(ref<Store> store, WorkerProto::BasicServerConnection & conn, Verbosity clientVerbosity)
+        : store(store)
+        , conn(conn)
+        , clientVerbosity(clientVerbosity)
+    {
+    }
+
+    void send(uint64_t id, std::string_view frame)
+    {
+        std::lock_guard<std::mutex> lock(sendLock);
+        conn.to << id;
+        conn.to(frame);
+        conn.to.flush();
+    }
+
+    /**
+     * Perform a request and send its result or error.
+     */
+    void perform(Request & req)
+    {
+        RequestLogger requestLogger(*this, req.id);
+        connectionLogger = &requestLogger;
+        Finally resetLogger([]() { connectionLogger = nullptr; });
+
+        StringSource from(req.args);
+        StringSink reply;
+        WorkerProto::WriteConn wconn{.to = reply, .version = conn.protoVersion};
+
+        try {
+            switch (req.op) {
+
+            case WorkerProto::Op::IsValidPath: {
+                auto path = store->parseStorePath(readString(from));
+                reply << store->isValidPath(path);
+                break;
+            }
+
+            case WorkerProto::Op::QueryPathInfo: {
+                auto path = store->parseStorePath(readString(from));
+                std::shared_ptr<const ValidPathInfo> info;
+                try {
+                    info = store->queryPathInfo(path);
+                } catch (InvalidPath &) {
+                }
+                if (info) {
+                    reply << 1;
+                    WorkerProto::write(*store, wconn, static_cast<const UnkeyedValidPathInfo &>(*info));
+                } else
+                    reply << 0;
+                break;
+            }
+
+            default:
+                throw Error("operation %1% is not supported on a multiplexed connection", req.op);
+            }
+        } catch (Error & e) {
+            StringSink buf;
+            buf << STDERR_ERROR << e;
+            send(req.id, buf.s);
+            return;
+        }
+
+        StringSink buf;
+        buf << STDERR_LAST << reply.s;
+        send(req.id, buf.s);
+    }
+
+    void worker(std::function<bool()> interruptCheck)
+    {
+#ifndef _WIN32
+        unix::interruptCheck = interruptCheck;
+#endif
+
+        while (true) {
+            Request req;
+            {
+                auto state(state_.lock());
+                while (state->pending.empty() && !state->done)
+                    state.wait(wakeup);
+                if (state->pending.empty())
+                    return;
+                req = std::move(state->pending.front());
+                state->pending.pop();
+            }
+
+            try {
+                perform(req);
+            } catch (...) {
+                /* We were interrupted or sending the reply failed, so
+                   the client is gone. */
+                ignoreExceptionInDestructor(lvlDebug);
+                auto state(state_.lock());
+                state->done = true;
+                state->pending = {};
+                wakeup.notify_all();
+                return;
+            }
+        }
+    }
+
+    /**
+     * Read requests until the client sends request ID 0 or hangs up,
+     * and wait for the pending requests to finish.
+     */
+    void run()
+    {
+        std::vector<std::thread> workers;
+
+        Finally joinWorkers([&]() {
+            {
+                auto state(state_.lock());
+                state->done = true;
+                if (std::uncaught_exceptions())
+                    state->pending = {};
+            }
+            wakeup.notify_all();
+            for (auto & thread : workers)
+                thread.join();
+        });
+
+#ifndef _WIN32
+        auto interruptCheck = unix::interruptCheck;
+#else
+        std::function<bool()> interruptCheck;
+#endif
+
+        /* Every multiplexed connection gets its own workers, so
+           don't let a few clients start hundreds of threads on large
+           machines. */
+        constexpr unsigned int maxWorkers = 8;
+        for (unsigned int n = 0; n < std::clamp(std::thread::hardware_concurrency(), 1U, maxWorkers); n++)
+            workers.emplace_back(&Multiplexer::worker, this, interruptCheck);
+
+        while (true) {
+            uint64_t id;
+            try {
+                id = readNum<uint64_t>(conn.from);
+            } catch (EndOfFile &) {
+                break;
+            }
+            if (id == 0)
+                break;
+
+            auto op = (WorkerProto::Op) readInt(conn.from);
+            auto args = readString(conn.from);
+
+            {
+                auto state(state_.lock());
+                if (state->done)
+                    break;
+                state->pending.push(Request{.id = id, .op = op, .args = std::move(args)});
+            }
+            wakeup.notify_one();
+        }
+    }
 };
 
 static void performOp(
@@ -302,6 +806,7 @@ static void performOp(
     ref<Store> store,
     TrustedFlag trusted,
     RecursiveFlag recursive,
+    ConnectionThread * thread,
     WorkerProto::BasicServerConnection & conn,
     WorkerProto::Op op)
 {
@@ -327,6 +832,14 @@ static void performOp(
             substitute = readInt(conn.from) ? Substitute : NoSubstitute;
         }
 
+        if (substitute && thread) {
+            StringSink args;
+            WorkerProto::write(*store, WorkerProto::WriteConn{.to = args, .version = conn.protoVersion}, paths);
+            args << 1;
+            thread->suspend(conn, trusted, op, std::move(args.s));
+            break;
+        }
+
         logger->startWork();
         if (substitute) {
             store->substitutePaths(paths);
@@ -789,28 +1302,21 @@ static void performOp(
 
     case WorkerProto::Op::SetOptions: {
 
-        ClientSettings clientSettings;
-
-        clientSettings.keepFailed = readInt(conn.from);
-        clientSettings.keepGoing = readInt(conn.from);
-        clientSettings.tryFallback = readInt(conn.from);
-        clientSettings.verbosity = (Verbosity) readInt(conn.from);
-        clientSettings.maxBuildJobs = readInt(conn.from);
-        clientSettings.maxSilentTime = readInt(conn.from);
-        readInt(conn.from); // obsolete useBuildHook
-        clientSettings.verboseBuild = lvlError == (Verbosity) readInt(conn.from);
-        readInt(conn.from); // obsolete logType
-        readInt(conn.from); // obsolete printBuildTrace
-        clientSettings.buildCores = readInt(conn.from);
-        clientSettings.useSubstitutes = readInt(conn.from);
-
-        if (GET_PROTOCOL_MINOR(conn.protoVersion) >= 12) {
-            unsigned int n = readInt(conn.from);
-            for (unsigned int i = 0; i < n; i++) {
-                auto name = readString(conn.from);
-                auto value = readString(conn.from);
-                clientSettings.overrides.emplace(name, value);
+        StringSink raw;
+        TeeSource from(conn.from, raw);
+        auto clientSettings = readClientSettings(from, conn.protoVersion);
+
+        if (thread) {
+            /* Settings are global, so we can't apply them here. */
+            thread->clientSettings = std::move(raw.s);
+            if (clientSettings.differs(trusted)) {
+                thread->suspend(conn, trusted, op);
+                break;
             }
+            logger->clientVerbosity = clientSettings.verbosity;
+            logger->startWork();
+            logger->stopWork();
+            break;
         }
 
         logger->startWork();
@@ -923,6 +1429,36 @@ static void performOp(
     }
 
     case WorkerProto::Op::NarFromPath: {
+#ifndef _WIN32
+        if (conn.features.contains(WorkerProto::featureFdPassing)) {
+            auto pathS = readString(conn.from);
+
+            /* Send the pipe through which we send the NAR before
+               anything else, since the client receives it before
+               reading any other reply. If we can't create the pipe,
+               the client will get the error instead. */
+            Pipe pipe;
+            try {
+                pipe.create();
+            } catch (...) {
+                sendFds(conn.from.fd, {});
+                throw;
+            }
+            sendFds(conn.from.fd, {pipe.readSide.get()});
+            pipe.readSide.close();
+
+            auto path = store->parseStorePath(pathS);
+            logger->startWork();
+            logger->stopWork();
+            conn.to.flush();
+
+            /* This splices the file contents into the pipe. */
+            FdSink sink(pipe.writeSide.get());
+            dumpPath(store->toRealPath(path), sink);
+            sink.flush();
+            break;
+        }
+#endif
         auto path = store->parseStorePath(readString(conn.from));
         logger->startWork();
         logger->stopWork();
@@ -949,6 +1485,35 @@ static void performOp(
             info.ultimate = false;
 
         if (GET_PROTOCOL_MINOR(conn.protoVersion) >= 23) {
+#ifndef _WIN32
+            if (conn.features.contains(WorkerProto::featureFdPassing)) {
+                /* Tell the client that we're ready to receive the pipe
+                   through which it sends the NAR. It must not send the
+                   pipe earlier, since we could read it into our buffer
+                   along with the arguments, which would lose it. */
+                logger->startWork();
+                logger->stopWork();
+                conn.to.flush();
+
+                auto fds = receiveFds(conn.from.fd, 1);
+                if (fds.empty())
+                    throw Error("the client did not send a pipe for the NAR of '%s'", store->printStorePath(path));
+
+                logger->startWork();
+                {
+                    FdSource source(fds[0].get());
+                    store->addToStore(info, source, (RepairFlag) repair, dontCheckSigs ? NoCheckSigs : CheckSigs);
+                    /* Consume the rest of the NAR if `addToStore()`
+                       didn't (e.g. because the path is already valid),
+                       so that the client doesn't get EPIPE. */
+                    NullSink nullSink;
+                    source.drainInto(nullSink);
+                }
+                logger->stopWork();
+                break;
+            }
+#endif
+
             logger->startWork();
             {
                 FramedSource source(conn.from);
@@ -1042,6 +1607,40 @@ static void performOp(
         break;
     }
 
+    case WorkerProto::Op::QueryBuildStats: {
+        auto path = store->parseStorePath(readString(conn.from));
+        logger->startWork();
+        auto stats = store->queryBuildStats(path);
+        logger->stopWork();
+        WorkerProto::write(*store, wconn, stats);
+        break;
+    }
+
+    case WorkerProto::Op::Multiplex: {
+        if (!conn.features.contains(WorkerProto::featureMultiplex))
+            throw Error("the client did not negotiate multiplexing");
+        logger->startWork();
+        logger->stopWork();
+        conn.to.flush();
+
+        /* Log messages are routed to the request that produced them
+           through `connectionLogger`, so make sure the global logger
+           honors it. In a daemon that serves connections in threads,
+           it already does. */
+        std::unique_ptr<Logger> prevLogger;
+        if (!thread && !recursive) {
+            prevLogger = std::move(nix::logger);
+            nix::logger = std::make_unique<ConnectionThreadsLogger>(makeSimpleLogger());
+        }
+        Finally restoreLogger([&]() {
+            if (prevLogger)
+                nix::logger = std::move(prevLogger);
+        });
+
+        Multiplexer(store, conn, logger->clientVerbosity).run();
+        break;
+    }
+
     case WorkerProto::Op::QueryFailedPaths:
     case WorkerProto::Op::ClearFailedPaths:
         throw Error("Removed operation %1%", op);
@@ -1051,80 +1650,56 @@ static void performOp(
     }
 }
 
-void processConnection(ref<Store> store, FdSource && from, FdSink && to, TrustedFlag trusted, RecursiveFlag recursive)
+/**
+ * Process client requests until the client disconnects or, if
+ * `thread` is set, until the connection is handed over. If `pendingOp`
+ * is set, perform that operation before reading any requests.
+ */
+static void serveConnection(
+    ref<Store> store,
+    WorkerProto::BasicServerConnection & conn,
+    TunnelLogger * tunnelLogger,
+    Logger * prevLogger,
+    TrustedFlag trusted,
+    RecursiveFlag recursive,
+    ConnectionThread * thread,
+    std::optional<WorkerProto::Op> pendingOp = std::nullopt)
 {
-#ifndef _WIN32 // TODO need graceful async exit support on Windows?
-    auto monitor = !recursive ? std::make_unique<MonitorFdHup>(from.fd) : nullptr;
-    (void) monitor; // suppress warning
-#endif
-
-    /* Exchange the greeting. */
-    auto [protoVersion, features] =
-        WorkerProto::BasicServerConnection::handshake(to, from, PROTOCOL_VERSION, WorkerProto::allFeatures);
-
-    if (protoVersion < 0x10a)
-        throw Error("the Nix client version is too old");
-
-    WorkerProto::BasicServerConnection conn;
-    conn.to = std::move(to);
-    conn.from = std::move(from);
-    conn.protoVersion = protoVersion;
-    conn.features = features;
-
-    auto tunnelLogger_ = std::make_unique<TunnelLogger>(conn.to, protoVersion);
-    auto tunnelLogger = tunnelLogger_.get();
-    std::unique_ptr<Logger> prevLogger_;
-    auto prevLogger = logger.get();
-    // FIXME
-    if (!recursive) {
-        prevLogger_ = std::move(logger);
-        logger = std::move(tunnelLogger_);
-        applyJSONLogger();
-    }
-
     unsigned int opCount = 0;
 
-    Finally finally([&]() {
-        setInterrupted(false);
-        printMsgUsing(prevLogger, lvlDebug, "%d operations", opCount);
-    });
-
-    conn.postHandshake(
-        *store,
-        {
-            .daemonNixVersion = nixVersion,
-            // We and the underlying store both need to trust the client for
-            // it to be trusted.
-            .remoteTrustsUs = trusted ? store->isTrustedClient() : std::optional{NotTrusted},
-        });
-
-    /* Send startup error messages to the client. */
-    tunnelLogger->startWork();
+    Finally finally([&]() { printMsgUsing(prevLogger, lvlDebug, "%d operations", opCount); });
 
     try {
 
-        tunnelLogger->stopWork();
-        conn.to.flush();
-
         /* Process client requests. */
         while (true) {
             WorkerProto::Op op;
-            try {
-                op = (enum WorkerProto::Op) readInt(conn.from);
-            } catch (Interrupted & e) {
-                break;
-            } catch (EndOfFile & e) {
-                break;
+            if (pendingOp) {
+                op = *pendingOp;
+                pendingOp.reset();
+            } else {
+                try {
+                    op = (enum WorkerProto::Op) readInt(conn.from);
+                } catch (Interrupted & e) {
+                    break;
+                } catch (EndOfFile & e) {
+                    break;
+                }
             }
 
             printMsgUsing(prevLogger, lvlDebug, "received daemon op %d", op);
 
+            if (thread && needsProcess(op)) {
+                thread->suspend(conn, trusted, op);
+                break;
+            }
+
             opCount++;
 
             debug("performing daemon worker op: %d", op);
 
             try {
-                performOp(tunnelLogger, store, trusted, recursive, conn, op);
+                performOp(tunnelLogger, store, trusted, recursive, thread, conn, op);
             } catch (Error & e) {
                 /* If we're not in a state where we can send replies, then
                    something went wrong processing the input of the
@@ -1141,6 +1716,9 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
                 throw;
             }
 
+            if (thread && thread->handedOver)
+                break;
+
             conn.to.flush();
 
             assert(!tunnelLogger->state_.lock()->canSendStderr);
@@ -1158,4 +1736,156 @@ void processConnection(ref<Store> store, FdSource && from, FdSink && to, Trusted
     }
 }
 
+/**
+ * Exchange the greeting with the client.
+ */
+static void handshake(WorkerProto::BasicServerConnection & conn, FdSource && from, FdSink && to)
+{
+    auto supportedFeatures = WorkerProto::BasicConnection::getSupportedFeatures(from.fd);
+
+    /* Don't offer to pass file descriptors unless we're talking over a
+       single socket. With `nix-daemon --stdio`, stdin and stdout are
+       typically relayed by something like `ssh` or `socat`. */
+    if (from.fd != to.fd)
+        supportedFeatures.erase(std::string(WorkerProto::featureFdPassing));
+
+    auto [protoVersion, features] =
+        WorkerProto::BasicServerConnection::handshake(to, from, PROTOCOL_VERSION, supportedFeatures);
+
+    if (protoVersion < 0x10a)
+        throw Error("the Nix client version is too old");
+
+    conn.to = std::move(to);
+    conn.from = std::move(from);
+    conn.protoVersion = protoVersion;
+    conn.features = features;
+    conn.checkFdPassing();
+}
+
+static void postHandshake(
+    ref<Store> store, WorkerProto::BasicServerConnection & conn, TunnelLogger * tunnelLogger, TrustedFlag trusted)
+{
+    conn.postHandshake(
+        *store,
+        {
+            .daemonNixVersion = nixVersion,
+            // We and the underlying store both need to trust the client for
+            // it to be trusted.
+            .remoteTrustsUs = trusted ? store->isTrustedClient() : std::optional{NotTrusted},
+        });
+
+    /* Send startup error messages to the client. */
+    tunnelLogger->startWork();
+    tunnelLogger->stopWork();
+    conn.to.flush();
+}
+
+void processConnection(ref<Store> store, FdSource && from, FdSink && to, TrustedFlag trusted, RecursiveFlag recursive)
+{
+#ifndef _WIN32 // TODO need graceful async exit support on Windows?
+    auto monitor = !recursive ? std::make_unique<MonitorFdHup>(from.fd) : nullptr;
+    (void) monitor; // suppress warning
+#endif
+
+    WorkerProto::BasicServerConnection conn;
+    handshake(conn, std::move(from), std::move(to));
+
+    auto tunnelLogger_ = std::make_unique<TunnelLogger>(conn.to, conn.protoVersion);
+    auto tunnelLogger = tunnelLogger_.get();
+    std::unique_ptr<Logger> prevLogger_;
+    auto prevLogger = logger.get();
+    // FIXME
+    if (!recursive) {
+        prevLogger_ = std::move(logger);
+        logger = std::move(tunnelLogger_);
+        applyJSONLogger();
+    }
+
+    Finally finally([&]() { setInterrupted(false); });
+
+    postHandshake(store, conn, tunnelLogger, trusted);
+
+    serveConnection(store, conn, tunnelLogger, prevLogger, trusted, recursive, nullptr);
+}
+
+void initConnectionThreads()
+{
+    assert(!daemonLogger);
+    auto threadsLogger = std::make_unique<ConnectionThreadsLogger>(std::move(logger));
+    daemonLogger = threadsLogger->daemonLogger.get();
+    logger = std::move(threadsLogger);
+}
+
+void processConnectionInThread(
+    ref<Store> store,
+    FdSource && from,
+    FdSink && to,
+    TrustedFlag trusted,
+    std::function<void(SuspendedConnection &&)> handOver)
+{
+    assert(daemonLogger);
+
+#ifndef _WIN32
+    /* A client hanging up must only interrupt its own connection. */
+    std::atomic<bool> hungUp{false};
+    MonitorFdHup monitor(from.fd, [&]() { hungUp = true; });
+    unix::interruptCheck = [&]() { return hungUp.load(); };
+    Finally resetInterruptCheck([]() { unix::interruptCheck = nullptr; });
+#endif
+
+    WorkerProto::BasicServerConnection conn;
+    handshake(conn, std::move(from), std::move(to));
+
+    TunnelLogger tunnelLogger(conn.to, conn.protoVersion);
+    connectionLogger = &tunnelLogger;
+    Finally resetLogger([]() { connectionLogger = nullptr; });
+
+    /* Release the temporary roots of the client when it disconnects,
+       rather than when the daemon exits. */
+    std::optional<LocalStore::TempRootsScope> tempRootsScope;
+    if (auto localStore = store.dynamic_pointer_cast<LocalStore>())
+        tempRootsScope.emplace(*localStore);
+
+    postHandshake(store, conn, &tunnelLogger, trusted);
+
+    ConnectionThread thread{.handOver = std::move(handOver)};
+
+    serveConnection(store, conn, &tunnelLogger, daemonLogger, trusted, NotRecursive, &thread);
+}
+
+void resumeConnection(ref<Store> store, FdSource && from, FdSink && to, SuspendedConnection && suspended)
+{
+#ifndef _WIN32
+    MonitorFdHup monitor(from.fd);
+#endif
+
+    WorkerProto::BasicServerConnection conn;
+    conn.to = std::move(to);
+    conn.from = std::move(from);
+    conn.protoVersion = suspended.protoVersion;
+    conn.features = std::move(suspended.features);
+
+    auto tunnelLogger_ = std::make_unique<TunnelLogger>(conn.to, conn.protoVersion);
+    auto tunnelLogger = tunnelLogger_.get();
+    auto prevLogger_ = std::move(logger);
+    auto prevLogger = prevLogger_.get();
+    logger = std::move(tunnelLogger_);
+    applyJSONLogger();
+
+    /* Replay the `SetOptions` operation, or apply its settings before
+       performing the pending operation. */
+    if (suspended.op == WorkerProto::Op::SetOptions) {
+        assert(suspended.clientSettings);
+        conn.from.fillBuffer(*suspended.clientSettings + suspended.buffered);
+    } else {
+        if (suspended.clientSettings) {
+            StringSource source(*suspended.clientSettings);
+            readClientSettings(source, conn.protoVersion).apply(suspended.trusted);
+        }
+        conn.from.fillBuffer(suspended.buffered);
+    }
+
+    serveConnection(store, conn, tunnelLogger, prevLogger, suspended.trusted, NotRecursive, nullptr, suspended.op);
+}
+
 } // namespace nix::daemon
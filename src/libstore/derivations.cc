@@ -9,6 +9,7 @@
 #include "nix/store/common-protocol-impl.hh"
 #include "nix/util/strings-inline.hh"
 #include "nix/util/json-utils.hh"
+#include "nix/store/drv-hash-disk-cache.hh"
 
 #include <boost/container/small_vector.hpp>
 #include <nlohmann/json.hpp>
@@ -787,27 +788,28 @@ DerivationType BasicDerivation::type() const
     throw Error("can't mix derivation output types");
 }
 
-Sync<DrvHashes> drvHashes;
+DrvHashes drvHashes;
 
 /* pathDerivationModulo and hashDerivationModulo are mutually recursive
  */
 
 /* Look up the derivation by value and memoize the
-   `hashDerivationModulo` call.
+   `hashDerivationModulo` call, both in memory and on disk. The disk
+   cache has already been consulted by `loadDrvHashes()`.
  */
 static const DrvHash pathDerivationModulo(Store & store, const StorePath & drvPath)
 {
-    {
-        auto hashes = drvHashes.lock();
-        auto h = hashes->find(drvPath);
-        if (h != hashes->end()) {
-            return h->second;
-        }
-    }
-    auto h = hashDerivationModulo(store, store.readInvalidDerivation(drvPath), false);
+    std::optional<DrvHash> h;
+    drvHashes.cvisit(drvPath, [&](auto & x) { h.emplace(x.second); });
+    if (h)
+        return *h;
+
+    debug("computing the hash of derivation '%s'", store.printStorePath(drvPath));
+    h = hashDerivationModulo(store, store.readInvalidDerivation(drvPath), false);
+    getDrvHashDiskCache()->upsert(store, drvPath, *h);
     // Cache it
-    drvHashes.lock()->insert_or_assign(drvPath, h);
-    return h;
+    drvHashes.insert_or_assign(drvPath, *h);
+    return *h;
 }
 
 /* See the header for interface details. These are the implementation details.
@@ -861,6 +863,13 @@ DrvHash hashDerivationModulo(Store & store, const Derivation & drv, bool maskOut
             [](const DerivationType::Impure &) -> DrvHash::Kind { return DrvHash::Kind::Deferred; }},
         drv.type().raw);
 
+    /* Look up the input derivations that aren't memoised in memory
+       in the disk cache all at once, rather than one at a time. */
+    StorePathSet inputDrvPaths;
+    for (auto & [drvPath, _] : drv.inputDrvs.map)
+        inputDrvPaths.insert(drvPath);
+    loadDrvHashes(*getDrvHashDiskCache(), store, inputDrvPaths);
+
     DerivedPathMap<StringSet>::ChildNode::Map inputs2;
     for (auto & [drvPath, node] : drv.inputDrvs.map) {
         const auto & res = pathDerivationModulo(store, drvPath);
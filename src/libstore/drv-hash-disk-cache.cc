@@ -0,0 +1,125 @@
+#include "nix/store/drv-hash-disk-cache.hh"
+#include "nix/store/sqlite.hh"
+#include "nix/util/users.hh"
+#include "nix/util/sync.hh"
+#include "nix/util/json-utils.hh"
+
+#include <nlohmann/json.hpp>
+
+namespace nix {
+
+class DrvHashDiskCacheImpl : public DrvHashDiskCache
+{
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt insertHash, queryHash;
+    };
+
+    /**
+     * Null if the cache could not be opened, in which case it is
+     * silently disabled.
+     */
+    std::unique_ptr<Sync<State>> _state;
+
+public:
+
+    DrvHashDiskCacheImpl(Path dbPath = getCacheDir() + "/drv-hashes-v1.sqlite")
+        : _state(std::make_unique<Sync<State>>())
+    {
+        try {
+            auto state(_state->lock());
+
+            createDirs(dirOf(dbPath));
+
+            state->db = SQLite(dbPath);
+
+            state->db.isCache();
+
+            state->db.exec(R"sql(
+                create table if not exists DrvHashes (
+                    path     text primary key not null,
+                    deferred integer not null,
+                    hashes   text not null
+                );
+            )sql");
+
+            state->insertHash.create(
+                state->db, "insert or replace into DrvHashes(path, deferred, hashes) values (?, ?, ?)");
+
+            state->queryHash.create(state->db, "select deferred, hashes from DrvHashes where path = ?");
+        } catch (Error & e) {
+            debug("not using the derivation hash cache: %s", e.what());
+            _state.reset();
+        }
+    }
+
+    std::map<StorePath, DrvHash> lookup(const StoreDirConfig & store, const StorePathSet & drvPaths) override
+    {
+        if (!_state || drvPaths.empty())
+            return {};
+        try {
+            return retrySQLite<std::map<StorePath, DrvHash>>([&]() {
+                std::map<StorePath, DrvHash> res;
+                auto state(_state->lock());
+                SQLiteTxn txn(state->db);
+                for (auto & drvPath : drvPaths) {
+                    auto query(state->queryHash.use()(store.printStorePath(drvPath)));
+                    if (!query.next())
+                        continue;
+                    DrvHash h{.kind = query.getInt(0) ? DrvHash::Kind::Deferred : DrvHash::Kind::Regular};
+                    for (auto & [outputName, hash] : nlohmann::json::parse(query.getStr(1)).items())
+                        h.hashes.insert_or_assign(outputName, Hash::parseSRI(getString(hash)));
+                    res.insert_or_assign(drvPath, std::move(h));
+                }
+                txn.commit();
+                return res;
+            });
+        } catch (Error & e) {
+            debug("cannot read derivation hash cache: %s", e.what());
+            return {};
+        }
+    }
+
+    void upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHash & h) override
+    {
+        if (!_state)
+            return;
+        auto hashes = nlohmann::json::object();
+        for (auto & [outputName, hash] : h.hashes)
+            hashes[outputName] = hash.to_string(HashFormat::SRI, true);
+        try {
+            retrySQLite<void>([&]() {
+                auto state(_state->lock());
+                state->insertHash.use()(store.printStorePath(drvPath))(h.kind == DrvHash::Kind::Deferred)(hashes.dump())
+                    .exec();
+            });
+        } catch (Error & e) {
+            debug("cannot write derivation hash cache: %s", e.what());
+        }
+    }
+};
+
+ref<DrvHashDiskCache> getDrvHashDiskCache()
+{
+    static ref<DrvHashDiskCache> cache = make_ref<DrvHashDiskCacheImpl>();
+    return cache;
+}
+
+ref<DrvHashDiskCache> getTestDrvHashDiskCache(Path dbPath)
+{
+    return make_ref<DrvHashDiskCacheImpl>(dbPath);
+}
+
+void loadDrvHashes(DrvHashDiskCache & cache, const StoreDirConfig & store, const StorePathSet & drvPaths)
+{
+    StorePathSet missing;
+    for (auto & drvPath : drvPaths)
+        if (!drvHashes.contains(drvPath))
+            missing.insert(drvPath);
+
+    for (auto & [drvPath, h] : cache.lookup(store, missing))
+        drvHashes.insert_or_assign(drvPath, std::move(h));
+}
+
+} // namespace nix
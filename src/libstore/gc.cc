@@ -15,6 +15,7 @@
 
 #include <boost/regex.hpp>
 
+#include <atomic>
 #include <functional>
 #include <queue>
 #include <algorithm>
@@ -47,11 +48,11 @@ void LocalStore::addIndirectRoot(const Path & path)
     makeSymlink(realRoot, path);
 }
 
-void LocalStore::createTempRootsFile()
+static void createTempRootsFile(const Path & fnTempRoots, Sync<AutoCloseFD> & _fdTempRoots)
 {
     auto fdTempRoots(_fdTempRoots.lock());
 
-    /* Create the temporary roots file for this process. */
+    /* Create the temporary roots file if necessary. */
     if (*fdTempRoots)
         return;
 
@@ -80,6 +81,39 @@ void LocalStore::createTempRootsFile()
     }
 }
 
+/**
+ * The innermost `TempRootsScope` of the current thread, if any.
+ */
+static thread_local LocalStore::TempRootsScope * tempRootsScope = nullptr;
+
+LocalStore::TempRootsScope::TempRootsScope(LocalStore & store)
+    : store(store)
+    , fnTempRoots([&]() {
+        /* The name must start with the pid, since that's what
+           findTempRoots() shows as the owner of the roots. */
+        static std::atomic<uint64_t> counter{0};
+        return fmt("%s/%d-%d", store.tempRootsDir, getpid(), counter++);
+    }())
+    , prev(tempRootsScope)
+{
+    tempRootsScope = this;
+}
+
+LocalStore::TempRootsScope::~TempRootsScope()
+{
+    tempRootsScope = prev;
+
+    try {
+        auto fd(fdTempRoots.lock());
+        if (*fd) {
+            fd->close();
+            unlink(fnTempRoots.c_str());
+        }
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
 void LocalStore::addTempRoot(const StorePath & path)
 {
     if (config->readOnly) {
@@ -88,20 +122,26 @@ void LocalStore::addTempRoot(const StorePath & path)
         return;
     }
 
-    createTempRootsFile();
+    auto scope = tempRootsScope && &tempRootsScope->store == this ? tempRootsScope : nullptr;
+    auto & fdTempRoots = scope ? scope->fdTempRoots : _fdTempRoots;
 
-    /* Open/create the global GC lock file. */
-    {
-        auto fdGCLock(_fdGCLock.lock());
-        if (!*fdGCLock)
-            *fdGCLock = openGCLock();
-    }
+    createTempRootsFile(scope ? scope->fnTempRoots : fnTempRoots, fdTempRoots);
+
+    /* Open/create the global GC lock file. Since flock() locks are
+       shared by everybody using the same file descriptor, we keep it
+       locked until we've written the temp root, so that another
+       thread can't release the shared lock in the meantime. Scopes
+       have their own file descriptor so that concurrent connections
+       don't wait for each other. */
+    auto fdGCLock((scope ? scope->fdGCLock : _fdGCLock).lock());
+    if (!*fdGCLock)
+        *fdGCLock = openGCLock();
 
 restart:
     /* Try to acquire a shared global GC lock (non-blocking). This
        only succeeds if the garbage collector is not currently
        running. */
-    FdLock gcLock(_fdGCLock.lock()->get(), ltRead, false, "");
+    FdLock gcLock(fdGCLock->get(), ltRead, false, "");
 
     if (!gcLock.acquired) {
         /* We couldn't get a shared global GC lock, so the garbage
@@ -154,7 +194,7 @@ restart:
     /* Record the store path in the temporary roots file so it will be
        seen by a future run of the garbage collector. */
     auto s = printStorePath(path) + '\0';
-    writeFull(_fdTempRoots.lock()->get(), s);
+    writeFull(fdTempRoots.lock()->get(), s);
 }
 
 static std::string censored = "{censored}";
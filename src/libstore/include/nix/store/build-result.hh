@@ -117,6 +117,16 @@ struct BuildResult
      */
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
 
+    /**
+     * Peak memory usage of the build, in bytes.
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * Number of bytes the build read from and wrote to block devices.
+     */
+    std::optional<uint64_t> ioRead, ioWrite;
+
     bool operator==(const BuildResult &) const noexcept;
     std::strong_ordering operator<=>(const BuildResult &) const noexcept;
 
@@ -131,6 +141,28 @@ struct BuildResult
     }
 };
 
+/**
+ * The resource usage of a local build of a derivation, as recorded
+ * in the Nix database.
+ */
+struct BuildStats
+{
+    BuildResult::Status status = BuildResult::MiscFailure;
+
+    time_t startTime = 0, stopTime = 0;
+
+    std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    std::optional<uint64_t> memoryPeak;
+
+    std::optional<uint64_t> ioRead, ioWrite;
+
+    static BuildStats fromBuildResult(const BuildResult & res);
+
+    bool operator==(const BuildStats &) const noexcept;
+    std::strong_ordering operator<=>(const BuildStats &) const noexcept;
+};
+
 /**
  * A `BuildResult` together with its "primary key".
  */
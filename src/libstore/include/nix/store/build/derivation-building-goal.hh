@@ -16,6 +16,7 @@ using std::map;
 
 #ifndef _WIN32 // TODO enable build hook on Windows
 struct HookInstance;
+struct RemoteBuild;
 struct DerivationBuilder;
 #endif
 
@@ -63,7 +64,8 @@ struct DerivationBuildingGoal : public Goal
      * File descriptor for the log file.
      */
     AutoCloseFD fdLogFile;
-    std::shared_ptr<BufferedSink> logFileSink, logSink;
+    std::shared_ptr<BufferedSink> logFileSink;
+    std::shared_ptr<Sink> logSink;
 
     /**
      * Number of bytes received from the builder's stdout/stderr.
@@ -86,6 +88,11 @@ struct DerivationBuildingGoal : public Goal
      */
     std::unique_ptr<HookInstance> hook;
 
+    /**
+     * The remote build, if `builders-in-process` is enabled.
+     */
+    std::unique_ptr<RemoteBuild> remoteBuild;
+
     std::unique_ptr<DerivationBuilder> builder;
 #endif
 
@@ -127,6 +134,12 @@ struct DerivationBuildingGoal : public Goal
      */
     HookReply tryBuildHook();
 
+    /**
+     * Like `tryBuildHook()`, but using the in-process
+     * `RemoteDispatcher`.
+     */
+    HookReply tryRemoteDispatcher();
+
     /**
      * Open a log file and a pipe to it.
      */
@@ -146,6 +159,9 @@ struct DerivationBuildingGoal : public Goal
     void handleEOF(Descriptor fd) override;
     void flushLine();
 
+    std::optional<std::chrono::steady_clock::time_point> logFlushDeadline() override;
+    void flushLog() override;
+
     /**
      * Wrappers around the corresponding Store methods that first consult the
      * derivation.  This is currently needed because when there is no drv file
@@ -4,6 +4,7 @@
 #include "nix/store/store-api.hh"
 #include "nix/store/build-result.hh"
 
+#include <chrono>
 #include <coroutine>
 
 namespace nix {
@@ -442,6 +443,20 @@ public:
         unreachable();
     }
 
+    /**
+     * The time by which log output buffered by this goal should be
+     * written out by calling `flushLog()`, if there is any.
+     */
+    virtual std::optional<std::chrono::steady_clock::time_point> logFlushDeadline()
+    {
+        return std::nullopt;
+    }
+
+    /**
+     * Write out buffered log output whose deadline has passed.
+     */
+    virtual void flushLog() {}
+
     void trace(std::string_view s);
 
     std::string getName() const
@@ -50,6 +50,11 @@ struct Child
     std::set<MuxablePipePollState::CommChannel> channels;
     bool respectTimeouts;
     bool inBuildSlot;
+    /**
+     * The amount of memory predicted to be used by this build, see
+     * `build-memory-budget`.
+     */
+    uint64_t memoryReserved = 0;
     /**
      * Time we last got output on stdout/stderr
      */
@@ -60,6 +65,7 @@ struct Child
 #ifndef _WIN32 // TODO Enable building on Windows
 /* Forward definition. */
 struct HookInstance;
+struct RemoteThreads;
 #endif
 
 /**
@@ -103,6 +109,17 @@ private:
      */
     size_t nrSubstitutions;
 
+    /**
+     * The sum of the predicted memory usage of the running local
+     * builds.
+     */
+    uint64_t memoryReserved = 0;
+
+    /**
+     * Cache for `predictMemoryUsage()`.
+     */
+    std::map<StorePath, uint64_t> memoryPredictions;
+
     /**
      * Maps used to prevent multiple instantiations of a goal for the
      * same derivation / path.
@@ -171,6 +188,13 @@ public:
 
 #ifndef _WIN32 // TODO Enable building on Windows
     std::unique_ptr<HookInstance> hook;
+
+    /**
+     * The threads of the remote builds started by this worker if
+     * `builders-in-process` is enabled. They're cancelled and joined
+     * when the worker is destroyed.
+     */
+    std::unique_ptr<RemoteThreads> remoteThreads;
 #endif
 
     uint64_t expectedBuilds = 0;
@@ -284,6 +308,19 @@ public:
      */
     void childTerminated(Goal * goal, bool wakeSleepers = true);
 
+    /**
+     * Return the predicted peak memory usage of a local build of
+     * `drvPath`, based on the build statistics of previous builds.
+     */
+    uint64_t predictMemoryUsage(const StorePath & drvPath);
+
+    /**
+     * Whether a local build of `drvPath` can be started now, taking
+     * into account `max-jobs`, `build-memory-budget` and
+     * `max-memory-pressure`.
+     */
+    bool canStartLocalBuild(const StorePath & drvPath);
+
     /**
      * Put `goal` to sleep until a build slot becomes available (which
      * might be right away).
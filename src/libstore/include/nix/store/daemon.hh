@@ -3,6 +3,7 @@
 
 #include "nix/util/serialise.hh"
 #include "nix/store/store-api.hh"
+#include "nix/store/worker-protocol.hh"
 
 namespace nix::daemon {
 
@@ -10,4 +11,68 @@ enum RecursiveFlag : bool { NotRecursive = false, Recursive = true };
 
 void processConnection(ref<Store> store, FdSource && from, FdSink && to, TrustedFlag trusted, RecursiveFlag recursive);
 
+/**
+ * The state of a connection that `processConnectionInThread()` hands
+ * over to a process of its own, to be resumed there with
+ * `resumeConnection()`.
+ */
+struct SuspendedConnection
+{
+    WorkerProto::Version protoVersion;
+
+    WorkerProto::FeatureSet features;
+
+    TrustedFlag trusted;
+
+    /**
+     * The arguments of the last `SetOptions` operation sent by the
+     * client, in wire format, if any.
+     */
+    std::optional<std::string> clientSettings;
+
+    /**
+     * The operation that the client requested and that hasn't been
+     * performed yet. If this is `SetOptions`, its arguments are in
+     * `clientSettings`, otherwise they haven't been read yet.
+     */
+    WorkerProto::Op op;
+
+    /**
+     * Data that has been read from the client but not processed yet.
+     */
+    std::string buffered;
+};
+
+/**
+ * Prepare the current process for serving connections in threads
+ * with `processConnectionInThread()`. This must be called before
+ * starting any of these threads.
+ */
+void initConnectionThreads();
+
+/**
+ * Like `processConnection()`, but for serving one of several
+ * connections that run concurrently in threads of the same process
+ * and that share `store`.
+ *
+ * Since settings are global to the process, this hands the connection
+ * over by calling `handOver` (after which it returns) if the client
+ * asks for settings that differ from the daemon's, or asks to build
+ * or substitute paths, which depends on those settings. The callback
+ * must arrange for the connection to be resumed in a process of its
+ * own.
+ */
+void processConnectionInThread(
+    ref<Store> store,
+    FdSource && from,
+    FdSink && to,
+    TrustedFlag trusted,
+    std::function<void(SuspendedConnection &&)> handOver);
+
+/**
+ * Continue serving a connection handed over by
+ * `processConnectionInThread()`.
+ */
+void resumeConnection(ref<Store> store, FdSource && from, FdSink && to, SuspendedConnection && suspended);
+
 } // namespace nix::daemon
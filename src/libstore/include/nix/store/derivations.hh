@@ -13,6 +13,8 @@
 #include <map>
 #include <variant>
 
+#include <boost/unordered/concurrent_flat_map.hpp>
+
 namespace nix {
 
 struct StoreDirConfig;
@@ -504,10 +506,10 @@ std::map<std::string, Hash> staticOutputHashes(Store & store, const Derivation &
 /**
  * Memoisation of hashDerivationModulo().
  */
-typedef std::map<StorePath, DrvHash> DrvHashes;
+typedef boost::concurrent_flat_map<StorePath, DrvHash, std::hash<StorePath>> DrvHashes;
 
 // FIXME: global, though at least thread-safe.
-extern Sync<DrvHashes> drvHashes;
+extern DrvHashes drvHashes;
 
 struct Source;
 struct Sink;
@@ -0,0 +1,44 @@
+#pragma once
+///@file
+
+#include "nix/util/ref.hh"
+#include "nix/store/derivations.hh"
+
+namespace nix {
+
+/**
+ * Persistent memoisation of `hashDerivationModulo()` for derivations
+ * read from the store. Store derivations are content-addressed and
+ * thus immutable, so entries never need to be invalidated. Entries
+ * are keyed on the full path of the derivation to account for the
+ * store directory.
+ *
+ * The cache is best-effort: if it can't be opened or queried, lookups
+ * miss and updates are dropped.
+ */
+class DrvHashDiskCache
+{
+public:
+    virtual ~DrvHashDiskCache() {}
+
+    /**
+     * Look up the hashes of `drvPaths` in a single transaction.
+     *
+     * @return The entries that were found.
+     */
+    virtual std::map<StorePath, DrvHash> lookup(const StoreDirConfig & store, const StorePathSet & drvPaths) = 0;
+
+    virtual void upsert(const StoreDirConfig & store, const StorePath & drvPath, const DrvHash & h) = 0;
+};
+
+ref<DrvHashDiskCache> getDrvHashDiskCache();
+
+ref<DrvHashDiskCache> getTestDrvHashDiskCache(Path dbPath);
+
+/**
+ * Add the hashes of those of `drvPaths` that are not in `drvHashes`
+ * yet, but are in `cache`, to `drvHashes`.
+ */
+void loadDrvHashes(DrvHashDiskCache & cache, const StoreDirConfig & store, const StorePathSet & drvPaths);
+
+} // namespace nix
@@ -164,6 +164,33 @@ public:
         )",
         {"substitution-max-jobs"}};
 
+    Setting<uint64_t> buildMemoryBudget{
+        this,
+        0,
+        "build-memory-budget",
+        R"(
+          The amount of memory, in bytes, that local builds are expected to use together.
+          Before starting a build, Nix predicts its memory usage from the peak memory usage of previous builds of the same derivation (or of other versions of the same package), as recorded by [`nix derivation stats`](@docroot@/command-ref/new-cli/nix3-derivation-stats.md).
+          If the predicted usage of the running builds plus that of the new build exceeds this budget, the new build is delayed until another build finishes.
+          Builds without recorded history are assumed to use no memory.
+          At least one local build is always allowed to run.
+
+          A value of `0` (the default) disables this feature.
+          Peak memory usage is only recorded for builds that run in a cgroup (see [`use-cgroups`](#conf-use-cgroups)).
+        )"};
+
+    Setting<unsigned int> maxMemoryPressure{
+        this,
+        0,
+        "max-memory-pressure",
+        R"(
+          Delay starting a new local build while the system is under memory pressure, that is, while the percentage of time in which some tasks were stalled waiting for memory over the last 10 seconds (the `some avg10` value of `/proc/pressure/memory`) is at least this value.
+          At least one local build is always allowed to run.
+
+          A value of `0` (the default) disables this feature.
+          This setting is only supported on Linux kernels with pressure stall information.
+        )"};
+
     Setting<unsigned int> buildCores{
         this,
         0,
@@ -411,6 +438,35 @@ public:
           This can drastically reduce build times if the network connection between the local machine and the remote build host is slow.
         )"};
 
+    Setting<uint64_t> buildersTransferCost{
+        this,
+        0,
+        "builders-transfer-cost",
+        R"(
+          The number of bytes that Nix considers as costly to copy to a [remote build machine](#conf-builders) as one build that is already running on it.
+
+          When choosing a machine for a remote build, Nix normally considers only the number of builds running on each machine relative to its speed factor.
+          If this setting is non-zero, Nix also asks the candidate machines that have a free build slot which inputs of the build they already have, and adds the size of the missing inputs divided by this value to the number of running builds.
+          The answers are cached across builds for ten minutes, so a machine is usually only asked about paths it isn't already known to have.
+          With [`builders-in-process`](#conf-builders-in-process), the machines are asked concurrently, and a machine that doesn't answer within two seconds is treated as if it were missing nothing.
+          This favours machines that already have most of the inputs of a build, reducing network traffic.
+          For example, with a value of `1073741824`, a machine that is missing 2 GiB of inputs is treated like a machine that is running two more builds.
+
+          A value of `0` (the default) disables this.
+        )"};
+
+    Setting<bool> buildersInProcess{
+        this,
+        false,
+        "builders-in-process",
+        R"(
+          If set to `true`, Nix dispatches builds to the [remote build machines](#conf-builders) itself rather than through the [`build-hook`](#conf-build-hook).
+          This avoids starting a process and connecting to the remote machine for every build: Nix keeps the connections to each machine open, tracks the number of running builds per machine in memory, and uploads the inputs of several builds to the same machine concurrently.
+          Changes to the list of machines are picked up within a minute.
+
+          With this setting, the build logs of `ssh://` machines are not shown; use `ssh-ng://` machines instead.
+        )"};
+
     Setting<off_t> reservedSize{
         this, 8 * 1024 * 1024, "gc-reserved-space", "Amount of reserved disk space for the garbage collector."};
 
@@ -572,6 +628,25 @@ public:
         )",
         {"build-compress-log"}};
 
+    Setting<bool> indexedLog{
+        this,
+        false,
+        "indexed-build-log",
+        R"(
+          If set to `true`, build logs written to `/nix/var/log/nix/drvs`
+          are stored as a sequence of independently compressed zstd frames
+          (with the suffix `.zst`) together with an index (with the suffix
+          `.zst.idx`). The log is written incrementally while the build is
+          running, which allows [`nix log`](@docroot@/command-ref/new-cli/nix3-log.md)
+          to follow the log of a build in progress and to extract part of
+          a large log without decompressing all of it.
+
+          This setting takes precedence over
+          [`compress-build-log`](#conf-compress-build-log). It is disabled
+          by default because other tools that read build logs directly
+          from `/nix/var/log/nix/drvs` don't understand this format.
+        )"};
+
     Setting<unsigned long> maxLogSize{
         this,
         0,
@@ -752,6 +827,45 @@ public:
             description of the `size` option of `tmpfs` in mount(8). The default
             is `50%`.
         )"};
+
+    Setting<size_t> sandboxStoreOverlayThreshold{
+        this,
+        0,
+        "sandbox-store-overlay-threshold",
+        R"(
+            *Linux only*
+
+            If a sandboxed build has at least this many input store paths,
+            expose the Nix store to it through a single `overlay` mount on top
+            of the host's Nix store, rather than by bind-mounting every input
+            into the sandbox separately. The lower layer of the overlay only
+            contains the input closure, and is kept in
+            `/nix/var/nix/sandbox-overlays/closures` to be reused by builds
+            with the same inputs. Layers that haven't been used for a day are
+            deleted.
+
+            This requires the Nix daemon to run as root. The default, `0`,
+            disables this feature.
+        )"};
+
+    Setting<size_t> sandboxNetworkNamespacePoolSize{
+        this,
+        0,
+        "sandbox-network-namespace-pool-size",
+        R"(
+            *Linux only*
+
+            The maximum number of network namespaces of finished sandboxed
+            builds that Nix keeps around for reuse by subsequent builds.
+            Creating and destroying a network namespace is often the most
+            expensive part of setting up the sandbox, so this speeds up
+            building many small derivations.
+
+            Reused network namespaces are only used when Nix runs as root.
+            They are owned by the host rather than by the build's user
+            namespace, so builds using them can't change the configuration
+            of their loopback interface. The default, `0`, disables reuse.
+        )"};
 #endif
 
 #if defined(__linux__) || defined(__FreeBSD__)
@@ -0,0 +1,77 @@
+#pragma once
+///@file
+
+#include "nix/util/serialise.hh"
+#include "nix/util/file-descriptor.hh"
+
+#include <chrono>
+
+namespace nix {
+
+/**
+ * A sink that writes a build log in the indexed format. The log is
+ * split into chunks that are compressed independently as zstd frames
+ * and appended to the file `path`. For each frame, the file
+ * `path.idx` records the end offset of the frame in the uncompressed
+ * log and in `path`, as two 64-bit little-endian integers. This
+ * allows `readIndexedLog()` to extract part of the log without
+ * decompressing all of it.
+ *
+ * A frame is written once enough data has accumulated, or once data
+ * has been pending for a second, so that readers can follow a log
+ * that is still being written. Since the latter must happen even if
+ * no more data arrives, the owner of the sink must call
+ * `flushPending()` by `flushDeadline()`. The writer holds a lock on
+ * the index until `finish()` is called (see `isIndexedLogActive()`).
+ */
+struct IndexedLogSink : FinishSink
+{
+    IndexedLogSink(const Path & path);
+
+    ~IndexedLogSink();
+
+    void operator()(std::string_view data) override;
+
+    /**
+     * Write any pending data and release the lock.
+     */
+    void finish() override;
+
+    /**
+     * The time by which `flushPending()` should be called, if there
+     * is pending data.
+     */
+    std::optional<std::chrono::steady_clock::time_point> flushDeadline() const;
+
+    /**
+     * Write the pending data as a frame if it has been pending for a
+     * second.
+     */
+    void flushPending();
+
+private:
+    AutoCloseFD fdLog, fdIndex;
+    std::string pending;
+    uint64_t uncompressedSize = 0, compressedSize = 0;
+
+    /**
+     * When `pending` last became non-empty.
+     */
+    std::chrono::steady_clock::time_point pendingSince;
+
+    void writeFrame(size_t size);
+};
+
+/**
+ * Return at most `length` bytes of the indexed log `path`, starting
+ * at byte `offset` of the uncompressed log. Only the frames that
+ * overlap this range are read and decompressed.
+ */
+std::string readIndexedLog(const Path & path, uint64_t offset = 0, std::optional<uint64_t> length = std::nullopt);
+
+/**
+ * Return whether the indexed log `path` is still being written.
+ */
+bool isIndexedLogActive(const Path & path);
+
+} // namespace nix
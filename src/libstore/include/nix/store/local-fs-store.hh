@@ -81,6 +81,23 @@ struct LocalFSStore : virtual Store, virtual GcStore, virtual LogStore
     }
 
     std::optional<std::string> getBuildLogExact(const StorePath & path) override;
+
+    std::optional<std::string>
+    getBuildLogRangeExact(const StorePath & path, uint64_t offset, std::optional<uint64_t> length) override;
+
+    bool isBuildLogActive(const StorePath & path) override;
+
+    bool canFollowBuildLogs() override
+    {
+        return true;
+    }
+
+private:
+
+    /**
+     * The location of the build log of `path` in the indexed format.
+     */
+    Path getIndexedBuildLogPath(const StorePath & path);
 };
 
 } // namespace nix
@@ -8,6 +8,7 @@
 #include "nix/store/indirect-root-store.hh"
 #include "nix/util/sync.hh"
 
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <string>
@@ -160,6 +161,12 @@ private:
         uint64_t availAfterGC = std::numeric_limits<uint64_t>::max();
 
         std::unique_ptr<PublicKeys> publicKeys;
+
+        /**
+         * The value of SQLite's `data_version` when we last checked
+         * whether the path info cache is up to date.
+         */
+        int64_t dataVersion = -1;
     };
 
     Sync<State> _state;
@@ -180,9 +187,9 @@ private:
 public:
 
     /**
-     * Hack for build-remote.cc.
+     * Hack for build-remote.cc and `RemoteDispatcher`.
      */
-    PathSet locksHeld;
+    Sync<PathSet> locksHeld;
 
     /**
      * Initialise the local store, upgrading the schema if
@@ -200,6 +207,20 @@ public:
 
     bool isValidPathUncached(const StorePath & path) override;
 
+    void revalidatePathInfoCache() override;
+
+    /**
+     * Make every cached path info lookup check whether another
+     * process has changed the database, and if so, clear the cache.
+     * This is only needed if the store is long-lived, like that of a
+     * daemon that serves connections in threads, since it adds a
+     * database query to every cache hit.
+     */
+    void enablePathInfoCacheRevalidation()
+    {
+        revalidatePathInfos = true;
+    }
+
     StorePathSet queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute = NoSubstitute) override;
 
     StorePathSet queryAllValidPaths() override;
@@ -234,9 +255,28 @@ public:
 
     void addTempRoot(const StorePath & path) override;
 
-private:
+    /**
+     * While an object of this type exists, the temporary roots that
+     * the current thread adds to `store` are recorded in a file of
+     * their own rather than in the one of the process, and are
+     * released when the object is destroyed. This is used by a daemon
+     * that serves clients in threads, so that a client's temporary
+     * roots don't outlive its connection.
+     */
+    struct TempRootsScope
+    {
+        LocalStore & store;
+        const Path fnTempRoots;
+        Sync<AutoCloseFD> fdTempRoots;
+        Sync<AutoCloseFD> fdGCLock;
+        TempRootsScope * prev;
+
+        TempRootsScope(LocalStore & store);
+        TempRootsScope(const TempRootsScope &) = delete;
+        ~TempRootsScope();
+    };
 
-    void createTempRootsFile();
+private:
 
     /**
      * The file to which we write our temporary roots.
@@ -248,6 +288,11 @@ private:
      */
     Sync<AutoCloseFD> _fdGCLock;
 
+    /**
+     * See `enablePathInfoCacheRevalidation()`.
+     */
+    std::atomic<bool> revalidatePathInfos{false};
+
     /**
      * Connection to the garbage collector.
      */
@@ -376,6 +421,20 @@ public:
     void queryRealisationUncached(
         const DrvOutput &, Callback<std::shared_ptr<const Realisation>> callback) noexcept override;
 
+    /**
+     * Record the resource usage of a build of `drvPath`. Only the
+     * most recent builds of each derivation are kept.
+     */
+    void addBuildStats(const StorePath & drvPath, const BuildStats & stats);
+
+    std::vector<BuildStats> queryBuildStats(const StorePath & drvPath) override;
+
+    /**
+     * Return the statistics of the most recent builds of any version
+     * of the derivation named `name` (as determined by `DrvName`).
+     */
+    std::vector<BuildStats> queryBuildStatsByName(std::string_view name);
+
     std::optional<std::string> getVersion() override;
 
 protected:
@@ -15,8 +15,41 @@ struct LogStore : public virtual Store
      */
     std::optional<std::string> getBuildLog(const StorePath & path);
 
+    /**
+     * Like `getBuildLog()`, but return at most `length` bytes of the
+     * log, starting at byte `offset`.
+     */
+    std::optional<std::string>
+    getBuildLog(const StorePath & path, uint64_t offset, std::optional<uint64_t> length = std::nullopt);
+
     virtual std::optional<std::string> getBuildLogExact(const StorePath & path) = 0;
 
+    /**
+     * Return part of the build log of `path`. The default
+     * implementation fetches the entire log; stores that can do
+     * better should override this.
+     */
+    virtual std::optional<std::string>
+    getBuildLogRangeExact(const StorePath & path, uint64_t offset, std::optional<uint64_t> length);
+
+    /**
+     * Return whether the build log of `path` is still being written,
+     * i.e. whether `getBuildLog()` may return more data later.
+     */
+    virtual bool isBuildLogActive(const StorePath & path)
+    {
+        return false;
+    }
+
+    /**
+     * Whether `isBuildLogActive()` can tell that a build is still
+     * running, i.e. whether build logs can be followed.
+     */
+    virtual bool canFollowBuildLogs()
+    {
+        return false;
+    }
+
     virtual void addBuildLog(const StorePath & path, std::string_view log) = 0;
 
     static LogStore & require(Store & store);
@@ -3,6 +3,9 @@
 
 #include "nix/util/ref.hh"
 #include "nix/store/store-reference.hh"
+#include "nix/store/path.hh"
+
+#include <chrono>
 
 namespace nix {
 
@@ -86,4 +89,28 @@ struct Machine
  */
 Machines getMachines();
 
+/**
+ * How long a path found to be valid on a remote machine is assumed
+ * to stay valid. After that it is queried again, since it may have
+ * been garbage-collected on the machine in the meantime.
+ */
+constexpr std::chrono::minutes knownValidTTL{10};
+
+/**
+ * Return the total NAR size of the paths in `paths` (which must be
+ * valid in `srcStore`) that are not valid in `dstStore`, i.e. the
+ * number of bytes that copying `paths` to `dstStore` would transfer.
+ *
+ * @param knownValid Paths known to be valid in `dstStore`. These are
+ * not queried, and the paths found to be valid are added to it.
+ */
+uint64_t getMissingSize(Store & srcStore, Store & dstStore, const StorePathSet & paths, StorePathSet & knownValid);
+
+/**
+ * Return the "load" of a machine with `slotsInUse` running builds, to
+ * which `missingSize` bytes would have to be copied for a new build,
+ * taking into account `builders-transfer-cost`.
+ */
+double getEffectiveLoad(uint64_t slotsInUse, uint64_t missingSize);
+
 } // namespace nix
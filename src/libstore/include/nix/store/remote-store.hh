@@ -29,6 +29,16 @@ struct RemoteStoreConfig : virtual StoreConfig
         std::numeric_limits<unsigned int>::max(),
         "max-connection-age",
         "Maximum age of a connection before it is closed."};
+
+    const Setting<bool> multiplex{
+        this,
+        false,
+        "multiplex",
+        R"(
+          Whether to send path validity and path info queries over a single connection on which many requests can be in flight at the same time, if the daemon supports this.
+          This speeds up callers that issue many queries concurrently, such as computing the closure of a path.
+          Only connections over a Unix domain socket support this.
+        )"};
 };
 
 /**
@@ -142,6 +152,8 @@ struct RemoteStore : public virtual Store, public virtual GcStore, public virtua
 
     void addBuildLog(const StorePath & drvPath, std::string_view log) override;
 
+    std::vector<BuildStats> queryBuildStats(const StorePath & drvPath) override;
+
     std::optional<std::string> getVersion() override;
 
     void connect() override;
@@ -182,6 +194,25 @@ private:
 
     std::atomic_bool failed{false};
 
+    struct Multiplexer;
+
+    /**
+     * The connection used for multiplexed queries, if it has been
+     * opened. See `RemoteStoreConfig::multiplex`.
+     */
+    Sync<std::shared_ptr<Multiplexer>> multiplexer_;
+
+    std::atomic_bool multiplexUnsupported{false};
+
+    /**
+     * Return the connection for multiplexed queries, opening it if
+     * necessary, or null if multiplexing is disabled or not supported
+     * by the daemon. `synchronous` denotes whether the caller waits
+     * for the reply, which is not possible from the callback of
+     * another multiplexed request.
+     */
+    std::shared_ptr<Multiplexer> getMultiplexer(bool synchronous);
+
     void copyDrvsFromEvalStore(const std::vector<DerivedPath> & paths, std::shared_ptr<Store> evalStore);
 };
 
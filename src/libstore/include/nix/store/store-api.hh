@@ -65,6 +65,7 @@ enum TrustedFlag : bool { NotTrusted = false, Trusted = true };
 
 struct BuildResult;
 struct KeyedBuildResult;
+struct BuildStats;
 
 typedef std::map<StorePath, std::optional<ContentAddress>> StorePathCAMap;
 
@@ -290,6 +291,13 @@ protected:
 
     virtual bool isValidPathUncached(const StorePath & path);
 
+    /**
+     * Called before looking up a path in the in-memory path info
+     * cache. Stores whose contents can be changed by other processes
+     * can override this to drop cache entries that may be stale.
+     */
+    virtual void revalidatePathInfoCache() {}
+
 public:
 
     /**
@@ -739,6 +747,12 @@ public:
      */
     virtual MissingPaths queryMissing(const std::vector<DerivedPath> & targets);
 
+    /**
+     * Return the resource usage of the most recent local builds of
+     * the derivation `drvPath`, most recent first.
+     */
+    virtual std::vector<BuildStats> queryBuildStats(const StorePath & drvPath);
+
     /**
      * Sort a set of paths topologically under the references
      * relation.  If p refers to q, then p precedes q in this list.
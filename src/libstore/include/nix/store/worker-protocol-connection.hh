@@ -28,6 +28,23 @@ struct WorkerProto::BasicConnection
      */
     FeatureSet features;
 
+    /**
+     * The protocol features that we support on a connection that
+     * receives from `fd`. This is `allFeatures`, plus
+     * `featureFdPassing` and `featureMultiplex` if `fd` is a Unix
+     * domain socket. Multiplexing is pointless over SSH (`ssh-ng://`),
+     * where the remote `nix-daemon --stdio` serves a single
+     * connection.
+     *
+     * Both sides being Unix domain sockets does not mean that they
+     * are the two ends of the same socket: a proxy (like `nix-daemon
+     * --stdio` forwarding to another daemon) may sit in between and
+     * drop the file descriptors. So if `featureFdPassing` is
+     * negotiated, both sides must check that passing actually works
+     * with `checkFdPassing()` right after `handshake()`.
+     */
+    static FeatureSet getSupportedFeatures(Descriptor fd);
+
     /**
      * Coercion to `WorkerProto::ReadConn`. This makes it easy to use the
      * factored out serve protocol serializers with a
@@ -72,6 +89,14 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
 
     std::exception_ptr processStderrReturn(Sink * sink = 0, Source * source = 0, bool flush = true, bool block = true);
 
+    /**
+     * Handle a log message of type `msg` (e.g. `STDERR_NEXT`) from
+     * the daemon, reading its payload from `from`.
+     *
+     * @return false if `msg` is not a log message.
+     */
+    static bool processLogMessage(uint64_t msg, Source & from);
+
     void
     processStderr(bool * daemonException, Sink * sink = 0, Source * source = 0, bool flush = true, bool block = true);
 
@@ -101,6 +126,14 @@ struct WorkerProto::BasicClientConnection : WorkerProto::BasicConnection
      */
     ClientHandshakeInfo postHandshake(const StoreDirConfig & store);
 
+    /**
+     * If `featureFdPassing` was negotiated, send a probe file
+     * descriptor to the daemon and remove the feature from `features`
+     * if the daemon did not receive it. Must be called right after
+     * `handshake()`, before anything else is sent.
+     */
+    void checkFdPassing();
+
     void addTempRoot(const StoreDirConfig & remoteStore, bool * daemonException, const StorePath & path);
 
     StorePathSet queryValidPaths(
@@ -160,6 +193,13 @@ struct WorkerProto::BasicServerConnection : WorkerProto::BasicConnection
      * information about the connection.
      */
     void postHandshake(const StoreDirConfig & store, const ClientHandshakeInfo & info);
+
+    /**
+     * Counterpart of `BasicClientConnection::checkFdPassing()`:
+     * receive the probe file descriptor from the client and tell it
+     * whether it arrived.
+     */
+    void checkFdPassing();
 };
 
 } // namespace nix
@@ -32,6 +32,7 @@ struct Source;
 struct DerivedPath;
 struct BuildResult;
 struct KeyedBuildResult;
+struct BuildStats;
 struct ValidPathInfo;
 struct UnkeyedValidPathInfo;
 enum BuildMode : uint8_t;
@@ -136,6 +137,26 @@ struct WorkerProto
     using FeatureSet = std::set<Feature, std::less<>>;
 
     static const FeatureSet allFeatures;
+
+    /**
+     * The daemon supports `Op::QueryBuildStats`.
+     */
+    static constexpr std::string_view featureBuildStats = "build-stats";
+
+    /**
+     * The daemon supports `Op::Multiplex`. Not part of `allFeatures`,
+     * see `BasicConnection::getSupportedFeatures()`.
+     */
+    static constexpr std::string_view featureMultiplex = "multiplex";
+
+    /**
+     * NAR contents are transferred through a pipe that is passed over
+     * the connection (a Unix domain socket) rather than through the
+     * connection itself. This affects `Op::NarFromPath` and
+     * `Op::AddToStoreNar`. Not part of `allFeatures`, see
+     * `BasicConnection::getSupportedFeatures()`.
+     */
+    static constexpr std::string_view featureFdPassing = "fd-passing";
 };
 
 enum struct WorkerProto::Op : uint64_t {
@@ -183,6 +204,23 @@ enum struct WorkerProto::Op : uint64_t {
     AddBuildLog = 45,
     BuildPathsWithResults = 46,
     AddPermRoot = 47,
+    QueryBuildStats = 48,
+
+    /**
+     * Switch the connection to multiplexed mode, in which the client
+     * can send requests without waiting for the replies to previous
+     * ones. Each request consists of a non-zero request ID, an
+     * operation and its arguments (as a string). The daemon performs
+     * the requests concurrently and replies in any order. Each reply
+     * frame starts with the ID of the request it belongs to, followed
+     * by a log message (`STDERR_NEXT` etc.), by `STDERR_ERROR` and the
+     * error, or by `STDERR_LAST` and the result (as a string). The
+     * latter two end the request. A request ID of 0 ends multiplexed
+     * mode once all pending requests have been answered.
+     *
+     * Only operations that query the store are supported.
+     */
+    Multiplex = 49,
 };
 
 struct WorkerProto::ClientHandshakeInfo
@@ -256,6 +294,8 @@ DECLARE_WORKER_SERIALISER(BuildResult);
 template<>
 DECLARE_WORKER_SERIALISER(KeyedBuildResult);
 template<>
+DECLARE_WORKER_SERIALISER(BuildStats);
+template<>
 DECLARE_WORKER_SERIALISER(ValidPathInfo);
 template<>
 DECLARE_WORKER_SERIALISER(UnkeyedValidPathInfo);
@@ -0,0 +1,201 @@
+#include "nix/store/indexed-log.hh"
+#include "nix/store/pathlocks.hh"
+#include "nix/util/compression.hh"
+#include "nix/util/file-system.hh"
+#include "nix/util/util.hh"
+
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
+
+namespace nix {
+
+/**
+ * The amount of uncompressed data per frame. Readers have to
+ * decompress at most one partial frame at either end of a range.
+ */
+static constexpr size_t frameSize = 1024 * 1024;
+
+/**
+ * The size of a record in the index.
+ */
+static constexpr size_t recordSize = 16;
+
+/**
+ * How long data may be pending before it's written as a frame.
+ */
+static constexpr std::chrono::seconds maxPendingTime{1};
+
+static AutoCloseFD openLogFile(const Path & path)
+{
+    /* Don't truncate the file here, since a reader may still be
+       reading a previous log, and we don't hold the lock yet. */
+    AutoCloseFD fd = toDescriptor(open(
+        path.c_str(),
+        O_CREAT | O_WRONLY
+#ifndef _WIN32
+            | O_CLOEXEC
+#endif
+        ,
+        0666));
+    if (!fd)
+        throw SysError("creating log file '%1%'", path);
+    return fd;
+}
+
+IndexedLogSink::IndexedLogSink(const Path & path)
+    : fdLog(openLogFile(path))
+    , fdIndex(openLogFile(path + ".idx"))
+{
+    /* Take the lock before truncating, so that a reader that sees an
+       unlocked index also sees a complete log. */
+    lockFile(fdIndex.get(), ltWrite, true);
+
+    for (auto [fd, fileName] : {std::pair{fdLog.get(), path}, std::pair{fdIndex.get(), path + ".idx"}})
+        if (ftruncate(fd, 0) == -1)
+            throw SysError("truncating log file '%1%'", fileName);
+}
+
+IndexedLogSink::~IndexedLogSink()
+{
+    try {
+        finish();
+    } catch (...) {
+        ignoreExceptionInDestructor();
+    }
+}
+
+void IndexedLogSink::operator()(std::string_view data)
+{
+    if (pending.empty())
+        pendingSince = std::chrono::steady_clock::now();
+
+    pending.append(data);
+
+    while (pending.size() >= frameSize)
+        writeFrame(frameSize);
+
+    flushPending();
+}
+
+void IndexedLogSink::finish()
+{
+    if (!fdIndex)
+        return;
+    if (!pending.empty())
+        writeFrame(pending.size());
+    fdLog.close();
+    /* Closing the index releases the lock. */
+    fdIndex.close();
+}
+
+std::optional<std::chrono::steady_clock::time_point> IndexedLogSink::flushDeadline() const
+{
+    if (pending.empty() || !fdIndex)
+        return std::nullopt;
+    return pendingSince + maxPendingTime;
+}
+
+void IndexedLogSink::flushPending()
+{
+    if (auto deadline = flushDeadline(); deadline && std::chrono::steady_clock::now() >= *deadline)
+        writeFrame(pending.size());
+}
+
+void IndexedLogSink::writeFrame(size_t size)
+{
+    auto frame = compress("zstd", std::string_view(pending).substr(0, size));
+
+    /* Write the frame before its index record, so that readers never
+       see a record for an incomplete frame. */
+    writeFull(fdLog.get(), frame);
+
+    uncompressedSize += size;
+    compressedSize += frame.size();
+
+    StringSink record;
+    record << uncompressedSize << compressedSize;
+    writeFull(fdIndex.get(), record.s);
+
+    pending.erase(0, size);
+    if (!pending.empty())
+        pendingSince = std::chrono::steady_clock::now();
+}
+
+std::string readIndexedLog(const Path & path, uint64_t offset, std::optional<uint64_t> length)
+{
+    /* Read the index first, and ignore a trailing partial record if
+       the log is still being written. */
+    auto index = readFile(path + ".idx");
+    auto nrFrames = index.size() / recordSize;
+
+    /* Return the end offsets of frame `i` in the uncompressed log and
+       in the log file. */
+    auto getEnd = [&](size_t i) -> std::pair<uint64_t, uint64_t> {
+        auto p = (unsigned char *) index.data() + i * recordSize;
+        return {readLittleEndian<uint64_t>(p), readLittleEndian<uint64_t>(p + 8)};
+    };
+
+    auto end = length && *length <= std::numeric_limits<uint64_t>::max() - offset ? offset + *length
+                                                                                   : std::numeric_limits<uint64_t>::max();
+
+    /* Find the first frame that ends after `offset`. */
+    size_t first = 0, last = nrFrames;
+    while (first < last) {
+        auto mid = first + (last - first) / 2;
+        if (getEnd(mid).first <= offset)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+
+    std::string res;
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw SysError("opening log file '%s'", path);
+
+    for (auto i = first; i < nrFrames; ++i) {
+        auto [uncompressedStart, compressedStart] = i > 0 ? getEnd(i - 1) : std::pair<uint64_t, uint64_t>{0, 0};
+        auto [uncompressedEnd, compressedEnd] = getEnd(i);
+
+        if (uncompressedStart >= end)
+            break;
+
+        if (uncompressedEnd < uncompressedStart || compressedEnd < compressedStart)
+            throw Error("index of log file '%s' is corrupt", path);
+
+        std::string frame(compressedEnd - compressedStart, 0);
+        file.seekg(compressedStart);
+        file.read(frame.data(), frame.size());
+        if (!file)
+            throw Error("reading log file '%s': unexpected end of file", path);
+
+        auto data = decompress("zstd", frame);
+        if (data.size() != uncompressedEnd - uncompressedStart)
+            throw Error("log file '%s' is corrupt", path);
+
+        auto from = std::max(offset, uncompressedStart) - uncompressedStart;
+        auto to = std::min(end, uncompressedEnd) - uncompressedStart;
+        res.append(data, from, to - from);
+    }
+
+    return res;
+}
+
+bool isIndexedLogActive(const Path & path)
+{
+    AutoCloseFD fd = toDescriptor(open(
+        (path + ".idx").c_str(),
+        O_RDONLY
+#ifndef _WIN32
+            | O_CLOEXEC
+#endif
+        ));
+    if (!fd)
+        return false;
+    return !lockFile(fd.get(), ltRead, false);
+}
+
+} // namespace nix
@@ -4,6 +4,7 @@
 #include "nix/store/local-fs-store.hh"
 #include "nix/store/globals.hh"
 #include "nix/util/compression.hh"
+#include "nix/store/indexed-log.hh"
 #include "nix/store/derivations.hh"
 
 namespace nix {
@@ -99,11 +100,15 @@ std::optional<std::string> LocalFSStore::getBuildLogExact(const StorePath & path
         Path logPath =
             j == 0 ? fmt("%s/%s/%s/%s", config.logDir.get(), drvsLogDir, baseName.substr(0, 2), baseName.substr(2))
                    : fmt("%s/%s/%s", config.logDir.get(), drvsLogDir, baseName);
+        Path logZstPath = logPath + ".zst";
         Path logBz2Path = logPath + ".bz2";
 
         if (pathExists(logPath))
             return readFile(logPath);
 
+        else if (pathExists(logZstPath))
+            return readIndexedLog(logZstPath);
+
         else if (pathExists(logBz2Path)) {
             try {
                 return decompress("bzip2", readFile(logBz2Path));
@@ -115,4 +120,24 @@ std::optional<std::string> LocalFSStore::getBuildLogExact(const StorePath & path
     return std::nullopt;
 }
 
+Path LocalFSStore::getIndexedBuildLogPath(const StorePath & path)
+{
+    auto baseName = path.to_string();
+    return fmt("%s/%s/%s/%s.zst", config.logDir.get(), drvsLogDir, baseName.substr(0, 2), baseName.substr(2));
+}
+
+std::optional<std::string>
+LocalFSStore::getBuildLogRangeExact(const StorePath & path, uint64_t offset, std::optional<uint64_t> length)
+{
+    auto logPath = getIndexedBuildLogPath(path);
+    if (pathExists(logPath))
+        return readIndexedLog(logPath, offset, length);
+    return LogStore::getBuildLogRangeExact(path, offset, length);
+}
+
+bool LocalFSStore::isBuildLogActive(const StorePath & path)
+{
+    return isIndexedLogActive(getIndexedBuildLogPath(path));
+}
+
 } // namespace nix
@@ -6,12 +6,15 @@
 #include "nix/store/worker-protocol.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/realisation.hh"
+#include "nix/store/build-result.hh"
+#include "nix/store/names.hh"
 #include "nix/store/nar-info.hh"
 #include "nix/util/references.hh"
 #include "nix/util/callback.hh"
 #include "nix/util/topo-sort.hh"
 #include "nix/util/finally.hh"
 #include "nix/util/compression.hh"
+#include "nix/store/indexed-log.hh"
 #include "nix/util/signals.hh"
 #include "nix/store/posix-fs-canonicalise.hh"
 #include "nix/util/posix-source-accessor.hh"
@@ -104,8 +107,13 @@ struct LocalStore::State::Stmts
     SQLiteStmt QueryAllRealisedOutputs;
     SQLiteStmt QueryPathFromHashPart;
     SQLiteStmt QueryValidPaths;
+    SQLiteStmt QueryDataVersion;
     SQLiteStmt QueryRealisationReferences;
     SQLiteStmt AddRealisationReference;
+    SQLiteStmt AddBuildStats;
+    SQLiteStmt QueryBuildStats;
+    SQLiteStmt QueryBuildStatsByName;
+    SQLiteStmt PruneBuildStats;
 };
 
 LocalStore::LocalStore(ref<const Config> config)
@@ -339,6 +347,7 @@ LocalStore::LocalStore(ref<const Config> config)
     // ensure efficient lookup.
     state->stmts->QueryPathFromHashPart.create(state->db, "select path from ValidPaths where path >= ? limit 1;");
     state->stmts->QueryValidPaths.create(state->db, "select path from ValidPaths");
+    state->stmts->QueryDataVersion.create(state->db, "pragma data_version;");
     if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations)) {
         state->stmts->RegisterRealisedOutput.create(
             state->db,
@@ -389,6 +398,41 @@ LocalStore::LocalStore(ref<const Config> config)
                     (select id from Realisations where drvPath = ? and outputName = ?));
             )");
     }
+    if (!config->readOnly) {
+        state->stmts->AddBuildStats.create(
+            state->db,
+            R"(
+                insert into BuildStats (drvPath, drvName, status, startTime, stopTime, cpuUser, cpuSystem, memoryPeak, ioRead, ioWrite)
+                values (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)
+                ;
+            )");
+        state->stmts->QueryBuildStats.create(
+            state->db,
+            R"(
+                select status, startTime, stopTime, cpuUser, cpuSystem, memoryPeak, ioRead, ioWrite from BuildStats
+                    where drvPath = ?
+                    order by id desc
+                    ;
+            )");
+        state->stmts->QueryBuildStatsByName.create(
+            state->db,
+            R"(
+                select status, startTime, stopTime, cpuUser, cpuSystem, memoryPeak, ioRead, ioWrite from BuildStats
+                    where drvName = ?
+                    order by id desc
+                    limit 10
+                    ;
+            )");
+        // Only keep the most recent builds of each derivation.
+        state->stmts->PruneBuildStats.create(
+            state->db,
+            R"(
+                delete from BuildStats
+                    where drvPath = ?1 and id not in
+                        (select id from BuildStats where drvPath = ?1 order by id desc limit 10)
+                    ;
+            )");
+    }
 }
 
 AutoCloseFD LocalStore::openGCLock()
@@ -568,6 +612,18 @@ void LocalStore::upgradeDBSchema(State & state)
             "20220326-ca-derivations",
 #include "ca-specific-schema.sql.gen.hh"
         );
+
+    if (!config->readOnly)
+        doUpgrade(
+            "20261019-build-stats",
+#include "build-stats-schema.sql.gen.hh"
+        );
+
+    if (!config->readOnly)
+        doUpgrade(
+            "20261019-build-stats-name",
+#include "build-stats-name-schema.sql.gen.hh"
+        );
 }
 
 /* To improve purity, users may want to make the Nix store a read-only
@@ -649,6 +705,84 @@ void LocalStore::registerDrvOutput(const Realisation & info)
     });
 }
 
+void LocalStore::addBuildStats(const StorePath & drvPath, const BuildStats & stats)
+{
+    if (config->readOnly)
+        return;
+
+    retrySQLite<void>([&]() {
+        auto state(_state.lock());
+        SQLiteTxn txn(state->db);
+
+        auto useAddBuildStats(state->stmts->AddBuildStats.use());
+        useAddBuildStats(printStorePath(drvPath))(
+            DrvName(drvPath.name().substr(0, drvPath.name().size() - drvExtension.size())).name)(
+            (int64_t) stats.status)((int64_t) stats.startTime)((int64_t) stats.stopTime);
+        for (auto & t : {stats.cpuUser, stats.cpuSystem})
+            useAddBuildStats(t ? (int64_t) t->count() : 0, t.has_value());
+        for (auto & n : {stats.memoryPeak, stats.ioRead, stats.ioWrite})
+            useAddBuildStats((int64_t) n.value_or(0), n.has_value());
+        useAddBuildStats.exec();
+
+        state->stmts->PruneBuildStats.use()(printStorePath(drvPath)).exec();
+        txn.commit();
+    });
+}
+
+static std::vector<BuildStats> readBuildStats(SQLiteStmt::Use & use)
+{
+    auto optionalInt = [&](int col) -> std::optional<uint64_t> {
+        if (use.isNull(col))
+            return std::nullopt;
+        return use.getInt(col);
+    };
+
+    auto optionalMicroseconds = [&](int col) -> std::optional<std::chrono::microseconds> {
+        if (use.isNull(col))
+            return std::nullopt;
+        return std::chrono::microseconds(use.getInt(col));
+    };
+
+    std::vector<BuildStats> res;
+    while (use.next()) {
+        BuildStats stats;
+        stats.status = (BuildResult::Status) use.getInt(0);
+        stats.startTime = use.getInt(1);
+        stats.stopTime = use.getInt(2);
+        stats.cpuUser = optionalMicroseconds(3);
+        stats.cpuSystem = optionalMicroseconds(4);
+        stats.memoryPeak = optionalInt(5);
+        stats.ioRead = optionalInt(6);
+        stats.ioWrite = optionalInt(7);
+        res.push_back(std::move(stats));
+    }
+    return res;
+}
+
+std::vector<BuildStats> LocalStore::queryBuildStats(const StorePath & drvPath)
+{
+    if (config->readOnly)
+        return {};
+
+    return retrySQLite<std::vector<BuildStats>>([&]() {
+        auto state(_state.lock());
+        auto useQueryBuildStats(state->stmts->QueryBuildStats.use()(printStorePath(drvPath)));
+        return readBuildStats(useQueryBuildStats);
+    });
+}
+
+std::vector<BuildStats> LocalStore::queryBuildStatsByName(std::string_view name)
+{
+    if (config->readOnly)
+        return {};
+
+    return retrySQLite<std::vector<BuildStats>>([&]() {
+        auto state(_state.lock());
+        auto useQueryBuildStats(state->stmts->QueryBuildStatsByName.use()(name));
+        return readBuildStats(useQueryBuildStats);
+    });
+}
+
 void LocalStore::cacheDrvOutputMapping(
     State & state, const uint64_t deriver, const std::string & outputName, const StorePath & output)
 {
@@ -799,6 +933,29 @@ bool LocalStore::isValidPathUncached(const StorePath & path)
     });
 }
 
+void LocalStore::revalidatePathInfoCache()
+{
+    if (!config->pathInfoCacheSize || !revalidatePathInfos)
+        return;
+
+    /* SQLite's `data_version` changes whenever another connection
+       (i.e. another process) commits a change to the database, in
+       which case paths may have been added or deleted behind our
+       back. Changes made through this store keep the cache up to
+       date. */
+    retrySQLite<void>([&]() {
+        auto state(_state.lock());
+        auto use(state->stmts->QueryDataVersion.use());
+        if (!use.next())
+            return;
+        auto dataVersion = use.getInt(0);
+        if (dataVersion != state->dataVersion) {
+            state->dataVersion = dataVersion;
+            Store::state.lock()->pathInfoCache.clear();
+        }
+    });
+}
+
 StorePathSet LocalStore::queryValidPaths(const StorePathSet & paths, SubstituteFlag maybeSubstitute)
 {
     StorePathSet res;
@@ -1054,7 +1211,7 @@ void LocalStore::addToStore(const ValidPathInfo & info, Source & source, RepairF
             /* Lock the output path.  But don't lock if we're being called
             from a build hook (whose parent process already acquired a
             lock on this path). */
-            if (!locksHeld.count(printStorePath(info.path)))
+            if (!locksHeld.lock()->count(printStorePath(info.path)))
                 outputLock.lockPaths({realPath});
 
             if (repair || !isValidPath(info.path)) {
@@ -1642,18 +1799,33 @@ void LocalStore::addBuildLog(const StorePath & drvPath, std::string_view log)
 
     auto baseName = drvPath.to_string();
 
-    auto logPath = fmt("%s/%s/%s/%s.bz2", config->logDir, drvsLogDir, baseName.substr(0, 2), baseName.substr(2));
+    auto logPath = fmt("%s/%s/%s/%s", config->logDir, drvsLogDir, baseName.substr(0, 2), baseName.substr(2));
 
-    if (pathExists(logPath))
+    if (pathExists(logPath + ".bz2") || pathExists(logPath + ".zst"))
         return;
 
     createDirs(dirOf(logPath));
 
-    auto tmpFile = fmt("%s.tmp.%d", logPath, getpid());
+    if (settings.indexedLog) {
+        logPath += ".zst";
+        auto tmpFile = fmt("%s.tmp.%d", logPath, getpid());
 
-    writeFile(tmpFile, compress("bzip2", log));
+        IndexedLogSink sink(tmpFile);
+        sink(log);
+        sink.finish();
 
-    std::filesystem::rename(tmpFile, logPath);
+        /* Move the index into place first, since readers look for the
+           log file. */
+        std::filesystem::rename(tmpFile + ".idx", logPath + ".idx");
+        std::filesystem::rename(tmpFile, logPath);
+    } else {
+        logPath += ".bz2";
+        auto tmpFile = fmt("%s.tmp.%d", logPath, getpid());
+
+        writeFile(tmpFile, compress("bzip2", log));
+
+        std::filesystem::rename(tmpFile, logPath);
+    }
 }
 
 std::optional<std::string> LocalStore::getVersion()
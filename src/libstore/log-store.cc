@@ -10,4 +10,24 @@ std::optional<std::string> LogStore::getBuildLog(const StorePath & path)
     return getBuildLogExact(maybePath.value());
 }
 
+std::optional<std::string>
+LogStore::getBuildLog(const StorePath & path, uint64_t offset, std::optional<uint64_t> length)
+{
+    auto maybePath = getBuildDerivationPath(path);
+    if (!maybePath)
+        return std::nullopt;
+    return getBuildLogRangeExact(maybePath.value(), offset, length);
+}
+
+std::optional<std::string>
+LogStore::getBuildLogRangeExact(const StorePath & path, uint64_t offset, std::optional<uint64_t> length)
+{
+    auto log = getBuildLogExact(path);
+    if (!log)
+        return std::nullopt;
+    if (offset >= log->size())
+        return "";
+    return log->substr(offset, length.value_or(std::string::npos));
+}
+
 } // namespace nix
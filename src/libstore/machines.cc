@@ -1,6 +1,7 @@
 #include "nix/store/machines.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/store-open.hh"
+#include "nix/store/store-api.hh"
 
 #include <algorithm>
 
@@ -211,4 +212,34 @@ Machines getMachines()
     return Machine::parseConfig({settings.thisSystem}, settings.builders);
 }
 
+uint64_t getMissingSize(Store & srcStore, Store & dstStore, const StorePathSet & paths, StorePathSet & knownValid)
+{
+    StorePathSet unknown;
+    for (auto & path : paths)
+        if (!knownValid.count(path))
+            unknown.insert(path);
+
+    if (unknown.empty())
+        return 0;
+
+    auto valid = dstStore.queryValidPaths(unknown);
+
+    uint64_t missingSize = 0;
+    for (auto & path : unknown) {
+        if (valid.count(path))
+            knownValid.insert(path);
+        else
+            missingSize += srcStore.queryPathInfo(path)->narSize;
+    }
+
+    return missingSize;
+}
+
+double getEffectiveLoad(uint64_t slotsInUse, uint64_t missingSize)
+{
+    if (!settings.buildersTransferCost)
+        return slotsInUse;
+    return slotsInUse + (double) missingSize / settings.buildersTransferCost;
+}
+
 } // namespace nix
@@ -18,9 +18,16 @@
 #include "nix/util/callback.hh"
 #include "nix/store/filetransfer.hh"
 #include "nix/util/signals.hh"
+#include "nix/util/unix-domain-socket.hh"
 
 #include <nlohmann/json.hpp>
 
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <queue>
+#include <thread>
+
 namespace nix {
 
 /* TODO: Separate these store types into different files, give them better names */
@@ -71,10 +78,11 @@ void RemoteStore::initConnection(Connection & conn)
         StringSink saved;
         TeeSource tee(conn.from, saved);
         try {
-            auto [protoVersion, features] =
-                WorkerProto::BasicClientConnection::handshake(conn.to, tee, PROTOCOL_VERSION, WorkerProto::allFeatures);
+            auto [protoVersion, features] = WorkerProto::BasicClientConnection::handshake(
+                conn.to, tee, PROTOCOL_VERSION, WorkerProto::BasicConnection::getSupportedFeatures(conn.from.fd));
             conn.protoVersion = protoVersion;
             conn.features = features;
+            conn.checkFdPassing();
         } catch (SerialisationError & e) {
             /* In case the other side is waiting for our input, close
                it. */
@@ -156,8 +164,297 @@ void RemoteStore::setOptions()
     setOptions(*(getConnection().handle));
 }
 
+/**
+ * A connection in multiplexed mode (see `WorkerProto::Op::Multiplex`).
+ * Requests are sent by the threads that issue them, while a thread
+ * of our own reads the replies. The callback of each request is then
+ * run by another thread, so that callbacks can send further requests
+ * (e.g. to query the references of a path) without blocking the
+ * reading of replies.
+ */
+struct RemoteStore::Multiplexer
+{
+    ref<Connection> conn;
+
+    /**
+     * Serialises sending requests.
+     */
+    std::mutex sendLock;
+
+    struct State
+    {
+        uint64_t nextId = 1;
+
+        std::map<uint64_t, Callback<std::string>> pending;
+
+        /**
+         * The error that ended the connection, if any.
+         */
+        std::exception_ptr failed;
+    };
+
+    Sync<State> state_;
+
+    /**
+     * Runs the callbacks of completed requests in order. This is
+     * kept alive by its thread, since a callback may destroy the
+     * multiplexer.
+     */
+    struct Executor
+    {
+        struct State
+        {
+            std::queue<std::function<void()>> queue;
+            bool quit = false;
+        };
+
+        Sync<State> state_;
+
+        std::condition_variable wakeup;
+
+        /**
+         * The number of requests that have been sent but whose
+         * callbacks haven't finished yet.
+         */
+        std::atomic<size_t> inFlight{0};
+
+        void enqueue(std::function<void()> work)
+        {
+            state_.lock()->queue.push(std::move(work));
+            wakeup.notify_one();
+        }
+
+        /**
+         * Make the thread exit once it has run all queued callbacks.
+         */
+        void finish()
+        {
+            state_.lock()->quit = true;
+            wakeup.notify_one();
+        }
+
+        void run()
+        {
+            inCallbackThread = true;
+
+            while (true) {
+                std::function<void()> work;
+                {
+                    auto state(state_.lock());
+                    while (state->queue.empty() && !state->quit)
+                        state.wait(wakeup);
+                    if (state->queue.empty())
+                        return;
+                    work = std::move(state->queue.front());
+                    state->queue.pop();
+                }
+                try {
+                    work();
+                } catch (...) {
+                    ignoreExceptionExceptInterrupt(lvlDebug);
+                }
+            }
+        }
+    };
+
+    std::shared_ptr<Executor> executor = std::make_shared<Executor>();
+
+    std::thread readerThread, executorThread;
+
+    /**
+     * Whether the current thread runs callbacks. These must not wait
+     * for other replies, since those are run by the same thread.
+     */
+    static thread_local bool inCallbackThread;
+
+    Multiplexer(ref<Connection> conn)
+        : conn(conn)
+    {
+        conn->to << WorkerProto::Op::Multiplex;
+        auto ex = conn->processStderrReturn();
+        if (ex)
+            std::rethrow_exception(ex);
+
+        executorThread = std::thread([executor(executor)]() { executor->run(); });
+        readerThread = std::thread([this]() { readReplies(); });
+    }
+
+    ~Multiplexer()
+    {
+        try {
+            /* Ending the connection causes the reader thread to exit,
+               after passing the remaining callbacks to the executor. */
+            conn->closeWrite();
+        } catch (...) {
+            ignoreExceptionInDestructor();
+        }
+        readerThread.join();
+
+        executor->finish();
+        if (executorThread.get_id() == std::this_thread::get_id())
+            executorThread.detach();
+        else
+            executorThread.join();
+    }
+
+    bool isFailed()
+    {
+        return (bool) state_.lock()->failed;
+    }
+
+    /**
+     * Send a request. `callback` is called with the result from the
+     * executor thread.
+     */
+    void call(WorkerProto::Op op, std::string_view args, Callback<std::string> callback)
+    {
+        uint64_t id = 0;
+
+        {
+            auto state(state_.lock());
+            if (!state->failed) {
+                id = state->nextId++;
+                state->pending.emplace(id, std::move(callback));
+                debug("sending multiplexed request %d (%d in flight)", id, ++executor->inFlight);
+            }
+        }
+
+        if (!id) {
+            callback.rethrow(state_.lock()->failed);
+            return;
+        }
+
+        try {
+            std::lock_guard<std::mutex> lock(sendLock);
+            conn->to << id << op << args;
+            conn->to.flush();
+        } catch (...) {
+            if (auto callback = takeCallback(id))
+                dispatch(std::move(*callback), {}, std::current_exception());
+        }
+    }
+
+    /**
+     * Synchronous wrapper around `call()`.
+     */
+    std::string call(WorkerProto::Op op, std::string_view args)
+    {
+        assert(!inCallbackThread);
+        std::promise<std::string> promise;
+        call(op, args, {[&](std::future<std::string> result) {
+                 try {
+                     promise.set_value(result.get());
+                 } catch (...) {
+                     promise.set_exception(std::current_exception());
+                 }
+             }});
+        return promise.get_future().get();
+    }
+
+private:
+
+    std::optional<Callback<std::string>> takeCallback(uint64_t id)
+    {
+        auto state(state_.lock());
+        auto i = state->pending.find(id);
+        if (i == state->pending.end())
+            return std::nullopt;
+        auto node = state->pending.extract(i);
+        return std::move(node.mapped());
+    }
+
+    /**
+     * Run `callback` in the executor thread.
+     */
+    void dispatch(Callback<std::string> && callback, std::string && result, std::exception_ptr ex)
+    {
+        auto callbackPtr = std::make_shared<Callback<std::string>>(std::move(callback));
+        executor->enqueue([executor(executor), callbackPtr, result(std::move(result)), ex]() mutable {
+            Finally done([&]() { executor->inFlight--; });
+            if (ex)
+                callbackPtr->rethrow(ex);
+            else
+                (*callbackPtr)(std::move(result));
+        });
+    }
+
+    void readReplies()
+    {
+        try {
+            while (true) {
+                auto id = readNum<uint64_t>(conn->from);
+                auto msg = readNum<uint64_t>(conn->from);
+
+                if (msg == STDERR_LAST || msg == STDERR_ERROR) {
+                    std::string result;
+                    std::exception_ptr ex;
+                    if (msg == STDERR_LAST)
+                        result = readString(conn->from);
+                    else
+                        ex = std::make_exception_ptr(readError(conn->from));
+
+                    auto callback = takeCallback(id);
+                    if (!callback)
+                        throw Error("got a reply to unknown request %d from the Nix daemon", id);
+                    dispatch(std::move(*callback), std::move(result), ex);
+                }
+
+                else if (!WorkerProto::BasicClientConnection::processLogMessage(msg, conn->from))
+                    throw Error("got unknown message type %x from Nix daemon", msg);
+            }
+        } catch (...) {
+            /* Fail all pending requests. Note that no new requests
+               are added once `failed` is set. */
+            decltype(State::pending) pending;
+            {
+                auto state(state_.lock());
+                state->failed = std::current_exception();
+                std::swap(pending, state->pending);
+            }
+            for (auto & [id, callback] : pending)
+                dispatch(std::move(callback), {}, std::current_exception());
+        }
+    }
+};
+
+thread_local bool RemoteStore::Multiplexer::inCallbackThread = false;
+
+std::shared_ptr<RemoteStore::Multiplexer> RemoteStore::getMultiplexer(bool synchronous)
+{
+    if (!config.multiplex || multiplexUnsupported || (synchronous && Multiplexer::inCallbackThread))
+        return nullptr;
+
+    std::shared_ptr<Multiplexer> prev;
+
+    auto multiplexer(multiplexer_.lock());
+
+    if (*multiplexer && (*multiplexer)->isFailed())
+        /* Reconnect, e.g. because the daemon was restarted. The old
+           connection is closed after releasing the lock. */
+        prev = std::move(*multiplexer);
+
+    if (!*multiplexer) {
+        if (!getConnection()->features.contains(WorkerProto::featureMultiplex)) {
+            multiplexUnsupported = true;
+            return nullptr;
+        }
+        auto conn = openConnectionWrapper();
+        initConnection(*conn);
+        *multiplexer = std::make_shared<Multiplexer>(conn);
+    }
+
+    return *multiplexer;
+}
+
 bool RemoteStore::isValidPathUncached(const StorePath & path)
 {
+    if (auto multiplexer = getMultiplexer(true)) {
+        StringSink args;
+        args << printStorePath(path);
+        StringSource result(multiplexer->call(WorkerProto::Op::IsValidPath, args.s));
+        return readInt(result);
+    }
+
     auto conn(getConnection());
     conn->to << WorkerProto::Op::IsValidPath << printStorePath(path);
     conn.processStderr();
@@ -259,6 +556,28 @@ void RemoteStore::queryPathInfoUncached(
     const StorePath & path, Callback<std::shared_ptr<const ValidPathInfo>> callback) noexcept
 {
     try {
+        if (auto multiplexer = getMultiplexer(false)) {
+            StringSink args;
+            args << printStorePath(path);
+            auto callbackPtr = std::make_shared<decltype(callback)>(std::move(callback));
+            multiplexer->call(
+                WorkerProto::Op::QueryPathInfo,
+                args.s,
+                {[this, path, callbackPtr, version{multiplexer->conn->protoVersion}](std::future<std::string> fut) {
+                    try {
+                        StringSource result(fut.get());
+                        if (!readInt(result))
+                            throw InvalidPath("path '%s' is not valid", printStorePath(path));
+                        auto info = WorkerProto::Serialise<UnkeyedValidPathInfo>::read(
+                            *this, WorkerProto::ReadConn{.from = result, .version = version});
+                        (*callbackPtr)(std::make_shared<const ValidPathInfo>(StorePath{path}, std::move(info)));
+                    } catch (...) {
+                        callbackPtr->rethrow();
+                    }
+                }});
+            return;
+        }
+
         std::shared_ptr<const ValidPathInfo> info;
         {
             auto conn(getConnection());
@@ -486,6 +805,45 @@ void RemoteStore::addToStore(const ValidPathInfo & info, Source & source, Repair
                  << repair << !checkSigs;
 
         if (GET_PROTOCOL_MINOR(conn->protoVersion) >= 23) {
+#ifndef _WIN32
+            if (conn->features.contains(WorkerProto::featureFdPassing)) {
+                /* Wait until the daemon is ready to receive the pipe
+                   through which we send the NAR. */
+                conn.processStderr();
+
+                debug("sending NAR of '%s' to the daemon through a pipe", printStorePath(info.path));
+                Pipe pipe;
+                pipe.create();
+                sendFds(conn->from.fd, {pipe.readSide.get()});
+                pipe.readSide.close();
+
+                try {
+                    FdSink pipeSink(pipe.writeSide.get());
+                    size_t checked = 0;
+                    LambdaSink sink([&](std::string_view data) {
+                        pipeSink(data);
+                        /* Whenever a chunk was written, process log
+                           messages and errors from the daemon. */
+                        if (pipeSink.written != checked) {
+                            checked = pipeSink.written;
+                            conn.processStderr(nullptr, nullptr, false, false);
+                        }
+                    });
+                    copyNAR(source, sink);
+                    pipeSink.flush();
+                } catch (SysError & e) {
+                    /* The daemon closed the pipe, probably because of
+                       an error, which is more useful to report. */
+                    if (e.errNo == EPIPE)
+                        conn.processStderr();
+                    throw;
+                }
+
+                pipe.writeSide.close();
+                conn.processStderr();
+                return;
+            }
+#endif
             conn.withFramedSink([&](Sink & sink) { copyNAR(source, sink); });
         } else if (GET_PROTOCOL_MINOR(conn->protoVersion) >= 21) {
             conn.processStderr(0, &source);
@@ -823,6 +1181,16 @@ void RemoteStore::addBuildLog(const StorePath & drvPath, std::string_view log)
     readInt(conn->from);
 }
 
+std::vector<BuildStats> RemoteStore::queryBuildStats(const StorePath & drvPath)
+{
+    auto conn(getConnection());
+    if (!conn->features.contains(WorkerProto::featureBuildStats))
+        unsupported("queryBuildStats");
+    conn->to << WorkerProto::Op::QueryBuildStats << printStorePath(drvPath);
+    conn.processStderr();
+    return WorkerProto::Serialise<std::vector<BuildStats>>::read(*this, *conn);
+}
+
 std::optional<std::string> RemoteStore::getVersion()
 {
     auto conn(getConnection());
@@ -854,6 +1222,26 @@ void RemoteStore::flushBadConnections()
 void RemoteStore::narFromPath(const StorePath & path, Sink & sink)
 {
     auto conn(getConnection());
+
+#ifndef _WIN32
+    if (conn->features.contains(WorkerProto::featureFdPassing)) {
+        conn->to << WorkerProto::Op::NarFromPath << printStorePath(path);
+        conn->to.flush();
+
+        /* The daemon sends the pipe through which it sends the NAR
+           before any other reply. */
+        auto fds = receiveFds(conn->from.fd, 1);
+        conn.processStderr();
+        if (fds.empty())
+            throw Error("the Nix daemon did not send a pipe for the NAR of '%s'", printStorePath(path));
+
+        debug("receiving NAR of '%s' from the daemon through a pipe", printStorePath(path));
+        FdSource source(fds[0].get());
+        copyNAR(source, sink);
+        return;
+    }
+#endif
+
     conn->narFromPath(*this, &conn.daemonException, path, [&](Source & source) { copyNAR(conn->from, sink); });
 }
 
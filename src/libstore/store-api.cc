@@ -2,6 +2,7 @@
 #include "nix/util/source-accessor.hh"
 #include "nix/store/globals.hh"
 #include "nix/store/derived-path.hh"
+#include "nix/store/build-result.hh"
 #include "nix/store/realisation.hh"
 #include "nix/store/derivations.hh"
 #include "nix/store/store-api.hh"
@@ -544,6 +545,8 @@ void Store::querySubstitutablePathInfos(const StorePathCAMap & paths, Substituta
 
 bool Store::isValidPath(const StorePath & storePath)
 {
+    revalidatePathInfoCache();
+
     {
         auto state_(state.lock());
         auto res = state_->pathInfoCache.get(storePath.to_string());
@@ -612,6 +615,8 @@ std::optional<std::shared_ptr<const ValidPathInfo>> Store::queryPathInfoFromClie
 {
     auto hashPart = std::string(storePath.hashPart());
 
+    revalidatePathInfoCache();
+
     {
         auto res = state.lock()->pathInfoCache.get(storePath.to_string());
         if (res && res->isKnownNow()) {
@@ -891,6 +896,11 @@ StorePathSet Store::exportReferences(const StorePathSet & storePaths, const Stor
     return paths;
 }
 
+std::vector<BuildStats> Store::queryBuildStats(const StorePath & drvPath)
+{
+    unsupported("queryBuildStats");
+}
+
 const Store::Stats & Store::getStats()
 {
     {
@@ -364,6 +364,11 @@ private:
      */
     void checkOutputs(const std::map<std::string, ValidPathInfo> & outputs);
 
+    /**
+     * Record the resource usage of this build in the Nix database.
+     */
+    void recordBuildStats(BuildResult::Status status);
+
 public:
 
     void deleteTmpDir(bool force) override;
@@ -546,6 +551,8 @@ std::variant<std::pair<BuildResult::Status, Error>, SingleDrvOutputs> Derivation
 
         deleteTmpDir(true);
 
+        recordBuildStats(BuildResult::Built);
+
         return std::move(builtOutputs);
 
     } catch (BuildError & e) {
@@ -554,10 +561,23 @@ std::variant<std::pair<BuildResult::Status, Error>, SingleDrvOutputs> Derivation
                                  : !derivationType.isSandboxed() || diskFull ? BuildResult::TransientFailure
                                                                              : BuildResult::PermanentFailure;
 
+        recordBuildStats(st);
+
         return std::pair{std::move(st), std::move(e)};
     }
 }
 
+void DerivationBuilderImpl::recordBuildStats(BuildResult::Status status)
+{
+    try {
+        auto stats = BuildStats::fromBuildResult(buildResult);
+        stats.status = status;
+        getLocalStore(store).addBuildStats(drvPath, stats);
+    } catch (...) {
+        ignoreExceptionExceptInterrupt();
+    }
+}
+
 void DerivationBuilderImpl::cleanupBuild()
 {
     deleteTmpDir(false);
@@ -3,6 +3,8 @@
 #  include "nix/store/personality.hh"
 #  include "nix/util/cgroup.hh"
 #  include "nix/util/linux-namespaces.hh"
+#  include "nix/util/sync.hh"
+#  include "nix/util/users.hh"
 #  include "linux/fchmodat2-compat.hh"
 
 #  include <sys/ioctl.h>
@@ -13,6 +15,10 @@
 #  include <sys/param.h>
 #  include <sys/mount.h>
 #  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#  include <sys/xattr.h>
+
+#  include <chrono>
 
 #  if HAVE_SECCOMP
 #    include <seccomp.h>
@@ -153,6 +159,93 @@ static void doBind(const Path & source, const Path & target, bool optional = fal
     }
 }
 
+static void bringUpLoopback()
+{
+    AutoCloseFD fd(socket(PF_INET, SOCK_DGRAM, IPPROTO_IP));
+    if (!fd)
+        throw SysError("cannot open IP socket");
+
+    struct ifreq ifr;
+    strcpy(ifr.ifr_name, "lo");
+    ifr.ifr_flags = IFF_UP | IFF_LOOPBACK | IFF_RUNNING;
+    if (ioctl(fd.get(), SIOCSIFFLAGS, &ifr) == -1)
+        throw SysError("cannot set loopback interface flags");
+}
+
+/**
+ * Network namespaces of finished builds, kept for reuse by
+ * subsequent builds (see `sandbox-network-namespace-pool-size`).
+ */
+static Sync<std::vector<AutoCloseFD>> networkNamespacePool;
+
+/**
+ * Get a network namespace with only a loopback interface from the
+ * pool, or create a new one.
+ */
+static AutoCloseFD getNetworkNamespace()
+{
+    {
+        auto pool(networkNamespacePool.lock());
+        if (!pool->empty()) {
+            auto fd = std::move(pool->back());
+            pool->pop_back();
+            return fd;
+        }
+    }
+
+    debug("creating network namespace for the sandbox pool");
+
+    Pipe ready, done;
+    ready.create();
+    done.create();
+
+    /* Create the namespace in a child process, and keep the child
+       alive until we've opened the namespace. */
+    Pid child = startProcess([&]() {
+        ready.readSide.close();
+        done.writeSide.close();
+
+        if (unshare(CLONE_NEWNET) == -1)
+            throw SysError("creating network namespace");
+
+        bringUpLoopback();
+
+        writeFull(ready.writeSide.get(), "1");
+
+        drainFD(done.readSide.get());
+
+        _exit(0);
+    });
+
+    ready.writeSide.close();
+    done.readSide.close();
+
+    if (drainFD(ready.readSide.get()) != "1")
+        throw Error("unable to create a network namespace");
+
+    AutoCloseFD fd(open(fmt("/proc/%d/ns/net", (pid_t) child).c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd)
+        throw SysError("opening network namespace");
+
+    done.writeSide.close();
+
+    if (child.wait() != 0)
+        throw Error("unable to create a network namespace");
+
+    return fd;
+}
+
+/**
+ * Return a network namespace to the pool. This must only be done
+ * once no process of the build that used it is left.
+ */
+static void releaseNetworkNamespace(AutoCloseFD && fd)
+{
+    auto pool(networkNamespacePool.lock());
+    if (pool->size() < settings.sandboxNetworkNamespacePoolSize)
+        pool->push_back(std::move(fd));
+}
+
 struct LinuxDerivationBuilder : DerivationBuilderImpl
 {
     using DerivationBuilderImpl::DerivationBuilderImpl;
@@ -179,6 +272,13 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
     AutoCloseFD sandboxMountNamespace;
     AutoCloseFD sandboxUserNamespace;
 
+    /**
+     * The network namespace from the pool that the builder runs in,
+     * if any. Otherwise the builder gets a fresh network namespace
+     * (if sandboxed).
+     */
+    AutoCloseFD pooledNetworkNamespace;
+
     /**
      * On Linux, whether we're doing the build in its own user
      * namespace.
@@ -197,6 +297,19 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
     PathsInChroot pathsInChroot;
 
+    /**
+     * If the Nix store is exposed to the builder through an overlay
+     * mount (see `sandbox-store-overlay-threshold`), the directory
+     * containing the overlay's upper and work directories and its
+     * mount point.
+     */
+    std::optional<Path> storeOverlayDir;
+
+    /**
+     * RAII object to delete the overlay directories.
+     */
+    std::shared_ptr<AutoDelete> autoDelStoreOverlay;
+
     /**
      * The cgroup of the builder, if any.
      */
@@ -207,6 +320,8 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
     void deleteTmpDir(bool force) override
     {
         autoDelChroot.reset(); /* this runs the destructor */
+        unmountStoreOverlay();
+        autoDelStoreOverlay.reset();
 
         DerivationBuilderImpl::deleteTmpDir(force);
     }
@@ -370,10 +485,14 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
         pathsInChroot = getPathsInSandbox();
 
-        for (auto & i : inputPaths) {
-            auto p = store.printStorePath(i);
-            pathsInChroot.insert_or_assign(p, store.toRealPath(p));
-        }
+        if (settings.sandboxStoreOverlayThreshold && inputPaths.size() >= settings.sandboxStoreOverlayThreshold)
+            prepareStoreOverlay();
+
+        if (!storeOverlayDir)
+            for (auto & i : inputPaths) {
+                auto p = store.printStorePath(i);
+                pathsInChroot.insert_or_assign(p, store.toRealPath(p));
+            }
 
         /* If we're repairing, checking or rebuilding part of a
            multiple-outputs derivation, it's possible that we're
@@ -400,6 +519,209 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
         }
     }
 
+    /**
+     * Mount an overlay that makes the input closure visible in the
+     * sandbox. This replaces a bind mount for every input by a single
+     * mount, which `startChild()` bind-mounts onto the store in the
+     * chroot.
+     *
+     * The overlay has two lower layers: a layer containing only the
+     * input closure (see `getClosureLayer()`), and the host store,
+     * which provides the contents of the inputs. The store in the
+     * sandbox is the `store` directory of the overlay, so the outputs
+     * end up in the `upper/store` directory.
+     */
+    void prepareStoreOverlay()
+    {
+        auto & localStore = getLocalStore(store);
+
+        /* The closure layer uses extended attributes in the
+           `trusted` namespace, which only root can set. */
+        if (!isRootUser()) {
+            debug("not using an overlay of the Nix store in the sandbox, because we're not running as root");
+            return;
+        }
+
+        /* The upper directory can't be inside the lower directory
+           (i.e. the store), but the outputs are moved from the upper
+           directory into the store, so it must be on the same file
+           system. The same goes for the hard links in the closure
+           layer. */
+        auto overlaysDir = localStore.config->stateDir.get() + "/sandbox-overlays";
+        createDirs(overlaysDir);
+
+        if (lstat(overlaysDir).st_dev != lstat(localStore.config->realStoreDir.get()).st_dev) {
+            warn(
+                "not using an overlay of the Nix store in the sandbox, because '%s' is not on the same file system as the Nix store",
+                overlaysDir);
+            return;
+        }
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        auto dir = overlaysDir + "/" + std::string(drvPath.to_string());
+
+        /* Unmount a left-over overlay of a previous build of this
+           derivation, e.g. if Nix was killed. */
+        umount2((dir + "/merged").c_str(), MNT_DETACH);
+        deletePath(dir);
+
+        autoDelStoreOverlay = std::make_shared<AutoDelete>(dir);
+
+        printMsg(lvlChatty, "exposing the Nix store in the sandbox through an overlay in '%s'", dir);
+
+        if (mkdir(dir.c_str(), 0700) == -1)
+            throw SysError("cannot create '%s'", dir);
+
+        createDir(dir + "/work", 0700);
+        createDir(dir + "/merged", 0700);
+
+        /* The `store` directory in the upper directory becomes the
+           root of the store in the sandbox, so give it the same
+           permissions as the fake Nix store in the chroot. */
+        createDir(dir + "/upper", 0755);
+        auto upperDir = dir + "/upper/store";
+        createDir(upperDir, 0755);
+        chmod_(upperDir, 01775);
+
+        if (buildUser && chown(upperDir.c_str(), 0, buildUser->getGID()) == -1)
+            throw SysError("cannot change ownership of '%1%'", upperDir);
+
+        /* Determine which entries of the host store the build may
+           see: its inputs and the store paths in `sandbox-paths`, but
+           not its outputs. The latter may already exist if we're
+           checking, repairing or building some of the outputs of a
+           derivation, in which case the builder must not see (and
+           fail to create) them. */
+        StringSet visible;
+        for (auto & i : inputPaths)
+            visible.insert(std::string(i.to_string()));
+        for (auto & [target, source] : pathsInChroot)
+            if (store.isInStore(target) && source.source == store.toRealPath(target))
+                visible.insert(std::string(store.toStorePath(target).first.to_string()));
+        for (auto & i : drv.outputsAndOptPaths(store))
+            if (i.second.second)
+                visible.erase(std::string(i.second.second->to_string()));
+
+        auto closureLayer = getClosureLayer(overlaysDir + "/closures", visible);
+
+        auto options =
+            fmt("lowerdir=%s:%s,upperdir=%s/upper,workdir=%s/work,redirect_dir=follow,index=off",
+                closureLayer,
+                localStore.config->realStoreDir.get(),
+                dir,
+                dir);
+        if (mount("overlay", (dir + "/merged").c_str(), "overlay", 0, options.c_str()) == -1)
+            throw SysError("unable to mount an overlay of the Nix store on '%s'", dir + "/merged");
+
+        storeOverlayDir = dir;
+
+        printMsg(
+            lvlChatty,
+            "set up the Nix store overlay for %d store paths in %d ms",
+            visible.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime)
+                .count());
+    }
+
+    /**
+     * Return an overlay layer whose opaque `store` directory contains
+     * an entry for every store path in `visible`, and nothing else.
+     * Directories are empty, with a redirect to the corresponding
+     * store path in the host store; other store paths are hard links.
+     * Layers are cached in `closuresDir`, so builds with the same
+     * inputs share a layer.
+     */
+    Path getClosureLayer(const Path & closuresDir, const StringSet & visible)
+    {
+        auto & localStore = getLocalStore(store);
+        auto realStoreDir = localStore.config->realStoreDir.get();
+
+        createDirs(closuresDir);
+
+        auto layer =
+            closuresDir + "/"
+            + hashString(HashAlgorithm::SHA256, concatStringsSep("\n", visible)).to_string(HashFormat::Nix32, false);
+
+        if (pathExists(layer)) {
+            debug("reusing the Nix store overlay layer '%s'", layer);
+            /* Record that the layer is in use, so that it isn't
+               removed as stale below. */
+            if (utimensat(AT_FDCWD, layer.c_str(), nullptr, 0) == -1)
+                throw SysError("updating the modification time of '%s'", layer);
+            return layer;
+        }
+
+        /* Remove layers that haven't been used for a day. These keep
+           store paths that are not directories alive by hard link
+           after they've been garbage-collected. */
+        auto now = time(nullptr);
+        for (auto & entry : DirectoryIterator{closuresDir}) {
+            auto path = entry.path().string();
+            if (lstat(path).st_mtime < now - 24 * 60 * 60)
+                deletePath(path);
+        }
+
+        /* Create the layer under a temporary name and rename it into
+           place, so that concurrent builds never see a partial
+           layer. */
+        auto tmpLayer = makeTempPath(closuresDir, ".tmp");
+        AutoDelete autoDelTmpLayer(tmpLayer);
+        createDir(tmpLayer, 0755);
+
+        /* Making the directory opaque hides the entries of the host
+           store that aren't in the layer. */
+        auto layerStoreDir = tmpLayer + "/store";
+        createDir(layerStoreDir, 0755);
+        if (setxattr(layerStoreDir.c_str(), "trusted.overlay.opaque", "y", 1, 0) == -1)
+            throw SysError("making '%s' opaque", layerStoreDir);
+
+        for (auto & name : visible) {
+            checkInterrupt();
+            auto source = realStoreDir + "/" + name;
+            auto target = layerStoreDir + "/" + name;
+            auto st = lstat(source);
+            if (S_ISDIR(st.st_mode)) {
+                if (mkdir(target.c_str(), st.st_mode & 07777) == -1)
+                    throw SysError("creating directory '%s'", target);
+                /* Absolute redirects are relative to the root of
+                   the lower layers, i.e. the host store. */
+                auto redirect = "/" + name;
+                if (setxattr(target.c_str(), "trusted.overlay.redirect", redirect.data(), redirect.size(), 0) == -1)
+                    throw SysError("setting the overlay redirect of '%s'", target);
+                if (lchown(target.c_str(), st.st_uid, st.st_gid) == -1)
+                    throw SysError("changing ownership of '%s'", target);
+                chmod_(target, st.st_mode & 07777);
+                setWriteTime(target, st);
+            } else if (link(source.c_str(), target.c_str()) == -1) {
+                if (errno != EMLINK)
+                    throw SysError("creating hard link '%s'", target);
+                /* Too many links to the file, e.g. because it's been
+                   deduplicated by `nix-store --optimise`. */
+                copyFile(source, target, false);
+            }
+        }
+
+        if (rename(tmpLayer.c_str(), layer.c_str()) == -1) {
+            /* Another build created the same layer in the meantime. */
+            if (errno != EEXIST && errno != ENOTEMPTY)
+                throw SysError("renaming '%s' to '%s'", tmpLayer, layer);
+        } else
+            autoDelTmpLayer.cancel();
+
+        return layer;
+    }
+
+    /**
+     * Unmount the overlay created by `prepareStoreOverlay()`. The
+     * builder has its own copy of the mount in its mount namespace.
+     */
+    void unmountStoreOverlay()
+    {
+        if (storeOverlayDir && umount2((*storeOverlayDir + "/merged").c_str(), MNT_DETACH) == -1 && errno != EINVAL)
+            debug("unable to unmount the Nix store overlay in '%s': %s", *storeOverlayDir, strerror(errno));
+    }
+
     Strings getPreBuildHookArgs() override
     {
         assert(!chrootRootDir.empty());
@@ -408,6 +730,10 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
     Path realPathInSandbox(const Path & p) override
     {
+        /* Paths written to the store by the builder end up in the
+           overlay's upper directory. */
+        if (storeOverlayDir && store.isInStore(p))
+            return *storeOverlayDir + "/upper/store/" + std::string(baseNameOf(p));
         // FIXME: why the needsHashRewrite() conditional?
         return !needsHashRewrite() ? chrootRootDir + p : store.toRealPath(p);
     }
@@ -452,6 +778,11 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
         usingUserNamespace = userNamespacesSupported();
 
+        /* Entering a network namespace that we created requires
+           privileges in the host user namespace. */
+        if (derivationType.isSandboxed() && settings.sandboxNetworkNamespacePoolSize > 0 && isRootUser())
+            pooledNetworkNamespace = getNetworkNamespace();
+
         Pipe sendPid;
         sendPid.create();
 
@@ -476,7 +807,10 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
                 ProcessOptions options;
                 options.cloneFlags = CLONE_NEWPID | CLONE_NEWNS | CLONE_NEWIPC | CLONE_NEWUTS | CLONE_PARENT | SIGCHLD;
-                if (derivationType.isSandboxed())
+                if (pooledNetworkNamespace) {
+                    if (setns(pooledNetworkNamespace.get(), CLONE_NEWNET) == -1)
+                        throw SysError("entering network namespace");
+                } else if (derivationType.isSandboxed())
                     options.cloneFlags |= CLONE_NEWNET;
                 if (usingUserNamespace)
                     options.cloneFlags |= CLONE_NEWUSER;
@@ -570,19 +904,10 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
 
         userNamespaceSync.readSide = -1;
 
-        if (derivationType.isSandboxed()) {
-
-            /* Initialise the loopback interface. */
-            AutoCloseFD fd(socket(PF_INET, SOCK_DGRAM, IPPROTO_IP));
-            if (!fd)
-                throw SysError("cannot open IP socket");
-
-            struct ifreq ifr;
-            strcpy(ifr.ifr_name, "lo");
-            ifr.ifr_flags = IFF_UP | IFF_LOOPBACK | IFF_RUNNING;
-            if (ioctl(fd.get(), SIOCSIFFLAGS, &ifr) == -1)
-                throw SysError("cannot set loopback interface flags");
-        }
+        /* Initialise the loopback interface. Pooled network
+           namespaces already have it. */
+        if (derivationType.isSandboxed() && !pooledNetworkNamespace)
+            bringUpLoopback();
 
         /* Set the hostname etc. to fixed values. */
         char hostname[] = "localhost";
@@ -618,7 +943,14 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
            to fail with EINVAL. Don't know why. */
         Path chrootStoreDir = chrootRootDir + store.storeDir;
 
-        if (mount(chrootStoreDir.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
+        if (storeOverlayDir) {
+            /* Expose the input closure through the overlay mounted
+               by prepareStoreOverlay(), with writes (i.e. the
+               outputs) going to its upper directory. */
+            auto source = *storeOverlayDir + "/merged/store";
+            if (mount(source.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
+                throw SysError("unable to bind mount '%s' to '%s'", source, chrootStoreDir);
+        } else if (mount(chrootStoreDir.c_str(), chrootStoreDir.c_str(), 0, MS_BIND, 0) == -1)
             throw SysError("unable to bind mount the Nix store", chrootStoreDir);
 
         if (mount(0, chrootStoreDir.c_str(), 0, MS_SHARED, 0) == -1)
@@ -682,6 +1014,10 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
             if (i.second.source == "/proc")
                 continue; // backwards compatibility
 
+            /* Store paths are already visible through the overlay. */
+            if (storeOverlayDir && store.isInStore(i.first) && i.second.source == store.toRealPath(i.first))
+                continue;
+
 #  if HAVE_EMBEDDED_SANDBOX_SHELL
             if (i.second.source == "__embedded_sandbox_shell__") {
                 static unsigned char sh[] = {
@@ -803,16 +1139,30 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
         sandboxMountNamespace = -1;
         sandboxUserNamespace = -1;
 
-        return DerivationBuilderImpl::unprepareBuild();
+        auto res = DerivationBuilderImpl::unprepareBuild();
+
+        /* The builder and its PID namespace are gone, so nothing can
+           use the network namespace anymore. */
+        if (pooledNetworkNamespace)
+            releaseNetworkNamespace(std::move(pooledNetworkNamespace));
+
+        return res;
     }
 
     void killSandbox(bool getStats) override
     {
+        /* The outputs are moved out of the upper directory of the
+           overlay, which mustn't be modified while it's mounted. */
+        unmountStoreOverlay();
+
         if (cgroup) {
             auto stats = destroyCgroup(*cgroup);
             if (getStats) {
                 buildResult.cpuUser = stats.cpuUser;
                 buildResult.cpuSystem = stats.cpuSystem;
+                buildResult.memoryPeak = stats.memoryPeak;
+                buildResult.ioRead = stats.ioRead;
+                buildResult.ioWrite = stats.ioWrite;
             }
             return;
         }
@@ -833,8 +1183,10 @@ struct ChrootLinuxDerivationBuilder : LinuxDerivationBuilder
                 if (buildMode != bmCheck && status.known->isValid())
                     continue;
                 auto p = store.toRealPath(status.known->path);
-                if (pathExists(chrootRootDir + p))
-                    std::filesystem::rename((chrootRootDir + p), p);
+                auto pInSandbox = storeOverlayDir ? realPathInSandbox(store.printStorePath(status.known->path))
+                                                  : chrootRootDir + p;
+                if (pathExists(pInSandbox))
+                    std::filesystem::rename(pInSandbox, p);
             }
     }
 
@@ -0,0 +1,655 @@
+#include "nix/store/build/remote-dispatcher.hh"
+#include "nix/store/build-result.hh"
+#include "nix/store/derivations.hh"
+#include "nix/store/globals.hh"
+#include "nix/store/local-store.hh"
+#include "nix/store/realisation.hh"
+#include "nix/store/store-open.hh"
+#include "nix/util/finally.hh"
+#include "nix/util/logging.hh"
+#include "nix/util/signals.hh"
+
+#include <atomic>
+#include <future>
+#include <map>
+
+namespace nix {
+
+struct RemoteDispatcher::MachineState
+{
+    const std::string storeUri;
+
+    /**
+     * The most recent configuration of this machine. Guarded by
+     * `RemoteDispatcher::state_`.
+     */
+    std::shared_ptr<const Machine> machine;
+
+    /**
+     * The number of reserved job slots.
+     */
+    std::atomic<uint64_t> load{0};
+
+    /**
+     * Whether this machine may be used. Machines that we fail to
+     * connect to are disabled.
+     */
+    std::atomic<bool> enabled;
+
+    /**
+     * The store for this machine, opened on first use and kept open
+     * (along with its connection pool) afterwards. The lock is held
+     * while connecting, so use `connected` to check whether this is
+     * set without blocking.
+     */
+    Sync<std::shared_ptr<Store>> store;
+
+    std::atomic<bool> connected{false};
+
+    /**
+     * Whether a thread is connecting to this machine, see
+     * `RemoteDispatcher::reserve()`.
+     */
+    std::atomic<bool> connecting{false};
+
+    /**
+     * Paths known to be valid on this machine, with the time at which
+     * they were found to be valid, see `getMissingSize()`. Entries
+     * older than `knownValidTTL` are dropped.
+     */
+    Sync<std::map<StorePath, std::chrono::steady_clock::time_point>> knownValid;
+
+    /**
+     * Whether a `getMissingSize()` query to this machine is still
+     * running, see `RemoteDispatcher::reserve()`.
+     */
+    std::atomic<bool> probing{false};
+
+    MachineState(const Machine & machine)
+        : storeUri(machine.storeUri.render())
+        , machine(std::make_shared<const Machine>(machine))
+        , enabled(machine.enabled)
+    {
+    }
+
+    ref<Store> getStore(const Machine & machine)
+    {
+        auto store(this->store.lock());
+
+        if (!*store) {
+            Activity act(*logger, lvlTalkative, actUnknown, fmt("connecting to '%s'", storeUri));
+
+            auto storeRef = machine.completeStoreReference();
+
+            /* `completeStoreReference()` sets up `ssh://` stores for
+               the build hook, which gets a single connection and
+               passes build logs on file descriptor 4. Neither
+               applies here. */
+            auto * generic = std::get_if<StoreReference::Specified>(&storeRef.variant);
+            if (generic && generic->scheme == "ssh") {
+                storeRef.params.erase("log-fd");
+                storeRef.params["max-connections"] = std::to_string(std::max(machine.maxJobs, 1U));
+            }
+
+            auto newStore = openStore(std::move(storeRef));
+            newStore->connect();
+            *store = newStore.get_ptr();
+            connected = true;
+        }
+
+        return ref<Store>(*store);
+    }
+
+    StorePathSet getKnownValid()
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto knownValid(this->knownValid.lock());
+        StorePathSet res;
+        for (auto i = knownValid->begin(); i != knownValid->end();) {
+            if (i->second + knownValidTTL < now)
+                i = knownValid->erase(i);
+            else
+                res.insert((i++)->first);
+        }
+        return res;
+    }
+
+    void addKnownValid(const StorePathSet & paths)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto knownValid(this->knownValid.lock());
+        for (auto & path : paths)
+            knownValid->insert_or_assign(path, now);
+    }
+};
+
+/**
+ * How long `RemoteDispatcher::reserve()` waits for new connections to
+ * machines. A machine that takes longer is treated as busy, and the
+ * connection is set up in the background for the next build.
+ */
+constexpr std::chrono::seconds connectTimeout{2};
+
+/**
+ * How long `RemoteDispatcher::reserve()` waits for the machines to
+ * report how much of a build's inputs they are missing. A machine
+ * that takes longer is scheduled as if the amount were unknown, and
+ * the query finishes in the background, so that its answer is cached
+ * for the next build.
+ */
+constexpr std::chrono::seconds missingSizeTimeout{2};
+
+RemoteThreads::~RemoteThreads()
+{
+    quit = true;
+
+    while (true) {
+        std::map<uint64_t, std::thread> running;
+        {
+            auto state(state_.lock());
+            running = std::move(state->running);
+            state->running.clear();
+            state->finished.clear();
+        }
+        if (running.empty())
+            break;
+        for (auto & [_, thread] : running)
+            thread.join();
+    }
+}
+
+void RemoteThreads::spawn(std::function<void()> fn, std::shared_ptr<std::atomic<bool>> cancelled)
+{
+    auto state(state_.lock());
+
+    /* Join the threads that have finished since the last call. */
+    for (auto id : state->finished) {
+        auto i = state->running.find(id);
+        assert(i != state->running.end());
+        i->second.join();
+        state->running.erase(i);
+    }
+    state->finished.clear();
+
+    /* The thread can't mark itself as finished before we've added
+       it to `running`, since we hold the lock. */
+    auto id = state->nextId++;
+    state->running.emplace(
+        id, std::thread([this, id, fn{std::move(fn)}, cancelled{std::move(cancelled)}]() mutable {
+            ReceiveInterrupts receiveInterrupts;
+            unix::interruptCheck = [&]() { return quit || (cancelled && *cancelled); };
+            fn();
+            /* Release whatever `fn` holds on to (e.g. stores) before
+               we can be joined. */
+            fn = nullptr;
+            state_.lock()->finished.push_back(id);
+        }));
+}
+
+RemoteDispatcher::Slot::Slot(std::shared_ptr<MachineState> machine)
+    : machine(std::move(machine))
+{
+    this->machine->load++;
+}
+
+RemoteDispatcher::Slot::~Slot()
+{
+    machine->load--;
+}
+
+std::string RemoteDispatcher::Slot::getMachineName() const
+{
+    return machine->storeUri;
+}
+
+RemoteBuild::~RemoteBuild()
+{
+    *cancelled = true;
+}
+
+void RemoteBuild::wait()
+{
+    result.get();
+}
+
+RemoteDispatcher & RemoteDispatcher::get()
+{
+    static RemoteDispatcher dispatcher;
+    return dispatcher;
+}
+
+void RemoteDispatcher::refreshMachines(State & state)
+{
+    /* Pick up changes to the machines file every once in a while,
+       rather than on every build. */
+    auto now = std::chrono::steady_clock::now();
+    if (state.builders == settings.builders.get() && now < state.lastRefresh + std::chrono::seconds(60))
+        return;
+
+    auto machines = getMachines();
+    debug("got %d remote builders", machines.size());
+
+    /* Keep the state (in particular the load and the open store) of
+       machines that are still configured. */
+    std::vector<std::shared_ptr<MachineState>> newMachines;
+    for (auto & m : machines) {
+        auto storeUri = m.storeUri.render();
+        auto i = std::find_if(state.machines.begin(), state.machines.end(), [&](auto & old) {
+            return old->storeUri == storeUri;
+        });
+        if (i != state.machines.end()) {
+            /* Give machines that we failed to connect to another
+               chance. */
+            (*i)->machine = std::make_shared<const Machine>(m);
+            (*i)->enabled = m.enabled;
+            newMachines.push_back(*i);
+        } else
+            newMachines.push_back(std::make_shared<MachineState>(m));
+    }
+
+    state.machines = std::move(newMachines);
+    state.builders = settings.builders.get();
+    state.lastRefresh = now;
+}
+
+static bool allSupportedLocally(Store & store, const StringSet & requiredFeatures)
+{
+    for (auto & feature : requiredFeatures)
+        if (!store.config.systemFeatures.get().count(feature))
+            return false;
+    return true;
+}
+
+/**
+ * Connect to `machine` in a thread in `threads`, see
+ * `RemoteDispatcher::MachineState::getStore()`. If that fails, the
+ * machine is disabled.
+ */
+static std::future<void> connectToMachine(
+    RemoteThreads & threads,
+    std::shared_ptr<RemoteDispatcher::MachineState> machine,
+    std::shared_ptr<const Machine> config)
+{
+    auto promise = std::make_shared<std::promise<void>>();
+    auto future = promise->get_future();
+
+    threads.spawn([machine{std::move(machine)}, config{std::move(config)}, parent{getCurActivity()}, promise]() {
+        PushActivity pact(parent);
+        try {
+            machine->getStore(*config);
+        } catch (Interrupted &) {
+        } catch (std::exception & e) {
+            printError("cannot build on '%s': %s", machine->storeUri, e.what());
+            machine->enabled = false;
+        }
+        machine->connecting = false;
+        promise->set_value();
+    });
+
+    return future;
+}
+
+/**
+ * Ask `machine`, which must be connected, in a thread in `threads`
+ * how much of `inputs` it is missing, see `getMissingSize()`.
+ */
+static std::future<uint64_t> probeMissingSize(
+    RemoteThreads & threads,
+    std::shared_ptr<RemoteDispatcher::MachineState> machine,
+    std::shared_ptr<const Machine> config,
+    Store & store,
+    const StorePathSet & inputs)
+{
+    auto promise = std::make_shared<std::promise<uint64_t>>();
+    auto future = promise->get_future();
+
+    threads.spawn([machine{std::move(machine)},
+                   config{std::move(config)},
+                   store{store.shared_from_this()},
+                   inputs,
+                   parent{getCurActivity()},
+                   promise]() {
+        PushActivity pact(parent);
+        try {
+            auto machineStore = machine->getStore(*config);
+            auto knownValid = machine->getKnownValid();
+            StorePathSet unknown;
+            for (auto & path : inputs)
+                if (!knownValid.count(path))
+                    unknown.insert(path);
+            /* Don't hold the lock on `knownValid` while querying the
+               machine, so that finished builds can update it. */
+            StorePathSet found;
+            auto missingSize = getMissingSize(*store, *machineStore, unknown, found);
+            machine->addKnownValid(found);
+            promise->set_value(missingSize);
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+        machine->probing = false;
+    });
+
+    return future;
+}
+
+std::pair<RemoteDispatcher::Reply, std::unique_ptr<RemoteDispatcher::Slot>> RemoteDispatcher::reserve(
+    RemoteThreads & threads,
+    Store & store,
+    const StorePath & drvPath,
+    const std::string & system,
+    const StringSet & requiredFeatures,
+    const StorePathSet & inputs,
+    bool amWilling)
+{
+    /* It would be possible to build locally after some builds clear
+       out, so don't show the warning now. */
+    bool couldBuildLocally =
+        settings.maxBuildJobs > 0
+        && (system == settings.thisSystem || settings.extraPlatforms.get().count(system) > 0)
+        && allSupportedLocally(store, requiredFeatures);
+
+    /* It's possible to build this locally right now. */
+    bool canBuildLocally = amWilling && couldBuildLocally;
+
+    auto suitable = [&](const MachineState & m) {
+        auto & config = *m.machine;
+        return m.enabled && config.systemSupported(system) && config.allSupported(requiredFeatures)
+               && config.mandatoryMet(requiredFeatures);
+    };
+
+    auto hasFreeSlot = [&](const MachineState & m) { return m.load < m.machine->maxJobs; };
+
+    /* Connect to the suitable machines with a free slot that we
+       haven't connected to yet. This happens in separate threads, so
+       that we don't wait for more than a bounded time. */
+    {
+        std::vector<std::future<void>> connections;
+        {
+            auto state(state_.lock());
+            refreshMachines(*state);
+            for (auto & m : state->machines)
+                if (suitable(*m) && hasFreeSlot(*m) && !m->connected && !m->connecting.exchange(true))
+                    connections.push_back(connectToMachine(threads, m, m->machine));
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + connectTimeout;
+        for (auto & connection : connections)
+            connection.wait_until(deadline);
+    }
+
+    /* Determine how much of the inputs each suitable, connected
+       machine with a free slot is missing. We ask them all
+       concurrently and only wait for a bounded time. Machines that
+       are still busy answering a previous query are skipped. */
+    std::map<MachineState *, uint64_t> missingSizes;
+    if (settings.buildersTransferCost) {
+        std::vector<std::pair<std::shared_ptr<MachineState>, std::future<uint64_t>>> probes;
+        {
+            auto state(state_.lock());
+            for (auto & m : state->machines)
+                if (suitable(*m) && hasFreeSlot(*m) && m->connected && !m->probing.exchange(true))
+                    probes.emplace_back(m, probeMissingSize(threads, m, m->machine, store, inputs));
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + missingSizeTimeout;
+
+        for (auto & [m, probe] : probes) {
+            if (probe.wait_until(deadline) != std::future_status::ready) {
+                debug("machine '%s' didn't report its missing inputs in time", m->storeUri);
+                continue;
+            }
+            try {
+                missingSizes[m.get()] = probe.get();
+                debug("machine '%s' is missing %d bytes of inputs", m->storeUri, missingSizes[m.get()]);
+            } catch (std::exception & e) {
+                printError("cannot build on '%s': %s", m->storeUri, e.what());
+                m->enabled = false;
+            }
+        }
+    }
+
+    auto state(state_.lock());
+
+    refreshMachines(*state);
+
+    if (state->machines.empty())
+        return {Reply::DeclinePermanently, nullptr};
+
+    std::shared_ptr<MachineState> bestMachine;
+    bool rightType = false;
+    bool connecting = false;
+    double bestLoad = 0;
+
+    for (auto & m : state->machines) {
+        auto & config = *m->machine;
+
+        if (!suitable(*m))
+            continue;
+
+        rightType = true;
+
+        uint64_t slotsInUse = m->load;
+        if (slotsInUse >= config.maxJobs)
+            continue;
+
+        if (!m->connected) {
+            connecting = true;
+            continue;
+        }
+
+        auto missingSize = missingSizes.find(m.get());
+        double load = getEffectiveLoad(slotsInUse, missingSize != missingSizes.end() ? missingSize->second : 0);
+
+        bool best = false;
+        if (!bestMachine)
+            best = true;
+        else if (load / config.speedFactor < bestLoad / bestMachine->machine->speedFactor)
+            best = true;
+        else if (load / config.speedFactor == bestLoad / bestMachine->machine->speedFactor) {
+            if (config.speedFactor > bestMachine->machine->speedFactor)
+                best = true;
+            else if (config.speedFactor == bestMachine->machine->speedFactor && load < bestLoad)
+                best = true;
+        }
+
+        if (best) {
+            bestLoad = load;
+            bestMachine = m;
+        }
+    }
+
+    if (!bestMachine) {
+        /* Wait for machines with a free slot that we're still
+           connecting to, even if we could build locally. */
+        if (connecting || (rightType && !canBuildLocally))
+            return {Reply::Postpone, nullptr};
+
+        printMsg(
+            couldBuildLocally ? lvlChatty : lvlWarn,
+            "Failed to find a machine for remote build!\n"
+            "derivation: %s\n"
+            "required (system, features): (%s, [%s])",
+            drvPath.to_string(),
+            system,
+            concatStringsSep<StringSet>(", ", requiredFeatures));
+
+        return {Reply::Decline, nullptr};
+    }
+
+    /* Reserve the slot while we still hold the lock, so that
+       concurrent callers see the new load. */
+    return {Reply::Accept, std::make_unique<Slot>(bestMachine)};
+}
+
+static void buildOnMachine(
+    Store & store,
+    Store & sshStore,
+    const std::string & storeUri,
+    const StorePath & drvPath,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs,
+    const std::atomic<bool> & cancelled)
+{
+    /* We can't interrupt an operation on the remote store, but we can
+       avoid starting the next one once the goal is gone. */
+    auto checkCancelled = [&]() {
+        if (cancelled)
+            throw Error("remote build of '%s' on '%s' was cancelled", store.printStorePath(drvPath), storeUri);
+    };
+
+    auto substitute = settings.buildersUseSubstitutes ? Substitute : NoSubstitute;
+
+    {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("copying dependencies to '%s'", storeUri));
+        copyPaths(store, sshStore, inputs, NoRepair, NoCheckSigs, substitute);
+    }
+
+    checkCancelled();
+
+    auto drv = store.readDerivation(drvPath);
+
+    std::optional<BuildResult> optResult;
+
+    // If we don't know whether we are trusted (e.g. `ssh://`
+    // stores), we assume we are. This is necessary for backwards
+    // compat.
+    bool trustedOrLegacy = ({
+        std::optional trusted = sshStore.isTrustedClient();
+        !trusted || *trusted;
+    });
+
+    // See the very large comment in `case WorkerProto::Op::BuildDerivation:` in
+    // `src/libstore/daemon.cc` that explains the trust model here.
+    if (trustedOrLegacy || drv.type().isCA()) {
+        // Hijack the inputs paths of the derivation to include all
+        // the paths that come from the `inputDrvs` set. See
+        // `build-remote.cc` for why we don't do this if `inputDrvs`
+        // is empty.
+        if (!drv.inputDrvs.map.empty())
+            drv.inputSrcs = inputs;
+        optResult = sshStore.buildDerivation(drvPath, (const BasicDerivation &) drv);
+        auto & result = *optResult;
+        if (!result.success()) {
+            if (settings.keepFailed) {
+                warn(
+                    "The failed build directory was kept on the remote builder due to `--keep-failed`.%s",
+                    (settings.thisSystem == drv.platform || settings.extraPlatforms.get().count(drv.platform) > 0)
+                        ? " You can re-run the command with `--builders ''` to disable remote building for this invocation."
+                        : "");
+            }
+            throw Error("build of '%s' on '%s' failed: %s", store.printStorePath(drvPath), storeUri, result.errorMsg);
+        }
+    } else {
+        copyClosure(store, sshStore, StorePathSet{drvPath}, NoRepair, NoCheckSigs, substitute);
+        auto res = sshStore.buildPathsWithResults({DerivedPath::Built{
+            .drvPath = makeConstantStorePathRef(drvPath),
+            .outputs = OutputsSpec::All{},
+        }});
+        // One path to build should produce exactly one build result
+        assert(res.size() == 1);
+        optResult = std::move(res[0]);
+    }
+
+    /* The goal no longer holds the locks on the output paths, so
+       don't copy them. */
+    checkCancelled();
+
+    std::set<Realisation> missingRealisations;
+    StorePathSet missingPaths;
+    if (experimentalFeatureSettings.isEnabled(Xp::CaDerivations) && !drv.type().hasKnownOutputPaths()) {
+        auto outputHashes = staticOutputHashes(store, drv);
+        for (auto & outputName : wantedOutputs) {
+            auto thisOutputId = DrvOutput{outputHashes.at(outputName), outputName};
+            if (!store.queryRealisation(thisOutputId)) {
+                debug("missing output %s", outputName);
+                auto i = optResult->builtOutputs.find(outputName);
+                assert(i != optResult->builtOutputs.end());
+                missingRealisations.insert(i->second);
+                missingPaths.insert(i->second.outPath);
+            }
+        }
+    } else {
+        for (auto & [outputName, hopefullyOutputPath] : drv.outputsAndOptPaths(store)) {
+            assert(hopefullyOutputPath.second);
+            if (!store.isValidPath(*hopefullyOutputPath.second))
+                missingPaths.insert(*hopefullyOutputPath.second);
+        }
+    }
+
+    if (!missingPaths.empty()) {
+        Activity act(*logger, lvlTalkative, actUnknown, fmt("copying outputs from '%s'", storeUri));
+
+        /* The goal that started this build holds the locks on the
+           output paths, and since POSIX locks are per process,
+           re-locking and unlocking them here would release them. */
+        auto localStore = dynamic_cast<LocalStore *>(&store);
+        if (localStore)
+            for (auto & path : missingPaths)
+                localStore->locksHeld.lock()->insert(store.printStorePath(path));
+        Finally releaseLocks([&]() {
+            if (localStore)
+                for (auto & path : missingPaths)
+                    localStore->locksHeld.lock()->erase(store.printStorePath(path));
+        });
+
+        copyPaths(sshStore, store, missingPaths, NoRepair, NoCheckSigs, NoSubstitute);
+    }
+
+    // XXX: Should be done as part of `copyPaths`
+    for (auto & realisation : missingRealisations) {
+        experimentalFeatureSettings.require(Xp::CaDerivations);
+        store.registerDrvOutput(realisation);
+    }
+}
+
+std::unique_ptr<RemoteBuild> RemoteDispatcher::build(
+    RemoteThreads & threads,
+    std::unique_ptr<Slot> slot,
+    Store & store,
+    const StorePath & drvPath,
+    const StorePathSet & inputs,
+    const StringSet & wantedOutputs)
+{
+    auto sshStore = ref<Store>(*slot->machine->store.lock());
+
+    auto remoteBuild = std::make_unique<RemoteBuild>();
+    remoteBuild->done.create();
+
+    auto promise = std::make_shared<std::promise<void>>();
+    remoteBuild->result = promise->get_future();
+
+    // Until we have C++23 std::move_only_function
+    auto doneWrite = std::make_shared<AutoCloseFD>(std::move(remoteBuild->done.writeSide));
+
+    /* The thread must not refer to `remoteBuild` or borrow `store`,
+       since the goal may be destroyed before the thread finishes. */
+    threads.spawn(
+        [store{store.shared_from_this()},
+         sshStore,
+         drvPath,
+         inputs,
+         wantedOutputs,
+         parent{getCurActivity()},
+         slot{std::shared_ptr<Slot>(std::move(slot))},
+         cancelled{remoteBuild->cancelled},
+         promise,
+         doneWrite]() mutable {
+            PushActivity pact(parent);
+            try {
+                buildOnMachine(*store, *sshStore, slot->getMachineName(), drvPath, inputs, wantedOutputs, *cancelled);
+                slot->machine->addKnownValid(inputs);
+                promise->set_value();
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+            /* Release the slot before signalling the worker, so that
+               waiting builds can use it. */
+            slot.reset();
+            doneWrite->close();
+        },
+        remoteBuild->cancelled);
+
+    return remoteBuild;
+}
+
+} // namespace nix
@@ -0,0 +1,207 @@
+#pragma once
+///@file
+
+#include "nix/store/machines.hh"
+#include "nix/store/path.hh"
+#include "nix/util/file-descriptor.hh"
+#include "nix/util/sync.hh"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <thread>
+
+namespace nix {
+
+class Store;
+
+/**
+ * The background threads that `RemoteDispatcher` runs on behalf of a
+ * `Worker`: remote builds, and connections and queries to machines.
+ * Destroying this object cancels the threads and waits for them to
+ * finish, so that none of them outlives the `Worker`.
+ */
+struct RemoteThreads
+{
+    RemoteThreads() = default;
+    RemoteThreads(const RemoteThreads &) = delete;
+    ~RemoteThreads();
+
+    /**
+     * Run `fn` in a new thread. `fn` must not throw. Operations in
+     * the thread that check for interrupts (see `checkInterrupt()`)
+     * throw `Interrupted` once this object is being destroyed, or
+     * once `cancelled` (if given) is set.
+     */
+    void spawn(std::function<void()> fn, std::shared_ptr<std::atomic<bool>> cancelled = nullptr);
+
+private:
+
+    std::atomic<bool> quit{false};
+
+    struct State
+    {
+        uint64_t nextId = 0;
+
+        std::map<uint64_t, std::thread> running;
+
+        /**
+         * The threads in `running` that have finished and can be
+         * joined.
+         */
+        std::vector<uint64_t> finished;
+    };
+
+    Sync<State> state_;
+};
+
+/**
+ * A build running on a remote machine in a background thread, see
+ * `RemoteDispatcher::build()`.
+ */
+struct RemoteBuild
+{
+    /**
+     * Closed (i.e. reports EOF) when the build has finished. The
+     * write side is owned by the build thread.
+     */
+    Pipe done;
+
+    /**
+     * Shared with the build thread, see `~RemoteBuild()`.
+     */
+    std::shared_ptr<std::atomic<bool>> cancelled = std::make_shared<std::atomic<bool>>(false);
+
+    /**
+     * The outcome of the build, set before `done` is closed.
+     */
+    std::future<void> result;
+
+    /**
+     * If the build hasn't finished yet, abandon it without waiting:
+     * the thread skips its remaining steps (building or copying back
+     * the outputs) and is joined by its `RemoteThreads`.
+     */
+    ~RemoteBuild();
+
+    /**
+     * Wait for the build to finish, and rethrow its error, if any.
+     */
+    void wait();
+};
+
+/**
+ * Dispatches builds to the machines listed in `builders` from within
+ * the Nix process, as an alternative to the `build-hook`. This is
+ * used if `builders-in-process` is enabled.
+ *
+ * Unlike the build hook, the dispatcher parses the machine list only
+ * when it changes, keeps one store (and thus one connection pool) per
+ * machine open for the lifetime of the process, does slot accounting
+ * in memory rather than through lock files in `current-load`, and
+ * doesn't serialise uploads to a machine.
+ */
+struct RemoteDispatcher
+{
+    struct MachineState;
+
+    enum struct Reply {
+        /**
+         * A slot was reserved.
+         */
+        Accept,
+
+        /**
+         * There are suitable machines, but they're all busy.
+         */
+        Postpone,
+
+        /**
+         * No machine can build this derivation.
+         */
+        Decline,
+
+        /**
+         * There are no remote machines at all.
+         */
+        DeclinePermanently,
+    };
+
+    /**
+     * A reserved job slot on a machine. The slot is released when
+     * this object is destroyed.
+     */
+    struct Slot
+    {
+        std::shared_ptr<MachineState> machine;
+
+        Slot(std::shared_ptr<MachineState> machine);
+        Slot(const Slot &) = delete;
+        ~Slot();
+
+        /**
+         * The name of the machine, for display purposes.
+         */
+        std::string getMachineName() const;
+    };
+
+    /**
+     * Reserve a slot on the least loaded machine that supports
+     * `system` and `requiredFeatures`. Machines that we haven't
+     * connected to yet are connected to in `threads`; we only wait a
+     * bounded time for that, and postpone if it takes longer.
+     * If `builders-transfer-cost` is set, the size of the `inputs`
+     * that are missing on a machine counts towards its load.
+     * `amWilling` denotes whether the caller could build the
+     * derivation locally right now, in which case we decline rather
+     * than postpone if all suitable machines are busy.
+     */
+    std::pair<Reply, std::unique_ptr<Slot>> reserve(
+        RemoteThreads & threads,
+        Store & store,
+        const StorePath & drvPath,
+        const std::string & system,
+        const StringSet & requiredFeatures,
+        const StorePathSet & inputs,
+        bool amWilling);
+
+    /**
+     * Start building `drvPath` in `slot` in a thread in `threads`.
+     * This copies `inputs` to the remote machine, builds the
+     * derivation and copies the missing outputs in `wantedOutputs`
+     * back to `store`.
+     */
+    std::unique_ptr<RemoteBuild> build(
+        RemoteThreads & threads,
+        std::unique_ptr<Slot> slot,
+        Store & store,
+        const StorePath & drvPath,
+        const StorePathSet & inputs,
+        const StringSet & wantedOutputs);
+
+    /**
+     * Return the dispatcher shared by all builds in this process.
+     */
+    static RemoteDispatcher & get();
+
+private:
+
+    struct State
+    {
+        /**
+         * The value of `builders` from which `machines` was computed.
+         */
+        std::optional<std::string> builders;
+
+        std::chrono::steady_clock::time_point lastRefresh;
+
+        std::vector<std::shared_ptr<MachineState>> machines;
+    };
+
+    Sync<State> state_;
+
+    void refreshMachines(State & state);
+};
+
+} // namespace nix
@@ -2,10 +2,23 @@
 #include "nix/store/worker-protocol-impl.hh"
 #include "nix/store/build-result.hh"
 #include "nix/store/derivations.hh"
+#include "nix/util/unix-domain-socket.hh"
 
 namespace nix {
 
-const WorkerProto::FeatureSet WorkerProto::allFeatures{};
+const WorkerProto::FeatureSet WorkerProto::allFeatures{std::string(WorkerProto::featureBuildStats)};
+
+WorkerProto::FeatureSet WorkerProto::BasicConnection::getSupportedFeatures(Descriptor fd)
+{
+    auto features = allFeatures;
+#ifndef _WIN32
+    if (isUnixDomainSocket(fd)) {
+        features.insert(std::string(featureFdPassing));
+        features.insert(std::string(featureMultiplex));
+    }
+#endif
+    return features;
+}
 
 WorkerProto::BasicClientConnection::~BasicClientConnection()
 {
@@ -32,6 +45,39 @@ static Logger::Fields readFields(Source & from)
     return fields;
 }
 
+bool WorkerProto::BasicClientConnection::processLogMessage(uint64_t msg, Source & from)
+{
+    if (msg == STDERR_NEXT)
+        printError(chomp(readString(from)));
+
+    else if (msg == STDERR_START_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        auto lvl = (Verbosity) readInt(from);
+        auto type = (ActivityType) readInt(from);
+        auto s = readString(from);
+        auto fields = readFields(from);
+        auto parent = readNum<ActivityId>(from);
+        logger->startActivity(act, lvl, type, s, fields, parent);
+    }
+
+    else if (msg == STDERR_STOP_ACTIVITY) {
+        auto act = readNum<ActivityId>(from);
+        logger->stopActivity(act);
+    }
+
+    else if (msg == STDERR_RESULT) {
+        auto act = readNum<ActivityId>(from);
+        auto type = (ResultType) readInt(from);
+        auto fields = readFields(from);
+        logger->result(act, type, fields);
+    }
+
+    else
+        return false;
+
+    return true;
+}
+
 std::exception_ptr
 WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * source, bool flush, bool block)
 {
@@ -74,37 +120,12 @@ WorkerProto::BasicClientConnection::processStderrReturn(Sink * sink, Source * so
             break;
         }
 
-        else if (msg == STDERR_NEXT)
-            printError(chomp(readString(from)));
-
-        else if (msg == STDERR_START_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            auto lvl = (Verbosity) readInt(from);
-            auto type = (ActivityType) readInt(from);
-            auto s = readString(from);
-            auto fields = readFields(from);
-            auto parent = readNum<ActivityId>(from);
-            logger->startActivity(act, lvl, type, s, fields, parent);
-        }
-
-        else if (msg == STDERR_STOP_ACTIVITY) {
-            auto act = readNum<ActivityId>(from);
-            logger->stopActivity(act);
-        }
-
-        else if (msg == STDERR_RESULT) {
-            auto act = readNum<ActivityId>(from);
-            auto type = (ResultType) readInt(from);
-            auto fields = readFields(from);
-            logger->result(act, type, fields);
-        }
-
         else if (msg == STDERR_LAST) {
             assert(block);
             break;
         }
 
-        else
+        else if (!processLogMessage(msg, from))
             throw Error("got unknown message type %x from Nix daemon", msg);
     }
 
@@ -213,6 +234,27 @@ std::tuple<WorkerProto::Version, WorkerProto::FeatureSet> WorkerProto::BasicServ
     return {protoVersion, intersectFeatures(clientFeatures, supportedFeatures)};
 }
 
+void WorkerProto::BasicClientConnection::checkFdPassing()
+{
+#ifndef _WIN32
+    if (!features.contains(featureFdPassing))
+        return;
+
+    /* The daemon sends nothing after its features until it has
+       received the probe, so there is nothing in our read buffer that
+       `receiveFds()` would miss later on. */
+    Pipe pipe;
+    pipe.create();
+    to.flush();
+    sendFds(from.fd, {pipe.readSide.get()});
+
+    if (!readInt(from)) {
+        debug("the daemon did not receive our file descriptor, not passing NARs through pipes");
+        features.erase(std::string(featureFdPassing));
+    }
+#endif
+}
+
 WorkerProto::ClientHandshakeInfo WorkerProto::BasicClientConnection::postHandshake(const StoreDirConfig & store)
 {
     WorkerProto::ClientHandshakeInfo res;
@@ -244,6 +286,26 @@ void WorkerProto::BasicServerConnection::postHandshake(const StoreDirConfig & st
     WorkerProto::write(store, *this, info);
 }
 
+void WorkerProto::BasicServerConnection::checkFdPassing()
+{
+#ifndef _WIN32
+    if (!features.contains(featureFdPassing))
+        return;
+
+    /* If there is a proxy between us and the client, we get the byte
+       that carries the probe but not the probe itself. */
+    auto fds = receiveFds(from.fd, 1);
+    bool received = fds.size() == 1;
+    to << received;
+    to.flush();
+
+    if (!received) {
+        debug("the client's file descriptor did not arrive, not passing NARs through pipes");
+        features.erase(std::string(featureFdPassing));
+    }
+#endif
+}
+
 UnkeyedValidPathInfo WorkerProto::BasicClientConnection::queryPathInfo(
     const StoreDirConfig & store, bool * daemonException, const StorePath & path)
 {
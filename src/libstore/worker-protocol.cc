@@ -162,6 +162,51 @@ void WorkerProto::Serialise<KeyedBuildResult>::write(
     WorkerProto::write(store, conn, static_cast<const BuildResult &>(res));
 }
 
+static std::optional<uint64_t> readOptionalNum(Source & from)
+{
+    auto tag = readNum<uint8_t>(from);
+    switch (tag) {
+    case 0:
+        return std::nullopt;
+    case 1:
+        return readNum<uint64_t>(from);
+    default:
+        throw Error("Invalid optional tag from remote");
+    }
+}
+
+static void writeOptionalNum(Sink & to, const std::optional<uint64_t> & n)
+{
+    if (!n)
+        to << uint8_t{0};
+    else
+        to << uint8_t{1} << *n;
+}
+
+BuildStats WorkerProto::Serialise<BuildStats>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
+{
+    BuildStats res;
+    res.status = static_cast<BuildResult::Status>(readInt(conn.from));
+    conn.from >> res.startTime >> res.stopTime;
+    res.cpuUser = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
+    res.cpuSystem = WorkerProto::Serialise<std::optional<std::chrono::microseconds>>::read(store, conn);
+    res.memoryPeak = readOptionalNum(conn.from);
+    res.ioRead = readOptionalNum(conn.from);
+    res.ioWrite = readOptionalNum(conn.from);
+    return res;
+}
+
+void WorkerProto::Serialise<BuildStats>::write(
+    const StoreDirConfig & store, WorkerProto::WriteConn conn, const BuildStats & stats)
+{
+    conn.to << stats.status << stats.startTime << stats.stopTime;
+    WorkerProto::write(store, conn, stats.cpuUser);
+    WorkerProto::write(store, conn, stats.cpuSystem);
+    writeOptionalNum(conn.to, stats.memoryPeak);
+    writeOptionalNum(conn.to, stats.ioRead);
+    writeOptionalNum(conn.to, stats.ioWrite);
+}
+
 BuildResult WorkerProto::Serialise<BuildResult>::read(const StoreDirConfig & store, WorkerProto::ReadConn conn)
 {
     BuildResult res;
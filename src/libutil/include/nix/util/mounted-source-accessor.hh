@@ -0,0 +1,24 @@
+#pragma once
+
+#include "nix/util/source-accessor.hh"
+
+namespace nix {
+
+/**
+ * A source accessor that presents a set of other accessors mounted
+ * at particular paths. Mount points can be added after construction.
+ * Accessors returned by `makeMountedSourceAccessor()` implement this
+ * interface.
+ */
+struct MountedSourceAccessor : SourceAccessor
+{
+    virtual void mount(CanonPath mountPoint, ref<SourceAccessor> accessor) = 0;
+
+    /**
+     * Return the accessor mounted on `mountPoint`, or `nullptr` if
+     * there is none.
+     */
+    virtual std::shared_ptr<SourceAccessor> getMount(CanonPath mountPoint) = 0;
+};
+
+} // namespace nix
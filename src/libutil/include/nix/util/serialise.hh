@@ -2,6 +2,7 @@
 ///@file
 
 #include <memory>
+#include <optional>
 #include <type_traits>
 
 #include "nix/util/types.hh"
@@ -123,6 +124,19 @@ struct BufferedSource : Source
      */
     bool hasData();
 
+    /**
+     * Remove and return the data in the buffer that hasn't been read
+     * yet, e.g. to pass it on together with the underlying file
+     * descriptor.
+     */
+    std::string takeBuffer();
+
+    /**
+     * Make the next reads return `data` before reading from the
+     * underlying source. The buffer must be empty.
+     */
+    void fillBuffer(std::string_view data);
+
 protected:
     /**
      * Underlying read call, to be overridden.
@@ -156,6 +170,7 @@ struct FdSink : BufferedSink
         fd = s.fd;
         s.fd = INVALID_DESCRIPTOR;
         written = s.written;
+        isPipe = s.isPipe;
         return *this;
     }
 
@@ -165,8 +180,20 @@ struct FdSink : BufferedSink
 
     bool good() override;
 
+    /**
+     * Write `len` bytes read from the file `from` (starting at its
+     * current offset) to this sink without copying them through user
+     * space. This is only possible on Linux if this sink is a pipe.
+     *
+     * @return false if this isn't possible, in which case nothing has
+     * been written.
+     */
+    bool spliceFrom(Descriptor from, uint64_t len);
+
 private:
     bool _good = true;
+
+    std::optional<bool> isPipe;
 };
 
 /**
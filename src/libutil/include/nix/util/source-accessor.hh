@@ -180,6 +180,18 @@ struct SourceAccessor : std::enable_shared_from_this<SourceAccessor>
      */
     std::optional<std::string> fingerprint;
 
+    /**
+     * Return a string that uniquely represents the contents of
+     * `path`, regardless of the rest of this accessor. Unlike
+     * `fingerprint`, this is the same for identical subtrees of
+     * different accessors, e.g. an unchanged directory in two Git
+     * revisions.
+     */
+    virtual std::optional<std::string> getContentFingerprint(const CanonPath & path)
+    {
+        return std::nullopt;
+    }
+
     /**
      * Return the maximum last-modified time of the files in this
      * tree, if available.
@@ -10,6 +10,7 @@
 #include <unistd.h>
 
 #include <filesystem>
+#include <vector>
 
 namespace nix {
 
@@ -87,4 +88,31 @@ void connect(Socket fd, const std::filesystem::path & path);
  */
 AutoCloseFD connect(const std::filesystem::path & path);
 
+#ifndef _WIN32
+
+/**
+ * Whether `fd` is a Unix domain socket, i.e. whether file descriptors
+ * can be passed over it.
+ */
+bool isUnixDomainSocket(Descriptor fd);
+
+/**
+ * Send the file descriptors `fds` over the Unix domain socket `fd`.
+ * They are sent along with a single byte of data, so that the
+ * receiving side can use `receiveFds()` to receive them even on a
+ * stream socket. `fds` may be empty.
+ */
+void sendFds(Socket fd, const std::vector<Descriptor> & fds);
+
+/**
+ * Receive file descriptors sent with `sendFds()`. Throws `EndOfFile`
+ * if the other side has closed the connection.
+ *
+ * @param maxFds The maximum number of file descriptors to receive.
+ * Any further descriptors are closed.
+ */
+std::vector<AutoCloseFD> receiveFds(Socket fd, size_t maxFds);
+
+#endif
+
 } // namespace nix
@@ -135,6 +135,37 @@ static CgroupStats destroyCgroup(const std::filesystem::path & cgroup, bool retu
                 }
             }
         }
+
+        /* Note: `memory.peak` requires Linux 5.19. */
+        auto memoryPeakPath = cgroup / "memory.peak";
+
+        if (pathExists(memoryPeakPath))
+            stats.memoryPeak = string2Int<uint64_t>(trim(readFile(memoryPeakPath)));
+
+        auto iostatPath = cgroup / "io.stat";
+
+        if (pathExists(iostatPath)) {
+            stats.ioRead = 0;
+            stats.ioWrite = 0;
+            /* Lines look like `8:0 rbytes=1 wbytes=2 rios=3 ...`. */
+            for (auto & line : tokenizeString<std::vector<std::string>>(readFile(iostatPath), "\n")) {
+                for (auto & field : tokenizeString<std::vector<std::string>>(line, " ")) {
+                    std::string_view readPrefix = "rbytes=";
+                    if (hasPrefix(field, readPrefix)) {
+                        auto n = string2Int<uint64_t>(field.substr(readPrefix.size()));
+                        if (n)
+                            *stats.ioRead += *n;
+                    }
+
+                    std::string_view writePrefix = "wbytes=";
+                    if (hasPrefix(field, writePrefix)) {
+                        auto n = string2Int<uint64_t>(field.substr(writePrefix.size()));
+                        if (n)
+                            *stats.ioWrite += *n;
+                    }
+                }
+            }
+        }
     }
 
     if (rmdir(cgroup.c_str()) == -1)
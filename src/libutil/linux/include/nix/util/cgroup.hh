@@ -15,6 +15,16 @@ StringMap getCgroups(const Path & cgroupFile);
 struct CgroupStats
 {
     std::optional<std::chrono::microseconds> cpuUser, cpuSystem;
+
+    /**
+     * The highest memory usage of the cgroup, in bytes.
+     */
+    std::optional<uint64_t> memoryPeak;
+
+    /**
+     * The number of bytes read from and written to block devices.
+     */
+    std::optional<uint64_t> ioRead, ioWrite;
 };
 
 /**
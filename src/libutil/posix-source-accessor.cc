@@ -1,4 +1,5 @@
 #include "nix/util/posix-source-accessor.hh"
+#include "nix/util/serialise.hh"
 #include "nix/util/source-path.hh"
 #include "nix/util/signals.hh"
 #include "nix/util/sync.hh"
@@ -60,6 +61,10 @@ void PosixSourceAccessor::readFile(const CanonPath & path, Sink & sink, std::fun
 
     sizeCallback(st.st_size);
 
+    /* If the sink is a pipe, move the contents into it directly. */
+    if (auto fdSink = dynamic_cast<FdSink *>(&sink); fdSink && fdSink->spliceFrom(fd.get(), st.st_size))
+        return;
+
     off_t left = st.st_size;
 
     std::array<unsigned char, 64 * 1024> buf;
@@ -16,6 +16,11 @@
 #  include <poll.h>
 #endif
 
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <sys/stat.h>
+#endif
+
 namespace nix {
 
 void BufferedSink::operator()(std::string_view data)
@@ -76,6 +81,44 @@ bool FdSink::good()
     return _good;
 }
 
+bool FdSink::spliceFrom(Descriptor from, uint64_t len)
+{
+#ifdef __linux__
+    if (!isPipe) {
+        struct stat st;
+        isPipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    }
+    if (!*isPipe)
+        return false;
+
+    flush();
+
+    bool first = true;
+    while (len) {
+        checkInterrupt();
+        auto n = splice(from, nullptr, fd, nullptr, std::min(len, (uint64_t) 1 << 30), SPLICE_F_MOVE);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* The file system doesn't support splicing. */
+            if (first && (errno == EINVAL || errno == ENOSYS))
+                return false;
+            _good = false;
+            throw SysError("splicing data into a pipe");
+        }
+        if (n == 0)
+            throw EndOfFile("unexpected end-of-file");
+        first = false;
+        len -= n;
+        written += n;
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
 void Source::operator()(char * data, size_t len)
 {
     while (len) {
@@ -133,6 +176,29 @@ bool BufferedSource::hasData()
     return bufPosOut < bufPosIn;
 }
 
+std::string BufferedSource::takeBuffer()
+{
+    std::string data;
+    if (hasData())
+        data.assign(buffer.get() + bufPosOut, bufPosIn - bufPosOut);
+    bufPosIn = bufPosOut = 0;
+    return data;
+}
+
+void BufferedSource::fillBuffer(std::string_view data)
+{
+    assert(!hasData());
+    if (data.empty())
+        return;
+    if (!buffer || data.size() > bufSize) {
+        bufSize = std::max(bufSize, data.size());
+        buffer = decltype(buffer)(new char[bufSize]);
+    }
+    memcpy(buffer.get(), data.data(), data.size());
+    bufPosOut = 0;
+    bufPosIn = data.size();
+}
+
 size_t FdSource::readUnbuffered(char * data, size_t len)
 {
 #ifdef _WIN32
@@ -63,6 +63,22 @@ struct UnionSourceAccessor : SourceAccessor
         return SourceAccessor::showPath(path);
     }
 
+    std::optional<std::string> getContentFingerprint(const CanonPath & path) override
+    {
+        /* Directories that exist in several accessors are merged, so
+           only forward to an accessor if it's the only one that has
+           `path`. */
+        std::shared_ptr<SourceAccessor> found;
+        for (auto & accessor : accessors) {
+            if (!accessor->maybeLstat(path))
+                continue;
+            if (found)
+                return std::nullopt;
+            found = accessor;
+        }
+        return found ? found->getContentFingerprint(path) : std::nullopt;
+    }
+
     std::optional<std::filesystem::path> getPhysicalPath(const CanonPath & path) override
     {
         for (auto & accessor : accessors) {
@@ -120,4 +120,92 @@ AutoCloseFD connect(const std::filesystem::path & path)
     return fd;
 }
 
+#ifndef _WIN32
+
+bool isUnixDomainSocket(Descriptor fd)
+{
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr *) &addr, &len) == -1)
+        return false;
+    return addr.ss_family == AF_UNIX;
+}
+
+void sendFds(Socket fd, const std::vector<Descriptor> & fds)
+{
+    char data = 0;
+    struct iovec iov{.iov_base = &data, .iov_len = 1};
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (!fds.empty()) {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        auto cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+
+    while (sendmsg(fd, &msg, 0) == -1)
+        if (errno != EINTR)
+            throw SysError("sending file descriptors");
+}
+
+std::vector<AutoCloseFD> receiveFds(Socket fd, size_t maxFds)
+{
+    char data;
+    struct iovec iov{.iov_base = &data, .iov_len = 1};
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * maxFds));
+
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    ssize_t n;
+    while ((n = recvmsg(
+                fd,
+                &msg,
+                0
+#  ifdef MSG_CMSG_CLOEXEC
+                    | MSG_CMSG_CLOEXEC
+#  endif
+                ))
+           == -1)
+        if (errno != EINTR)
+            throw SysError("receiving file descriptors");
+
+    if (n == 0)
+        throw EndOfFile("unexpected end-of-file receiving file descriptors");
+
+    std::vector<AutoCloseFD> fds;
+
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; i++) {
+            int received;
+            memcpy(&received, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            AutoCloseFD receivedFd{received};
+            unix::closeOnExec(receivedFd.get());
+            if (fds.size() < maxFds)
+                fds.push_back(std::move(receivedFd));
+        }
+    }
+
+    return fds;
+}
+
+#endif
+
 } // namespace nix
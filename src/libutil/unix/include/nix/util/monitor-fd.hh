@@ -3,6 +3,7 @@
 
 #include <thread>
 #include <atomic>
+#include <functional>
 
 #include <cstdlib>
 #include <poll.h>
@@ -21,10 +22,14 @@ private:
     Pipe notifyPipe;
 
 public:
-    MonitorFdHup(int fd)
+    /**
+     * Call `onHangup` (by default, interrupt the process) when the
+     * other side of `fd` hangs up.
+     */
+    MonitorFdHup(int fd, std::function<void()> onHangup = unix::triggerInterrupt)
     {
         notifyPipe.create();
-        thread = std::thread([this, fd]() {
+        thread = std::thread([this, fd, onHangup]() {
             while (true) {
                 // There is a POSIX violation on macOS: you have to listen for
                 // at least POLLHUP to receive HUP events for a FD. POSIX says
@@ -92,7 +97,7 @@ public:
                 if (count == 0)
                     continue;
                 if (fds[0].revents & POLLHUP) {
-                    unix::triggerInterrupt();
+                    onHangup();
                     break;
                 }
                 if (fds[1].revents & POLLHUP) {
@@ -451,7 +451,11 @@ static void main_nix_build(int argc, char ** argv)
             throw UsageError("nix-shell requires a single derivation");
 
         auto & packageInfo = drvs.front();
-        auto drv = evalStore->derivationFromPath(packageInfo.requireDrvPath());
+        auto drvPath = packageInfo.requireDrvPath();
+        /* With `derivation-batch-size`, the derivation may not have
+           been written yet. */
+        state->flushDerivations();
+        auto drv = evalStore->derivationFromPath(drvPath);
 
         std::vector<DerivedPath> pathsToBuild;
         RealisedPath::Set pathsToCopy;
@@ -522,6 +526,9 @@ static void main_nix_build(int argc, char ** argv)
             pathsToCopy.insert(src);
         }
 
+        /* Write the `bashInteractive` derivation. */
+        state->flushDerivations();
+
         buildPaths(pathsToBuild);
 
         if (dryRun)
@@ -704,6 +711,8 @@ static void main_nix_build(int argc, char ** argv)
                 drvMap[drvPath] = {drvMap.size(), {outputName}};
         }
 
+        state->flushDerivations();
+
         buildPaths(pathsToBuild);
 
         if (dryRun)
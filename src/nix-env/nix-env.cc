@@ -472,6 +472,10 @@ static void printMissing(EvalState & state, PackageInfos & elems)
                     .path = i.queryOutPath(),
                 });
 
+    /* With `derivation-batch-size`, the derivations may not have been
+       written yet. */
+    state.flushDerivations();
+
     printMissing(state.store, targets);
 }
 
@@ -755,6 +759,7 @@ static void opSet(Globals & globals, Strings opFlags, Strings opArgs)
                       .path = drv.queryOutPath(),
                   }),
     };
+    globals.state->flushDerivations();
     printMissing(globals.state->store, paths);
     if (globals.dryRun)
         return;
@@ -40,6 +40,10 @@ bool createUserEnv(
         if (auto drvPath = i.queryDrvPath())
             drvsToBuild.push_back({*drvPath});
 
+    /* With `derivation-batch-size`, the derivations may not have been
+       written yet. */
+    state.flushDerivations();
+
     debug("building user environment dependencies");
     state.store->buildPaths(toDerivedPaths(drvsToBuild), state.repair ? bmRepair : bmNormal);
 
@@ -151,6 +155,7 @@ bool createUserEnv(
     debug("building user environment");
     std::vector<StorePathWithOutputs> topLevelDrvs;
     topLevelDrvs.push_back({topLevelDrv});
+    state.flushDerivations();
     state.store->buildPaths(toDerivedPaths(topLevelDrvs), state.repair ? bmRepair : bmNormal);
 
     /* Switch the current user environment to the output path. */
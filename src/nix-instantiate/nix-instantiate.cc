@@ -90,11 +90,14 @@ void processExpr(
                     if (++rootNr > 1)
                         rootName += "-" + std::to_string(rootNr);
                     auto store2 = state.store.dynamic_pointer_cast<LocalFSStore>();
-                    if (store2)
+                    if (store2) {
+                        state.flushDerivations();
                         drvPathS = store2->addPermRoot(drvPath, rootName);
+                    }
                 }
                 std::cout << fmt("%s%s\n", drvPathS, (outputName != "out" ? "!" + outputName : ""));
             }
+            state.flushDerivations();
         }
     }
 }
@@ -87,6 +87,7 @@ UnresolvedApp InstallableValue::toApp(EvalState & state)
                             };
                         },
                         [&](const NixStringContextElem::Opaque & o) -> DerivedPath {
+                            state.materializeStorePath(o.path);
                             return DerivedPath::Opaque{
                                 .path = o.path,
                             };
@@ -34,6 +34,12 @@ builtPathsWithResultToJSON(const std::vector<BuiltPathWithResult> & buildables,
                         j["cpuUser"] = ((double) b.result->cpuUser->count()) / 1000000;
                     if (b.result->cpuSystem)
                         j["cpuSystem"] = ((double) b.result->cpuSystem->count()) / 1000000;
+                    if (b.result->memoryPeak)
+                        j["memoryPeak"] = *b.result->memoryPeak;
+                    if (b.result->ioRead)
+                        j["ioRead"] = *b.result->ioRead;
+                    if (b.result->ioWrite)
+                        j["ioWrite"] = *b.result->ioWrite;
                 }
                 res.push_back(j);
             },
@@ -0,0 +1,93 @@
+#include "nix/cmd/command.hh"
+#include "nix/main/common-args.hh"
+#include "nix/store/store-api.hh"
+#include "nix/store/build-result.hh"
+#include "nix/util/ansicolor.hh"
+#include <nlohmann/json.hpp>
+
+using namespace nix;
+
+static std::string showStatus(BuildResult::Status status)
+{
+    BuildResult res;
+    res.status = status;
+    return res.toString();
+}
+
+struct CmdDerivationStats : InstallablesCommand, MixJSON
+{
+    std::string description() override
+    {
+        return "show the resource usage of past builds of a derivation";
+    }
+
+    std::string doc() override
+    {
+        return
+#include "derivation-stats.md"
+            ;
+    }
+
+    Category category() override
+    {
+        return catUtility;
+    }
+
+    void run(ref<Store> store, Installables && installables) override
+    {
+        auto drvPaths = Installable::toDerivations(store, installables, true);
+
+        nlohmann::json jsonRoot = nlohmann::json::object();
+
+        for (auto & drvPath : drvPaths) {
+            auto allStats = store->queryBuildStats(drvPath);
+
+            if (json) {
+                auto jsonStats = nlohmann::json::array();
+                for (auto & stats : allStats) {
+                    auto j = nlohmann::json::object();
+                    j["status"] = showStatus(stats.status);
+                    j["startTime"] = stats.startTime;
+                    j["stopTime"] = stats.stopTime;
+                    if (stats.cpuUser)
+                        j["cpuUser"] = ((double) stats.cpuUser->count()) / 1000000;
+                    if (stats.cpuSystem)
+                        j["cpuSystem"] = ((double) stats.cpuSystem->count()) / 1000000;
+                    if (stats.memoryPeak)
+                        j["memoryPeak"] = *stats.memoryPeak;
+                    if (stats.ioRead)
+                        j["ioRead"] = *stats.ioRead;
+                    if (stats.ioWrite)
+                        j["ioWrite"] = *stats.ioWrite;
+                    jsonStats.push_back(std::move(j));
+                }
+                jsonRoot[store->printStorePath(drvPath)] = std::move(jsonStats);
+                continue;
+            }
+
+            logger->cout(ANSI_BOLD "%s" ANSI_NORMAL, store->printStorePath(drvPath));
+
+            if (allStats.empty())
+                logger->cout("  no recorded builds");
+
+            for (auto & stats : allStats) {
+                auto line = fmt("  %s, %ds", showStatus(stats.status), stats.stopTime - stats.startTime);
+                if (stats.cpuUser && stats.cpuSystem)
+                    line += fmt(
+                        ", CPU %.3fs user / %.3fs system",
+                        ((double) stats.cpuUser->count()) / 1000000,
+                        ((double) stats.cpuSystem->count()) / 1000000);
+                if (stats.memoryPeak)
+                    line += fmt(", peak memory %s", showBytes(*stats.memoryPeak));
+                if (stats.ioRead && stats.ioWrite)
+                    line += fmt(", I/O %s read / %s written", showBytes(*stats.ioRead), showBytes(*stats.ioWrite));
+                logger->cout(line);
+            }
+        }
+
+        if (json)
+            printJSON(jsonRoot);
+    }
+};
+
+static auto rCmdDerivationStats = registerCommand2<CmdDerivationStats>({"derivation", "stats"});
@@ -3,11 +3,41 @@
 #include "nix/main/shared.hh"
 #include "nix/store/store-open.hh"
 #include "nix/store/log-store.hh"
+#include "nix/util/signals.hh"
+
+#include <thread>
 
 using namespace nix;
 
 struct CmdLog : InstallableCommand
 {
+    uint64_t offset = 0;
+    std::optional<uint64_t> length;
+    bool follow = false;
+
+    CmdLog()
+    {
+        addFlag({
+            .longName = "offset",
+            .description = "Skip the first *n* bytes of the log.",
+            .labels = {"n"},
+            .handler = {&offset},
+        });
+
+        addFlag({
+            .longName = "length",
+            .description = "Show at most *n* bytes of the log.",
+            .labels = {"n"},
+            .handler = {&length},
+        });
+
+        addFlag({
+            .longName = "follow",
+            .description = "If the build is still running, keep showing new output until it finishes.",
+            .handler = {&follow, true},
+        });
+    }
+
     std::string description() override
     {
         return "show the build log of the specified packages or paths, if available";
@@ -53,12 +83,37 @@ struct CmdLog : InstallableCommand
             }
             auto & logSub = *logSubP;
 
-            auto log = logSub.getBuildLog(path);
+            auto log = logSub.getBuildLog(path, offset, length);
             if (!log)
                 continue;
             logger->stop();
             printInfo("got build log for '%s' from '%s'", installable->what(), logSub.getUri());
             writeFull(getStandardOutput(), *log);
+
+            if (follow && !logSub.canFollowBuildLogs())
+                warn("cannot follow build logs in '%s'; only showing what has been written so far", logSub.getUri());
+            else if (follow) {
+                auto drvPath = logSub.getBuildDerivationPath(path);
+                uint64_t written = log->size();
+                while (drvPath && (!length || written < *length)) {
+                    /* Check whether the build is still running before
+                       reading, so that we don't miss output written
+                       just before it finished. */
+                    auto active = logSub.isBuildLogActive(*drvPath);
+                    auto more = logSub.getBuildLog(
+                        path, offset + written, length ? std::optional(*length - written) : std::nullopt);
+                    if (more && !more->empty()) {
+                        writeFull(getStandardOutput(), *more);
+                        written += more->size();
+                    } else if (!active)
+                        break;
+                    else {
+                        checkInterrupt();
+                        std::this_thread::sleep_for(std::chrono::seconds(1));
+                    }
+                }
+            }
+
             return;
         }
 
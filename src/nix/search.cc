@@ -11,6 +11,7 @@
 #include "nix/expr/attr-path.hh"
 #include "nix/util/hilite.hh"
 #include "nix/util/strings-inline.hh"
+#include "nix/util/thread-pool.hh"
 
 #include <regex>
 #include <fstream>
@@ -90,6 +91,76 @@ struct CmdSearch : InstallableValueCommand, MixJSON
 
         uint64_t results = 0;
 
+        struct Match
+        {
+            std::vector<std::smatch> attrPathMatches;
+            std::vector<std::smatch> nameMatches;
+            std::vector<std::smatch> descriptionMatches;
+        };
+
+        /* Note: this is called concurrently when searching the index
+           of the evaluation cache. */
+        auto match = [&](const eval_cache::SearchEntry & entry) -> std::optional<Match> {
+            Match m;
+            bool found = false;
+
+            for (auto & regex : excludeRegexes) {
+                if (std::regex_search(entry.attrPath, regex) || std::regex_search(entry.pname, regex)
+                    || std::regex_search(entry.description, regex))
+                    return std::nullopt;
+            }
+
+            for (auto & regex : regexes) {
+                found = false;
+                auto addAll = [&found](std::sregex_iterator it, std::vector<std::smatch> & vec) {
+                    const auto end = std::sregex_iterator();
+                    while (it != end) {
+                        vec.push_back(*it++);
+                        found = true;
+                    }
+                };
+
+                addAll(std::sregex_iterator(entry.attrPath.begin(), entry.attrPath.end(), regex), m.attrPathMatches);
+                addAll(std::sregex_iterator(entry.pname.begin(), entry.pname.end(), regex), m.nameMatches);
+                addAll(
+                    std::sregex_iterator(entry.description.begin(), entry.description.end(), regex),
+                    m.descriptionMatches);
+
+                if (!found)
+                    break;
+            }
+
+            if (!found)
+                return std::nullopt;
+
+            return m;
+        };
+
+        auto print = [&](const eval_cache::SearchEntry & entry, const Match & m) {
+            results++;
+            if (json) {
+                (*jsonOut)[entry.attrPath] = {
+                    {"pname", entry.pname},
+                    {"version", entry.version},
+                    {"description", entry.description},
+                };
+            } else {
+                if (results > 1)
+                    logger->cout("");
+                logger->cout(
+                    "* %s%s",
+                    wrap("\e[0;1m", hiliteMatches(entry.attrPath, m.attrPathMatches, ANSI_GREEN, "\e[0;1m")),
+                    entry.version != "" ? " (" + entry.version + ")" : "");
+                if (entry.description != "")
+                    logger->cout(
+                        "  %s", hiliteMatches(entry.description, m.descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
+            }
+        };
+
+        /* The derivations found while walking the current cursor, to
+           be stored in the search index of the evaluation cache. */
+        std::vector<eval_cache::SearchEntry> entries;
+
         std::function<void(eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath, bool initialRecurse)>
             visit;
 
@@ -114,57 +185,18 @@ struct CmdSearch : InstallableValueCommand, MixJSON
                     auto aDescription = aMeta ? aMeta->maybeGetAttr(state->sDescription) : nullptr;
                     auto description = aDescription ? aDescription->getString() : "";
                     std::replace(description.begin(), description.end(), '\n', ' ');
-                    auto attrPath2 = concatStringsSep(".", attrPathS);
-
-                    std::vector<std::smatch> attrPathMatches;
-                    std::vector<std::smatch> descriptionMatches;
-                    std::vector<std::smatch> nameMatches;
-                    bool found = false;
 
-                    for (auto & regex : excludeRegexes) {
-                        if (std::regex_search(attrPath2, regex) || std::regex_search(name.name, regex)
-                            || std::regex_search(description, regex))
-                            return;
-                    }
+                    eval_cache::SearchEntry entry{
+                        .attrPath = concatStringsSep(".", attrPathS),
+                        .pname = name.name,
+                        .version = name.version,
+                        .description = std::move(description),
+                    };
 
-                    for (auto & regex : regexes) {
-                        found = false;
-                        auto addAll = [&found](std::sregex_iterator it, std::vector<std::smatch> & vec) {
-                            const auto end = std::sregex_iterator();
-                            while (it != end) {
-                                vec.push_back(*it++);
-                                found = true;
-                            }
-                        };
-
-                        addAll(std::sregex_iterator(attrPath2.begin(), attrPath2.end(), regex), attrPathMatches);
-                        addAll(std::sregex_iterator(name.name.begin(), name.name.end(), regex), nameMatches);
-                        addAll(std::sregex_iterator(description.begin(), description.end(), regex), descriptionMatches);
-
-                        if (!found)
-                            break;
-                    }
+                    if (auto m = match(entry))
+                        print(entry, *m);
 
-                    if (found) {
-                        results++;
-                        if (json) {
-                            (*jsonOut)[attrPath2] = {
-                                {"pname", name.name},
-                                {"version", name.version},
-                                {"description", description},
-                            };
-                        } else {
-                            if (results > 1)
-                                logger->cout("");
-                            logger->cout(
-                                "* %s%s",
-                                wrap("\e[0;1m", hiliteMatches(attrPath2, attrPathMatches, ANSI_GREEN, "\e[0;1m")),
-                                name.version != "" ? " (" + name.version + ")" : "");
-                            if (description != "")
-                                logger->cout(
-                                    "  %s", hiliteMatches(description, descriptionMatches, ANSI_GREEN, ANSI_NORMAL));
-                        }
-                    }
+                    entries.push_back(std::move(entry));
                 }
 
                 else if (
@@ -187,8 +219,38 @@ struct CmdSearch : InstallableValueCommand, MixJSON
             }
         };
 
-        for (auto & cursor : installable->getCursors(*state))
-            visit(*cursor, cursor->getAttrPath(), true);
+        /* Match the entries of a search index in parallel, and print
+           the results in order. */
+        auto searchIndex = [&](const std::vector<eval_cache::SearchEntry> & index) {
+            static constexpr size_t chunkSize = 1024;
+
+            std::vector<std::optional<Match>> matches(index.size());
+
+            ThreadPool pool;
+
+            for (size_t start = 0; start < index.size(); start += chunkSize)
+                pool.enqueue([&, start]() {
+                    for (size_t i = start; i < std::min(start + chunkSize, index.size()); ++i)
+                        matches[i] = match(index[i]);
+                });
+
+            pool.process();
+
+            for (size_t i = 0; i < index.size(); ++i)
+                if (matches[i])
+                    print(index[i], *matches[i]);
+        };
+
+        for (auto & cursor : installable->getCursors(*state)) {
+            if (auto index = cursor->getSearchIndex()) {
+                debug("using search index of '%s'", cursor->getAttrPathStr());
+                searchIndex(*index);
+            } else {
+                entries.clear();
+                visit(*cursor, cursor->getAttrPath(), true);
+                cursor->setSearchIndex(entries);
+            }
+        }
 
         if (json)
             printJSON(*jsonOut);
@@ -14,6 +14,7 @@
 #include "nix/util/config-global.hh"
 #include "nix/store/derivations.hh"
 #include "nix/util/finally.hh"
+#include "nix/util/sync.hh"
 #include "nix/cmd/legacy.hh"
 #include "nix/store/daemon.hh"
 #include "man-pages.hh"
@@ -21,6 +22,8 @@
 #include <algorithm>
 #include <climits>
 #include <cstring>
+#include <queue>
+#include <thread>
 
 #include <unistd.h>
 #include <signal.h>
@@ -104,6 +107,33 @@ AuthorizationSettings authorizationSettings;
 
 static GlobalConfig::Register rSettings(&authorizationSettings);
 
+struct DaemonSettings : Config
+{
+    Setting<bool> useThreads{
+        this,
+        false,
+        "daemon-use-threads",
+        R"(
+          If set to `true`, the Nix daemon serves client connections in threads of a single process, rather than forking a new process for every connection.
+          These connections share one store, including its database connection and its in-memory caches, which makes short-lived connections much cheaper.
+
+          Since the settings of the daemon apply to the entire process, a connection is still moved to a process of its own when the client asks to build or substitute paths, or sets options that would change the daemon's settings.
+        )"};
+
+    Setting<size_t> maxThreads{
+        this,
+        128,
+        "daemon-max-threads",
+        R"(
+          The maximum number of threads that serve client connections if [`daemon-use-threads`](#conf-daemon-use-threads) is enabled.
+          Connections that arrive while all threads are busy are served by a process of their own, as if `daemon-use-threads` were disabled.
+        )"};
+};
+
+DaemonSettings daemonSettings;
+
+static GlobalConfig::Register rDaemonSettings(&daemonSettings);
+
 #ifndef __linux__
 #  define SPLICE_F_MOVE 0
 
@@ -288,6 +318,255 @@ static std::pair<TrustedFlag, std::string> authPeer(const PeerInfo & peer)
     return {trusted, std::move(user)};
 }
 
+static void writeSuspendedConnection(Sink & sink, const SuspendedConnection & conn)
+{
+    sink << conn.protoVersion << conn.features << (bool) conn.trusted;
+    if (conn.clientSettings)
+        sink << 1 << *conn.clientSettings;
+    else
+        sink << 0;
+    sink << (uint64_t) conn.op << conn.buffered;
+}
+
+static SuspendedConnection readSuspendedConnection(Source & source)
+{
+    SuspendedConnection conn;
+    conn.protoVersion = readNum<WorkerProto::Version>(source);
+    conn.features = readStrings<WorkerProto::FeatureSet>(source);
+    conn.trusted = readNum<bool>(source) ? Trusted : NotTrusted;
+    if (readNum<bool>(source))
+        conn.clientSettings = readString(source);
+    conn.op = (WorkerProto::Op) readNum<uint64_t>(source);
+    conn.buffered = readString(source);
+    return conn;
+}
+
+/**
+ * A process that resumes the connections handed over by connection
+ * threads (see `daemon-use-threads`) in processes of their own. It is
+ * started before any connection threads, so the processes it forks
+ * start out in the same state as in a daemon that doesn't use
+ * threads.
+ */
+struct ForkServer
+{
+    AutoCloseFD fd;
+    Pid pid;
+
+    ForkServer(AutoCloseFD & fdSocket)
+    {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1)
+            throw SysError("creating socket pair");
+        AutoCloseFD ourSide = fds[0];
+        AutoCloseFD theirSide = fds[1];
+        unix::closeOnExec(ourSide.get());
+        unix::closeOnExec(theirSide.get());
+
+        ProcessOptions options;
+        options.errorPrefix = "unexpected Nix daemon error: ";
+        options.allowVfork = false;
+        pid = startProcess(
+            [&]() {
+                fdSocket = -1;
+                ourSide = -1;
+                run(std::move(theirSide));
+            },
+            options);
+
+        fd = std::move(ourSide);
+    }
+
+    [[noreturn]] static void run(AutoCloseFD fd)
+    {
+        //  Get rid of children automatically; don't let them become zombies.
+        setSigChldAction(true);
+
+        while (true) {
+            std::vector<AutoCloseFD> fds;
+            try {
+                fds = receiveFds(fd.get(), 2);
+            } catch (EndOfFile &) {
+                //  The daemon has exited.
+                exit(0);
+            }
+
+            if (fds.size() != 2)
+                continue;
+
+            try {
+                ProcessOptions options;
+                options.errorPrefix = "unexpected Nix daemon error: ";
+                options.dieWithParent = false;
+                options.runExitHandlers = true;
+                options.allowVfork = false;
+                startProcess(
+                    [&]() {
+                        fd = -1;
+
+                        //  Background the daemon.
+                        if (setsid() == -1)
+                            throw SysError("creating a new session");
+
+                        //  Restore normal handling of SIGCHLD.
+                        setSigChldAction(false);
+
+                        FdSource source(fds[1].get());
+                        if (readNum<bool>(source)) {
+                            auto suspended = readSuspendedConnection(source);
+                            fds[1] = -1;
+
+                            resumeConnection(
+                                openUncachedStore(),
+                                FdSource(fds[0].get()),
+                                FdSink(fds[0].get()),
+                                std::move(suspended));
+                        } else {
+                            auto trusted = readNum<bool>(source) ? Trusted : NotTrusted;
+                            fds[1] = -1;
+
+                            processConnection(
+                                openUncachedStore(),
+                                FdSource(fds[0].get()),
+                                FdSink(fds[0].get()),
+                                trusted,
+                                NotRecursive);
+                        }
+
+                        exit(0);
+                    },
+                    options);
+            } catch (Error & error) {
+                auto ei = error.info();
+                ei.msg = HintFmt("error resuming connection: %1%", ei.msg.str());
+                logError(ei);
+            }
+        }
+    }
+
+    /**
+     * Pass the client connection `remote` to the fork server, which
+     * resumes it in a new process.
+     */
+    void handOver(Descriptor remote, const SuspendedConnection & conn)
+    {
+        Pipe pipe;
+        pipe.create();
+        sendFds(fd.get(), {remote, pipe.readSide.get()});
+        pipe.readSide.close();
+        FdSink sink(pipe.writeSide.get());
+        sink << true;
+        writeSuspendedConnection(sink, conn);
+        sink.flush();
+    }
+
+    /**
+     * Pass the new client connection `remote` to the fork server,
+     * which serves it in a new process.
+     */
+    void handOverNew(Descriptor remote, TrustedFlag trusted)
+    {
+        Pipe pipe;
+        pipe.create();
+        sendFds(fd.get(), {remote, pipe.readSide.get()});
+        pipe.readSide.close();
+        FdSink sink(pipe.writeSide.get());
+        sink << false << (bool) trusted;
+        sink.flush();
+    }
+};
+
+/**
+ * A pool of at most `daemon-max-threads` threads that serve
+ * connections. Threads are started on demand and reused for
+ * subsequent connections. If all threads are busy, new connections
+ * are refused, so that they can be served by a process of their own
+ * instead of waiting.
+ */
+struct ConnectionThreadPool : std::enable_shared_from_this<ConnectionThreadPool>
+{
+    const size_t maxThreads;
+
+    struct State
+    {
+        std::queue<std::function<void()>> pending;
+        size_t threads = 0;
+        size_t idle = 0;
+    };
+
+    Sync<State> state_;
+
+    std::condition_variable wakeup;
+
+    ConnectionThreadPool(size_t maxThreads)
+        : maxThreads(std::max<size_t>(maxThreads, 1))
+    {
+    }
+
+    /**
+     * Run `work` in a thread of the pool, unless all threads are
+     * busy.
+     *
+     * @return Whether `work` was accepted.
+     */
+    bool tryEnqueue(std::function<void()> work)
+    {
+        auto state(state_.lock());
+        if (state->pending.size() >= state->idle) {
+            if (state->threads >= maxThreads) {
+                debug("all %d connection threads are busy", maxThreads);
+                return false;
+            }
+            state->threads++;
+            /* The threads keep the pool alive, since they outlive
+               the daemon loop. */
+            std::thread([pool(shared_from_this())]() { pool->run(); }).detach();
+        }
+        state->pending.push(std::move(work));
+        wakeup.notify_one();
+        return true;
+    }
+
+    [[noreturn]] void run()
+    {
+        while (true) {
+            std::function<void()> work;
+            {
+                auto state(state_.lock());
+                state->idle++;
+                while (state->pending.empty())
+                    state.wait(wakeup);
+                state->idle--;
+                work = std::move(state->pending.front());
+                state->pending.pop();
+            }
+            work();
+        }
+    }
+};
+
+/**
+ * Serve a connection in a thread that shares `store` with other
+ * connections, see `daemon-use-threads`.
+ */
+static void
+serveConnectionInThread(ref<Store> store, std::shared_ptr<ForkServer> forkServer, AutoCloseFD remote, TrustedFlag trusted)
+{
+    try {
+        processConnectionInThread(
+            store, FdSource(remote.get()), FdSink(remote.get()), trusted, [&](SuspendedConnection && conn) {
+                forkServer->handOver(remote.get(), conn);
+            });
+    } catch (Interrupted &) {
+    } catch (Error & error) {
+        auto ei = error.info();
+        ei.msg = HintFmt("unexpected Nix daemon error: %1%", ei.msg.str());
+        logError(ei);
+    } catch (std::exception & e) {
+        printError("unexpected Nix daemon error: %s", e.what());
+    }
+}
+
 /**
  * Run a server. The loop opens a socket and accepts new connections from that
  * socket.
@@ -319,7 +598,9 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
     }
 
     //  Get rid of children automatically; don't let them become zombies.
-    setSigChldAction(true);
+    //  With threads, the children are forked by the fork server instead.
+    if (!daemonSettings.useThreads)
+        setSigChldAction(true);
 
 #ifdef __linux__
     if (settings.useCgroups) {
@@ -342,6 +623,22 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
     }
 #endif
 
+    std::shared_ptr<ForkServer> forkServer;
+    std::shared_ptr<Store> sharedStore;
+    std::shared_ptr<ConnectionThreadPool> threadPool;
+
+    if (daemonSettings.useThreads) {
+        forkServer = std::make_shared<ForkServer>(fdSocket);
+        //  Unlike a per-connection store, this one keeps its caches.
+        sharedStore = openStore();
+        //  Other processes (e.g. those serving handed-over
+        //  connections) may change the store behind our back.
+        if (auto localStore = std::dynamic_pointer_cast<LocalStore>(sharedStore))
+            localStore->enablePathInfoCacheRevalidation();
+        threadPool = std::make_shared<ConnectionThreadPool>(daemonSettings.maxThreads);
+        initConnectionThreads();
+    }
+
     //  Loop accepting connections.
     while (1) {
 
@@ -378,6 +675,17 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
                 peer.pidKnown ? std::to_string(peer.pid) : "<unknown>",
                 peer.uidKnown ? user : "<unknown>");
 
+            if (sharedStore) {
+                auto remoteShared = std::make_shared<AutoCloseFD>(std::move(remote));
+                if (!threadPool->tryEnqueue(
+                        [store(ref<Store>(sharedStore)), forkServer, remoteShared, trusted]() {
+                            serveConnectionInThread(store, forkServer, std::move(*remoteShared), trusted);
+                        }))
+                    //  Don't make the client wait for a thread.
+                    forkServer->handOverNew(remoteShared->get(), trusted);
+                continue;
+            }
+
             //  Fork a child to handle the connection.
             ProcessOptions options;
             options.errorPrefix = "unexpected Nix daemon error: ";
@@ -430,6 +738,10 @@ static void daemonLoop(std::optional<TrustedFlag> forceTrustClientOpt)
  */
 static void forwardStdioConnection(RemoteStore & store)
 {
+    /* We only relay bytes, not file descriptors. If the client and the
+       daemon both negotiate `fd-passing`, the probe in the handshake
+       (see `WorkerProto::BasicConnection::getSupportedFeatures()`)
+       doesn't arrive, so they fall back to sending NARs inline. */
     auto conn = store.openConnectionWrapper();
     int from = conn->from.fd;
     int to = conn->to.fd;
@@ -0,0 +1,70 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireSandboxSupport
+requiresUnprivilegedUserNamespaces
+[[ "${busybox-}" =~ busybox ]] || skipTest "no busybox"
+
+# Avoid store dir being inside sandbox build-dir
+unset NIX_STORE_DIR
+
+file=build-hook.nix
+
+builders=(
+  "ssh://localhost?remote-store=$TEST_ROOT/machine1?system-features=foo - - 1 1 foo"
+  "$TEST_ROOT/machine2 - - 1 1 bar"
+  "ssh-ng://localhost?remote-store=$TEST_ROOT/machine3?system-features=baz - - 1 1 baz"
+)
+
+chmod -R +w "$TEST_ROOT/machine"* || true
+rm -rf "$TEST_ROOT/machine"* || true
+
+# Dispatch the builds from the Nix process instead of the build hook.
+nix build -L -v -f "$file" -o "$TEST_ROOT/result" --max-jobs 0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders-in-process \
+  --builders "$(IFS=';'; echo "${builders[*]}")"
+
+outPath=$(readlink -f "$TEST_ROOT/result")
+
+grep 'FOO BAR BAZ' "$TEST_ROOT/machine0/$outPath"
+
+# Each input was built on the machine with the required feature.
+nix path-info --store "$TEST_ROOT/machine1" --all | grepQuiet builder-build-remote-input-1.sh
+nix path-info --store "$TEST_ROOT/machine2" --all | grepQuiet builder-build-remote-input-2.sh
+nix path-info --store "$TEST_ROOT/machine3" --all | grepQuiet builder-build-remote-input-3.sh
+
+# Failures on the remote machine are reported.
+out="$(nix-build 2>&1 failing.nix --no-out-link -j0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders-in-process \
+  --builders "$(IFS=';'; echo "${builders[*]}")")" || true
+
+[[ "$out" =~ .*"Cannot build".* ]]
+
+# A failing build doesn't wait for other remote builds to finish
+# (without --keep-going).
+cat > "$TEST_ROOT/cancel.nix" <<EOF
+{ busybox }:
+let
+  mk = name: cmd: derivation {
+    inherit name;
+    system = builtins.currentSystem;
+    builder = busybox;
+    args = [ "sh" "-c" cmd ];
+  };
+in [ (mk "fails-fast" "exit 1") (mk "slow" "sleep 100; echo > \$out") ]
+EOF
+
+start=$SECONDS
+out="$(nix-build 2>&1 "$TEST_ROOT/cancel.nix" --no-out-link -j0 \
+  --arg busybox "$busybox" \
+  --store "$TEST_ROOT/machine0" \
+  --builders-in-process \
+  --builders "ssh-ng://localhost?remote-store=$TEST_ROOT/machine3 - - 2 1")" || true
+
+[[ "$out" =~ .*"Cannot build".*"fails-fast".* ]]
+(( SECONDS - start < 60 ))
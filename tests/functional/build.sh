@@ -199,3 +199,11 @@ else
 fi
 <<<"$out" grepQuiet -vE "hash mismatch in fixed-output derivation '.*-x3\\.drv'"
 <<<"$out" grepQuiet -vE "hash mismatch in fixed-output derivation '.*-x2\\.drv'"
+
+# Builds are recorded in the build statistics.
+if isDaemonNewer "2.31pre20261019"; then
+    expr="with import ${config_nix}; mkDerivation { name = \"stats-$RANDOM\"; buildCommand = \"echo \$RANDOM > \$out\"; }"
+    drvPath=$(nix eval --raw --impure --expr "($expr).drvPath")
+    nix build --no-link --impure --expr "$expr"
+    [[ $(nix derivation stats --json "$drvPath^*" | jq -r ".\"$drvPath\"[0].status") = Built ]]
+fi
@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+requireDaemonNewerThan "2.31pre20261019"
+
+clearStore
+
+startDaemon
+
+outPath=$(nix-build dependencies.nix --no-out-link)
+head -c 10000000 /dev/urandom > "$TEST_ROOT/big"
+bigPath=$(nix-store --add "$TEST_ROOT/big")
+
+# NARs received from the daemon through a pipe are the same as those
+# produced locally.
+for path in "$outPath" "$bigPath"; do
+    nix-store --dump "$path" --debug > "$TEST_ROOT/daemon.nar" 2> "$TEST_ROOT/log"
+    grepQuiet "receiving NAR of '$path' from the daemon through a pipe" "$TEST_ROOT/log"
+    NIX_REMOTE= nix-store --dump "$path" > "$TEST_ROOT/local.nar"
+    cmp "$TEST_ROOT/daemon.nar" "$TEST_ROOT/local.nar"
+done
+
+# NARs sent to the daemon through a pipe are imported correctly.
+paths=$(nix-store -qR "$outPath" "$bigPath")
+nix-store --export $paths > "$TEST_ROOT/exported"
+nix-store --delete $paths
+nix-store --import --debug < "$TEST_ROOT/exported" 2> "$TEST_ROOT/log"
+grepQuiet "sending NAR of '$bigPath' to the daemon through a pipe" "$TEST_ROOT/log"
+nix-store --verify-path $paths
+
+# Importing paths that are already valid also works.
+nix-store --import < "$TEST_ROOT/exported"
+
+killDaemon
@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+requireDaemonNewerThan "2.31pre20261019"
+
+clearStore
+
+startDaemon
+
+outPath=$(nix-build dependencies.nix --no-out-link)
+
+multiplexed="unix://$NIX_DAEMON_SOCKET_PATH?multiplex=true"
+
+# Path info queries over a multiplexed connection give the same
+# results as over ordinary connections.
+nix path-info --recursive --json --store "$multiplexed" "$outPath" > "$TEST_ROOT/multiplexed.json"
+nix path-info --recursive --json "$outPath" > "$TEST_ROOT/plain.json"
+diff <(jq -S . "$TEST_ROOT/multiplexed.json") <(jq -S . "$TEST_ROOT/plain.json")
+
+nix-store --store "$multiplexed" --check-validity "$outPath"
+
+# Multiplexing is opt-in.
+(! nix path-info --recursive -vvvv "$outPath" 2>&1 | grepQuiet "sending multiplexed request")
+
+# Computing a closure has several requests in flight at the same time,
+# including the queries for the references of a path, which are sent
+# from the callback of the query for the path itself.
+maxInFlight=$(nix path-info --store "$multiplexed" --recursive -vvvv "$outPath" 2>&1 \
+  | sed -n 's/.*sending multiplexed request [0-9]* (\([0-9]*\) in flight).*/\1/p' \
+  | sort -n | tail -1)
+(( maxInFlight > 1 ))
+(( $(nix path-info --store "$multiplexed" --recursive -vvvv "$outPath" 2>&1 | grep -c "sending multiplexed request") >= $(nix path-info --recursive "$outPath" | wc -l) ))
+
+# Errors are reported per request.
+expectStderr 1 nix path-info --store "$multiplexed" "$NIX_STORE_DIR/ffffffffffffffffffffffffffffffff-x" | grepQuiet "is not valid"
+
+# Concurrent clients.
+pids=()
+for i in $(seq 1 5); do
+    nix path-info --store "$multiplexed" --recursive "$outPath" > /dev/null &
+    pids+=($!)
+done
+for pid in "${pids[@]}"; do
+    wait "$pid"
+done
+
+killDaemon
@@ -0,0 +1,49 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+requireDaemonNewerThan "2.31pre20261019"
+
+clearStore
+
+echo 'daemon-use-threads = true' >> "$test_nix_conf"
+# Fewer threads than concurrent clients, so that some connections are
+# served by processes of their own.
+echo 'daemon-max-threads = 2' >> "$test_nix_conf"
+
+startDaemon
+
+# Concurrent connections served by threads of the same process.
+pids=()
+for i in $(seq 1 10); do
+    (
+        path=$(echo "hello $i" | nix-store --add /dev/stdin)
+        nix path-info "$path" | grepQuiet "$path"
+    ) &
+    pids+=($!)
+done
+for pid in "${pids[@]}"; do
+    wait "$pid"
+done
+
+# Builds are handed over to a process of their own.
+outPath=$(nix-build dependencies.nix --no-out-link)
+[[ $(cat "$outPath/foobar") = FOOBAR ]]
+
+# So are connections with settings that differ from the daemon's.
+nix-store --delete "$outPath"
+(! nix path-info "$outPath")
+outPath=$(nix-build dependencies.nix --no-out-link --keep-going)
+[[ $(cat "$outPath/foobar") = FOOBAR ]]
+
+# The threads notice that another process added the path.
+nix path-info "$outPath"
+
+# Temporary roots are released when the client disconnects.
+path=$(echo "temporary" | nix-store --add /dev/stdin)
+nix-store --delete "$path"
+[[ ! -e "$path" ]]
+
+killDaemon
@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+TODO_NixOS
+
+clearStoreIfPossible
+
+export NIX_PATH=config="${config_nix}"
+
+# Queued derivations are written to the store before being returned.
+drvPath=$(nix-instantiate --option derivation-batch-size 1000 dependencies.nix)
+nix-store -q --tree "$drvPath" | grep '───.*builder-dependencies-input-1.sh'
+
+# Batching must not change the derivation paths.
+clearStoreIfPossible
+[[ "$(nix-instantiate --option derivation-batch-size 2 dependencies.nix)" = "$drvPath" ]]
+
+# Import from derivation writes queued derivations before building them.
+outPath=$(nix-build --option derivation-batch-size 1000 ./import-from-derivation.nix -A result --no-out-link)
+[ "$(cat "$outPath")" = FOO579 ]
+
+# So does `nix build`.
+clearStoreIfPossible
+nix build --option derivation-batch-size 1000 --no-link -f dependencies.nix
+
+# nix-build, nix-shell and nix-env write queued derivations before
+# using them.
+clearStoreIfPossible
+nix-build --option derivation-batch-size 1000 dependencies.nix --no-out-link
+
+clearStoreIfPossible
+NIX_PATH=nixpkgs="$PWD/shell.nix" nix-shell --option derivation-batch-size 1000 "$PWD/shell.nix" -A shellDrv --run true
+
+clearStoreIfPossible
+nix-env --option derivation-batch-size 1000 -p "$TEST_ROOT/batch-profile" -f ./user-envs.nix -i foo-1.0
+[[ -e "$TEST_ROOT/batch-profile/bin/foo" ]]
@@ -0,0 +1,21 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+requireDaemonNewerThan "2.31pre20261019"
+
+clearStore
+
+drvPath=$(nix-instantiate dependencies.nix)
+nix-store --realise "$drvPath"
+
+# A process that needs the hashes of the input derivations computes
+# them from the derivations in the store...
+rm -f "$HOME/.cache/nix/drv-hashes-v1.sqlite"
+nix-store --realise "$drvPath" -vvvv 2> "$TEST_ROOT/drv-hash-cold.log"
+grepQuiet "computing the hash of derivation" "$TEST_ROOT/drv-hash-cold.log"
+[[ -e "$HOME/.cache/nix/drv-hashes-v1.sqlite" ]]
+
+# ...while later processes get them from the disk cache.
+nix-store --realise "$drvPath" -vvvv 2> "$TEST_ROOT/drv-hash-warm.log"
+grepQuietInverse "computing the hash of derivation" "$TEST_ROOT/drv-hash-warm.log"
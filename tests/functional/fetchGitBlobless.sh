@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+
+# shellcheck source=common.sh
+source common.sh
+
+requireGit
+
+repo="$TEST_ROOT/blobless-parent"
+
+git init "$repo"
+git -C "$repo" config user.email "foobar@example.com"
+git -C "$repo" config user.name "Foobar"
+
+# Allow partial clones and fetching missing blobs by hash.
+git -C "$repo" config uploadpack.allowFilter true
+git -C "$repo" config uploadpack.allowAnySHA1InWant true
+
+mkdir -p "$repo/dir"
+echo foo > "$repo/dir/a"
+echo bar > "$repo/dir/b"
+echo baz > "$repo/c"
+git -C "$repo" add dir c
+git -C "$repo" commit -m "First commit"
+
+rev=$(git -C "$repo" rev-parse HEAD)
+
+# A blobless clone fetches the file contents on demand.
+path=$(nix eval --impure --raw --expr "(builtins.fetchGit { url = \"file://$repo\"; rev = \"$rev\"; blobless = true; }).outPath")
+[[ $(cat "$path/dir/a") = foo ]]
+[[ $(cat "$path/c") = baz ]]
+
+cacheRepo=$(echo "$TEST_HOME"/.cache/nix/gitv3/*-blobless)
+[[ $(git -C "$cacheRepo" config extensions.partialclone) = origin ]]
+
+# The result is the same as for a full clone.
+path2=$(nix eval --impure --raw --expr "(builtins.fetchGit { url = \"file://$repo\"; rev = \"$rev\"; }).outPath")
+[[ $path = "$path2" ]]
+
+# Copying a tree to the store fetches all its missing blobs in one
+# request, rather than one per directory.
+mkdir -p "$repo/d1/d2/d3" "$repo/e"
+echo 1 > "$repo/d1/f"
+echo 2 > "$repo/d1/d2/f"
+echo 3 > "$repo/d1/d2/d3/f"
+echo 4 > "$repo/e/f"
+git -C "$repo" add d1 e
+git -C "$repo" commit -m "Second commit"
+
+rev2=$(git -C "$repo" rev-parse HEAD)
+
+nix eval -v --impure --raw --expr "(builtins.fetchGit { url = \"file://$repo\"; rev = \"$rev2\"; blobless = true; }).outPath" \
+    2> "$TEST_ROOT/blobless.log"
+[[ $(grep -c "missing objects into Git repository" "$TEST_ROOT/blobless.log") = 1 ]]
+
+# Without a revision, the HEAD ref is cached in the blobless clone as well.
+rm -rf "$TEST_HOME/.cache/nix"
+nix eval --impure --raw --expr "(builtins.fetchGit { url = \"file://$repo\"; blobless = true; }).outPath" \
+    2> "$TEST_ROOT/blobless-head.log"
+(! grepQuiet "could not update cached head" "$TEST_ROOT/blobless-head.log")
+[[ $(git -C "$(echo "$TEST_HOME"/.cache/nix/gitv3/*-blobless)" symbolic-ref HEAD) = "$(git -C "$repo" symbolic-ref HEAD)" ]]
+
+# Submodules are fetched blobless as well.
+git config --global protocol.file.allow always
+subRepo="$TEST_ROOT/blobless-sub"
+git init "$subRepo"
+git -C "$subRepo" config user.email "foobar@example.com"
+git -C "$subRepo" config user.name "Foobar"
+git -C "$subRepo" config uploadpack.allowFilter true
+git -C "$subRepo" config uploadpack.allowAnySHA1InWant true
+echo sub > "$subRepo/file"
+git -C "$subRepo" add file
+git -C "$subRepo" commit -m "Submodule commit"
+git -C "$repo" submodule add "$subRepo" sub
+git -C "$repo" commit -m "Add submodule"
+
+rev3=$(git -C "$repo" rev-parse HEAD)
+
+rm -rf "$TEST_HOME/.cache/nix"
+path=$(nix eval --impure --raw --expr "(builtins.fetchGit { url = \"file://$repo\"; rev = \"$rev3\"; blobless = true; submodules = true; }).outPath")
+[[ $(cat "$path/sub/file") = sub ]]
+for cacheRepo in "$TEST_HOME"/.cache/nix/gitv3/*/; do
+    [[ $cacheRepo = *-blobless/ ]]
+done
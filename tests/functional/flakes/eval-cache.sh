@@ -48,3 +48,96 @@ nix build --no-link "$flake1Dir#stack-depth"
 expect 1 nix build "$flake1Dir#ifd" --option allow-import-from-derivation false 2>&1 \
   | grepQuiet 'error: cannot build .* during evaluation because the option '\''allow-import-from-derivation'\'' is disabled'
 nix build --no-link "$flake1Dir#ifd"
+
+# Changing a file only invalidates the cached attributes that depend on it.
+flake2Dir="$TEST_ROOT/eval-cache-flake2"
+
+createGitRepo "$flake2Dir" ""
+cp "${config_nix}" "$flake2Dir/"
+
+cat >"$flake2Dir/flake.nix" <<EOF
+{
+  outputs = { self }: let inherit (import ./config.nix) mkDerivation; in {
+    a = mkDerivation {
+      name = "a";
+      buildCommand = "echo \${builtins.readFile ./a} > \$out";
+    };
+    b = mkDerivation {
+      name = "b";
+      buildCommand = "echo \${builtins.readFile ./b} > \$out";
+    };
+    c = mkDerivation {
+      name = "c";
+      buildCommand = "echo \${self.rev or self.dirtyRev} > \$out";
+    };
+  };
+}
+EOF
+
+echo a > "$flake2Dir/a"
+echo b > "$flake2Dir/b"
+git -C "$flake2Dir" add flake.nix config.nix a b
+git -C "$flake2Dir" commit -m "Init"
+
+# Make the tree dirty, so that editing it doesn't change its revision.
+echo a1 > "$flake2Dir/a"
+
+nix build --no-link "$flake2Dir#a"
+nix build --no-link "$flake2Dir#b"
+NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#a"
+
+echo a2 > "$flake2Dir/a"
+
+NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#b"
+expect 1 env NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#a" 2>&1 \
+  | grepQuiet 'not everything is cached'
+[[ $(cat "$(nix build --no-link --print-out-paths "$flake2Dir#a")") = a2 ]]
+
+# Committing doesn't invalidate the cache either, except for the
+# attributes that depend on the revision.
+nix build --no-link "$flake2Dir#c"
+git -C "$flake2Dir" commit -a -m "Change a"
+NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#a"
+NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#b"
+expect 1 env NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#c" 2>&1 \
+  | grepQuiet 'not everything is cached'
+nix build --no-link "$flake2Dir#c"
+
+echo b1 > "$flake2Dir/b"
+git -C "$flake2Dir" commit -a -m "Change b"
+NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#a"
+expect 1 env NIX_ALLOW_EVAL=0 nix build --no-link "$flake2Dir#b" 2>&1 \
+  | grepQuiet 'not everything is cached'
+
+# `nix search` stores its results in the evaluation cache, and
+# notices changes to the package set.
+flake3Dir="$TEST_ROOT/eval-cache-flake3"
+
+createGitRepo "$flake3Dir" ""
+cp "${config_nix}" "$flake3Dir/"
+
+cat >"$flake3Dir/flake.nix" <<EOF2
+{
+  outputs = { self }: let inherit (import ./config.nix) mkDerivation; in {
+    packages.$system.hello = mkDerivation {
+      name = "hello-1.0";
+      buildCommand = "touch \$out";
+      meta.description = builtins.readFile ./description;
+    };
+  };
+}
+EOF2
+
+echo -n foo > "$flake3Dir/description"
+git -C "$flake3Dir" add flake.nix config.nix description
+git -C "$flake3Dir" commit -m "Init"
+
+echo -n bar > "$flake3Dir/description"
+
+nix search "$flake3Dir" hello | grepQuiet bar
+NIX_ALLOW_EVAL=0 nix search "$flake3Dir" hello | grepQuiet bar
+
+echo -n baz > "$flake3Dir/description"
+
+nix search "$flake3Dir" hello | grepQuiet baz
+(( $(nix search "$flake3Dir" bar | wc -l) == 0 ))
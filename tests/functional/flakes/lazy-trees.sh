@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+
+source ./common.sh
+
+requireGit
+
+flakeDir="$TEST_ROOT/flake"
+
+createGitRepo "$flakeDir"
+
+cat > "$flakeDir/flake.nix" <<EOF
+{
+  outputs = { self }: {
+    data = builtins.readFile ./data;
+    src = "\${self}";
+    sub = "\${./sub}";
+    file = builtins.toFile "lazy-ref" "\${self}";
+    drv = (import ./config.nix).mkDerivation {
+      name = "lazy";
+      buildCommand = "cat \${self}/data > \$out";
+    };
+  };
+}
+EOF
+
+echo hello > "$flakeDir/data"
+mkdir "$flakeDir/sub"
+echo foo > "$flakeDir/sub/file"
+cp "${config_nix}" "$flakeDir/"
+git -C "$flakeDir" add flake.nix data sub config.nix
+git -C "$flakeDir" commit -m 'Initial'
+
+# Evaluating the flake doesn't copy it to the store.
+[[ $(nix eval --raw --lazy-trees "$flakeDir#data") = hello ]]
+storePath=$(nix eval --raw --lazy-trees "$flakeDir#src")
+[[ ! -e $storePath ]]
+
+# Using the flake in a derivation copies it to the store.
+outPath=$(nix build --no-link --print-out-paths --lazy-trees "$flakeDir#drv")
+[[ $(cat "$outPath") = hello ]]
+[[ -e $storePath ]]
+
+# The store path is the same as without lazy trees.
+[[ $(nix eval --raw "$flakeDir#src") = "$storePath" ]]
+
+# Unchanged subtrees of a dirty workdir are not copied again after
+# other files change.
+echo world > "$flakeDir/data"
+subPath=$(nix eval --raw --lazy-trees "$flakeDir#sub")
+[[ $(cat "$subPath/file") = foo ]]
+echo again > "$flakeDir/data"
+nix eval --raw --lazy-trees --debug "$flakeDir#sub" 2>&1 >/dev/null | grepQuiet "store path cache hit for '.*/sub'"
+[[ $(nix eval --raw --lazy-trees "$flakeDir#sub") = "$subPath" ]]
+
+# A change inside the subtree is picked up.
+echo bar > "$flakeDir/sub/file"
+subPath2=$(nix eval --raw --lazy-trees "$flakeDir#sub")
+[[ $subPath2 != "$subPath" ]]
+[[ $(cat "$subPath2/file") = bar ]]
+
+# Likewise, a subtree that is unchanged between two commits is not
+# copied again, but a commit that changes it invalidates the cache.
+git -C "$flakeDir" commit -a -m 'Update sub'
+subPath3=$(nix eval --raw --lazy-trees "$flakeDir#sub")
+[[ $subPath3 = "$subPath2" ]]
+echo more > "$flakeDir/data"
+git -C "$flakeDir" commit -a -m 'Update data'
+nix eval --raw --lazy-trees --debug "$flakeDir#sub" 2>&1 >/dev/null | grepQuiet "store path cache hit for '.*/sub'"
+[[ $(nix eval --raw --lazy-trees "$flakeDir#sub") = "$subPath2" ]]
+echo baz > "$flakeDir/sub/file"
+git -C "$flakeDir" commit -a -m 'Update sub again'
+nix eval --raw --lazy-trees --debug "$flakeDir#sub" 2>&1 >/dev/null | grepQuietInverse "store path cache hit for '.*/sub'"
+subPath4=$(nix eval --raw --lazy-trees "$flakeDir#sub")
+[[ $subPath4 != "$subPath2" ]]
+[[ $(cat "$subPath4/file") = baz ]]
+
+# Store paths referenced by a file created by `builtins.toFile` are
+# copied to the store.
+selfPath=$(nix eval --raw --lazy-trees "$flakeDir#src")
+[[ ! -e $selfPath ]]
+filePath=$(nix eval --raw --lazy-trees "$flakeDir#file")
+[[ $(cat "$filePath") = "$selfPath" ]]
+[[ -e $selfPath ]]
@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+
+source ./common.sh
+
+requireGit
+
+# Fetching flake inputs concurrently must produce the same lock file
+# as fetching them one at a time.
+
+createGitRepo "$TEST_ROOT/leaf"
+cat > "$TEST_ROOT/leaf/flake.nix" <<EOF
+{
+  outputs = { ... }: { };
+}
+EOF
+git -C "$TEST_ROOT/leaf" add flake.nix
+git -C "$TEST_ROOT/leaf" commit -m 'Initial'
+
+for i in 0 1 2 3; do
+    createGitRepo "$TEST_ROOT/data$i"
+    echo "$i" > "$TEST_ROOT/data$i/data"
+    git -C "$TEST_ROOT/data$i" add data
+    git -C "$TEST_ROOT/data$i" commit -m 'Initial'
+
+    createGitRepo "$TEST_ROOT/dep$i"
+    cat > "$TEST_ROOT/dep$i/flake.nix" <<EOF
+{
+  inputs.leaf.url = "git+file://$TEST_ROOT/leaf";
+  inputs.data = {
+    url = "git+file://$TEST_ROOT/data$i";
+    flake = false;
+  };
+  outputs = { ... }: { n = $i; };
+}
+EOF
+    git -C "$TEST_ROOT/dep$i" add flake.nix
+    git -C "$TEST_ROOT/dep$i" commit -m 'Initial'
+done
+
+rootDir="$TEST_ROOT/root"
+mkdir -p "$rootDir"
+cat > "$rootDir/flake.nix" <<EOF
+{
+  inputs.dep0.url = "git+file://$TEST_ROOT/dep0";
+  inputs.dep1.url = "git+file://$TEST_ROOT/dep1";
+  inputs.dep2.url = "git+file://$TEST_ROOT/dep2";
+  inputs.dep3 = {
+    url = "git+file://$TEST_ROOT/dep3";
+    inputs.leaf.follows = "dep0/leaf";
+  };
+  inputs.data = {
+    url = "git+file://$TEST_ROOT/data0";
+    flake = false;
+  };
+  outputs = { ... }: { };
+}
+EOF
+
+# Use an empty fetcher cache for each run, so that every input is
+# actually fetched.
+lockWithJobs() {
+    local jobs="$1"
+    rm -f "$rootDir/flake.lock"
+    XDG_CACHE_HOME="$TEST_ROOT/cache-$jobs" \
+        nix flake lock --option flake-input-fetch-jobs "$jobs" "path:$rootDir"
+    cp "$rootDir/flake.lock" "$TEST_ROOT/flake.lock.$jobs"
+}
+
+lockWithJobs 1
+lockWithJobs 8
+
+grepQuiet "data3" "$TEST_ROOT/flake.lock.8"
+cmp "$TEST_ROOT/flake.lock.1" "$TEST_ROOT/flake.lock.8"
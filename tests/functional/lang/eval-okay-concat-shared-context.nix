@@ -0,0 +1,26 @@
+with builtins;
+
+let
+
+  drv = builtins.derivation {
+    name = "test";
+    builder = "/bin/sh";
+    system = "x86_64-linux";
+  };
+
+  s = "${drv}";
+
+  ctx = getContext s;
+
+in
+
+[
+  (getContext ("" + s) == ctx)
+  (getContext (s + "") == ctx)
+  (getContext "${s}" == ctx)
+  (getContext (concatStringsSep ", " [ s ]) == ctx)
+  (getContext ("" + unsafeDiscardStringContext s + substring 0 0 s) == ctx)
+  (getContext (concatStringsSep (substring 0 0 s) [ "foo" ]) == ctx)
+  ("" + "foo" + "" == "foo")
+  (concatStringsSep ", " [ "foo" ] == "foo")
+]
@@ -96,3 +96,51 @@ nix-sandbox-build symlink-derivation.nix -A test_sandbox_paths \
     --option extra-sandbox-paths "/dir=$TEST_ROOT" \
     --option extra-sandbox-paths "/symlinkDir=$symlinkDir" \
     --option extra-sandbox-paths "/symlink=$symlinkcert"
+
+# With `sandbox-store-overlay-threshold`, the store is exposed to builds
+# with large closures through a single overlay mount.
+nix-sandbox-build dependencies.nix --check --option sandbox-store-overlay-threshold 1
+
+outPath=$(nix-sandbox-build --option sandbox-store-overlay-threshold 100 -E 'with import '"${config_nix}"'; mkDerivation {
+  name = "many-inputs";
+  inputs = builtins.genList (n: builtins.toFile "input-${toString n}" "${toString n}\n") 1000;
+  buildCommand = "cat $inputs > $out";
+}')
+[[ $(nix store cat "$outPath" | wc -l) = 1000 ]]
+
+# Store paths outside of the input closure are hidden from the build.
+hidden=$(nix-store --add ./config.nix)
+nix-sandbox-build --option sandbox-store-overlay-threshold 1 -E 'with import '"${config_nix}"'; mkDerivation {
+  name = "overlay-hidden";
+  inputs = [ (builtins.toFile "input" "x") ];
+  buildCommand = "test ! -e '"$hidden"' && touch $out";
+}'
+
+# The lower layer of the overlay is reused by builds with the same inputs (if
+# we're root).
+for n in 1 2; do
+    nix-sandbox-build -vv --option sandbox-store-overlay-threshold 1 -E 'with import '"${config_nix}"'; mkDerivation {
+      name = "overlay-reuse-'"$n"'";
+      inputs = [ (builtins.toFile "input" "x") ];
+      buildCommand = "touch $out";
+    }' 2> "$TEST_ROOT/overlay-$n.log"
+done
+if [[ $(id -u) = 0 ]]; then
+    grepQuiet "set up the Nix store overlay for .* store paths in .* ms" "$TEST_ROOT/overlay-1.log"
+    grepQuiet "reusing the Nix store overlay layer" "$TEST_ROOT/overlay-2.log"
+fi
+
+# Network namespaces can be reused by subsequent builds (if we're root).
+mapfile -t netnsPaths < <(nix-sandbox-build -j1 --option sandbox-network-namespace-pool-size 1 -E 'with import '"${config_nix}"'; map (n: mkDerivation {
+  name = "netns-${toString n}";
+  buildCommand = "readlink /proc/self/ns/net > $out";
+}) [ 1 2 3 ]')
+[[ ${#netnsPaths[@]} = 3 ]]
+if [[ $(id -u) = 0 ]]; then
+    # The builds ran one after another, so they all got the same
+    # namespace from the pool.
+    netns1=$(nix store cat "${netnsPaths[0]}")
+    [[ $netns1 =~ ^net: ]]
+    [[ $(nix store cat "${netnsPaths[1]}") = "$netns1" ]]
+    [[ $(nix store cat "${netnsPaths[2]}") = "$netns1" ]]
+fi
@@ -42,3 +42,50 @@ if [[ "$NIX_REMOTE" != "daemon" ]]; then
     grep '{"action":"start","fields":\[".*-dependencies-top.drv","",1,1\],"id":.*,"level":3,"parent":0' "$TEST_ROOT/log.json" >&2
     (( $(grep '{"action":"msg","level":5,"msg":"executing builder .*"}' "$TEST_ROOT/log.json" | wc -l) == 5 ))
 fi
+
+# Test indexed logs, which span several frames here.
+if isDaemonNewer "2.31pre20261019"; then
+    clearStore
+    rm -rf "$NIX_LOG_DIR"
+    builder="$(realpath "$(mktemp)")"
+    echo -e "#!/bin/sh\nseq 1 300000\nmkdir \$out" > "$builder"
+    outp="$(nix-build --indexed-build-log -E \
+        'with import '"${config_nix}"'; mkDerivation { name = "indexed"; builder = '"$builder"'; }' \
+        --no-out-link)"
+    seq 1 300000 > "$TEST_ROOT/expected-log"
+    nix log "$outp" | diff - "$TEST_ROOT/expected-log"
+    nix-store -l "$outp" | diff - "$TEST_ROOT/expected-log"
+    nix log --follow "$outp" | diff - "$TEST_ROOT/expected-log"
+    [[ "$(nix log --offset 1500000 --length 20 "$outp")" = "$(tail -c +1500001 "$TEST_ROOT/expected-log" | head -c 20)" ]]
+    [[ -z "$(nix log --offset 100000000 "$outp")" ]]
+
+    # Binary caches can't tell whether a build is still running.
+    nix store copy-log --to "file://$TEST_ROOT/log-cache" "$outp"
+    nix log --follow --store "file://$TEST_ROOT/log-cache" "$outp" 2> "$TEST_ROOT/follow.err" \
+        | diff - "$TEST_ROOT/expected-log"
+    grepQuiet "cannot follow build logs" "$TEST_ROOT/follow.err"
+
+    # The log of a running build can be followed. Output that is followed
+    # by silence shows up without waiting for more output.
+    fifo="$TEST_ROOT/indexed.fifo"
+    mkfifo "$fifo"
+    drvPath="$(nix-instantiate -E "
+      with import ${config_nix};
+      mkDerivation {
+        name = \"indexed-running\";
+        buildCommand = \"echo started; read x < $fifo; echo finished; mkdir \$out\";
+      }")"
+    nix-store --realise --indexed-build-log "$drvPath" &
+    pid=$!
+    for ((i = 0; i < 60; i++)); do
+        [[ "$(nix log "$drvPath" 2> /dev/null)" = started ]] && break
+        sleep 1
+    done
+    [[ "$(nix log "$drvPath")" = started ]]
+    nix log --follow "$drvPath" > "$TEST_ROOT/followed" &
+    followPid=$!
+    echo > "$fifo"
+    wait "$pid"
+    wait "$followPid"
+    printf 'started\nfinished\n' | diff - "$TEST_ROOT/followed"
+fi
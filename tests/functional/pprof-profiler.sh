@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+
+source common.sh
+
+profile="$TEST_ROOT/nix.pb.gz"
+
+nix-instantiate --eval --strict \
+    --eval-profiler pprof \
+    --eval-profile-file "$profile" \
+    --expr 'let f = arg: arg; in builtins.map f [ 1 2 3 ]'
+
+# The profile is a gzipped protobuf whose string table contains the
+# symbolized frames.
+gzip -dc "$profile" > "$TEST_ROOT/nix.pb"
+grepQuiet -a "«string»:1:22:primop map" "$TEST_ROOT/nix.pb"
+grepQuiet -a "alloc_space" "$TEST_ROOT/nix.pb"
@@ -195,6 +195,100 @@
         f"fetching as flake input (store path {fetched_flake}) yielded a different result than using fetchGit (store path {fetched_lfs})"
 
 
+    with subtest("Fetch several lfs files in one batch"):
+      for name in ["batch_a", "batch_b", "batch_c"]:
+        client.succeed(f"dd if=/dev/urandom of={repo.path}/{name} bs=1M count=1 >&2")
+        client.succeed(f"{repo.git} lfs track --filename {name} >&2")
+      client.succeed(f"{repo.git} add : >&2")
+      client.succeed(f"{repo.git} commit -m 'add several lfs files' >&2")
+      client.succeed(f"{repo.git} push origin main >&2")
+
+      batch_rev = client.succeed(f"{repo.git} rev-parse HEAD").strip()
+
+      # make sure that none of the objects are cached yet
+      client.succeed("rm -rf ~/.cache/nix")
+
+      fetchGit_batch_expr = f"""
+        builtins.fetchGit {{
+          url = "{repo.remote}";
+          rev = "{batch_rev}";
+          ref = "main";
+          lfs = true;
+        }}
+      """
+      fetched_batch = client.succeed(f"""
+        nix eval --debug --impure --raw --expr '({fetchGit_batch_expr}).outPath' 2>{repo.path}/../batch.log
+      """)
+
+      for name in ["beeg", "batch_a", "batch_b", "batch_c"]:
+        client.succeed(f"cmp {repo.path}/{name} {fetched_batch}/{name} >&2")
+
+      # all objects were requested in a single batch request
+      batch_requests = client.succeed(f"grep -c 'objects/batch' {repo.path}/../batch.log").strip()
+      assert int(batch_requests) == 1, \
+        f"expected a single git-lfs batch request, got {batch_requests}"
+
+
+    with subtest("An lfs object missing on the server doesn't break other files"):
+      # a valid pointer to an object that was never uploaded
+      missing_oid = "0" * 64
+      client.succeed(f"""
+        printf 'version https://git-lfs.github.com/spec/v1\\noid sha256:{missing_oid}\\nsize 42\\n' >{repo.path}/missing
+      """)
+      client.succeed(f"{repo.git} lfs track --filename missing >&2")
+      client.succeed(f"{repo.git} add : >&2")
+      client.succeed(f"{repo.git} commit -m 'add pointer to missing lfs object' >&2")
+      client.succeed(f"{repo.git} push --no-verify origin main >&2")
+
+      missing_rev = client.succeed(f"{repo.git} rev-parse HEAD").strip()
+
+      client.succeed("rm -rf ~/.cache/nix")
+
+      # lazy trees only apply to flake inputs, so use one to read a single
+      # file of the revision
+      with TemporaryDirectory() as tempdir:
+        client.succeed(f"mkdir -p {tempdir}")
+        client.succeed(f"""
+          printf '{{
+            inputs = {{
+              foo = {{
+                url = "git+{repo.remote}?ref=main&rev={missing_rev}&lfs=1";
+                flake = false;
+              }};
+            }};
+            outputs = {{ foo, self }}: {{
+              batchA = builtins.readFile (foo + "/batch_a");
+              batchB = builtins.readFile (foo + "/batch_b");
+              inherit (foo) outPath;
+            }};
+          }}' >{tempdir}/flake.nix
+        """)
+
+        # the error for the missing object doesn't abort prefetching the
+        # other objects of the revision
+        client.succeed(f"""
+          nix eval --debug --no-eval-cache --raw --option lazy-trees true \\
+            {tempdir}#batchA >{repo.path}/../batch_a.out
+        """)
+        client.succeed(f"cmp {repo.path}/batch_a {repo.path}/../batch_a.out >&2")
+
+        # a corrupt object in the cache is fetched again
+        batch_b_oid = client.succeed(f"sha256sum {repo.path}/batch_b | cut -d' ' -f1").strip()
+        client.succeed(f"echo garbage >~/.cache/nix/git-lfs/objects/{batch_b_oid[:2]}/{batch_b_oid}")
+        client.succeed(f"""
+          nix eval --no-eval-cache --raw --option lazy-trees true \\
+            {tempdir}#batchB >{repo.path}/../batch_b.out
+        """)
+        client.succeed(f"cmp {repo.path}/batch_b {repo.path}/../batch_b.out >&2")
+
+        # fetching the missing object itself reports the server's error
+        error = client.fail(f"""
+          nix eval --no-eval-cache --raw --option lazy-trees true {tempdir}#outPath 2>&1
+        """)
+        assert "git-lfs server cannot provide object" in error, \
+          f"expected the git-lfs server error, got: {error}"
+
+
     with subtest("Check self.lfs"):
       client.succeed(f"""
         printf '{{